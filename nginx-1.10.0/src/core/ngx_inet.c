@@ -473,6 +473,146 @@ ngx_ptocidr(ngx_str_t *text, ngx_cidr_t *cidr)
 }
 
 
+ngx_cidr_trie_t *
+ngx_cidr_trie_create(ngx_pool_t *pool, ngx_array_t *cidrs)
+{
+    ngx_uint_t         i;
+    ngx_pool_t        *temp;
+    ngx_cidr_t        *cidr;
+    ngx_cidr_trie_t   *trie;
+    ngx_radix_tree_t  *tree;
+#if (NGX_HAVE_INET6)
+    ngx_radix_tree_t  *tree6;
+#endif
+
+    trie = ngx_pcalloc(pool, sizeof(ngx_cidr_trie_t));
+    if (trie == NULL) {
+        return NULL;
+    }
+
+    temp = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, pool->log);
+    if (temp == NULL) {
+        return NULL;
+    }
+
+    tree = ngx_radix_tree_create(temp, 0);
+    if (tree == NULL) {
+        goto failed;
+    }
+
+#if (NGX_HAVE_INET6)
+    tree6 = ngx_radix_tree_create(temp, 0);
+    if (tree6 == NULL) {
+        goto failed;
+    }
+#endif
+
+    cidr = cidrs->elts;
+
+    for (i = 0; i < cidrs->nelts; i++) {
+
+        switch (cidr[i].family) {
+
+#if (NGX_HAVE_INET6)
+        case AF_INET6:
+            if (ngx_radix128tree_insert(tree6, cidr[i].u.in6.addr.s6_addr,
+                                        cidr[i].u.in6.mask.s6_addr, 1)
+                == NGX_ERROR)
+            {
+                goto failed;
+            }
+
+            break;
+#endif
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+        case AF_UNIX:
+            trie->local = 1;
+            break;
+#endif
+
+        default: /* AF_INET */
+            if (ngx_radix32tree_insert(tree, ntohl(cidr[i].u.in.addr),
+                                       ntohl(cidr[i].u.in.mask), 1)
+                == NGX_ERROR)
+            {
+                goto failed;
+            }
+
+            break;
+        }
+
+        /* NGX_BUSY is okay, the network is listed twice */
+    }
+
+    trie->in = ngx_radix_trie_create(pool, tree, 32);
+    if (trie->in == NULL) {
+        goto failed;
+    }
+
+#if (NGX_HAVE_INET6)
+    trie->in6 = ngx_radix_trie_create(pool, tree6, 128);
+    if (trie->in6 == NULL) {
+        goto failed;
+    }
+#endif
+
+    ngx_destroy_pool(temp);
+
+    return trie;
+
+failed:
+
+    ngx_destroy_pool(temp);
+
+    return NULL;
+}
+
+
+ngx_int_t
+ngx_cidr_trie_match(ngx_cidr_trie_t *trie, struct sockaddr *sa)
+{
+    in_addr_t         inaddr;
+#if (NGX_HAVE_INET6)
+    u_char           *p;
+    struct in6_addr  *inaddr6;
+#endif
+
+    switch (sa->sa_family) {
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        inaddr6 = &((struct sockaddr_in6 *) sa)->sin6_addr;
+        p = inaddr6->s6_addr;
+
+        if (IN6_IS_ADDR_V4MAPPED(inaddr6)) {
+            inaddr = p[12] << 24;
+            inaddr += p[13] << 16;
+            inaddr += p[14] << 8;
+            inaddr += p[15];
+
+            return ngx_radix32trie_find(trie->in, inaddr) == 1
+                   ? NGX_OK : NGX_DECLINED;
+        }
+
+        return ngx_radix128trie_find(trie->in6, p) == 1
+               ? NGX_OK : NGX_DECLINED;
+#endif
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+    case AF_UNIX:
+        return trie->local ? NGX_OK : NGX_DECLINED;
+#endif
+
+    default: /* AF_INET */
+        inaddr = ntohl(((struct sockaddr_in *) sa)->sin_addr.s_addr);
+
+        return ngx_radix32trie_find(trie->in, inaddr) == 1
+               ? NGX_OK : NGX_DECLINED;
+    }
+}
+
+
 ngx_int_t
 ngx_parse_addr(ngx_pool_t *pool, ngx_addr_t *addr, u_char *text, size_t len)
 {
@@ -74,6 +74,17 @@ typedef struct {
 } ngx_addr_t;
 
 
+/* a set of networks compiled for lookups, see ngx_cidr_trie_create() */
+
+typedef struct {
+    ngx_radix_trie_t         *in;
+#if (NGX_HAVE_INET6)
+    ngx_radix_trie_t         *in6;
+#endif
+    ngx_uint_t                local;     /* unsigned  local:1; */
+} ngx_cidr_trie_t;
+
+
 typedef struct {
     ngx_str_t                 url;  // urlӦַ
     ngx_str_t                 host;  // urlӦ
@@ -111,6 +122,8 @@ size_t ngx_sock_ntop(struct sockaddr *sa, socklen_t socklen, u_char *text,
     size_t len, ngx_uint_t port);
 size_t ngx_inet_ntop(int family, void *addr, u_char *text, size_t len);
 ngx_int_t ngx_ptocidr(ngx_str_t *text, ngx_cidr_t *cidr);
+ngx_cidr_trie_t *ngx_cidr_trie_create(ngx_pool_t *pool, ngx_array_t *cidrs);
+ngx_int_t ngx_cidr_trie_match(ngx_cidr_trie_t *trie, struct sockaddr *sa);
 ngx_int_t ngx_parse_addr(ngx_pool_t *pool, ngx_addr_t *addr, u_char *text,
     size_t len);
 ngx_int_t ngx_parse_url(ngx_pool_t *pool, ngx_url_t *u);
@@ -9,7 +9,20 @@
 #include <ngx_core.h>
 
 
+typedef struct {
+    ngx_array_t        nodes;
+    ngx_array_t        leaves;
+    ngx_uint_t         bits;
+} ngx_radix_trie_ctx_t;
+
+
 static ngx_radix_node_t *ngx_radix_alloc(ngx_radix_tree_t *tree);
+static ngx_int_t ngx_radix_trie_build(ngx_radix_trie_ctx_t *ctx, ngx_uint_t n,
+    ngx_radix_node_t *node, uintptr_t value, ngx_uint_t depth);
+static ngx_inline ngx_uint_t ngx_radix_trie_chunk(uint64_t hi, uint64_t lo,
+    ngx_uint_t off);
+static ngx_inline ngx_uint_t ngx_radix_trie_index(uint64_t vector,
+    ngx_uint_t v);
 
 
 ngx_radix_tree_t *
@@ -263,6 +276,45 @@ ngx_radix32tree_find(ngx_radix_tree_t *tree, uint32_t key)
 }
 
 
+/*
+ * returns the value of the shortest network in the tree that contains
+ * the key/mask network, or NGX_RADIX_NO_VALUE; only the path down to
+ * the network itself is walked
+ */
+
+uintptr_t
+ngx_radix32tree_find_prefix(ngx_radix_tree_t *tree, uint32_t key,
+    uint32_t mask)
+{
+    uint32_t           bit;
+    ngx_radix_node_t  *node;
+
+    bit = 0x80000000;
+    node = tree->root;
+
+    while (node) {
+        if (node->value != NGX_RADIX_NO_VALUE) {
+            return node->value;
+        }
+
+        if (!(mask & bit)) {
+            break;
+        }
+
+        if (key & bit) {
+            node = node->right;
+
+        } else {
+            node = node->left;
+        }
+
+        bit >>= 1;
+    }
+
+    return NGX_RADIX_NO_VALUE;
+}
+
+
 #if (NGX_HAVE_INET6)
 
 ngx_int_t
@@ -457,9 +509,338 @@ ngx_radix128tree_find(ngx_radix_tree_t *tree, u_char *key)
     return value;
 }
 
+
+uintptr_t
+ngx_radix128tree_find_prefix(ngx_radix_tree_t *tree, u_char *key,
+    u_char *mask)
+{
+    u_char             bit;
+    ngx_uint_t         i;
+    ngx_radix_node_t  *node;
+
+    i = 0;
+    bit = 0x80;
+    node = tree->root;
+
+    while (node) {
+        if (node->value != NGX_RADIX_NO_VALUE) {
+            return node->value;
+        }
+
+        if (i == 16 || !(mask[i] & bit)) {
+            break;
+        }
+
+        if (key[i] & bit) {
+            node = node->right;
+
+        } else {
+            node = node->left;
+        }
+
+        bit >>= 1;
+
+        if (bit == 0) {
+            i++;
+            bit = 0x80;
+        }
+    }
+
+    return NGX_RADIX_NO_VALUE;
+}
+
+#endif
+
+
+ngx_radix_trie_t *
+ngx_radix_trie_create(ngx_pool_t *pool, ngx_radix_tree_t *tree,
+    ngx_uint_t bits)
+{
+    ngx_pool_t            *temp;
+    ngx_radix_trie_t      *trie;
+    ngx_radix_trie_ctx_t   ctx;
+
+    temp = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, pool->log);
+    if (temp == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&ctx.nodes, temp, 64, sizeof(ngx_radix_trie_node_t))
+        != NGX_OK)
+    {
+        goto failed;
+    }
+
+    if (ngx_array_init(&ctx.leaves, temp, 64, sizeof(uintptr_t)) != NGX_OK) {
+        goto failed;
+    }
+
+    ctx.bits = bits;
+
+    if (ngx_array_push(&ctx.nodes) == NULL) {
+        goto failed;
+    }
+
+    if (ngx_radix_trie_build(&ctx, 0, tree->root, tree->root->value, 0)
+        != NGX_OK)
+    {
+        goto failed;
+    }
+
+    trie = ngx_palloc(pool, sizeof(ngx_radix_trie_t));
+    if (trie == NULL) {
+        goto failed;
+    }
+
+    trie->nodes = ngx_palloc(pool,
+                             ctx.nodes.nelts * sizeof(ngx_radix_trie_node_t));
+    if (trie->nodes == NULL) {
+        goto failed;
+    }
+
+    trie->leaves = ngx_palloc(pool, ctx.leaves.nelts * sizeof(uintptr_t));
+    if (trie->leaves == NULL) {
+        goto failed;
+    }
+
+    ngx_memcpy(trie->nodes, ctx.nodes.elts,
+               ctx.nodes.nelts * sizeof(ngx_radix_trie_node_t));
+    ngx_memcpy(trie->leaves, ctx.leaves.elts,
+               ctx.leaves.nelts * sizeof(uintptr_t));
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, pool->log, 0,
+                   "radix trie: %ui nodes, %ui leaves",
+                   ctx.nodes.nelts, ctx.leaves.nelts);
+
+    ngx_destroy_pool(temp);
+
+    return trie;
+
+failed:
+
+    ngx_destroy_pool(temp);
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_radix_trie_build(ngx_radix_trie_ctx_t *ctx, ngx_uint_t n,
+    ngx_radix_node_t *node, uintptr_t value, ngx_uint_t depth)
+{
+    uint64_t                vector, leafvec;
+    uint32_t                base0, base1;
+    uintptr_t              *leaf, values[64];
+    ngx_uint_t              s, k;
+    ngx_radix_node_t       *next, *children[64];
+    ngx_radix_trie_node_t  *tn;
+
+    /*
+     * each of the 64 slots is resolved by walking up to 6 levels down
+     * the radix tree, inheriting the last value found on the way
+     */
+
+    vector = 0;
+
+    for (s = 0; s < 64; s++) {
+        next = node;
+        values[s] = value;
+
+        for (k = 0; k < NGX_RADIX_TRIE_STRIDE && depth + k < ctx->bits; k++) {
+
+            if (s & (0x20 >> k)) {
+                next = next->right;
+
+            } else {
+                next = next->left;
+            }
+
+            if (next == NULL) {
+                break;
+            }
+
+            if (next->value != NGX_RADIX_NO_VALUE) {
+                values[s] = next->value;
+            }
+        }
+
+        if (next
+            && k == NGX_RADIX_TRIE_STRIDE
+            && depth + NGX_RADIX_TRIE_STRIDE < ctx->bits
+            && (next->left || next->right))
+        {
+            children[s] = next;
+            vector |= (uint64_t) 1 << s;
+
+        } else {
+            children[s] = NULL;
+        }
+    }
+
+    /* adjacent leaf slots with equal values share a single leaf */
+
+    leafvec = 0;
+    base0 = ctx->leaves.nelts;
+    leaf = NULL;
+
+    for (s = 0; s < 64; s++) {
+
+        if (children[s] || (leaf && *leaf == values[s])) {
+            continue;
+        }
+
+        leaf = ngx_array_push(&ctx->leaves);
+        if (leaf == NULL) {
+            return NGX_ERROR;
+        }
+
+        *leaf = values[s];
+        leafvec |= (uint64_t) 1 << s;
+    }
+
+    base1 = ctx->nodes.nelts;
+
+    if (vector) {
+        tn = ngx_array_push_n(&ctx->nodes,
+                              ngx_radix_trie_index(vector, 63) + 1);
+        if (tn == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    tn = (ngx_radix_trie_node_t *) ctx->nodes.elts + n;
+
+    tn->vector = vector;
+    tn->leafvec = leafvec;
+    tn->base0 = base0;
+    tn->base1 = base1;
+
+    for (s = 0; s < 64; s++) {
+
+        if (children[s] == NULL) {
+            continue;
+        }
+
+        if (ngx_radix_trie_build(ctx, base1++, children[s], values[s],
+                                 depth + NGX_RADIX_TRIE_STRIDE)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+uintptr_t
+ngx_radix32trie_find(ngx_radix_trie_t *trie, uint32_t key)
+{
+    uint64_t                hi;
+    ngx_uint_t              v, off;
+    ngx_radix_trie_node_t  *node;
+
+    hi = (uint64_t) key << 32;
+    node = trie->nodes;
+
+    for (off = 0; /* void */ ; off += NGX_RADIX_TRIE_STRIDE) {
+        v = ngx_radix_trie_chunk(hi, 0, off);
+
+        if (!(node->vector & ((uint64_t) 1 << v))) {
+            break;
+        }
+
+        node = &trie->nodes[node->base1
+                            + ngx_radix_trie_index(node->vector, v)];
+    }
+
+    return trie->leaves[node->base0 + ngx_radix_trie_index(node->leafvec, v)];
+}
+
+
+#if (NGX_HAVE_INET6)
+
+uintptr_t
+ngx_radix128trie_find(ngx_radix_trie_t *trie, u_char *key)
+{
+    uint64_t                hi, lo;
+    ngx_uint_t              i, v, off;
+    ngx_radix_trie_node_t  *node;
+
+    hi = 0;
+    lo = 0;
+
+    for (i = 0; i < 8; i++) {
+        hi = (hi << 8) | key[i];
+        lo = (lo << 8) | key[i + 8];
+    }
+
+    node = trie->nodes;
+
+    for (off = 0; /* void */ ; off += NGX_RADIX_TRIE_STRIDE) {
+        v = ngx_radix_trie_chunk(hi, lo, off);
+
+        if (!(node->vector & ((uint64_t) 1 << v))) {
+            break;
+        }
+
+        node = &trie->nodes[node->base1
+                            + ngx_radix_trie_index(node->vector, v)];
+    }
+
+    return trie->leaves[node->base0 + ngx_radix_trie_index(node->leafvec, v)];
+}
+
 #endif
 
 
+/* 6 key bits starting at the offset, the key is padded with zero bits */
+
+static ngx_inline ngx_uint_t
+ngx_radix_trie_chunk(uint64_t hi, uint64_t lo, ngx_uint_t off)
+{
+    if (off <= 58) {
+        return (ngx_uint_t) (hi >> (58 - off)) & 0x3f;
+    }
+
+    if (off < 64) {
+        return (ngx_uint_t) ((hi << (off - 58)) | (lo >> (122 - off))) & 0x3f;
+    }
+
+    off -= 64;
+
+    if (off <= 58) {
+        return (ngx_uint_t) (lo >> (58 - off)) & 0x3f;
+    }
+
+    return (ngx_uint_t) (lo << (off - 58)) & 0x3f;
+}
+
+
+/* the number of bits set in the vector up to and including the slot, less 1 */
+
+static ngx_inline ngx_uint_t
+ngx_radix_trie_index(uint64_t vector, ngx_uint_t v)
+{
+    vector &= ((uint64_t) 2 << v) - 1;
+
+#if (__GNUC__ >= 4)
+
+    return __builtin_popcountll(vector) - 1;
+
+#else
+
+    vector -= (vector >> 1) & 0x5555555555555555ULL;
+    vector = (vector & 0x3333333333333333ULL)
+             + ((vector >> 2) & 0x3333333333333333ULL);
+    vector = (vector + (vector >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+
+    return (ngx_uint_t) ((vector * 0x0101010101010101ULL) >> 56) - 1;
+
+#endif
+}
+
+
 static ngx_radix_node_t *
 ngx_radix_alloc(ngx_radix_tree_t *tree)
 {
@@ -42,6 +42,8 @@ ngx_int_t ngx_radix32tree_insert(ngx_radix_tree_t *tree,
 ngx_int_t ngx_radix32tree_delete(ngx_radix_tree_t *tree,
     uint32_t key, uint32_t mask);
 uintptr_t ngx_radix32tree_find(ngx_radix_tree_t *tree, uint32_t key);
+uintptr_t ngx_radix32tree_find_prefix(ngx_radix_tree_t *tree, uint32_t key,
+    uint32_t mask);
 
 #if (NGX_HAVE_INET6)
 ngx_int_t ngx_radix128tree_insert(ngx_radix_tree_t *tree,
@@ -49,6 +51,38 @@ ngx_int_t ngx_radix128tree_insert(ngx_radix_tree_t *tree,
 ngx_int_t ngx_radix128tree_delete(ngx_radix_tree_t *tree,
     u_char *key, u_char *mask);
 uintptr_t ngx_radix128tree_find(ngx_radix_tree_t *tree, u_char *key);
+uintptr_t ngx_radix128tree_find_prefix(ngx_radix_tree_t *tree, u_char *key,
+    u_char *mask);
+#endif
+
+
+/*
+ * A read-only, level-compressed copy of a radix tree: every node covers
+ * 6 bits of a key, its children and leaves are stored contiguously and
+ * are addressed by population counts of the node bitmaps.
+ */
+
+#define NGX_RADIX_TRIE_STRIDE  6
+
+typedef struct {
+    uint64_t           vector;    /* slots with a child node */
+    uint64_t           leafvec;   /* slots starting a run of equal leaves */
+    uint32_t           base0;     /* first leaf */
+    uint32_t           base1;     /* first child node */
+} ngx_radix_trie_node_t;
+
+
+typedef struct {
+    ngx_radix_trie_node_t  *nodes;
+    uintptr_t              *leaves;
+} ngx_radix_trie_t;
+
+
+ngx_radix_trie_t *ngx_radix_trie_create(ngx_pool_t *pool,
+    ngx_radix_tree_t *tree, ngx_uint_t bits);
+uintptr_t ngx_radix32trie_find(ngx_radix_trie_t *trie, uint32_t key);
+#if (NGX_HAVE_INET6)
+uintptr_t ngx_radix128trie_find(ngx_radix_trie_t *trie, u_char *key);
 #endif
 
 
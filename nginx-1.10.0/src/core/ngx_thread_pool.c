@@ -209,7 +209,7 @@ ngx_thread_pool_destroy(ngx_thread_pool_t *tp)
     }
 
     /* pthread_cond_tpthread_mutex_t */
-    (void) ngx_thread_cond_destroy(&tp->cond, tp->log)
+    (void) ngx_thread_cond_destroy(&tp->cond, tp->log);
     (void) ngx_thread_mutex_destroy(&tp->mtx, tp->log);
 }
 
@@ -34,10 +34,18 @@ typedef struct {
 
 #endif
 
+/*
+ * The rules are matched by the longest prefix: a rule hidden by an earlier
+ * rule covering it is never used, and for the rest the first match is also
+ * the longest one.  Tries map addresses to indices in the rules arrays.
+ */
+
 typedef struct {
     ngx_array_t      *rules;     /* array of ngx_http_access_rule_t */
+    ngx_radix_trie_t *trie;
 #if (NGX_HAVE_INET6)
     ngx_array_t      *rules6;    /* array of ngx_http_access_rule6_t */
+    ngx_radix_trie_t *trie6;
 #endif
 #if (NGX_HAVE_UNIX_DOMAIN)
     ngx_array_t      *rules_un;  /* array of ngx_http_access_rule_un_t */
@@ -62,7 +70,10 @@ static char *ngx_http_access_rule(ngx_conf_t *cf, ngx_command_t *cmd,
 static void *ngx_http_access_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_access_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
+static ngx_int_t ngx_http_access_compile(ngx_conf_t *cf,
+    ngx_http_access_loc_conf_t *alcf);
 static ngx_int_t ngx_http_access_init(ngx_conf_t *cf);
+static ngx_uint_t ngx_http_access_active(void **loc_conf);
 
 
 static ngx_command_t  ngx_http_access_commands[] = {
@@ -183,22 +194,24 @@ static ngx_int_t
 ngx_http_access_inet(ngx_http_request_t *r, ngx_http_access_loc_conf_t *alcf,
     in_addr_t addr)
 {
-    ngx_uint_t               i;
+    uintptr_t                i;
     ngx_http_access_rule_t  *rule;
 
-    rule = alcf->rules->elts;
-    for (i = 0; i < alcf->rules->nelts; i++) {
-
-        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "access: %08XD %08XD %08XD",
-                       addr, rule[i].mask, rule[i].addr);
+    i = ngx_radix32trie_find(alcf->trie, ntohl(addr));
 
-        if ((addr & rule[i].mask) == rule[i].addr) {
-            return ngx_http_access_found(r, rule[i].deny);
-        }
+    if (i == NGX_RADIX_NO_VALUE) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "access: %08XD no match", addr);
+        return NGX_DECLINED;
     }
 
-    return NGX_DECLINED;
+    rule = alcf->rules->elts;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "access: %08XD %08XD %08XD",
+                   addr, rule[i].mask, rule[i].addr);
+
+    return ngx_http_access_found(r, rule[i].deny);
 }
 
 
@@ -208,42 +221,34 @@ static ngx_int_t
 ngx_http_access_inet6(ngx_http_request_t *r, ngx_http_access_loc_conf_t *alcf,
     u_char *p)
 {
-    ngx_uint_t                n;
-    ngx_uint_t                i;
+    uintptr_t                 i;
     ngx_http_access_rule6_t  *rule6;
 
-    rule6 = alcf->rules6->elts;
-    for (i = 0; i < alcf->rules6->nelts; i++) {
-
-#if (NGX_DEBUG)
-        {
-        size_t  cl, ml, al;
-        u_char  ct[NGX_INET6_ADDRSTRLEN];
-        u_char  mt[NGX_INET6_ADDRSTRLEN];
-        u_char  at[NGX_INET6_ADDRSTRLEN];
-
-        cl = ngx_inet6_ntop(p, ct, NGX_INET6_ADDRSTRLEN);
-        ml = ngx_inet6_ntop(rule6[i].mask.s6_addr, mt, NGX_INET6_ADDRSTRLEN);
-        al = ngx_inet6_ntop(rule6[i].addr.s6_addr, at, NGX_INET6_ADDRSTRLEN);
-
-        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "access: %*s %*s %*s", cl, ct, ml, mt, al, at);
-        }
-#endif
+    i = ngx_radix128trie_find(alcf->trie6, p);
 
-        for (n = 0; n < 16; n++) {
-            if ((p[n] & rule6[i].mask.s6_addr[n]) != rule6[i].addr.s6_addr[n]) {
-                goto next;
-            }
-        }
+    if (i == NGX_RADIX_NO_VALUE) {
+        return NGX_DECLINED;
+    }
 
-        return ngx_http_access_found(r, rule6[i].deny);
+    rule6 = alcf->rules6->elts;
 
-    next:
-        continue;
+#if (NGX_DEBUG)
+    {
+    size_t  cl, ml, al;
+    u_char  ct[NGX_INET6_ADDRSTRLEN];
+    u_char  mt[NGX_INET6_ADDRSTRLEN];
+    u_char  at[NGX_INET6_ADDRSTRLEN];
+
+    cl = ngx_inet6_ntop(p, ct, NGX_INET6_ADDRSTRLEN);
+    ml = ngx_inet6_ntop(rule6[i].mask.s6_addr, mt, NGX_INET6_ADDRSTRLEN);
+    al = ngx_inet6_ntop(rule6[i].addr.s6_addr, at, NGX_INET6_ADDRSTRLEN);
+
+    ngx_log_debug6(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "access: %*s %*s %*s", cl, ct, ml, mt, al, at);
     }
+#endif
 
-    return NGX_DECLINED;
+    return ngx_http_access_found(r, rule6[i].deny);
 }
 
 #endif
@@ -438,18 +443,120 @@ ngx_http_access_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 #endif
     ) {
         conf->rules = prev->rules;
+        conf->trie = prev->trie;
 #if (NGX_HAVE_INET6)
         conf->rules6 = prev->rules6;
+        conf->trie6 = prev->trie6;
 #endif
 #if (NGX_HAVE_UNIX_DOMAIN)
         conf->rules_un = prev->rules_un;
 #endif
     }
 
+    if (ngx_http_access_compile(cf, conf) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    /* let other locations inheriting the same rules share the tries */
+
+    if (conf->rules == prev->rules) {
+        prev->trie = conf->trie;
+    }
+
+#if (NGX_HAVE_INET6)
+    if (conf->rules6 == prev->rules6) {
+        prev->trie6 = conf->trie6;
+    }
+#endif
+
     return NGX_CONF_OK;
 }
 
 
+static ngx_int_t
+ngx_http_access_compile(ngx_conf_t *cf, ngx_http_access_loc_conf_t *alcf)
+{
+    ngx_uint_t                i;
+    ngx_radix_tree_t         *tree;
+    ngx_http_access_rule_t   *rule;
+#if (NGX_HAVE_INET6)
+    ngx_http_access_rule6_t  *rule6;
+#endif
+
+    if (alcf->rules && alcf->trie == NULL) {
+
+        tree = ngx_radix_tree_create(cf->temp_pool, 0);
+        if (tree == NULL) {
+            return NGX_ERROR;
+        }
+
+        rule = alcf->rules->elts;
+
+        for (i = 0; i < alcf->rules->nelts; i++) {
+
+            /* a rule within the network of an earlier one never matches */
+
+            if (ngx_radix32tree_find_prefix(tree, ntohl(rule[i].addr),
+                                            ntohl(rule[i].mask))
+                != NGX_RADIX_NO_VALUE)
+            {
+                continue;
+            }
+
+            if (ngx_radix32tree_insert(tree, ntohl(rule[i].addr),
+                                       ntohl(rule[i].mask), i)
+                == NGX_ERROR)
+            {
+                return NGX_ERROR;
+            }
+        }
+
+        alcf->trie = ngx_radix_trie_create(cf->pool, tree, 32);
+        if (alcf->trie == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+#if (NGX_HAVE_INET6)
+
+    if (alcf->rules6 && alcf->trie6 == NULL) {
+
+        tree = ngx_radix_tree_create(cf->temp_pool, 0);
+        if (tree == NULL) {
+            return NGX_ERROR;
+        }
+
+        rule6 = alcf->rules6->elts;
+
+        for (i = 0; i < alcf->rules6->nelts; i++) {
+
+            if (ngx_radix128tree_find_prefix(tree, rule6[i].addr.s6_addr,
+                                             rule6[i].mask.s6_addr)
+                != NGX_RADIX_NO_VALUE)
+            {
+                continue;
+            }
+
+            if (ngx_radix128tree_insert(tree, rule6[i].addr.s6_addr,
+                                        rule6[i].mask.s6_addr, i)
+                == NGX_ERROR)
+            {
+                return NGX_ERROR;
+            }
+        }
+
+        alcf->trie6 = ngx_radix_trie_create(cf->pool, tree, 128);
+        if (alcf->trie6 == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+#endif
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_access_init(ngx_conf_t *cf)
 {
@@ -465,5 +572,33 @@ ngx_http_access_init(ngx_conf_t *cf)
 
     *h = ngx_http_access_handler;
 
-    return NGX_OK;
+    return ngx_http_set_phase_active(cf, ngx_http_access_handler,
+                                     ngx_http_access_active);
+}
+
+
+static ngx_uint_t
+ngx_http_access_active(void **loc_conf)
+{
+    ngx_http_access_loc_conf_t  *alcf;
+
+    alcf = loc_conf[ngx_http_access_module.ctx_index];
+
+    if (alcf->rules) {
+        return 1;
+    }
+
+#if (NGX_HAVE_INET6)
+    if (alcf->rules6) {
+        return 1;
+    }
+#endif
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+    if (alcf->rules_un) {
+        return 1;
+    }
+#endif
+
+    return 0;
 }
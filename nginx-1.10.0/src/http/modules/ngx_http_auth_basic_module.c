@@ -35,6 +35,7 @@ static void *ngx_http_auth_basic_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_auth_basic_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
 static ngx_int_t ngx_http_auth_basic_init(ngx_conf_t *cf);
+static ngx_uint_t ngx_http_auth_basic_active(void **loc_conf);
 static char *ngx_http_auth_basic_user_file(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 
@@ -433,7 +434,19 @@ ngx_http_auth_basic_init(ngx_conf_t *cf)
 
     *h = ngx_http_auth_basic_handler;
 
-    return NGX_OK;
+    return ngx_http_set_phase_active(cf, ngx_http_auth_basic_handler,
+                                     ngx_http_auth_basic_active);
+}
+
+
+static ngx_uint_t
+ngx_http_auth_basic_active(void **loc_conf)
+{
+    ngx_http_auth_basic_loc_conf_t  *alcf;
+
+    alcf = loc_conf[ngx_http_auth_basic_module.ctx_index];
+
+    return alcf->realm && alcf->user_file.value.data;
 }
 
 
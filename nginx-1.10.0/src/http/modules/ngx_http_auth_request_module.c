@@ -41,6 +41,7 @@ static void *ngx_http_auth_request_create_conf(ngx_conf_t *cf);
 static char *ngx_http_auth_request_merge_conf(ngx_conf_t *cf,
     void *parent, void *child);
 static ngx_int_t ngx_http_auth_request_init(ngx_conf_t *cf);
+static ngx_uint_t ngx_http_auth_request_active(void **loc_conf);
 static char *ngx_http_auth_request(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_auth_request_set(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -349,7 +350,19 @@ ngx_http_auth_request_init(ngx_conf_t *cf)
 
     *h = ngx_http_auth_request_handler;
 
-    return NGX_OK;
+    return ngx_http_set_phase_active(cf, ngx_http_auth_request_handler,
+                                     ngx_http_auth_request_active);
+}
+
+
+static ngx_uint_t
+ngx_http_auth_request_active(void **loc_conf)
+{
+    ngx_http_auth_request_conf_t  *arcf;
+
+    arcf = loc_conf[ngx_http_auth_request_module.ctx_index];
+
+    return arcf->uri.len != 0;
 }
 
 
@@ -18,9 +18,9 @@ typedef struct {
 
 
 typedef struct {
-    ngx_radix_tree_t                *tree;
+    ngx_radix_trie_t                *tree;
 #if (NGX_HAVE_INET6)
-    ngx_radix_tree_t                *tree6;
+    ngx_radix_trie_t                *tree6;
 #endif
 } ngx_http_geo_trees_t;
 
@@ -53,6 +53,8 @@ typedef struct {
     ngx_pool_t                      *temp_pool;
 
     size_t                           data_size;
+    time_t                           refresh;
+    time_t                           mtime;
 
     ngx_str_t                        include_name;
     ngx_uint_t                       includes;
@@ -66,15 +68,36 @@ typedef struct {
 } ngx_http_geo_conf_ctx_t;
 
 
+/*
+ * a binary range base that is reloaded by workers when it changes,
+ * the file is checked from a timer rather than on lookups
+ */
+
+typedef struct {
+    ngx_str_t                        name;
+    u_char                          *base;      /* NULL for the initial one */
+    time_t                           mtime;
+    time_t                           interval;
+    ngx_event_t                      event;
+} ngx_http_geo_refresh_t;
+
+
+typedef struct {
+    ngx_array_t                     *refresh;   /* ngx_http_geo_refresh_t * */
+} ngx_http_geo_main_conf_t;
+
+
 typedef struct {
     union {
         ngx_http_geo_trees_t         trees;
         ngx_http_geo_high_ranges_t   high;
     } u;
 
-    ngx_array_t                     *proxies;
+    ngx_cidr_trie_t                 *proxies;
     unsigned                         proxy_recursive:1;
 
+    ngx_http_geo_refresh_t          *refresh;
+
     ngx_int_t                        index;
 } ngx_http_geo_ctx_t;
 
@@ -105,6 +128,15 @@ static char *ngx_http_geo_include(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
     ngx_str_t *name);
 static ngx_int_t ngx_http_geo_include_binary_base(ngx_conf_t *cf,
     ngx_http_geo_conf_ctx_t *ctx, ngx_str_t *name);
+static ngx_int_t ngx_http_geo_init_refresh(ngx_conf_t *cf,
+    ngx_http_geo_ctx_t *geo, ngx_http_geo_conf_ctx_t *ctx);
+static ngx_http_geo_range_t **ngx_http_geo_fixup_binary_base(u_char *base,
+    size_t size);
+static void ngx_http_geo_refresh_binary_base(ngx_http_geo_ctx_t *ctx,
+    ngx_log_t *log);
+static void ngx_http_geo_refresh_handler(ngx_event_t *ev);
+static void *ngx_http_geo_create_main_conf(ngx_conf_t *cf);
+static ngx_int_t ngx_http_geo_init_process(ngx_cycle_t *cycle);
 static void ngx_http_geo_create_binary_base(ngx_http_geo_conf_ctx_t *ctx);
 static u_char *ngx_http_geo_copy_values(u_char *base, u_char *p,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
@@ -127,7 +159,7 @@ static ngx_http_module_t  ngx_http_geo_module_ctx = {
     NULL,                                  /* preconfiguration */
     NULL,                                  /* postconfiguration */
 
-    NULL,                                  /* create main configuration */
+    ngx_http_geo_create_main_conf,         /* create main configuration */
     NULL,                                  /* init main configuration */
 
     NULL,                                  /* create server configuration */
@@ -145,7 +177,7 @@ ngx_module_t  ngx_http_geo_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_geo_init_process,             /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -187,7 +219,7 @@ ngx_http_geo_cidr_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 
     if (ngx_http_geo_addr(r, ctx, &addr) != NGX_OK) {
         vv = (ngx_http_variable_value_t *)
-                  ngx_radix32tree_find(ctx->u.trees.tree, INADDR_NONE);
+                  ngx_radix32trie_find(ctx->u.trees.tree, INADDR_NONE);
         goto done;
     }
 
@@ -205,11 +237,11 @@ ngx_http_geo_cidr_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
             inaddr += p[15];
 
             vv = (ngx_http_variable_value_t *)
-                      ngx_radix32tree_find(ctx->u.trees.tree, inaddr);
+                      ngx_radix32trie_find(ctx->u.trees.tree, inaddr);
 
         } else {
             vv = (ngx_http_variable_value_t *)
-                      ngx_radix128tree_find(ctx->u.trees.tree6, p);
+                      ngx_radix128trie_find(ctx->u.trees.tree6, p);
         }
 
         break;
@@ -220,7 +252,7 @@ ngx_http_geo_cidr_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
         inaddr = ntohl(sin->sin_addr.s_addr);
 
         vv = (ngx_http_variable_value_t *)
-                  ngx_radix32tree_find(ctx->u.trees.tree, inaddr);
+                  ngx_radix32trie_find(ctx->u.trees.tree, inaddr);
 
         break;
     }
@@ -242,13 +274,13 @@ ngx_http_geo_range_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 {
     ngx_http_geo_ctx_t *ctx = (ngx_http_geo_ctx_t *) data;
 
+    u_char                *p;
     in_addr_t              inaddr;
     ngx_addr_t             addr;
     ngx_uint_t             n;
     struct sockaddr_in    *sin;
     ngx_http_geo_range_t  *range;
 #if (NGX_HAVE_INET6)
-    u_char                *p;
     struct in6_addr       *inaddr6;
 #endif
 
@@ -303,6 +335,19 @@ ngx_http_geo_range_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
         }
     }
 
+    if (ctx->refresh && v->len) {
+
+        /* the base may be replaced while the request still uses the value */
+
+        p = ngx_pnalloc(r->pool, v->len);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(p, v->data, v->len);
+        v->data = p;
+    }
+
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http geo: %v", v);
 
@@ -323,8 +368,9 @@ ngx_http_geo_addr(ngx_http_request_t *r, ngx_http_geo_ctx_t *ctx,
     xfwd = &r->headers_in.x_forwarded_for;
 
     if (xfwd->nelts > 0 && ctx->proxies != NULL) {
-        (void) ngx_http_get_forwarded_addr(r, addr, xfwd, NULL,
-                                           ctx->proxies, ctx->proxy_recursive);
+        (void) ngx_http_get_forwarded_addr_trie(r, addr, xfwd, NULL,
+                                                ctx->proxies,
+                                                ctx->proxy_recursive);
     }
 
     return NGX_OK;
@@ -387,7 +433,7 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     value = cf->args->elts;
 
-    geo = ngx_palloc(cf->pool, sizeof(ngx_http_geo_ctx_t));
+    geo = ngx_pcalloc(cf->pool, sizeof(ngx_http_geo_ctx_t));
     if (geo == NULL) {
         return NGX_CONF_ERROR;
     }
@@ -460,7 +506,13 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     *cf = save;
 
-    geo->proxies = ctx.proxies;
+    if (ctx.proxies) {
+        geo->proxies = ngx_cidr_trie_create(cf->pool, ctx.proxies);
+        if (geo->proxies == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
     geo->proxy_recursive = ctx.proxy_recursive;
 
     if (ctx.ranges) {
@@ -487,13 +539,19 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
             if (ctx.allow_binary_include
                 && !ctx.outside_entries
-                && ctx.entries > 100000
+                && (ctx.entries > 100000 || ctx.refresh)
                 && ctx.includes == 1)
             {
                 ngx_http_geo_create_binary_base(&ctx);
             }
         }
 
+        if (ctx.refresh) {
+            if (ngx_http_geo_init_refresh(cf, geo, &ctx) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+        }
+
         if (ctx.high.default_value == NULL) {
             ctx.high.default_value = &ngx_http_variable_null_value;
         }
@@ -507,32 +565,19 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         ngx_destroy_pool(pool);
 
     } else {
-        if (ctx.tree == NULL) {
-            ctx.tree = ngx_radix_tree_create(cf->pool, -1);
-            if (ctx.tree == NULL) {
-                return NGX_CONF_ERROR;
-            }
+        if (ctx.refresh) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"refresh\" requires \"ranges\"");
+            return NGX_CONF_ERROR;
         }
 
-        geo->u.trees.tree = ctx.tree;
-
-#if (NGX_HAVE_INET6)
-        if (ctx.tree6 == NULL) {
-            ctx.tree6 = ngx_radix_tree_create(cf->pool, -1);
-            if (ctx.tree6 == NULL) {
+        if (ctx.tree == NULL) {
+            ctx.tree = ngx_radix_tree_create(ctx.temp_pool, 0);
+            if (ctx.tree == NULL) {
                 return NGX_CONF_ERROR;
             }
         }
 
-        geo->u.trees.tree6 = ctx.tree6;
-#endif
-
-        var->get_handler = ngx_http_geo_cidr_variable;
-        var->data = (uintptr_t) geo;
-
-        ngx_destroy_pool(ctx.temp_pool);
-        ngx_destroy_pool(pool);
-
         if (ngx_radix32tree_insert(ctx.tree, 0, 0,
                                    (uintptr_t) &ngx_http_variable_null_value)
             == NGX_ERROR)
@@ -542,14 +587,39 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
         /* NGX_BUSY is okay (default was set explicitly) */
 
+        /* the radix trees are only used to build the tries for lookups */
+
+        geo->u.trees.tree = ngx_radix_trie_create(cf->pool, ctx.tree, 32);
+        if (geo->u.trees.tree == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
 #if (NGX_HAVE_INET6)
+        if (ctx.tree6 == NULL) {
+            ctx.tree6 = ngx_radix_tree_create(ctx.temp_pool, 0);
+            if (ctx.tree6 == NULL) {
+                return NGX_CONF_ERROR;
+            }
+        }
+
         if (ngx_radix128tree_insert(ctx.tree6, zero.s6_addr, zero.s6_addr,
                                     (uintptr_t) &ngx_http_variable_null_value)
             == NGX_ERROR)
         {
             return NGX_CONF_ERROR;
         }
+
+        geo->u.trees.tree6 = ngx_radix_trie_create(cf->pool, ctx.tree6, 128);
+        if (geo->u.trees.tree6 == NULL) {
+            return NGX_CONF_ERROR;
+        }
 #endif
+
+        var->get_handler = ngx_http_geo_cidr_variable;
+        var->data = (uintptr_t) geo;
+
+        ngx_destroy_pool(ctx.temp_pool);
+        ngx_destroy_pool(pool);
     }
 
     return rv;
@@ -610,6 +680,20 @@ ngx_http_geo(ngx_conf_t *cf, ngx_command_t *dummy, void *conf)
 
         goto done;
 
+    } else if (ngx_strcmp(value[0].data, "refresh") == 0) {
+
+        ctx->refresh = ngx_parse_time(&value[1], 1);
+
+        if (ctx->refresh == (time_t) NGX_ERROR || ctx->refresh == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid refresh time \"%V\"", &value[1]);
+            goto failed;
+        }
+
+        rv = NGX_CONF_OK;
+
+        goto done;
+
     } else if (ngx_strcmp(value[0].data, "proxy") == 0) {
 
         if (ngx_http_geo_cidr_value(cf, &value[1], &cidr) != NGX_OK) {
@@ -1021,7 +1105,7 @@ ngx_http_geo_cidr(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
     ngx_cidr_t   cidr;
 
     if (ctx->tree == NULL) {
-        ctx->tree = ngx_radix_tree_create(ctx->pool, -1);
+        ctx->tree = ngx_radix_tree_create(ctx->temp_pool, 0);
         if (ctx->tree == NULL) {
             return NGX_CONF_ERROR;
         }
@@ -1029,7 +1113,7 @@ ngx_http_geo_cidr(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
 
 #if (NGX_HAVE_INET6)
     if (ctx->tree6 == NULL) {
-        ctx->tree6 = ngx_radix_tree_create(ctx->pool, -1);
+        ctx->tree6 = ngx_radix_tree_create(ctx->temp_pool, 0);
         if (ctx->tree6 == NULL) {
             return NGX_CONF_ERROR;
         }
@@ -1266,7 +1350,7 @@ ngx_http_geo_add_proxy(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
     ngx_cidr_t  *c;
 
     if (ctx->proxies == NULL) {
-        ctx->proxies = ngx_array_create(ctx->pool, 4, sizeof(ngx_cidr_t));
+        ctx->proxies = ngx_array_create(ctx->temp_pool, 4, sizeof(ngx_cidr_t));
         if (ctx->proxies == NULL) {
             return NGX_CONF_ERROR;
         }
@@ -1368,19 +1452,16 @@ static ngx_int_t
 ngx_http_geo_include_binary_base(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
     ngx_str_t *name)
 {
-    u_char                     *base, ch;
-    time_t                      mtime;
-    size_t                      size, len;
-    ssize_t                     n;
-    uint32_t                    crc32;
-    ngx_err_t                   err;
-    ngx_int_t                   rc;
-    ngx_uint_t                  i;
-    ngx_file_t                  file;
-    ngx_file_info_t             fi;
-    ngx_http_geo_range_t       *range, **ranges;
-    ngx_http_geo_header_t      *header;
-    ngx_http_variable_value_t  *vv;
+    u_char                  *base, ch;
+    time_t                   mtime;
+    size_t                   size;
+    ssize_t                  n;
+    ngx_err_t                err;
+    ngx_int_t                rc;
+    ngx_file_t               file;
+    ngx_file_info_t          fi;
+    ngx_http_geo_range_t   **ranges;
+    ngx_http_geo_header_t   *header;
 
     ngx_memzero(&file, sizeof(ngx_file_t));
     file.name = *name;
@@ -1466,6 +1547,57 @@ ngx_http_geo_include_binary_base(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
         goto failed;
     }
 
+    ranges = ngx_http_geo_fixup_binary_base(base, size);
+
+    if (ranges == NULL) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                  "CRC32 mismatch in binary geo range base \"%s\"", name->data);
+        goto failed;
+    }
+
+    ngx_conf_log_error(NGX_LOG_NOTICE, cf, 0,
+                       "using binary geo range base \"%s\"", name->data);
+
+    ctx->include_name = *name;
+    ctx->binary_include = 1;
+    ctx->high.low = ranges;
+    ctx->mtime = mtime;
+    rc = NGX_OK;
+
+    goto done;
+
+failed:
+
+    rc = NGX_DECLINED;
+
+done:
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name->data);
+    }
+
+    return rc;
+}
+
+
+/*
+ * converts the offsets of a binary base read into memory to pointers,
+ * returns NULL if the checksum does not match
+ */
+
+static ngx_http_geo_range_t **
+ngx_http_geo_fixup_binary_base(u_char *base, size_t size)
+{
+    size_t                      len;
+    uint32_t                    crc32;
+    ngx_uint_t                  i;
+    ngx_http_geo_range_t       *range, **ranges;
+    ngx_http_geo_header_t      *header;
+    ngx_http_variable_value_t  *vv;
+
+    header = (ngx_http_geo_header_t *) base;
+
     ngx_crc32_init(crc32);
 
     vv = (ngx_http_variable_value_t *) (base + sizeof(ngx_http_geo_header_t));
@@ -1507,33 +1639,243 @@ ngx_http_geo_include_binary_base(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
     ngx_crc32_final(crc32);
 
     if (crc32 != header->crc32) {
-        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
-                  "CRC32 mismatch in binary geo range base \"%s\"", name->data);
-        goto failed;
+        return NULL;
     }
 
-    ngx_conf_log_error(NGX_LOG_NOTICE, cf, 0,
-                       "using binary geo range base \"%s\"", name->data);
+    return ranges;
+}
 
-    ctx->include_name = *name;
-    ctx->binary_include = 1;
-    ctx->high.low = ranges;
-    rc = NGX_OK;
+
+static ngx_int_t
+ngx_http_geo_init_refresh(ngx_conf_t *cf, ngx_http_geo_ctx_t *geo,
+    ngx_http_geo_conf_ctx_t *ctx)
+{
+    ngx_file_info_t            fi;
+    ngx_http_geo_refresh_t    *rf, **rfp;
+    ngx_http_geo_main_conf_t  *gmcf;
+
+    if (ctx->includes + ctx->binary_include != 1 || ctx->outside_entries) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"refresh\" requires the ranges to be "
+                           "included from a single file");
+        return NGX_ERROR;
+    }
+
+    rf = ngx_pcalloc(cf->pool, sizeof(ngx_http_geo_refresh_t));
+    if (rf == NULL) {
+        return NGX_ERROR;
+    }
+
+    rf->interval = ctx->refresh;
+
+    if (ctx->binary_include) {
+        rf->name = ctx->include_name;
+        rf->mtime = ctx->mtime;
+
+    } else {
+        rf->name.len = ctx->include_name.len + 4;
+        rf->name.data = ngx_pnalloc(cf->pool, rf->name.len + 1);
+        if (rf->name.data == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_sprintf(rf->name.data, "%V.bin%Z", &ctx->include_name);
+
+        if (ngx_file_info(rf->name.data, &fi) != NGX_FILE_ERROR) {
+            rf->mtime = ngx_file_mtime(&fi);
+        }
+    }
+
+    rf->event.handler = ngx_http_geo_refresh_handler;
+    rf->event.data = geo;
+    rf->event.log = &cf->cycle->new_log;
+    rf->event.cancelable = 1;
+
+    gmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_geo_module);
+
+    if (gmcf->refresh == NULL) {
+        gmcf->refresh = ngx_array_create(cf->pool, 1,
+                                         sizeof(ngx_http_geo_refresh_t *));
+        if (gmcf->refresh == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    rfp = ngx_array_push(gmcf->refresh);
+    if (rfp == NULL) {
+        return NGX_ERROR;
+    }
+
+    *rfp = rf;
+
+    geo->refresh = rf;
+
+    return NGX_OK;
+}
+
+
+/*
+ * the file is read only when its mtime changes, so it should be
+ * replaced by rename() rather than rewritten in place
+ */
+
+static void
+ngx_http_geo_refresh_binary_base(ngx_http_geo_ctx_t *ctx, ngx_log_t *log)
+{
+    u_char                  *base;
+    size_t                   size;
+    ssize_t                  n;
+    ngx_file_t               file;
+    ngx_file_info_t          fi;
+    ngx_http_geo_range_t   **ranges;
+    ngx_http_geo_refresh_t  *rf;
+
+    rf = ctx->refresh;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+    file.name = rf->name;
+    file.log = log;
+
+    file.fd = ngx_open_file(rf->name.data, NGX_FILE_RDONLY, 0, 0);
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", rf->name.data);
+        return;
+    }
+
+    base = NULL;
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", rf->name.data);
+        goto done;
+    }
+
+    if (ngx_file_mtime(&fi) == rf->mtime) {
+        goto done;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+
+    if (size < 16) {
+        goto incompatible;
+    }
+
+    base = ngx_alloc(size, log);
+    if (base == NULL) {
+        goto done;
+    }
+
+    n = ngx_read_file(&file, base, size, 0);
+
+    if (n == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_read_file_n " \"%s\" failed", rf->name.data);
+        goto done;
+    }
+
+    if ((size_t) n != size
+        || ngx_memcmp(&ngx_http_geo_header, base, 12) != 0)
+    {
+        goto incompatible;
+    }
+
+    ranges = ngx_http_geo_fixup_binary_base(base, size);
+
+    if (ranges == NULL) {
+        goto incompatible;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "reloaded binary geo range base \"%s\"", rf->name.data);
+
+    if (rf->base) {
+        ngx_free(rf->base);
+    }
+
+    rf->base = base;
+    rf->mtime = ngx_file_mtime(&fi);
+    ctx->u.high.low = ranges;
+
+    base = NULL;
 
     goto done;
 
-failed:
+incompatible:
 
-    rc = NGX_DECLINED;
+    /* most likely the file is still being written, it is retried later */
+
+    ngx_log_error(NGX_LOG_WARN, log, 0,
+                  "invalid binary geo range base \"%s\"", rf->name.data);
 
 done:
 
+    if (base) {
+        ngx_free(base);
+    }
+
     if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
-        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
-                      ngx_close_file_n " \"%s\" failed", name->data);
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", rf->name.data);
+    }
+}
+
+
+static void
+ngx_http_geo_refresh_handler(ngx_event_t *ev)
+{
+    ngx_http_geo_ctx_t  *ctx = ev->data;
+
+    if (ngx_exiting) {
+        return;
     }
 
-    return rc;
+    ngx_http_geo_refresh_binary_base(ctx, ev->log);
+
+    ngx_add_timer(ev, ctx->refresh->interval * 1000);
+}
+
+
+static void *
+ngx_http_geo_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_geo_main_conf_t  *gmcf;
+
+    gmcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_geo_main_conf_t));
+    if (gmcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     gmcf->refresh = NULL;
+     */
+
+    return gmcf;
+}
+
+
+static ngx_int_t
+ngx_http_geo_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                 i;
+    ngx_http_geo_refresh_t   **rf;
+    ngx_http_geo_main_conf_t  *gmcf;
+
+    gmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_geo_module);
+
+    if (gmcf == NULL || gmcf->refresh == NULL) {
+        return NGX_OK;
+    }
+
+    rf = gmcf->refresh->elts;
+
+    for (i = 0; i < gmcf->refresh->nelts; i++) {
+        ngx_add_timer(&rf[i]->event, rf[i]->interval * 1000);
+    }
+
+    return NGX_OK;
 }
 
 
@@ -18,15 +18,34 @@ typedef struct {
 } ngx_http_limit_conn_node_t;
 
 
+/*
+ * A "sketch" zone does not store the keys: a connection is counted in one
+ * counter in each of NGX_HTTP_LIMIT_CONN_DEPTH rows, the counters being
+ * chosen by the key hashes, and the least of them is taken as the number
+ * of the key's connections.  The counters are updated without locking.
+ */
+
+#define NGX_HTTP_LIMIT_CONN_DEPTH  4
+
+
+typedef struct {
+    ngx_uint_t                 width;
+    ngx_atomic_t               cells[1];
+} ngx_http_limit_conn_sketch_t;
+
+
 typedef struct {
     ngx_shm_zone_t            *shm_zone;
-    ngx_rbtree_node_t         *node;
+    ngx_rbtree_node_t         *node;      /* NULL in a sketch zone */
+    uint32_t                   hash[2];
 } ngx_http_limit_conn_cleanup_t;
 
 
 typedef struct {
-    ngx_rbtree_t              *rbtree;
-    ngx_http_complex_value_t   key;
+    ngx_rbtree_t                  *rbtree;
+    ngx_http_limit_conn_sketch_t  *counters;
+    ngx_uint_t                     sketch;    /* unsigned  sketch:1 */
+    ngx_http_complex_value_t       key;
 } ngx_http_limit_conn_ctx_t;
 
 
@@ -45,7 +64,12 @@ typedef struct {
 
 static ngx_rbtree_node_t *ngx_http_limit_conn_lookup(ngx_rbtree_t *rbtree,
     ngx_str_t *key, uint32_t hash);
+static ngx_atomic_uint_t ngx_http_limit_conn_sketch_add(
+    ngx_http_limit_conn_sketch_t *sketch, uint32_t *hash,
+    ngx_atomic_int_t add);
 static void ngx_http_limit_conn_cleanup(void *data);
+static ngx_http_limit_conn_sketch_t *ngx_http_limit_conn_init_sketch(
+    ngx_shm_zone_t *shm_zone, ngx_slab_pool_t *shpool);
 static ngx_inline void ngx_http_limit_conn_cleanup_all(ngx_pool_t *pool);
 
 static void *ngx_http_limit_conn_create_conf(ngx_conf_t *cf);
@@ -56,6 +80,7 @@ static char *ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd,
 static char *ngx_http_limit_conn(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_http_limit_conn_init(ngx_conf_t *cf);
+static ngx_uint_t ngx_http_limit_conn_active(void **loc_conf);
 
 
 static ngx_conf_enum_t  ngx_http_limit_conn_log_levels[] = {
@@ -75,7 +100,7 @@ static ngx_conf_num_bounds_t  ngx_http_limit_conn_status_bounds = {
 static ngx_command_t  ngx_http_limit_conn_commands[] = {
 
     { ngx_string("limit_conn_zone"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE2,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE23,
       ngx_http_limit_conn_zone,
       0,
       0,
@@ -141,7 +166,7 @@ static ngx_int_t
 ngx_http_limit_conn_handler(ngx_http_request_t *r)
 {
     size_t                          n;
-    uint32_t                        hash;
+    uint32_t                        hash, h[2];
     ngx_str_t                       key;
     ngx_uint_t                      i;
     ngx_slab_pool_t                *shpool;
@@ -183,6 +208,41 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
 
         hash = ngx_crc32_short(key.data, key.len);
 
+        if (ctx->sketch) {
+            h[0] = hash;
+            h[1] = ngx_murmur_hash2(key.data, key.len) | 1;
+
+            if (ngx_http_limit_conn_sketch_add(ctx->counters, h, 1)
+                >= limits[i].conn)
+            {
+                ngx_http_limit_conn_sketch_add(ctx->counters, h, -1);
+
+                ngx_log_error(lccf->log_level, r->connection->log, 0,
+                              "limiting connections by zone \"%V\"",
+                              &limits[i].shm_zone->shm.name);
+
+                ngx_http_limit_conn_cleanup_all(r->pool);
+                return lccf->status_code;
+            }
+
+            cln = ngx_pool_cleanup_add(r->pool,
+                                       sizeof(ngx_http_limit_conn_cleanup_t));
+            if (cln == NULL) {
+                ngx_http_limit_conn_sketch_add(ctx->counters, h, -1);
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+            }
+
+            cln->handler = ngx_http_limit_conn_cleanup;
+            lccln = cln->data;
+
+            lccln->shm_zone = limits[i].shm_zone;
+            lccln->node = NULL;
+            lccln->hash[0] = h[0];
+            lccln->hash[1] = h[1];
+
+            continue;
+        }
+
         shpool = (ngx_slab_pool_t *) limits[i].shm_zone->shm.addr;
 
         ngx_shmtx_lock(&shpool->mutex);
@@ -333,6 +393,36 @@ ngx_http_limit_conn_lookup(ngx_rbtree_t *rbtree, ngx_str_t *key, uint32_t hash)
 }
 
 
+static ngx_atomic_uint_t
+ngx_http_limit_conn_sketch_add(ngx_http_limit_conn_sketch_t *sketch,
+    uint32_t *hash, ngx_atomic_int_t add)
+{
+    ngx_uint_t          i;
+    ngx_atomic_t       *cell;
+    ngx_atomic_uint_t   old, min;
+
+    /*
+     * returns the number of connections before the update; concurrent
+     * updates of the same key may race past the limit by a few connections
+     */
+
+    min = (ngx_atomic_uint_t) -1;
+
+    for (i = 0; i < NGX_HTTP_LIMIT_CONN_DEPTH; i++) {
+        cell = &sketch->cells[i * sketch->width
+                              + (hash[0] + i * hash[1]) % sketch->width];
+
+        old = ngx_atomic_fetch_add(cell, add);
+
+        if (old < min) {
+            min = old;
+        }
+    }
+
+    return min;
+}
+
+
 static void
 ngx_http_limit_conn_cleanup(void *data)
 {
@@ -344,6 +434,12 @@ ngx_http_limit_conn_cleanup(void *data)
     ngx_http_limit_conn_node_t  *lc;
 
     ctx = lccln->shm_zone->data;
+
+    if (lccln->node == NULL) {
+        ngx_http_limit_conn_sketch_add(ctx->counters, lccln->hash, -1);
+        return;
+    }
+
     shpool = (ngx_slab_pool_t *) lccln->shm_zone->shm.addr;
     node = lccln->node;
     lc = (ngx_http_limit_conn_node_t *) &node->color;
@@ -406,7 +502,18 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
             return NGX_ERROR;
         }
 
+        if (ctx->sketch != octx->sketch) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_conn_zone \"%V\" %s the \"sketch\" "
+                          "parameter while previously it did%s",
+                          &shm_zone->shm.name,
+                          ctx->sketch ? "uses" : "does not use",
+                          ctx->sketch ? " not" : "");
+            return NGX_ERROR;
+        }
+
         ctx->rbtree = octx->rbtree;
+        ctx->counters = octx->counters;
 
         return NGX_OK;
     }
@@ -414,7 +521,33 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
     shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
 
     if (shm_zone->shm.exists) {
-        ctx->rbtree = shpool->data;
+        if (ctx->sketch) {
+            ctx->counters = shpool->data;
+
+        } else {
+            ctx->rbtree = shpool->data;
+        }
+
+        return NGX_OK;
+    }
+
+    len = sizeof(" in limit_conn_zone \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shpool->log_ctx, " in limit_conn_zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    if (ctx->sketch) {
+        ctx->counters = ngx_http_limit_conn_init_sketch(shm_zone, shpool);
+        if (ctx->counters == NULL) {
+            return NGX_ERROR;
+        }
+
+        shpool->data = ctx->counters;
 
         return NGX_OK;
     }
@@ -434,17 +567,51 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
     ngx_rbtree_init(ctx->rbtree, sentinel,
                     ngx_http_limit_conn_rbtree_insert_value);
 
-    len = sizeof(" in limit_conn_zone \"\"") + shm_zone->shm.name.len;
+    return NGX_OK;
+}
 
-    shpool->log_ctx = ngx_slab_alloc(shpool, len);
-    if (shpool->log_ctx == NULL) {
-        return NGX_ERROR;
+
+static ngx_http_limit_conn_sketch_t *
+ngx_http_limit_conn_init_sketch(ngx_shm_zone_t *shm_zone,
+    ngx_slab_pool_t *shpool)
+{
+    size_t                         len;
+    ngx_uint_t                     pages, width;
+    ngx_http_limit_conn_sketch_t  *sketch;
+
+    /* the counters take all the zone pages left */
+
+    pages = (shpool->end - shpool->start) / ngx_pagesize;
+
+    width = (pages > 2) ? (pages - 2) * ngx_pagesize : 0;
+    width /= NGX_HTTP_LIMIT_CONN_DEPTH * sizeof(ngx_atomic_t);
+
+    shpool->log_nomem = 0;
+
+    for ( ;; ) {
+        if (width < 64) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_conn_zone \"%V\" is too small for a sketch",
+                          &shm_zone->shm.name);
+            return NULL;
+        }
+
+        len = offsetof(ngx_http_limit_conn_sketch_t, cells)
+              + NGX_HTTP_LIMIT_CONN_DEPTH * width * sizeof(ngx_atomic_t);
+
+        sketch = ngx_slab_calloc(shpool, len);
+        if (sketch) {
+            break;
+        }
+
+        width -= width / 8 + 1;
     }
 
-    ngx_sprintf(shpool->log_ctx, " in limit_conn_zone \"%V\"%Z",
-                &shm_zone->shm.name);
+    shpool->log_nomem = 1;
 
-    return NGX_OK;
+    sketch->width = width;
+
+    return sketch;
 }
 
 
@@ -556,6 +723,18 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strcmp(value[i].data, "sketch") == 0) {
+
+#if !(NGX_HAVE_ATOMIC_OPS)
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"sketch\" requires atomic operations");
+            return NGX_CONF_ERROR;
+#endif
+
+            ctx->sketch = 1;
+            continue;
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
@@ -666,5 +845,17 @@ ngx_http_limit_conn_init(ngx_conf_t *cf)
 
     *h = ngx_http_limit_conn_handler;
 
-    return NGX_OK;
+    return ngx_http_set_phase_active(cf, ngx_http_limit_conn_handler,
+                                     ngx_http_limit_conn_active);
+}
+
+
+static ngx_uint_t
+ngx_http_limit_conn_active(void **loc_conf)
+{
+    ngx_http_limit_conn_conf_t  *lccf;
+
+    lccf = loc_conf[ngx_http_limit_conn_module.ctx_index];
+
+    return lccf->limits.nelts != 0;
 }
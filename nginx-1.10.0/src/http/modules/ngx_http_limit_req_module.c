@@ -8,6 +8,7 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
+#include <ngx_md5.h>
 
 
 typedef struct {
@@ -19,27 +20,142 @@ typedef struct {
     /* integer value, 1 corresponds to 0.001 r/s */
     ngx_uint_t                   excess;
     ngx_uint_t                   count;
+    /* requests not yet sent to the peers, queued in dirty if non-zero */
+    ngx_uint_t                   delta;
+    ngx_queue_t                  dirty;
     u_char                       data[1];
 } ngx_http_limit_req_node_t;
 
 
+/*
+ * A "sketch" zone does not store the keys: a key is accounted in one leaky
+ * bucket in each of NGX_HTTP_LIMIT_REQ_DEPTH rows, the buckets being chosen
+ * by the key hashes, and the least filled of them is taken as its excess.
+ * Collisions may only overestimate it, and the memory used does not depend
+ * on the number of keys.
+ */
+
+#define NGX_HTTP_LIMIT_REQ_DEPTH  4
+
+
+typedef struct {
+    /* integer value, 1 corresponds to 0.001 r/s */
+    uint32_t                     excess;
+    uint32_t                     last;
+} ngx_http_limit_req_cell_t;
+
+
+typedef struct {
+    ngx_uint_t                   width;
+    ngx_http_limit_req_cell_t    cells[1];
+} ngx_http_limit_req_sketch_t;
+
+
 typedef struct {
     ngx_rbtree_t                  rbtree;
     ngx_rbtree_node_t             sentinel;
     ngx_queue_t                   queue;
+    ngx_queue_t                   dirty;
+    ngx_http_limit_req_sketch_t  *sketch;
 } ngx_http_limit_req_shctx_t;
 
 
+/*
+ * A zone may be split by the key hash into shards, each with its own
+ * slab pool, and thus its own lock, carved out of the zone memory.
+ */
+
 typedef struct {
     ngx_http_limit_req_shctx_t  *sh;
     ngx_slab_pool_t             *shpool;
+} ngx_http_limit_req_shard_t;
+
+
+#define NGX_HTTP_LIMIT_REQ_MAX_SHARDS  256
+#define NGX_HTTP_LIMIT_REQ_LEASES      1024
+#define NGX_HTTP_LIMIT_REQ_LEASE_KEY   48
+
+
+/*
+ * Requests a worker passes for a key without locking the zone.  They are
+ * charged to the shared node in advance, so the limit is never exceeded,
+ * and unused ones are given back when the lease expires.
+ */
+
+typedef struct {
+    uint32_t                     hash;
+    u_short                      len;
+    ngx_uint_t                   tokens;
+    ngx_msec_t                   expire;
+    u_char                       data[NGX_HTTP_LIMIT_REQ_LEASE_KEY];
+} ngx_http_limit_req_lease_t;
+
+
+typedef struct {
+    ngx_slab_pool_t             *shpool;
+    ngx_http_limit_req_shard_t  *shards;
+    ngx_uint_t                   nshards;
     /* integer value, 1 corresponds to 0.001 r/s */
     ngx_uint_t                   rate;
     ngx_http_complex_value_t     key;
     ngx_http_limit_req_node_t   *node;
+    ngx_http_limit_req_shard_t  *shard;       /* the node's shard */
+
+    ngx_uint_t                   sketch;      /* unsigned  sketch:1 */
+    ngx_uint_t                   pending;     /* unsigned  pending:1 */
+    uint32_t                     hash[2];     /* of the pending request */
+
+    ngx_str_t                    name;
+    ngx_uint_t                   sync;        /* unsigned  sync:1 */
+    ngx_event_t                  sync_event;  /* per worker */
+
+    ngx_uint_t                   lease;
+    ngx_msec_t                   lease_time;
+    ngx_http_limit_req_lease_t  *leases;      /* per worker */
+    ngx_event_t                  lease_event;
 } ngx_http_limit_req_ctx_t;
 
 
+/*
+ * The requests passed in a "sync" zone are periodically sent to the peers
+ * in datagrams of the form
+ *
+ *     "LR" version(1) zone_name_len(1) zone_name { key_len key count } ...
+ *     [ mac(16) ]
+ *
+ * with the key lengths and counts as base 128 varints, and the requests
+ * received from the peers are charged to the zone as if passed locally.
+ * A count saturates at NGX_HTTP_LIMIT_REQ_SYNC_MAX, the rest of a larger
+ * delta is sent in the next record for the key.
+ *
+ * With "limit_req_sync_secret" the datagrams end with an HMAC-MD5 of the
+ * rest keyed with the secret, and the ones without a valid MAC are
+ * rejected.  Otherwise only the source address is checked, which is
+ * trivially spoofed with UDP, so the sync address must then be reachable
+ * from a loopback or private network only.  Replayed datagrams are not
+ * detected in either case.
+ */
+
+#define NGX_HTTP_LIMIT_REQ_SYNC_VERSION  1
+#define NGX_HTTP_LIMIT_REQ_SYNC_MTU      1400
+#define NGX_HTTP_LIMIT_REQ_SYNC_MAX      65535
+#define NGX_HTTP_LIMIT_REQ_SYNC_MAC      16
+
+
+typedef struct {
+    ngx_addr_t                   addr;
+    ngx_socket_t                 fd;          /* per worker */
+} ngx_http_limit_req_peer_t;
+
+
+typedef struct {
+    ngx_array_t                  zones;       /* ngx_shm_zone_t * */
+    ngx_array_t                  peers;       /* ngx_http_limit_req_peer_t */
+    ngx_msec_t                   interval;
+    ngx_str_t                    secret;
+} ngx_http_limit_req_main_conf_t;
+
+
 typedef struct {
     ngx_shm_zone_t              *shm_zone;
     /* integer value, 1 corresponds to 0.001 r/s */
@@ -57,13 +173,47 @@ typedef struct {
 
 
 static void ngx_http_limit_req_delay(ngx_http_request_t *r);
+static ngx_http_limit_req_node_t *ngx_http_limit_req_find(
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t hash, ngx_str_t *key);
+static ngx_http_limit_req_node_t *ngx_http_limit_req_alloc(
+    ngx_http_limit_req_ctx_t *ctx, ngx_http_limit_req_shard_t *shard,
+    ngx_uint_t hash, ngx_str_t *key);
 static ngx_int_t ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit,
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t hash, ngx_str_t *key,
+    ngx_uint_t *ep, ngx_uint_t account, ngx_uint_t *lease);
+static ngx_int_t ngx_http_limit_req_sketch_lookup(
+    ngx_http_limit_req_limit_t *limit, ngx_http_limit_req_shard_t *shard,
     ngx_uint_t hash, ngx_str_t *key, ngx_uint_t *ep, ngx_uint_t account);
+static ngx_uint_t ngx_http_limit_req_sketch_excess(
+    ngx_http_limit_req_ctx_t *ctx, ngx_http_limit_req_sketch_t *sketch,
+    uint32_t *hash, uint32_t now);
+static void ngx_http_limit_req_sketch_charge(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_sketch_t *sketch, uint32_t *hash, uint32_t now,
+    ngx_uint_t excess);
+static ngx_int_t ngx_http_limit_req_leased(ngx_http_limit_req_limit_t *limit,
+    ngx_uint_t hash, ngx_str_t *key, ngx_uint_t *ep);
+static void ngx_http_limit_req_return_lease(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_lease_t *lease);
+static void ngx_http_limit_req_lease_handler(ngx_event_t *ev);
 static ngx_msec_t ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits,
     ngx_uint_t n, ngx_uint_t *ep, ngx_http_limit_req_limit_t **limit);
 static void ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx,
-    ngx_uint_t n);
-
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t n);
+
+static void ngx_http_limit_req_sync_flush(ngx_event_t *ev);
+static void ngx_http_limit_req_sync_send(ngx_http_limit_req_main_conf_t *lrmcf,
+    u_char *buf, size_t len);
+static void ngx_http_limit_req_sync_handler(ngx_connection_t *c);
+static void ngx_http_limit_req_sync_mac(ngx_str_t *secret, u_char *buf,
+    size_t len, u_char *mac);
+static void ngx_http_limit_req_sync_apply(ngx_http_limit_req_ctx_t *ctx,
+    ngx_str_t *key, ngx_uint_t count);
+static u_char *ngx_http_limit_req_sync_write(u_char *p, ngx_uint_t n);
+static u_char *ngx_http_limit_req_sync_read(u_char *p, u_char *last,
+    ngx_uint_t *np);
+
+static void *ngx_http_limit_req_create_main_conf(ngx_conf_t *cf);
+static char *ngx_http_limit_req_init_main_conf(ngx_conf_t *cf, void *conf);
 static void *ngx_http_limit_req_create_conf(ngx_conf_t *cf);
 static char *ngx_http_limit_req_merge_conf(ngx_conf_t *cf, void *parent,
     void *child);
@@ -71,7 +221,14 @@ static char *ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_limit_req(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_limit_req_sync_listen(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_limit_req_sync_peer(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static ngx_int_t ngx_http_limit_req_init(ngx_conf_t *cf);
+static ngx_uint_t ngx_http_limit_req_active(void **loc_conf);
+static ngx_int_t ngx_http_limit_req_init_process(ngx_cycle_t *cycle);
+static void ngx_http_limit_req_exit_process(ngx_cycle_t *cycle);
 
 
 static ngx_conf_enum_t  ngx_http_limit_req_log_levels[] = {
@@ -91,7 +248,7 @@ static ngx_conf_num_bounds_t  ngx_http_limit_req_status_bounds = {
 static ngx_command_t  ngx_http_limit_req_commands[] = {
 
     { ngx_string("limit_req_zone"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE3,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_2MORE,
       ngx_http_limit_req_zone,
       0,
       0,
@@ -118,6 +275,34 @@ static ngx_command_t  ngx_http_limit_req_commands[] = {
       offsetof(ngx_http_limit_req_conf_t, status_code),
       &ngx_http_limit_req_status_bounds },
 
+    { ngx_string("limit_req_sync_listen"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_http_limit_req_sync_listen,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("limit_req_sync_peer"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_http_limit_req_sync_peer,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("limit_req_sync_interval"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_limit_req_main_conf_t, interval),
+      NULL },
+
+    { ngx_string("limit_req_sync_secret"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_str_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_limit_req_main_conf_t, secret),
+      NULL },
+
       ngx_null_command
 };
 
@@ -126,8 +311,8 @@ static ngx_http_module_t  ngx_http_limit_req_module_ctx = {
     NULL,                                  /* preconfiguration */
     ngx_http_limit_req_init,               /* postconfiguration */
 
-    NULL,                                  /* create main configuration */
-    NULL,                                  /* init main configuration */
+    ngx_http_limit_req_create_main_conf,   /* create main configuration */
+    ngx_http_limit_req_init_main_conf,     /* init main configuration */
 
     NULL,                                  /* create server configuration */
     NULL,                                  /* merge server configuration */
@@ -144,10 +329,10 @@ ngx_module_t  ngx_http_limit_req_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_limit_req_init_process,       /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
-    NULL,                                  /* exit process */
+    ngx_http_limit_req_exit_process,       /* exit process */
     NULL,                                  /* exit master */
     NGX_MODULE_V1_PADDING
 };
@@ -159,10 +344,11 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
     uint32_t                     hash;
     ngx_str_t                    key;
     ngx_int_t                    rc;
-    ngx_uint_t                   n, excess;
+    ngx_uint_t                   n, excess, last;
     ngx_msec_t                   delay;
     ngx_http_limit_req_ctx_t    *ctx;
     ngx_http_limit_req_conf_t   *lrcf;
+    ngx_http_limit_req_shard_t  *shard;
     ngx_http_limit_req_limit_t  *limit, *limits;
 
     if (r->main->limit_req_set) {
@@ -204,12 +390,25 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
 
         hash = ngx_crc32_short(key.data, key.len);
 
-        ngx_shmtx_lock(&ctx->shpool->mutex);
+        last = (n == lrcf->limits.nelts - 1);
 
-        rc = ngx_http_limit_req_lookup(limit, hash, &key, &excess,
-                                       (n == lrcf->limits.nelts - 1));
+        if (ctx->leases
+            && last
+            && limit->nodelay
+            && key.len <= NGX_HTTP_LIMIT_REQ_LEASE_KEY)
+        {
+            rc = ngx_http_limit_req_leased(limit, hash, &key, &excess);
+
+        } else {
+            shard = &ctx->shards[hash % ctx->nshards];
+
+            ngx_shmtx_lock(&shard->shpool->mutex);
+
+            rc = ngx_http_limit_req_lookup(limit, shard, hash, &key, &excess,
+                                           last, NULL);
 
-        ngx_shmtx_unlock(&ctx->shpool->mutex);
+            ngx_shmtx_unlock(&shard->shpool->mutex);
+        }
 
         ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "limit_req[%ui]: %i %ui.%03ui",
@@ -238,15 +437,17 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
         while (n--) {
             ctx = limits[n].shm_zone->data;
 
+            ctx->pending = 0;
+
             if (ctx->node == NULL) {
                 continue;
             }
 
-            ngx_shmtx_lock(&ctx->shpool->mutex);
+            ngx_shmtx_lock(&ctx->shard->shpool->mutex);
 
             ctx->node->count--;
 
-            ngx_shmtx_unlock(&ctx->shpool->mutex);
+            ngx_shmtx_unlock(&ctx->shard->shpool->mutex);
 
             ctx->node = NULL;
         }
@@ -356,26 +557,16 @@ ngx_http_limit_req_rbtree_insert_value(ngx_rbtree_node_t *temp,
 }
 
 
-static ngx_int_t
-ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
-    ngx_str_t *key, ngx_uint_t *ep, ngx_uint_t account)
+static ngx_http_limit_req_node_t *
+ngx_http_limit_req_find(ngx_http_limit_req_shard_t *shard, ngx_uint_t hash,
+    ngx_str_t *key)
 {
-    size_t                      size;
-    ngx_int_t                   rc, excess;
-    ngx_time_t                 *tp;
-    ngx_msec_t                  now;
-    ngx_msec_int_t              ms;
+    ngx_int_t                   rc;
     ngx_rbtree_node_t          *node, *sentinel;
-    ngx_http_limit_req_ctx_t   *ctx;
     ngx_http_limit_req_node_t  *lr;
 
-    tp = ngx_timeofday();
-    now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
-
-    ctx = limit->shm_zone->data;
-
-    node = ctx->sh->rbtree.root;
-    sentinel = ctx->sh->rbtree.sentinel;
+    node = shard->sh->rbtree.root;
+    sentinel = shard->sh->rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -396,57 +587,40 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
         rc = ngx_memn2cmp(key->data, lr->data, key->len, (size_t) lr->len);
 
         if (rc == 0) {
-            ngx_queue_remove(&lr->queue);
-            ngx_queue_insert_head(&ctx->sh->queue, &lr->queue);
-
-            ms = (ngx_msec_int_t) (now - lr->last);
-
-            excess = lr->excess - ctx->rate * ngx_abs(ms) / 1000 + 1000;
-
-            if (excess < 0) {
-                excess = 0;
-            }
-
-            *ep = excess;
-
-            if ((ngx_uint_t) excess > limit->burst) {
-                return NGX_BUSY;
-            }
-
-            if (account) {
-                lr->excess = excess;
-                lr->last = now;
-                return NGX_OK;
-            }
-
-            lr->count++;
-
-            ctx->node = lr;
-
-            return NGX_AGAIN;
+            return lr;
         }
 
         node = (rc < 0) ? node->left : node->right;
     }
 
-    *ep = 0;
+    return NULL;
+}
+
+
+static ngx_http_limit_req_node_t *
+ngx_http_limit_req_alloc(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t hash, ngx_str_t *key)
+{
+    size_t                      size;
+    ngx_rbtree_node_t          *node;
+    ngx_http_limit_req_node_t  *lr;
 
     size = offsetof(ngx_rbtree_node_t, color)
            + offsetof(ngx_http_limit_req_node_t, data)
            + key->len;
 
-    ngx_http_limit_req_expire(ctx, 1);
+    ngx_http_limit_req_expire(ctx, shard, 1);
 
-    node = ngx_slab_alloc_locked(ctx->shpool, size);
+    node = ngx_slab_alloc_locked(shard->shpool, size);
 
     if (node == NULL) {
-        ngx_http_limit_req_expire(ctx, 0);
+        ngx_http_limit_req_expire(ctx, shard, 0);
 
-        node = ngx_slab_alloc_locked(ctx->shpool, size);
+        node = ngx_slab_alloc_locked(shard->shpool, size);
         if (node == NULL) {
             ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
                           "could not allocate node%s", ctx->shpool->log_ctx);
-            return NGX_ERROR;
+            return NULL;
         }
     }
 
@@ -456,62 +630,63 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
 
     lr->len = (u_short) key->len;
     lr->excess = 0;
+    lr->delta = 0;
 
     ngx_memcpy(lr->data, key->data, key->len);
 
-    ngx_rbtree_insert(&ctx->sh->rbtree, node);
+    ngx_rbtree_insert(&shard->sh->rbtree, node);
 
-    ngx_queue_insert_head(&ctx->sh->queue, &lr->queue);
+    ngx_queue_insert_head(&shard->sh->queue, &lr->queue);
 
-    if (account) {
-        lr->last = now;
-        lr->count = 0;
-        return NGX_OK;
-    }
+    return lr;
+}
 
-    lr->last = 0;
-    lr->count = 1;
 
-    ctx->node = lr;
+static ngx_inline void
+ngx_http_limit_req_sync_count(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_shard_t *shard, ngx_http_limit_req_node_t *lr,
+    ngx_uint_t n)
+{
+    if (!ctx->sync) {
+        return;
+    }
 
-    return NGX_AGAIN;
+    if (lr->delta == 0) {
+        ngx_queue_insert_tail(&shard->sh->dirty, &lr->dirty);
+    }
+
+    lr->delta += n;
 }
 
 
-static ngx_msec_t
-ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
-    ngx_uint_t *ep, ngx_http_limit_req_limit_t **limit)
+static ngx_int_t
+ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit,
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t hash, ngx_str_t *key,
+    ngx_uint_t *ep, ngx_uint_t account, ngx_uint_t *lease)
 {
     ngx_int_t                   excess;
     ngx_time_t                 *tp;
-    ngx_msec_t                  now, delay, max_delay;
+    ngx_msec_t                  now;
     ngx_msec_int_t              ms;
     ngx_http_limit_req_ctx_t   *ctx;
     ngx_http_limit_req_node_t  *lr;
 
-    excess = *ep;
+    tp = ngx_timeofday();
+    now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
 
-    if (excess == 0 || (*limit)->nodelay) {
-        max_delay = 0;
+    ctx = limit->shm_zone->data;
 
-    } else {
-        ctx = (*limit)->shm_zone->data;
-        max_delay = excess * 1000 / ctx->rate;
+    if (ctx->sketch) {
+        return ngx_http_limit_req_sketch_lookup(limit, shard, hash, key, ep,
+                                                account);
     }
 
-    while (n--) {
-        ctx = limits[n].shm_zone->data;
-        lr = ctx->node;
-
-        if (lr == NULL) {
-            continue;
-        }
+    lr = ngx_http_limit_req_find(shard, hash, key);
 
-        ngx_shmtx_lock(&ctx->shpool->mutex);
-
-        tp = ngx_timeofday();
+    if (lr) {
+        ngx_queue_remove(&lr->queue);
+        ngx_queue_insert_head(&shard->sh->queue, &lr->queue);
 
-        now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
         ms = (ngx_msec_int_t) (now - lr->last);
 
         excess = lr->excess - ctx->rate * ngx_abs(ms) / 1000 + 1000;
@@ -520,149 +695,909 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
             excess = 0;
         }
 
-        lr->last = now;
-        lr->excess = excess;
-        lr->count--;
+        *ep = excess;
 
-        ngx_shmtx_unlock(&ctx->shpool->mutex);
+        if ((ngx_uint_t) excess > limit->burst) {
+            return NGX_BUSY;
+        }
 
-        ctx->node = NULL;
+        if (account) {
 
-        if (limits[n].nodelay) {
-            continue;
+            /* the lease is charged in advance within the burst */
+
+            if (lease) {
+                *lease = ngx_min(ctx->lease,
+                                 (limit->burst - excess) / 1000);
+                excess += *lease * 1000;
+            }
+
+            ngx_http_limit_req_sync_count(ctx, shard, lr,
+                                          1 + (lease ? *lease : 0));
+
+            lr->excess = excess;
+            lr->last = now;
+            return NGX_OK;
         }
 
-        delay = excess * 1000 / ctx->rate;
+        lr->count++;
 
-        if (delay > max_delay) {
-            max_delay = delay;
-            *ep = excess;
-            *limit = &limits[n];
+        ctx->node = lr;
+        ctx->shard = shard;
+
+        return NGX_AGAIN;
+    }
+
+    *ep = 0;
+
+    lr = ngx_http_limit_req_alloc(ctx, shard, hash, key);
+    if (lr == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (account) {
+
+        if (lease) {
+            *lease = ngx_min(ctx->lease, limit->burst / 1000);
+            lr->excess = *lease * 1000;
         }
+
+        ngx_http_limit_req_sync_count(ctx, shard, lr,
+                                      1 + (lease ? *lease : 0));
+
+        lr->last = now;
+        lr->count = 0;
+        return NGX_OK;
     }
 
-    return max_delay;
+    lr->last = 0;
+    lr->count = 1;
+
+    ctx->node = lr;
+    ctx->shard = shard;
+
+    return NGX_AGAIN;
 }
 
 
-static void
-ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
+static ngx_int_t
+ngx_http_limit_req_sketch_lookup(ngx_http_limit_req_limit_t *limit,
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t hash, ngx_str_t *key,
+    ngx_uint_t *ep, ngx_uint_t account)
 {
-    ngx_int_t                   excess;
-    ngx_time_t                 *tp;
-    ngx_msec_t                  now;
-    ngx_queue_t                *q;
-    ngx_msec_int_t              ms;
-    ngx_rbtree_node_t          *node;
-    ngx_http_limit_req_node_t  *lr;
+    uint32_t                   h[2], now;
+    ngx_uint_t                 excess;
+    ngx_time_t                *tp;
+    ngx_http_limit_req_ctx_t  *ctx;
 
     tp = ngx_timeofday();
+    now = (uint32_t) (tp->sec * 1000 + tp->msec);
 
-    now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
+    ctx = limit->shm_zone->data;
 
-    /*
-     * n == 1 deletes one or two zero rate entries
-     * n == 0 deletes oldest entry by force
-     *        and one or two zero rate entries
-     */
+    h[0] = (uint32_t) hash;
+    h[1] = ngx_murmur_hash2(key->data, key->len) | 1;
 
-    while (n < 3) {
+    excess = ngx_http_limit_req_sketch_excess(ctx, shard->sh->sketch, h, now);
 
-        if (ngx_queue_empty(&ctx->sh->queue)) {
-            return;
-        }
+    *ep = excess;
 
-        q = ngx_queue_last(&ctx->sh->queue);
+    if (excess > limit->burst) {
+        return NGX_BUSY;
+    }
 
-        lr = ngx_queue_data(q, ngx_http_limit_req_node_t, queue);
+    if (account) {
+        ngx_http_limit_req_sketch_charge(ctx, shard->sh->sketch, h, now,
+                                         excess);
+        return NGX_OK;
+    }
 
-        if (lr->count) {
+    ctx->pending = 1;
+    ctx->hash[0] = h[0];
+    ctx->hash[1] = h[1];
+    ctx->shard = shard;
 
-            /*
-             * There is not much sense in looking further,
-             * because we bump nodes on the lookup stage.
-             */
+    return NGX_AGAIN;
+}
 
-            return;
-        }
 
-        if (n++ != 0) {
+static ngx_uint_t
+ngx_http_limit_req_sketch_excess(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_sketch_t *sketch, uint32_t *hash, uint32_t now)
+{
+    ngx_int_t                   excess, min;
+    ngx_uint_t                  i;
+    ngx_msec_int_t              ms;
+    ngx_http_limit_req_cell_t  *cell;
 
-            ms = (ngx_msec_int_t) (now - lr->last);
-            ms = ngx_abs(ms);
+    min = NGX_MAX_INT_T_VALUE;
 
-            if (ms < 60000) {
-                return;
-            }
+    for (i = 0; i < NGX_HTTP_LIMIT_REQ_DEPTH; i++) {
+        cell = &sketch->cells[i * sketch->width
+                              + (hash[0] + i * hash[1]) % sketch->width];
 
-            excess = lr->excess - ctx->rate * ms / 1000;
+        ms = (int32_t) (now - cell->last);
 
-            if (excess > 0) {
-                return;
-            }
+        excess = cell->excess - ctx->rate * ngx_abs(ms) / 1000 + 1000;
+
+        if (excess < min) {
+            min = excess;
         }
+    }
 
-        ngx_queue_remove(q);
+    return (min < 0) ? 0 : min;
+}
 
-        node = (ngx_rbtree_node_t *)
-                   ((u_char *) lr - offsetof(ngx_rbtree_node_t, color));
 
-        ngx_rbtree_delete(&ctx->sh->rbtree, node);
+static void
+ngx_http_limit_req_sketch_charge(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_sketch_t *sketch, uint32_t *hash, uint32_t now,
+    ngx_uint_t excess)
+{
+    ngx_int_t                   e;
+    ngx_uint_t                  i;
+    ngx_msec_int_t              ms;
+    ngx_http_limit_req_cell_t  *cell;
+
+    /*
+     * the conservative update: no bucket is raised above the new excess,
+     * so the buckets shared with other keys are overestimated less
+     */
+
+    for (i = 0; i < NGX_HTTP_LIMIT_REQ_DEPTH; i++) {
+        cell = &sketch->cells[i * sketch->width
+                              + (hash[0] + i * hash[1]) % sketch->width];
 
-        ngx_slab_free_locked(ctx->shpool, node);
+        ms = (int32_t) (now - cell->last);
+
+        e = cell->excess - ctx->rate * ngx_abs(ms) / 1000;
+
+        cell->excess = (e > (ngx_int_t) excess) ? (uint32_t) e
+                                                 : (uint32_t) excess;
+        cell->last = now;
     }
 }
 
 
 static ngx_int_t
-ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+ngx_http_limit_req_leased(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
+    ngx_str_t *key, ngx_uint_t *ep)
 {
-    ngx_http_limit_req_ctx_t  *octx = data;
+    ngx_int_t                    rc;
+    ngx_uint_t                   tokens;
+    ngx_http_limit_req_ctx_t    *ctx;
+    ngx_http_limit_req_lease_t  *lease;
+    ngx_http_limit_req_shard_t  *shard;
 
-    size_t                     len;
-    ngx_http_limit_req_ctx_t  *ctx;
+    ctx = limit->shm_zone->data;
 
-    ctx = shm_zone->data;
+    lease = &ctx->leases[hash % NGX_HTTP_LIMIT_REQ_LEASES];
 
-    if (octx) {
-        if (ctx->key.value.len != octx->key.value.len
-            || ngx_strncmp(ctx->key.value.data, octx->key.value.data,
-                           ctx->key.value.len)
-               != 0)
-        {
-            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
-                          "limit_req \"%V\" uses the \"%V\" key "
-                          "while previously it used the \"%V\" key",
-                          &shm_zone->shm.name, &ctx->key.value,
-                          &octx->key.value);
-            return NGX_ERROR;
-        }
+    if (lease->tokens
+        && lease->hash == hash
+        && lease->len == key->len
+        && (ngx_msec_int_t) (lease->expire - ngx_current_msec) > 0
+        && ngx_memcmp(lease->data, key->data, key->len) == 0)
+    {
+        lease->tokens--;
 
-        ctx->sh = octx->sh;
-        ctx->shpool = octx->shpool;
+        *ep = 0;
 
         return NGX_OK;
     }
 
-    ctx->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    ngx_http_limit_req_return_lease(ctx, lease);
 
-    if (shm_zone->shm.exists) {
-        ctx->sh = ctx->shpool->data;
+    shard = &ctx->shards[hash % ctx->nshards];
+
+    tokens = 0;
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    rc = ngx_http_limit_req_lookup(limit, shard, hash, key, ep, 1, &tokens);
+
+    ngx_shmtx_unlock(&shard->shpool->mutex);
+
+    if (rc != NGX_OK || tokens == 0) {
+        return rc;
+    }
+
+    lease->hash = (uint32_t) hash;
+    lease->len = (u_short) key->len;
+    lease->tokens = tokens;
+    lease->expire = ngx_current_msec + ctx->lease_time;
+
+    ngx_memcpy(lease->data, key->data, key->len);
+
+    if (!ctx->lease_event.timer_set) {
+        ngx_add_timer(&ctx->lease_event, ctx->lease_time);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_limit_req_return_lease(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_lease_t *lease)
+{
+    ngx_str_t                    key;
+    ngx_uint_t                   unused;
+    ngx_http_limit_req_node_t   *lr;
+    ngx_http_limit_req_shard_t  *shard;
+
+    if (lease->tokens == 0) {
+        return;
+    }
+
+    unused = lease->tokens * 1000;
+    lease->tokens = 0;
+
+    key.len = lease->len;
+    key.data = lease->data;
+
+    shard = &ctx->shards[lease->hash % ctx->nshards];
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    lr = ngx_http_limit_req_find(shard, lease->hash, &key);
+
+    if (lr) {
+        lr->excess = (lr->excess > unused) ? lr->excess - unused : 0;
+
+        if (lr->delta) {
+            lr->delta -= ngx_min(lr->delta, unused / 1000);
+
+            if (lr->delta == 0) {
+                ngx_queue_remove(&lr->dirty);
+            }
+        }
+    }
+
+    ngx_shmtx_unlock(&shard->shpool->mutex);
+}
+
+
+static void
+ngx_http_limit_req_lease_handler(ngx_event_t *ev)
+{
+    ngx_uint_t                   i, active;
+    ngx_http_limit_req_ctx_t    *ctx;
+    ngx_http_limit_req_lease_t  *lease;
+
+    ctx = ev->data;
+
+    active = 0;
+
+    for (i = 0; i < NGX_HTTP_LIMIT_REQ_LEASES; i++) {
+        lease = &ctx->leases[i];
+
+        if (lease->tokens == 0) {
+            continue;
+        }
+
+        if ((ngx_msec_int_t) (lease->expire - ngx_current_msec) > 0) {
+            active = 1;
+            continue;
+        }
+
+        ngx_http_limit_req_return_lease(ctx, lease);
+    }
+
+    if (active) {
+        ngx_add_timer(ev, ctx->lease_time);
+    }
+}
+
+
+static ngx_msec_t
+ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
+    ngx_uint_t *ep, ngx_http_limit_req_limit_t **limit)
+{
+    ngx_int_t                     excess;
+    ngx_time_t                   *tp;
+    ngx_msec_t                    now, delay, max_delay;
+    ngx_msec_int_t                ms;
+    ngx_http_limit_req_ctx_t     *ctx;
+    ngx_http_limit_req_node_t    *lr;
+    ngx_http_limit_req_sketch_t  *sketch;
+
+    excess = *ep;
+
+    if (excess == 0 || (*limit)->nodelay) {
+        max_delay = 0;
+
+    } else {
+        ctx = (*limit)->shm_zone->data;
+        max_delay = excess * 1000 / ctx->rate;
+    }
+
+    while (n--) {
+        ctx = limits[n].shm_zone->data;
+        lr = ctx->node;
+
+        if (lr == NULL && !ctx->pending) {
+            continue;
+        }
+
+        ngx_shmtx_lock(&ctx->shard->shpool->mutex);
+
+        tp = ngx_timeofday();
+
+        now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
+
+        if (ctx->pending) {
+            sketch = ctx->shard->sh->sketch;
+
+            excess = ngx_http_limit_req_sketch_excess(ctx, sketch, ctx->hash,
+                                                      (uint32_t) now);
+
+            ngx_http_limit_req_sketch_charge(ctx, sketch, ctx->hash,
+                                             (uint32_t) now, excess);
+
+        } else {
+            ms = (ngx_msec_int_t) (now - lr->last);
+
+            excess = lr->excess - ctx->rate * ngx_abs(ms) / 1000 + 1000;
+
+            if (excess < 0) {
+                excess = 0;
+            }
+
+            ngx_http_limit_req_sync_count(ctx, ctx->shard, lr, 1);
+
+            lr->last = now;
+            lr->excess = excess;
+            lr->count--;
+        }
+
+        ngx_shmtx_unlock(&ctx->shard->shpool->mutex);
+
+        ctx->node = NULL;
+        ctx->pending = 0;
+
+        if (limits[n].nodelay) {
+            continue;
+        }
+
+        delay = excess * 1000 / ctx->rate;
+
+        if (delay > max_delay) {
+            max_delay = delay;
+            *ep = excess;
+            *limit = &limits[n];
+        }
+    }
+
+    return max_delay;
+}
+
+
+static void
+ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t n)
+{
+    ngx_int_t                   excess;
+    ngx_time_t                 *tp;
+    ngx_msec_t                  now;
+    ngx_queue_t                *q;
+    ngx_msec_int_t              ms;
+    ngx_rbtree_node_t          *node;
+    ngx_http_limit_req_node_t  *lr;
+
+    tp = ngx_timeofday();
+
+    now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
+
+    /*
+     * n == 1 deletes one or two zero rate entries
+     * n == 0 deletes oldest entry by force
+     *        and one or two zero rate entries
+     */
+
+    while (n < 3) {
+
+        if (ngx_queue_empty(&shard->sh->queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&shard->sh->queue);
+
+        lr = ngx_queue_data(q, ngx_http_limit_req_node_t, queue);
+
+        if (lr->count) {
+
+            /*
+             * There is not much sense in looking further,
+             * because we bump nodes on the lookup stage.
+             */
+
+            return;
+        }
+
+        if (n++ != 0) {
+
+            ms = (ngx_msec_int_t) (now - lr->last);
+            ms = ngx_abs(ms);
+
+            if (ms < 60000) {
+                return;
+            }
+
+            excess = lr->excess - ctx->rate * ms / 1000;
+
+            if (excess > 0) {
+                return;
+            }
+        }
+
+        ngx_queue_remove(q);
+
+        if (lr->delta) {
+            ngx_queue_remove(&lr->dirty);
+        }
+
+        node = (ngx_rbtree_node_t *)
+                   ((u_char *) lr - offsetof(ngx_rbtree_node_t, color));
+
+        ngx_rbtree_delete(&shard->sh->rbtree, node);
+
+        ngx_slab_free_locked(shard->shpool, node);
+    }
+}
+
+
+static void
+ngx_http_limit_req_sync_flush(ngx_event_t *ev)
+{
+    u_char                          *p, *start, *last;
+    ngx_uint_t                       i, n, more, dropped;
+    ngx_queue_t                     *q;
+    ngx_http_limit_req_ctx_t        *ctx;
+    ngx_http_limit_req_node_t       *lr;
+    ngx_http_limit_req_shard_t      *shard;
+    ngx_http_limit_req_main_conf_t  *lrmcf;
+    static u_char                    buf[NGX_HTTP_LIMIT_REQ_SYNC_MTU];
+
+    ctx = ev->data;
+
+    lrmcf = ngx_http_cycle_get_module_main_conf(ngx_cycle,
+                                                ngx_http_limit_req_module);
+
+    p = buf;
+
+    *p++ = 'L';
+    *p++ = 'R';
+    *p++ = NGX_HTTP_LIMIT_REQ_SYNC_VERSION;
+    *p++ = (u_char) ctx->name.len;
+
+    p = ngx_cpymem(p, ctx->name.data, ctx->name.len);
+
+    start = p;
+    last = buf + NGX_HTTP_LIMIT_REQ_SYNC_MTU;
+
+    if (lrmcf->secret.len) {
+        last -= NGX_HTTP_LIMIT_REQ_SYNC_MAC;
+    }
+
+    dropped = 0;
+
+    for (i = 0; i < ctx->nshards; i++) {
+        shard = &ctx->shards[i];
+
+        do {
+            ngx_shmtx_lock(&shard->shpool->mutex);
+
+            while (!ngx_queue_empty(&shard->sh->dirty)) {
+                q = ngx_queue_head(&shard->sh->dirty);
+                lr = ngx_queue_data(q, ngx_http_limit_req_node_t, dirty);
+
+                /* a key length and a count take up to 3 bytes each */
+
+                if (p + lr->len + 6 > last && p != start) {
+                    break;
+                }
+
+                ngx_queue_remove(q);
+
+                if (start + lr->len + 6 > last) {
+                    /* the key does not fit even in an empty datagram */
+                    dropped++;
+                    lr->delta = 0;
+                    continue;
+                }
+
+                n = ngx_min(lr->delta, NGX_HTTP_LIMIT_REQ_SYNC_MAX);
+
+                p = ngx_http_limit_req_sync_write(p, lr->len);
+                p = ngx_cpymem(p, lr->data, lr->len);
+                p = ngx_http_limit_req_sync_write(p, n);
+
+                lr->delta -= n;
+
+                if (lr->delta) {
+                    ngx_queue_insert_tail(&shard->sh->dirty, q);
+                }
+            }
+
+            more = !ngx_queue_empty(&shard->sh->dirty);
+
+            ngx_shmtx_unlock(&shard->shpool->mutex);
+
+            if (more) {
+                ngx_http_limit_req_sync_send(lrmcf, buf, p - buf);
+                p = start;
+            }
+
+        } while (more);
+    }
+
+    if (p != start) {
+        ngx_http_limit_req_sync_send(lrmcf, buf, p - buf);
+    }
+
+    if (dropped) {
+        ngx_log_error(NGX_LOG_WARN, ev->log, 0,
+                      "limit_req sync dropped %ui keys too long "
+                      "for a datagram in zone \"%V\"", dropped, &ctx->name);
+    }
+
+    /* the remaining deltas are sent when the timer is cancelled on exit */
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    ngx_add_timer(ev, lrmcf->interval);
+}
+
+
+static void
+ngx_http_limit_req_sync_send(ngx_http_limit_req_main_conf_t *lrmcf,
+    u_char *buf, size_t len)
+{
+    ssize_t                     n;
+    ngx_uint_t                  i;
+    ngx_http_limit_req_peer_t  *peer;
+
+    if (lrmcf->secret.len) {
+        ngx_http_limit_req_sync_mac(&lrmcf->secret, buf, len, buf + len);
+        len += NGX_HTTP_LIMIT_REQ_SYNC_MAC;
+    }
+
+    peer = lrmcf->peers.elts;
+
+    for (i = 0; i < lrmcf->peers.nelts; i++) {
+
+        if (peer[i].fd == (ngx_socket_t) -1) {
+            continue;
+        }
+
+        n = sendto(peer[i].fd, buf, len, 0, peer[i].addr.sockaddr,
+                   peer[i].addr.socklen);
+
+        if (n == -1) {
+            ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_socket_errno,
+                          "sendto() to limit_req sync peer %V failed",
+                          &peer[i].addr.name);
+        }
+    }
+}
+
+
+static void
+ngx_http_limit_req_sync_handler(ngx_connection_t *c)
+{
+    u_char                          *p, *last, diff;
+    u_char                           mac[NGX_HTTP_LIMIT_REQ_SYNC_MAC];
+    ngx_str_t                        name, key;
+    ngx_uint_t                       i, len, count;
+    ngx_pool_t                      *pool;
+    ngx_shm_zone_t                 **zone;
+    ngx_http_limit_req_ctx_t        *ctx;
+    ngx_http_limit_req_peer_t       *peer;
+    ngx_http_limit_req_main_conf_t  *lrmcf;
+
+    lrmcf = c->listening->servers;
+
+    peer = lrmcf->peers.elts;
+
+    for (i = 0; i < lrmcf->peers.nelts; i++) {
+        if (ngx_cmp_sockaddr(c->sockaddr, c->socklen, peer[i].addr.sockaddr,
+                             peer[i].addr.socklen, 0)
+            == NGX_OK)
+        {
+            break;
+        }
+    }
+
+    if (i == lrmcf->peers.nelts) {
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "limit_req sync datagram from unknown peer %V",
+                      &c->addr_text);
+        goto done;
+    }
+
+    p = c->buffer->pos;
+    last = c->buffer->last;
+
+    if (lrmcf->secret.len) {
+        if (last - p < NGX_HTTP_LIMIT_REQ_SYNC_MAC) {
+            goto invalid;
+        }
+
+        last -= NGX_HTTP_LIMIT_REQ_SYNC_MAC;
+
+        ngx_http_limit_req_sync_mac(&lrmcf->secret, p, last - p, mac);
+
+        diff = 0;
+
+        for (i = 0; i < NGX_HTTP_LIMIT_REQ_SYNC_MAC; i++) {
+            diff |= mac[i] ^ last[i];
+        }
+
+        if (diff) {
+            ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                          "limit_req sync datagram with invalid MAC from %V",
+                          &c->addr_text);
+            goto done;
+        }
+    }
+
+    if (last - p < 4
+        || p[0] != 'L'
+        || p[1] != 'R'
+        || p[2] != NGX_HTTP_LIMIT_REQ_SYNC_VERSION
+        || last - p < 4 + p[3])
+    {
+        goto invalid;
+    }
+
+    name.len = p[3];
+    name.data = p + 4;
+
+    p += 4 + name.len;
+
+    zone = lrmcf->zones.elts;
+
+    for (i = 0; i < lrmcf->zones.nelts; i++) {
+        if (zone[i]->shm.name.len == name.len
+            && ngx_strncmp(zone[i]->shm.name.data, name.data, name.len) == 0)
+        {
+            break;
+        }
+    }
+
+    if (i == lrmcf->zones.nelts) {
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "limit_req sync datagram for unknown zone \"%V\"",
+                      &name);
+        goto done;
+    }
+
+    ctx = zone[i]->data;
+
+    while (p < last) {
+        p = ngx_http_limit_req_sync_read(p, last, &len);
+
+        if (p == NULL || len == 0 || (ngx_uint_t) (last - p) < len) {
+            goto invalid;
+        }
+
+        key.len = len;
+        key.data = p;
+
+        p = ngx_http_limit_req_sync_read(p + len, last, &count);
+
+        if (p == NULL) {
+            goto invalid;
+        }
+
+        if (count) {
+            ngx_http_limit_req_sync_apply(ctx, &key, count);
+        }
+    }
+
+    goto done;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                  "invalid limit_req sync datagram from %V", &c->addr_text);
+
+done:
+
+    pool = c->pool;
+
+    ngx_close_connection(c);
+
+    ngx_destroy_pool(pool);
+}
+
+
+static void
+ngx_http_limit_req_sync_mac(ngx_str_t *secret, u_char *buf, size_t len,
+    u_char *mac)
+{
+    u_char      key[64], pad[64], md[16];
+    ngx_uint_t  i;
+    ngx_md5_t   md5;
+
+    ngx_memzero(key, sizeof(key));
+
+    if (secret->len > sizeof(key)) {
+        ngx_md5_init(&md5);
+        ngx_md5_update(&md5, secret->data, secret->len);
+        ngx_md5_final(key, &md5);
+
+    } else {
+        ngx_memcpy(key, secret->data, secret->len);
+    }
+
+    for (i = 0; i < sizeof(key); i++) {
+        pad[i] = key[i] ^ 0x36;
+    }
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, pad, sizeof(pad));
+    ngx_md5_update(&md5, buf, len);
+    ngx_md5_final(md, &md5);
+
+    for (i = 0; i < sizeof(key); i++) {
+        pad[i] = key[i] ^ 0x5c;
+    }
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, pad, sizeof(pad));
+    ngx_md5_update(&md5, md, sizeof(md));
+    ngx_md5_final(mac, &md5);
+}
+
+
+static void
+ngx_http_limit_req_sync_apply(ngx_http_limit_req_ctx_t *ctx, ngx_str_t *key,
+    ngx_uint_t count)
+{
+    uint32_t                     hash;
+    ngx_int_t                    excess;
+    ngx_time_t                  *tp;
+    ngx_msec_t                   now;
+    ngx_msec_int_t               ms;
+    ngx_http_limit_req_node_t   *lr;
+    ngx_http_limit_req_shard_t  *shard;
+
+    hash = ngx_crc32_short(key->data, key->len);
+
+    shard = &ctx->shards[hash % ctx->nshards];
+
+    tp = ngx_timeofday();
+    now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    lr = ngx_http_limit_req_find(shard, hash, key);
+
+    if (lr) {
+        ms = (ngx_msec_int_t) (now - lr->last);
+
+        excess = lr->excess - ctx->rate * ngx_abs(ms) / 1000;
+
+        if (excess < 0) {
+            excess = 0;
+        }
+
+        lr->excess = excess + count * 1000;
+        lr->last = now;
+
+    } else {
+        lr = ngx_http_limit_req_alloc(ctx, shard, hash, key);
+
+        if (lr) {
+            /* as for a local node, the first request is not an excess */
+
+            lr->excess = (count - 1) * 1000;
+            lr->last = now;
+            lr->count = 0;
+        }
+    }
+
+    ngx_shmtx_unlock(&shard->shpool->mutex);
+}
+
+
+static u_char *
+ngx_http_limit_req_sync_write(u_char *p, ngx_uint_t n)
+{
+    while (n >= 0x80) {
+        *p++ = (u_char) (n | 0x80);
+        n >>= 7;
+    }
+
+    *p++ = (u_char) n;
+
+    return p;
+}
+
+
+static u_char *
+ngx_http_limit_req_sync_read(u_char *p, u_char *last, ngx_uint_t *np)
+{
+    ngx_uint_t  n, shift;
+
+    n = 0;
+
+    for (shift = 0; p < last && shift < 21; shift += 7) {
+        n |= (ngx_uint_t) (*p & 0x7f) << shift;
+
+        if ((*p++ & 0x80) == 0) {
+            *np = ngx_min(n, NGX_HTTP_LIMIT_REQ_SYNC_MAX);
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_limit_req_ctx_t  *octx = data;
+
+    u_char                       *p;
+    size_t                        len, size;
+    ngx_uint_t                    i, pages, width;
+    ngx_slab_pool_t              *sp;
+    ngx_http_limit_req_ctx_t     *ctx;
+    ngx_http_limit_req_shard_t   *shard;
+    ngx_http_limit_req_sketch_t  *sketch;
+
+    ctx = shm_zone->data;
+
+    if (octx) {
+        if (ctx->key.value.len != octx->key.value.len
+            || ngx_strncmp(ctx->key.value.data, octx->key.value.data,
+                           ctx->key.value.len)
+               != 0)
+        {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_req \"%V\" uses the \"%V\" key "
+                          "while previously it used the \"%V\" key",
+                          &shm_zone->shm.name, &ctx->key.value,
+                          &octx->key.value);
+            return NGX_ERROR;
+        }
 
-        return NGX_OK;
-    }
+        if (ctx->sketch != octx->sketch) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_req \"%V\" %s the \"sketch\" parameter "
+                          "while previously it did%s",
+                          &shm_zone->shm.name,
+                          ctx->sketch ? "uses" : "does not use",
+                          ctx->sketch ? " not" : "");
+            return NGX_ERROR;
+        }
 
-    ctx->sh = ngx_slab_alloc(ctx->shpool, sizeof(ngx_http_limit_req_shctx_t));
-    if (ctx->sh == NULL) {
-        return NGX_ERROR;
+        if (ctx->nshards != octx->nshards) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_req \"%V\" uses %ui shards "
+                          "while previously it used %ui shards",
+                          &shm_zone->shm.name, ctx->nshards, octx->nshards);
+            return NGX_ERROR;
+        }
+
+        ctx->shards = octx->shards;
+        ctx->shpool = octx->shpool;
+
+        return NGX_OK;
     }
 
-    ctx->shpool->data = ctx->sh;
+    ctx->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
 
-    ngx_rbtree_init(&ctx->sh->rbtree, &ctx->sh->sentinel,
-                    ngx_http_limit_req_rbtree_insert_value);
+    if (shm_zone->shm.exists) {
+        ctx->shards = ctx->shpool->data;
 
-    ngx_queue_init(&ctx->sh->queue);
+        return NGX_OK;
+    }
 
     len = sizeof(" in limit_req zone \"\"") + shm_zone->shm.name.len;
 
@@ -676,10 +1611,149 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 
     ctx->shpool->log_nomem = 0;
 
+    len = ctx->nshards * sizeof(ngx_http_limit_req_shard_t);
+
+    ctx->shards = ngx_slab_alloc(ctx->shpool, len);
+    if (ctx->shards == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->shpool->data = ctx->shards;
+
+    /* the pages left after the two above allocations are split evenly */
+
+    pages = (ctx->shpool->end - ctx->shpool->start) / ngx_pagesize - 2;
+    size = pages / ctx->nshards * ngx_pagesize;
+
+    for (i = 0; i < ctx->nshards; i++) {
+        shard = &ctx->shards[i];
+
+        if (ctx->nshards == 1) {
+            shard->shpool = ctx->shpool;
+
+        } else {
+            p = ngx_slab_alloc(ctx->shpool, size);
+
+            if (p == NULL || size < 8 * ngx_pagesize) {
+                ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                              "limit_req zone \"%V\" is too small "
+                              "for %ui shards",
+                              &shm_zone->shm.name, ctx->nshards);
+                return NGX_ERROR;
+            }
+
+            sp = (ngx_slab_pool_t *) p;
+
+            sp->end = p + size;
+            sp->min_shift = 3;
+            sp->addr = p;
+
+            if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            ngx_slab_init(sp);
+
+            sp->log_ctx = ctx->shpool->log_ctx;
+            sp->log_nomem = 0;
+
+            shard->shpool = sp;
+        }
+
+        shard->sh = ngx_slab_alloc(shard->shpool,
+                                   sizeof(ngx_http_limit_req_shctx_t));
+        if (shard->sh == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_rbtree_init(&shard->sh->rbtree, &shard->sh->sentinel,
+                        ngx_http_limit_req_rbtree_insert_value);
+
+        ngx_queue_init(&shard->sh->queue);
+        ngx_queue_init(&shard->sh->dirty);
+
+        shard->sh->sketch = NULL;
+
+        if (!ctx->sketch) {
+            continue;
+        }
+
+        /* the sketch takes the rest of the shard pages */
+
+        sp = shard->shpool;
+        pages = (sp->end - sp->start) / ngx_pagesize;
+
+        width = (pages > 4) ? (pages - 4) * ngx_pagesize : 0;
+        width /= NGX_HTTP_LIMIT_REQ_DEPTH * sizeof(ngx_http_limit_req_cell_t);
+
+        for ( ;; ) {
+            if (width < 64) {
+                ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                              "limit_req zone \"%V\" is too small "
+                              "for a sketch", &shm_zone->shm.name);
+                return NGX_ERROR;
+            }
+
+            len = offsetof(ngx_http_limit_req_sketch_t, cells)
+                  + NGX_HTTP_LIMIT_REQ_DEPTH * width
+                    * sizeof(ngx_http_limit_req_cell_t);
+
+            sketch = ngx_slab_calloc(sp, len);
+            if (sketch) {
+                break;
+            }
+
+            width -= width / 8 + 1;
+        }
+
+        sketch->width = width;
+        shard->sh->sketch = sketch;
+    }
+
     return NGX_OK;
 }
 
 
+static void *
+ngx_http_limit_req_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_limit_req_main_conf_t  *lrmcf;
+
+    lrmcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_limit_req_main_conf_t));
+    if (lrmcf == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&lrmcf->zones, cf->pool, 1, sizeof(ngx_shm_zone_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    if (ngx_array_init(&lrmcf->peers, cf->pool, 1,
+                       sizeof(ngx_http_limit_req_peer_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    lrmcf->interval = NGX_CONF_UNSET_MSEC;
+
+    return lrmcf;
+}
+
+
+static char *
+ngx_http_limit_req_init_main_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_http_limit_req_main_conf_t *lrmcf = conf;
+
+    ngx_conf_init_msec_value(lrmcf->interval, 100);
+
+    return NGX_CONF_OK;
+}
+
+
 static void *
 ngx_http_limit_req_create_conf(ngx_conf_t *cf)
 {
@@ -729,13 +1803,16 @@ ngx_http_limit_req_merge_conf(ngx_conf_t *cf, void *parent, void *child)
 static char *
 ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
+    ngx_http_limit_req_main_conf_t *lrmcf = conf;
+
     u_char                            *p;
     size_t                             len;
     ssize_t                            size;
     ngx_str_t                         *value, name, s;
-    ngx_int_t                          rate, scale;
+    ngx_int_t                          rate, scale, shards, lease;
     ngx_uint_t                         i;
-    ngx_shm_zone_t                    *shm_zone;
+    ngx_msec_t                         lease_time;
+    ngx_shm_zone_t                    *shm_zone, **zone;
     ngx_http_limit_req_ctx_t          *ctx;
     ngx_http_compile_complex_value_t   ccv;
 
@@ -760,6 +1837,9 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     rate = 1;
     scale = 1;
     name.len = 0;
+    shards = 1;
+    lease = 0;
+    lease_time = 100;
 
     for (i = 2; i < cf->args->nelts; i++) {
 
@@ -821,6 +1901,65 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "shards=", 7) == 0) {
+
+            shards = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (shards <= 0 || shards > NGX_HTTP_LIMIT_REQ_MAX_SHARDS) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid number of shards \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+#if !(NGX_HAVE_ATOMIC_OPS)
+            if (shards > 1) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "\"%V\" requires atomic operations",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+#endif
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "sketch") == 0) {
+            ctx->sketch = 1;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "sync") == 0) {
+            ctx->sync = 1;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "lease=", 6) == 0) {
+
+            lease = ngx_atoi(value[i].data + 6, value[i].len - 6);
+            if (lease <= 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid lease \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "lease_time=", 11) == 0) {
+
+            s.len = value[i].len - 11;
+            s.data = value[i].data + 11;
+
+            lease_time = ngx_parse_time(&s, 0);
+            if (lease_time == (ngx_msec_t) NGX_ERROR || lease_time == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid lease time \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
@@ -833,7 +1972,44 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    if (ctx->sketch && lease) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"sketch\" cannot be used with \"lease\"");
+        return NGX_CONF_ERROR;
+    }
+
+    if (ctx->sketch && ctx->sync) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"sketch\" cannot be used with \"sync\"");
+        return NGX_CONF_ERROR;
+    }
+
+    if (ctx->sync && name.len > 255) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone name \"%V\" is too long for \"sync\"",
+                           &name);
+        return NGX_CONF_ERROR;
+    }
+
     ctx->rate = rate * 1000 / scale;
+    ctx->nshards = shards;
+
+    if (lease) {
+        ctx->lease = lease;
+        ctx->lease_time = lease_time;
+
+        ctx->leases = ngx_pcalloc(cf->pool,
+                                  NGX_HTTP_LIMIT_REQ_LEASES
+                                  * sizeof(ngx_http_limit_req_lease_t));
+        if (ctx->leases == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ctx->lease_event.data = ctx;
+        ctx->lease_event.handler = ngx_http_limit_req_lease_handler;
+        ctx->lease_event.log = &cf->cycle->new_log;
+        ctx->lease_event.cancelable = 1;
+    }
 
     shm_zone = ngx_shared_memory_add(cf, &name, size,
                                      &ngx_http_limit_req_module);
@@ -853,6 +2029,22 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     shm_zone->init = ngx_http_limit_req_init_zone;
     shm_zone->data = ctx;
 
+    ctx->name = shm_zone->shm.name;
+
+    if (ctx->sync) {
+        zone = ngx_array_push(&lrmcf->zones);
+        if (zone == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *zone = shm_zone;
+
+        ctx->sync_event.data = ctx;
+        ctx->sync_event.handler = ngx_http_limit_req_sync_flush;
+        ctx->sync_event.log = &cf->cycle->new_log;
+        ctx->sync_event.cancelable = 1;
+    }
+
     return NGX_CONF_OK;
 }
 
@@ -949,6 +2141,122 @@ ngx_http_limit_req(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_http_limit_req_sync_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_limit_req_main_conf_t *lrmcf = conf;
+
+#if (NGX_WIN32)
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "\"%V\" is not supported on this platform", &cmd->name);
+
+    return NGX_CONF_ERROR;
+
+#else
+
+    ngx_str_t        *value;
+    ngx_url_t         u;
+    ngx_listening_t  *ls;
+
+    value = cf->args->elts;
+
+    ngx_memzero(&u, sizeof(ngx_url_t));
+
+    u.url = value[1];
+    u.listen = 1;
+
+    if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
+        if (u.err) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "%s in \"%V\" of the \"%V\" directive",
+                               u.err, &u.url, &cmd->name);
+        }
+
+        return NGX_CONF_ERROR;
+    }
+
+    if (u.no_port) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no port in \"%V\" of the \"%V\" directive",
+                           &u.url, &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    ls = ngx_create_listening(cf, &u.sockaddr, u.socklen);
+    if (ls == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ls->type = SOCK_DGRAM;
+    ls->addr_ntop = 1;
+    ls->handler = ngx_http_limit_req_sync_handler;
+    ls->pool_size = 256;
+    ls->servers = lrmcf;
+
+    ls->logp = &cf->cycle->new_log;
+    ls->log.data = &ls->addr_text;
+    ls->log.handler = ngx_accept_log_error;
+
+    ls->wildcard = u.wildcard;
+
+#if (NGX_HAVE_INET6 && defined IPV6_V6ONLY)
+    ls->ipv6only = 1;
+#endif
+
+    return NGX_CONF_OK;
+
+#endif
+}
+
+
+static char *
+ngx_http_limit_req_sync_peer(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_limit_req_main_conf_t *lrmcf = conf;
+
+    ngx_str_t                  *value;
+    ngx_url_t                   u;
+    ngx_uint_t                  i;
+    ngx_http_limit_req_peer_t  *peer;
+
+    value = cf->args->elts;
+
+    ngx_memzero(&u, sizeof(ngx_url_t));
+
+    u.url = value[1];
+
+    if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
+        if (u.err) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "%s in \"%V\" of the \"%V\" directive",
+                               u.err, &u.url, &cmd->name);
+        }
+
+        return NGX_CONF_ERROR;
+    }
+
+    if (u.no_port) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no port in \"%V\" of the \"%V\" directive",
+                           &u.url, &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    for (i = 0; i < u.naddrs; i++) {
+        peer = ngx_array_push(&lrmcf->peers);
+        if (peer == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        peer->addr = u.addrs[i];
+        peer->fd = (ngx_socket_t) -1;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
 static ngx_int_t
 ngx_http_limit_req_init(ngx_conf_t *cf)
 {
@@ -964,5 +2272,88 @@ ngx_http_limit_req_init(ngx_conf_t *cf)
 
     *h = ngx_http_limit_req_handler;
 
+    return ngx_http_set_phase_active(cf, ngx_http_limit_req_handler,
+                                     ngx_http_limit_req_active);
+}
+
+
+static ngx_uint_t
+ngx_http_limit_req_active(void **loc_conf)
+{
+    ngx_http_limit_req_conf_t  *lrcf;
+
+    lrcf = loc_conf[ngx_http_limit_req_module.ctx_index];
+
+    return lrcf->limits.nelts != 0;
+}
+
+
+static ngx_int_t
+ngx_http_limit_req_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                       i;
+    ngx_shm_zone_t                 **zone;
+    ngx_http_limit_req_ctx_t        *ctx;
+    ngx_http_limit_req_peer_t       *peer;
+    ngx_http_limit_req_main_conf_t  *lrmcf;
+
+    lrmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                                ngx_http_limit_req_module);
+
+    if (lrmcf == NULL || lrmcf->zones.nelts == 0) {
+        return NGX_OK;
+    }
+
+    peer = lrmcf->peers.elts;
+
+    for (i = 0; i < lrmcf->peers.nelts; i++) {
+        peer[i].fd = ngx_socket(peer[i].addr.sockaddr->sa_family,
+                                SOCK_DGRAM, 0);
+
+        if (peer[i].fd == (ngx_socket_t) -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                          ngx_socket_n " failed");
+            return NGX_ERROR;
+        }
+
+        if (ngx_nonblocking(peer[i].fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                          ngx_nonblocking_n " failed");
+            return NGX_ERROR;
+        }
+    }
+
+    zone = lrmcf->zones.elts;
+
+    for (i = 0; i < lrmcf->zones.nelts; i++) {
+        ctx = zone[i]->data;
+        ngx_add_timer(&ctx->sync_event, lrmcf->interval);
+    }
+
     return NGX_OK;
 }
+
+
+static void
+ngx_http_limit_req_exit_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                       i;
+    ngx_http_limit_req_peer_t       *peer;
+    ngx_http_limit_req_main_conf_t  *lrmcf;
+
+    lrmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                                ngx_http_limit_req_module);
+
+    if (lrmcf == NULL) {
+        return;
+    }
+
+    peer = lrmcf->peers.elts;
+
+    for (i = 0; i < lrmcf->peers.nelts; i++) {
+        if (peer[i].fd != (ngx_socket_t) -1) {
+            (void) ngx_close_socket(peer[i].fd);
+            peer[i].fd = (ngx_socket_t) -1;
+        }
+    }
+}
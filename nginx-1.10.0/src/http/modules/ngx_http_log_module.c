@@ -52,8 +52,55 @@ typedef struct {
     ngx_array_t                 formats;    /* array of ngx_http_log_fmt_t */
     /* Ƿʹcombinedʽӡ־ı־ */
     ngx_uint_t                  combined_used; /* unsigned  combined_used:1 */
+    ngx_array_t                *rings;      /* array of ngx_http_log_ring_t * */
 } ngx_http_log_main_conf_t;
 
+
+#if (NGX_THREADS)
+
+/* the most buffers a log file may have filled or being written */
+
+#define NGX_HTTP_LOG_THREAD_BUFS    16
+
+
+typedef struct ngx_http_log_thread_buf_s  ngx_http_log_thread_buf_t;
+
+struct ngx_http_log_thread_buf_s {
+    ngx_http_log_thread_buf_t  *next;
+    u_char                     *start;
+    size_t                      len;
+    ngx_fd_t                    fd;
+    unsigned                    alloc:1;    /* larger than the buffer size */
+};
+
+
+typedef struct {
+    ngx_http_log_thread_buf_t  *bufs;
+    u_char                     *name;
+    ngx_int_t                   gzip;
+    size_t                      len;
+    size_t                      written;
+    ngx_err_t                   err;
+    ngx_uint_t                  usec;
+} ngx_http_log_thread_ctx_t;
+
+
+/* per worker statistics of threaded log writes */
+
+typedef struct {
+    ngx_uint_t                  writes;
+    ngx_uint_t                  usec;
+    ngx_uint_t                  max_usec;
+    ngx_uint_t                  blocked;
+    ngx_uint_t                  dropped;
+} ngx_http_log_thread_stats_t;
+
+
+static ngx_http_log_thread_stats_t  ngx_http_log_thread_stats;
+
+#endif
+
+
 /* ־ */
 typedef struct {
     u_char                     *start;  // ڴʼַ
@@ -63,8 +110,89 @@ typedef struct {
     ngx_event_t                *event;  // ¼
     ngx_msec_t                  flush;  // flushʱ
     ngx_int_t                   gzip;  // ѹ
+
+#if (NGX_THREADS)
+    ngx_thread_pool_t          *thread_pool;
+    ngx_thread_task_t          *task;
+    size_t                      size;
+    ngx_uint_t                  nbufs;
+    ngx_http_log_thread_buf_t  *current;
+    ngx_http_log_thread_buf_t  *queue;      /* filled, oldest first */
+    ngx_http_log_thread_buf_t **last_queued;
+    ngx_http_log_thread_buf_t  *free;
+#endif
 } ngx_http_log_buf_t;
 
+
+/*
+ * a shared memory ring of formatted log records: workers reserve space
+ * with an atomic compare-and-set on "head" and format records in place,
+ * the records are written to the file from a timer by whichever process
+ * gets the zone mutex; a record never starts in the last bytes of the
+ * ring that cannot hold its header, those are skipped
+ */
+
+#define NGX_HTTP_LOG_RING_READY     0x80000000
+#define NGX_HTTP_LOG_RING_BUF       65536
+#define NGX_HTTP_LOG_RING_TIMEOUT   1000
+
+#define NGX_HTTP_LOG_RING_MAGIC     "NGXRING1"
+#define NGX_HTTP_LOG_RING_HEADER    4096
+
+
+typedef struct {
+    volatile uint32_t           span;   /* reserved size, header included */
+    volatile uint32_t           len;    /* written last, with READY flag */
+    volatile uint32_t           time;   /* reservation time, in msec */
+    volatile uint32_t           pos;    /* low bits of the ring position,
+                                           set once span and time are */
+} ngx_http_log_ring_rec_t;
+
+
+typedef struct {
+    u_char                      magic[8];
+    ngx_atomic_t                head;
+    ngx_atomic_t                tail;
+    ngx_atomic_t                dropped;
+    ngx_atomic_t                dropped_bytes;
+    ngx_atomic_uint_t           reported;
+    size_t                      size;       /* power of two */
+    u_char                     *data;
+} ngx_http_log_ring_sh_t;
+
+
+/*
+ * a ring with the "map" parameter lives in a file mapped by the master
+ * process instead, so that an external reader can consume the records
+ * without nginx writing them anywhere: the file starts with a header page
+ * holding ngx_http_log_ring_sh_t, "size" bytes of records follow; the
+ * reader takes records from "tail" while they have the READY flag, zeroes
+ * each record's span and only then advances "tail", and gives up records
+ * left unpublished for too long, as the drain does: by the span in the
+ * header if "pos" matches, or else up to the next header with a matching
+ * "pos"
+ */
+
+typedef struct {
+    u_char                     *addr;
+    size_t                      size;
+    ngx_uint_t                  count;      /* cycles using the mapping */
+} ngx_http_log_ring_map_t;
+
+
+typedef struct {
+    ngx_http_log_ring_sh_t     *sh;
+    ngx_slab_pool_t            *shpool;
+    ngx_shm_zone_t             *shm_zone;
+    ngx_open_file_t            *file;
+    u_char                     *buf;
+    ngx_event_t                 event;
+    ngx_msec_t                  flush;
+    time_t                      error_log_time;
+    size_t                      map_size;
+    ngx_http_log_ring_map_t    *map;
+} ngx_http_log_ring_t;
+
 /*
  * ־·Ķ
  * Ϊ־·пܺбͳַҪб룬Աй
@@ -76,6 +204,14 @@ typedef struct {
 } ngx_http_log_script_t;
 
 
+typedef struct {
+    ngx_uint_t                  rate;       /* in 1/10000 */
+    ngx_http_complex_value_t   *key;
+    ngx_uint_t                  keep_status;
+    ngx_msec_t                  keep_time;
+} ngx_http_log_sample_t;
+
+
 typedef struct {
     ngx_open_file_t            *file;  // ־ʹõļ
     ngx_http_log_script_t      *script;  // ־·Ķ(·ΪNULL)
@@ -84,6 +220,8 @@ typedef struct {
     ngx_syslog_peer_t          *syslog_peer;  // syslogôӡsyslogöãΪNULL
     ngx_http_log_fmt_t         *format;  // ʹõ־ʽ
     ngx_http_complex_value_t   *filter;
+    ngx_http_log_ring_t        *ring;
+    ngx_http_log_sample_t      *sample;
 } ngx_http_log_t;
 
 
@@ -106,6 +244,8 @@ typedef struct {
 } ngx_http_log_var_t;
 
 
+static ngx_int_t ngx_http_log_sampled(ngx_http_request_t *r,
+    ngx_http_log_sample_t *sample);
 static void ngx_http_log_write(ngx_http_request_t *r, ngx_http_log_t *log,
     u_char *buf, size_t len);
 static ssize_t ngx_http_log_script_write(ngx_http_request_t *r,
@@ -122,6 +262,41 @@ static void ngx_http_log_gzip_free(void *opaque, void *address);
 static void ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log);
 static void ngx_http_log_flush_handler(ngx_event_t *ev);
 
+static void ngx_http_log_ring_write(ngx_http_request_t *r,
+    ngx_http_log_t *log, size_t len);
+static size_t ngx_http_log_ring_reclaim(ngx_http_log_ring_t *ring,
+    ngx_http_log_ring_rec_t *rec, ngx_atomic_uint_t tail,
+    ngx_atomic_uint_t head, ngx_log_t *log);
+static ngx_int_t ngx_http_log_ring_drain(ngx_http_log_ring_t *ring,
+    ngx_uint_t wait, ngx_log_t *log);
+static void ngx_http_log_ring_handler(ngx_event_t *ev);
+#if !(NGX_WIN32)
+static ngx_int_t ngx_http_log_ring_init_map(ngx_http_log_ring_t *ring,
+    ngx_http_log_ring_t *oring, ngx_log_t *log);
+static void ngx_http_log_ring_cleanup(void *data);
+#endif
+static ngx_int_t ngx_http_log_ring_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static void ngx_http_log_exit_process(ngx_cycle_t *cycle);
+
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_log_thread_flush(ngx_open_file_t *file,
+    size_t len, ngx_log_t *log);
+static ngx_http_log_thread_buf_t *ngx_http_log_thread_alloc(
+    ngx_http_log_buf_t *buffer, size_t len, ngx_log_t *log);
+static void ngx_http_log_thread_free(ngx_http_log_buf_t *buffer,
+    ngx_http_log_thread_buf_t *tb);
+static void ngx_http_log_thread_post(ngx_open_file_t *file, ngx_log_t *log);
+static void ngx_http_log_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_log_thread_write(ngx_http_log_thread_ctx_t *ctx,
+    ngx_log_t *log);
+static void ngx_http_log_thread_event_handler(ngx_event_t *ev);
+static void ngx_http_log_thread_exit(ngx_open_file_t *file, ngx_log_t *log);
+static ngx_int_t ngx_http_log_thread_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_log_add_variables(ngx_conf_t *cf);
+#endif
+
 static u_char *ngx_http_log_pipe(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
 static u_char *ngx_http_log_time(ngx_http_request_t *r, u_char *buf,
@@ -148,6 +323,14 @@ static size_t ngx_http_log_variable_getlen(ngx_http_request_t *r,
 static u_char *ngx_http_log_variable(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
 static uintptr_t ngx_http_log_escape(u_char *dst, u_char *src, size_t size);
+static size_t ngx_http_log_json_variable_getlen(ngx_http_request_t *r,
+    uintptr_t data);
+static u_char *ngx_http_log_json_variable(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op);
+static uintptr_t ngx_http_log_json_escape(u_char *dst, u_char *src,
+    size_t size);
+static u_char *ngx_http_log_uint(u_char *buf, uint64_t n);
+static u_char *ngx_http_log_msec3(u_char *buf, time_t sec, ngx_uint_t msec);
 
 
 static void *ngx_http_log_create_main_conf(ngx_conf_t *cf);
@@ -159,7 +342,8 @@ static char *ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd,
 static char *ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_log_compile_format(ngx_conf_t *cf,
-    ngx_array_t *flushes, ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s);
+    ngx_array_t *flushes, ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s,
+    ngx_uint_t json);
 static char *ngx_http_log_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_http_log_init(ngx_conf_t *cf);
@@ -194,7 +378,11 @@ static ngx_command_t  ngx_http_log_commands[] = {
 
 
 static ngx_http_module_t  ngx_http_log_module_ctx = {
+#if (NGX_THREADS)
+    ngx_http_log_add_variables,            /* preconfiguration */
+#else
     NULL,                                  /* preconfiguration */
+#endif
     ngx_http_log_init,                     /* postconfiguration */
 
     ngx_http_log_create_main_conf,         /* create main configuration */
@@ -218,7 +406,7 @@ ngx_module_t  ngx_http_log_module = {
     NULL,                                  /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
-    NULL,                                  /* exit process */
+    ngx_http_log_exit_process,             /* exit process */
     NULL,                                  /* exit master */
     NGX_MODULE_V1_PADDING
 };
@@ -259,6 +447,7 @@ ngx_http_log_handler(ngx_http_request_t *r)
     u_char                   *line, *p;
     size_t                    len, size;
     ssize_t                   n;
+    ngx_int_t                 rc;
     ngx_str_t                 val;
     ngx_uint_t                i, l;
     ngx_http_log_t           *log;
@@ -280,6 +469,18 @@ ngx_http_log_handler(ngx_http_request_t *r)
     log = lcf->logs->elts;
     for (l = 0; l < lcf->logs->nelts; l++) {
 
+        if (log[l].sample) {
+            rc = ngx_http_log_sampled(r, log[l].sample);
+
+            if (rc == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            if (rc == NGX_DECLINED) {
+                continue;
+            }
+        }
+
         if (log[l].filter) {
             if (ngx_http_complex_value(r, log[l].filter, &val) != NGX_OK) {
                 return NGX_ERROR;
@@ -330,6 +531,11 @@ ngx_http_log_handler(ngx_http_request_t *r)
 
         len += NGX_LINEFEED_SIZE;
 
+        if (log[l].ring) {
+            ngx_http_log_ring_write(r, &log[l], len);
+            continue;
+        }
+
         /* ȡ־ */
         buffer = log[l].file ? log[l].file->data : NULL;
 
@@ -341,6 +547,18 @@ ngx_http_log_handler(ngx_http_request_t *r)
              * ־ед뵽ļУڳռ䣬Ǵ˴Ҫӡ
              * ûд뵽Уʱںalloc_lilneд뵽ļС
              */
+#if (NGX_THREADS)
+            if (buffer->thread_pool
+                && len > (size_t) (buffer->last - buffer->pos)
+                && ngx_http_log_thread_flush(log[l].file, len,
+                                             r->connection->log)
+                   != NGX_OK)
+            {
+                ngx_http_log_thread_stats.dropped += len;
+                continue;
+            }
+#endif
+
             if (len > (size_t) (buffer->last - buffer->pos)) {
 
                 /* ед뵽ļ */
@@ -431,6 +649,56 @@ ngx_http_log_handler(ngx_http_request_t *r)
     return NGX_OK;
 }
 
+
+/*
+ * decides whether a sampled log gets the request before any of
+ * the format operations run: errors and slow requests are always kept,
+ * others are kept either at random or by a hash of the key, so that
+ * related requests are logged or skipped together
+ */
+
+static ngx_int_t
+ngx_http_log_sampled(ngx_http_request_t *r, ngx_http_log_sample_t *sample)
+{
+    uint32_t         hash;
+    ngx_str_t        val;
+    ngx_uint_t       status;
+    ngx_time_t      *tp;
+    ngx_msec_int_t   ms;
+
+    if (sample->keep_status) {
+        status = r->err_status ? r->err_status : r->headers_out.status;
+
+        if (status >= sample->keep_status) {
+            return NGX_OK;
+        }
+    }
+
+    if (sample->keep_time) {
+        tp = ngx_timeofday();
+
+        ms = (ngx_msec_int_t)
+                 ((tp->sec - r->start_sec) * 1000 + (tp->msec - r->start_msec));
+
+        if (ms >= (ngx_msec_int_t) sample->keep_time) {
+            return NGX_OK;
+        }
+    }
+
+    if (sample->key == NULL) {
+        hash = (uint32_t) ngx_random();
+
+    } else {
+        if (ngx_http_complex_value(r, sample->key, &val) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        hash = ngx_murmur_hash2(val.data, val.len);
+    }
+
+    return (hash % 10000 < sample->rate) ? NGX_OK : NGX_DECLINED;
+}
+
 /* ־д뵽ļ */
 static void
 ngx_http_log_write(ngx_http_request_t *r, ngx_http_log_t *log, u_char *buf,
@@ -771,6 +1039,21 @@ ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log)
         return;
     }
 
+#if (NGX_THREADS)
+    if (buffer->thread_pool) {
+
+        /* if all buffers are busy, the records wait for the next flush */
+
+        if (ngx_http_log_thread_flush(file, 0, log) == NGX_OK
+            && buffer->event && buffer->event->timer_set)
+        {
+            ngx_del_timer(buffer->event);
+        }
+
+        return;
+    }
+#endif
+
 #if (NGX_ZLIB)
     if (buffer->gzip) {
         n = ngx_http_log_gzip(file->fd, buffer->start, len, buffer->gzip, log);
@@ -810,6 +1093,20 @@ ngx_http_log_flush_handler(ngx_event_t *ev)
                    "http log buffer flush handler");
 
     if (ev->timedout) {
+
+#if (NGX_THREADS)
+        file = ev->data;
+        buffer = file->data;
+
+        if (buffer->thread_pool) {
+            if (ngx_http_log_thread_flush(file, 0, ev->log) != NGX_OK) {
+                ngx_add_timer(ev, buffer->flush);
+            }
+
+            return;
+        }
+#endif
+
         ngx_http_log_flush(ev->data, ev->log);
         return;
     }
@@ -823,256 +1120,1427 @@ ngx_http_log_flush_handler(ngx_event_t *ev)
 }
 
 
-static u_char *
-ngx_http_log_copy_short(ngx_http_request_t *r, u_char *buf,
-    ngx_http_log_op_t *op)
+static void
+ngx_http_log_ring_write(ngx_http_request_t *r, ngx_http_log_t *log,
+    size_t len)
 {
-    size_t     len;
-    uintptr_t  data;
+    u_char                   *p, *start;
+    size_t                    need, pad, off;
+    ngx_uint_t                i;
+    ngx_atomic_uint_t         head, tail;
+    ngx_http_log_op_t        *op;
+    ngx_http_log_ring_t      *ring;
+    ngx_http_log_ring_sh_t   *sh;
+    ngx_http_log_ring_rec_t  *rec;
 
-    len = op->len;
-    data = op->data;
+    ring = log->ring;
+    sh = ring->sh;
 
-    while (len--) {
-        *buf++ = (u_char) (data & 0xff);
-        data >>= 8;
+    need = ngx_align(sizeof(ngx_http_log_ring_rec_t) + len, 8);
+
+    if (need > sh->size) {
+        goto dropped;
     }
 
-    return buf;
-}
+    for ( ;; ) {
+        head = sh->head;
+        tail = sh->tail;
 
+        /* a record never wraps, the end of the ring is padded instead */
 
-static u_char *
-ngx_http_log_copy_long(ngx_http_request_t *r, u_char *buf,
-    ngx_http_log_op_t *op)
-{
-    return ngx_cpymem(buf, (u_char *) op->data, op->len);
-}
+        off = head & (sh->size - 1);
+        pad = (off + need > sh->size) ? sh->size - off : 0;
 
+        if (head + pad + need - tail > sh->size) {
+            goto dropped;
+        }
 
-static u_char *
-ngx_http_log_pipe(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
-{
-    if (r->pipeline) {
-        *buf = 'p';
-    } else {
-        *buf = '.';
+        if (ngx_atomic_cmp_set(&sh->head, head, head + pad + need)) {
+            break;
+        }
     }
 
-    return buf + 1;
-}
+    if (pad) {
+        if (pad >= sizeof(ngx_http_log_ring_rec_t)) {
+            rec = (ngx_http_log_ring_rec_t *) (sh->data + off);
+            rec->span = pad;
+            ngx_memory_barrier();
+            rec->pos = (uint32_t) head;
+            rec->len = NGX_HTTP_LOG_RING_READY;
+        }
 
+        head += pad;
+        off = 0;
+    }
 
-static u_char *
-ngx_http_log_time(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
-{
-    return ngx_cpymem(buf, ngx_cached_http_log_time.data,
-                      ngx_cached_http_log_time.len);
-}
+    /*
+     * the stamp lets the drain give up the record if this worker dies,
+     * "pos" tells the drain that the span is valid
+     */
 
-static u_char *
-ngx_http_log_iso8601(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
-{
-    return ngx_cpymem(buf, ngx_cached_http_log_iso8601.data,
-                      ngx_cached_http_log_iso8601.len);
-}
+    rec = (ngx_http_log_ring_rec_t *) (sh->data + off);
+    rec->time = (uint32_t) ngx_current_msec | 1;
+    rec->span = need;
+    ngx_memory_barrier();
+    rec->pos = (uint32_t) head;
 
-static u_char *
-ngx_http_log_msec(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
-{
-    ngx_time_t  *tp;
+    start = (u_char *) rec + sizeof(ngx_http_log_ring_rec_t);
+    p = start;
 
-    tp = ngx_timeofday();
+    op = log->format->ops->elts;
+    for (i = 0; i < log->format->ops->nelts; i++) {
+        p = op[i].run(r, p, &op[i]);
+    }
 
-    return ngx_sprintf(buf, "%T.%03M", tp->sec, tp->msec);
-}
+    ngx_linefeed(p);
 
+    ngx_memory_barrier();
+    rec->len = (uint32_t) (p - start) | NGX_HTTP_LOG_RING_READY;
 
-static u_char *
-ngx_http_log_request_time(ngx_http_request_t *r, u_char *buf,
-    ngx_http_log_op_t *op)
-{
-    ngx_time_t      *tp;
-    ngx_msec_int_t   ms;
+    if (!ring->event.timer_set && ring->map == NULL) {
+        ngx_add_timer(&ring->event, ring->flush);
+    }
 
-    tp = ngx_timeofday();
+    return;
 
-    ms = (ngx_msec_int_t)
-             ((tp->sec - r->start_sec) * 1000 + (tp->msec - r->start_msec));
-    ms = ngx_max(ms, 0);
+dropped:
 
-    return ngx_sprintf(buf, "%T.%03M", (time_t) ms / 1000, ms % 1000);
+    (void) ngx_atomic_fetch_add(&sh->dropped, 1);
+    (void) ngx_atomic_fetch_add(&sh->dropped_bytes, (ngx_atomic_int_t) len);
+
+    if (!ring->event.timer_set && ring->map == NULL) {
+        ngx_add_timer(&ring->event, ring->flush);
+    }
 }
 
 
-static u_char *
-ngx_http_log_status(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
+/*
+ * a record not published within NGX_HTTP_LOG_RING_TIMEOUT after its
+ * reservation is given up, as its worker has most likely died; should the
+ * worker have died before stamping the reservation, the drain stamps it.
+ * The span is taken from the header once "pos" is set; if the worker died
+ * before that, the record ends where the next header with a matching
+ * "pos" starts, so only the dead record is given up.  Returns the size
+ * given up, or 0 if the record is to be waited for
+ */
+
+static size_t
+ngx_http_log_ring_reclaim(ngx_http_log_ring_t *ring,
+    ngx_http_log_ring_rec_t *rec, ngx_atomic_uint_t tail,
+    ngx_atomic_uint_t head, ngx_log_t *log)
 {
-    ngx_uint_t  status;
+    size_t                    span, off, n;
+    uint32_t                  now, time;
+    ngx_atomic_uint_t         next;
+    ngx_http_log_ring_sh_t   *sh;
+    ngx_http_log_ring_rec_t  *r;
 
-    if (r->err_status) {
-        status = r->err_status;
+    sh = ring->sh;
+    now = (uint32_t) ngx_current_msec | 1;
 
-    } else if (r->headers_out.status) {
-        status = r->headers_out.status;
+    time = rec->time;
 
-    } else if (r->http_version == NGX_HTTP_VERSION_9) {
-        status = 9;
+    if (time == 0) {
+        rec->time = now;
+        return 0;
+    }
 
-    } else {
-        status = 0;
+    if ((uint32_t) (now - time) < NGX_HTTP_LOG_RING_TIMEOUT) {
+        return 0;
     }
 
-    return ngx_sprintf(buf, "%03ui", status);
-}
+    if (rec->pos == (uint32_t) tail) {
+        ngx_memory_barrier();
+        span = rec->span;
 
+    } else {
 
-static u_char *
-ngx_http_log_bytes_sent(ngx_http_request_t *r, u_char *buf,
-    ngx_http_log_op_t *op)
-{
-    return ngx_sprintf(buf, "%O", r->connection->sent);
-}
+        for (next = tail + 8; next != head; next += 8) {
+            off = next & (sh->size - 1);
 
+            if (sh->size - off < sizeof(ngx_http_log_ring_rec_t)) {
+                continue;
+            }
 
-/*
- * although there is a real $body_bytes_sent variable,
- * this log operation code function is more optimized for logging
- */
+            r = (ngx_http_log_ring_rec_t *) (sh->data + off);
 
-static u_char *
-ngx_http_log_body_bytes_sent(ngx_http_request_t *r, u_char *buf,
-    ngx_http_log_op_t *op)
-{
-    off_t  length;
+            if (r->pos != (uint32_t) next) {
+                continue;
+            }
 
-    length = r->connection->sent - r->header_size;
+            ngx_memory_barrier();
 
-    if (length > 0) {
-        return ngx_sprintf(buf, "%O", length);
+            /* the text of a record may look like a header, check the span */
+
+            if (r->span >= sizeof(ngx_http_log_ring_rec_t)
+                && r->span % 8 == 0
+                && r->span <= head - next)
+            {
+                break;
+            }
+        }
+
+        span = next - tail;
     }
 
-    *buf = '0';
+    ngx_log_error(NGX_LOG_ALERT, log, 0,
+                  "access log ring \"%V\" record was not completed "
+                  "in time, %uz bytes given up",
+                  &ring->shm_zone->shm.name, span);
 
-    return buf + 1;
-}
+    (void) ngx_atomic_fetch_add(&sh->dropped, 1);
+    (void) ngx_atomic_fetch_add(&sh->dropped_bytes, (ngx_atomic_int_t) span);
 
+    /* the space given up wraps if it includes the end of the ring */
 
-static u_char *
-ngx_http_log_request_length(ngx_http_request_t *r, u_char *buf,
-    ngx_http_log_op_t *op)
-{
-    return ngx_sprintf(buf, "%O", r->request_length);
+    off = tail & (sh->size - 1);
+    n = ngx_min(span, sh->size - off);
+
+    ngx_memzero(sh->data + off, n);
+    ngx_memzero(sh->data, span - n);
+
+    return span;
 }
 
-/* ־ */
+
 static ngx_int_t
-ngx_http_log_variable_compile(ngx_conf_t *cf, ngx_http_log_op_t *op,
-    ngx_str_t *value)
+ngx_http_log_ring_drain(ngx_http_log_ring_t *ring, ngx_uint_t wait,
+    ngx_log_t *log)
 {
-    ngx_int_t  index;
+    u_char                   *p, *last;
+    size_t                    len, off;
+    ssize_t                   n;
+    ngx_err_t                 err;
+    ngx_uint_t                failed;
+    ngx_atomic_uint_t         tail, head, dropped, bytes;
+    ngx_http_log_ring_sh_t   *sh;
+    ngx_http_log_ring_rec_t  *rec;
 
-    /*  */
-    index = ngx_http_get_variable_index(cf, value);
-    if (index == NGX_ERROR) {
-        return NGX_ERROR;
+    sh = ring->sh;
+
+    if (wait) {
+        ngx_shmtx_lock(&ring->shpool->mutex);
+
+    } else if (!ngx_shmtx_trylock(&ring->shpool->mutex)) {
+        return NGX_AGAIN;
     }
 
-    /*
-     * ΪԶ־ļʱ䳤ǲȷģｫ䳤Ϊ0
-     * Ȼgetlenصȡйеıֵ
-     */
-    op->len = 0;
-    op->getlen = ngx_http_log_variable_getlen;  // ûȡֵȵĻص
-    op->run = ngx_http_log_variable;  // ûȡֵĻص
-    op->data = index;  // 洢Ǳ
+    tail = sh->tail;
+    head = sh->head;
 
-    return NGX_OK;
+    p = ring->buf;
+    last = ring->buf + NGX_HTTP_LOG_RING_BUF;
+    failed = 0;
+    err = 0;
+
+    while (tail != head) {
+        off = tail & (sh->size - 1);
+
+        if (sh->size - off < sizeof(ngx_http_log_ring_rec_t)) {
+            ngx_memzero(sh->data + off, sh->size - off);
+            tail += sh->size - off;
+            continue;
+        }
+
+        rec = (ngx_http_log_ring_rec_t *) (sh->data + off);
+
+        len = rec->len;
+
+        if (!(len & NGX_HTTP_LOG_RING_READY)) {
+
+            /* the record is still being formatted, or its worker died */
+
+            len = ngx_http_log_ring_reclaim(ring, rec, tail, head, log);
+
+            if (len == 0) {
+                break;
+            }
+
+            tail += len;
+
+            continue;
+        }
+
+        ngx_memory_barrier();
+
+        len &= ~NGX_HTTP_LOG_RING_READY;
+
+        if (len > (size_t) (last - p)) {
+            n = ngx_write_fd(ring->file->fd, ring->buf, p - ring->buf);
+
+            if (n != p - ring->buf) {
+                err = (n == -1) ? ngx_errno : 0;
+                failed++;
+            }
+
+            p = ring->buf;
+        }
+
+        if (len > NGX_HTTP_LOG_RING_BUF) {
+            n = ngx_write_fd(ring->file->fd,
+                             (u_char *) rec + sizeof(ngx_http_log_ring_rec_t),
+                             len);
+
+            if (n != (ssize_t) len) {
+                err = (n == -1) ? ngx_errno : 0;
+                failed++;
+            }
+
+        } else {
+            p = ngx_cpymem(p, (u_char *) rec + sizeof(ngx_http_log_ring_rec_t),
+                           len);
+        }
+
+        tail += rec->span;
+
+        /* producers rely on reserved space being zeroed */
+
+        ngx_memzero(rec, rec->span);
+    }
+
+    if (p != ring->buf) {
+        n = ngx_write_fd(ring->file->fd, ring->buf, p - ring->buf);
+
+        if (n != p - ring->buf) {
+            err = (n == -1) ? ngx_errno : 0;
+            failed++;
+        }
+    }
+
+    ngx_memory_barrier();
+    sh->tail = tail;
+
+    dropped = sh->dropped;
+    bytes = sh->dropped_bytes;
+
+    if (dropped != sh->reported) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "access log ring \"%V\" overflowed, %uA records "
+                      "(%uA bytes in total) dropped so far",
+                      &ring->shm_zone->shm.name, dropped, bytes);
+
+        sh->reported = dropped;
+    }
+
+    ngx_shmtx_unlock(&ring->shpool->mutex);
+
+    if (failed && ngx_time() != ring->error_log_time) {
+        ring->error_log_time = ngx_time();
+
+        ngx_log_error(NGX_LOG_ALERT, log, err,
+                      ngx_write_fd_n " to \"%s\" failed",
+                      ring->file->name.data);
+    }
+
+    return (tail == head) ? NGX_OK : NGX_AGAIN;
+}
+
+
+static void
+ngx_http_log_ring_handler(ngx_event_t *ev)
+{
+    ngx_http_log_ring_t  *ring;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0, "http log ring drain");
+
+    ring = ev->data;
+
+    if (ngx_http_log_ring_drain(ring, ngx_exiting, ev->log) == NGX_OK
+        || ngx_exiting)
+    {
+        return;
+    }
+
+    /* the ring is not empty yet or is being drained by another process */
+
+    ngx_add_timer(ev, ring->flush);
+}
+
+
+static ngx_int_t
+ngx_http_log_ring_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_log_ring_t  *oring = data;
+
+    size_t                   size;
+    ngx_http_log_ring_t     *ring;
+    ngx_http_log_ring_sh_t  *sh;
+
+    ring = shm_zone->data;
+
+#if !(NGX_WIN32)
+    if (ring->map_size) {
+        return ngx_http_log_ring_init_map(ring, oring, shm_zone->shm.log);
+    }
+#endif
+
+    if (oring && oring->map == NULL) {
+        ring->sh = oring->sh;
+        ring->shpool = oring->shpool;
+        return NGX_OK;
+    }
+
+    ring->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        ring->sh = ring->shpool->data;
+        return NGX_OK;
+    }
+
+    sh = ngx_slab_alloc(ring->shpool, sizeof(ngx_http_log_ring_sh_t));
+    if (sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(sh, sizeof(ngx_http_log_ring_sh_t));
+    ngx_memcpy(sh->magic, NGX_HTTP_LOG_RING_MAGIC, 8);
+
+    ring->sh = sh;
+    ring->shpool->data = sh;
+
+    /* the ring takes the largest power of two that fits into the zone */
+
+    for (size = ngx_pagesize; size * 2 <= shm_zone->shm.size; size *= 2) {
+        /* void */
+    }
+
+    ring->shpool->log_nomem = 0;
+
+    for ( /* void */ ; size >= ngx_pagesize; size /= 2) {
+        sh->data = ngx_slab_alloc(ring->shpool, size);
+        if (sh->data) {
+            break;
+        }
+    }
+
+    ring->shpool->log_nomem = 1;
+
+    if (sh->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(sh->data, size);
+    sh->size = size;
+
+    ngx_sprintf(ring->shpool->log_ctx, " in access log ring \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    return NGX_OK;
+}
+
+
+#if !(NGX_WIN32)
+
+static ngx_int_t
+ngx_http_log_ring_init_map(ngx_http_log_ring_t *ring,
+    ngx_http_log_ring_t *oring, ngx_log_t *log)
+{
+    u_char                   *addr, *name;
+    size_t                    size;
+    ngx_fd_t                  fd;
+    ngx_http_log_ring_sh_t   *sh;
+    ngx_http_log_ring_map_t  *map;
+
+    name = ring->file->name.data;
+
+    for (size = ngx_pagesize; size * 2 <= ring->map_size; size *= 2) {
+        /* void */
+    }
+
+    if (oring && oring->map
+        && oring->map->size == NGX_HTTP_LOG_RING_HEADER + size
+        && ngx_strcmp(oring->file->name.data, name) == 0)
+    {
+        ring->map = oring->map;
+        ring->map->count++;
+        ring->sh = oring->sh;
+        return NGX_OK;
+    }
+
+    map = ngx_alloc(sizeof(ngx_http_log_ring_map_t), log);
+    if (map == NULL) {
+        return NGX_ERROR;
+    }
+
+    /*
+     * the file is created anew rather than truncated, as the workers
+     * of the previous configuration may still use the old mapping
+     */
+
+    if (ngx_delete_file(name) == NGX_FILE_ERROR && ngx_errno != NGX_ENOENT) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", name);
+        goto failed;
+    }
+
+    fd = ngx_open_file(name, NGX_FILE_RDWR, NGX_FILE_CREATE_OR_OPEN,
+                       NGX_FILE_DEFAULT_ACCESS);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", name);
+        goto failed;
+    }
+
+    if (ftruncate(fd, NGX_HTTP_LOG_RING_HEADER + size) == -1) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                      "ftruncate() \"%s\" failed", name);
+        (void) ngx_close_file(fd);
+        goto failed;
+    }
+
+    addr = (u_char *) mmap(NULL, NGX_HTTP_LOG_RING_HEADER + size,
+                           PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (addr == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                      "mmap(\"%s\") failed", name);
+        (void) ngx_close_file(fd);
+        goto failed;
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name);
+    }
+
+    /* the new file is zero filled */
+
+    sh = (ngx_http_log_ring_sh_t *) addr;
+
+    ngx_memcpy(sh->magic, NGX_HTTP_LOG_RING_MAGIC, 8);
+    sh->size = size;
+    sh->data = addr + NGX_HTTP_LOG_RING_HEADER;
+
+    map->addr = addr;
+    map->size = NGX_HTTP_LOG_RING_HEADER + size;
+    map->count = 1;
+
+    ring->map = map;
+    ring->sh = sh;
+
+    return NGX_OK;
+
+failed:
+
+    ngx_free(map);
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_http_log_ring_cleanup(void *data)
+{
+    ngx_http_log_ring_t  *ring = data;
+
+    ngx_http_log_ring_map_t  *map;
+
+    map = ring->map;
+
+    if (map == NULL || --map->count) {
+        return;
+    }
+
+    if (munmap((void *) map->addr, map->size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "munmap(%p, %uz) failed", map->addr, map->size);
+    }
+
+    ngx_free(map);
+}
+
+#endif
+
+
+static void
+ngx_http_log_exit_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                 i;
+    ngx_http_log_ring_t      **ring;
+    ngx_http_log_main_conf_t  *lmcf;
+#if (NGX_THREADS)
+    ngx_open_file_t           *file;
+    ngx_list_part_t           *part;
+    ngx_http_log_buf_t        *buffer;
+
+    part = &cycle->open_files.part;
+    file = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            file = part->elts;
+            i = 0;
+        }
+
+        if (file[i].flush != ngx_http_log_flush) {
+            continue;
+        }
+
+        buffer = file[i].data;
+
+        if (buffer->thread_pool) {
+            ngx_http_log_thread_exit(&file[i], cycle->log);
+        }
+    }
+#endif
+
+    lmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_log_module);
+
+    if (lmcf == NULL || lmcf->rings == NULL) {
+        return;
+    }
+
+    ring = lmcf->rings->elts;
+
+    for (i = 0; i < lmcf->rings->nelts; i++) {
+        if (ring[i]->sh && ring[i]->map == NULL) {
+            (void) ngx_http_log_ring_drain(ring[i], 1, cycle->log);
+        }
+    }
+}
+
+
+#if (NGX_THREADS)
+
+/*
+ * queues the filled buffer for the thread and switches to a buffer with
+ * room for "len" bytes; the buffers are written in the order they are
+ * queued, one task per file at a time.  NGX_BUSY means all buffers are
+ * still waiting to be written, the caller drops the record then
+ */
+
+static ngx_int_t
+ngx_http_log_thread_flush(ngx_open_file_t *file, size_t len, ngx_log_t *log)
+{
+    ngx_fd_t                    fd;
+    ngx_http_log_buf_t         *buffer;
+    ngx_http_log_thread_buf_t  *tb, *cur;
+
+    buffer = file->data;
+
+    if (buffer->pos == buffer->start
+        && len <= (size_t) (buffer->last - buffer->pos))
+    {
+        return NGX_OK;
+    }
+
+    tb = ngx_http_log_thread_alloc(buffer, len, log);
+    if (tb == NULL) {
+        return NGX_BUSY;
+    }
+
+    cur = buffer->current;
+
+    if (buffer->pos == buffer->start) {
+        ngx_http_log_thread_free(buffer, cur);
+        goto done;
+    }
+
+    /*
+     * the thread writes to its own descriptor, so the file may be
+     * reopened or closed while the buffer is queued
+     */
+
+    fd = dup(file->fd);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "dup() of \"%s\" failed", file->name.data);
+
+        ngx_http_log_thread_stats.dropped += buffer->pos - buffer->start;
+        ngx_http_log_thread_free(buffer, cur);
+        goto done;
+    }
+
+    cur->next = NULL;
+    cur->fd = fd;
+    cur->len = buffer->pos - buffer->start;
+
+    *buffer->last_queued = cur;
+    buffer->last_queued = &cur->next;
+
+    if (buffer->task->event.active) {
+        ngx_http_log_thread_stats.blocked++;
+    }
+
+done:
+
+    buffer->current = tb;
+    buffer->start = tb->start;
+    buffer->pos = tb->start;
+    buffer->last = tb->start + ngx_max(len, buffer->size);
+
+    ngx_http_log_thread_post(file, log);
+
+    return NGX_OK;
+}
+
+
+static ngx_http_log_thread_buf_t *
+ngx_http_log_thread_alloc(ngx_http_log_buf_t *buffer, size_t len,
+    ngx_log_t *log)
+{
+    ngx_http_log_thread_buf_t  *tb;
+
+    if (len <= buffer->size && buffer->free) {
+        tb = buffer->free;
+        buffer->free = tb->next;
+
+        return tb;
+    }
+
+    if (buffer->nbufs == NGX_HTTP_LOG_THREAD_BUFS) {
+        return NULL;
+    }
+
+    if (len <= buffer->size) {
+        tb = ngx_palloc(ngx_cycle->pool,
+                        sizeof(ngx_http_log_thread_buf_t) + buffer->size);
+        if (tb == NULL) {
+            return NULL;
+        }
+
+        tb->alloc = 0;
+
+    } else {
+
+        /* a record larger than the buffer gets a buffer of its own */
+
+        tb = ngx_alloc(sizeof(ngx_http_log_thread_buf_t) + len, log);
+        if (tb == NULL) {
+            return NULL;
+        }
+
+        tb->alloc = 1;
+    }
+
+    tb->start = (u_char *) (tb + 1);
+
+    buffer->nbufs++;
+
+    return tb;
+}
+
+
+static void
+ngx_http_log_thread_free(ngx_http_log_buf_t *buffer,
+    ngx_http_log_thread_buf_t *tb)
+{
+    if (tb->alloc) {
+        ngx_free(tb);
+        buffer->nbufs--;
+        return;
+    }
+
+    tb->next = buffer->free;
+    buffer->free = tb;
+}
+
+
+/* hands the queued buffers to the thread unless a write is in progress */
+
+static void
+ngx_http_log_thread_post(ngx_open_file_t *file, ngx_log_t *log)
+{
+    ngx_thread_task_t          *task;
+    ngx_http_log_buf_t         *buffer;
+    ngx_http_log_thread_ctx_t  *ctx;
+    ngx_http_log_thread_buf_t  *tb, *next;
+
+    buffer = file->data;
+    task = buffer->task;
+
+    if (buffer->queue == NULL || task->event.active) {
+        return;
+    }
+
+    ctx = task->ctx;
+
+    ctx->bufs = buffer->queue;
+    ctx->name = file->name.data;
+    ctx->gzip = buffer->gzip;
+
+    buffer->queue = NULL;
+    buffer->last_queued = &buffer->queue;
+
+    if (ngx_thread_task_post(buffer->thread_pool, task) == NGX_OK) {
+        return;
+    }
+
+    for (tb = ctx->bufs; tb; tb = next) {
+        next = tb->next;
+
+        (void) ngx_close_file(tb->fd);
+
+        ngx_http_log_thread_stats.dropped += tb->len;
+        ngx_http_log_thread_free(buffer, tb);
+    }
+
+    ctx->bufs = NULL;
+}
+
+
+static void
+ngx_http_log_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_log_thread_ctx_t *ctx = data;
+
+    struct timeval  start, end;
+
+    ngx_gettimeofday(&start);
+
+    ngx_http_log_thread_write(ctx, log);
+
+    ngx_gettimeofday(&end);
+
+    ctx->usec = (end.tv_sec - start.tv_sec) * 1000000
+                + end.tv_usec - start.tv_usec;
+}
+
+
+static void
+ngx_http_log_thread_write(ngx_http_log_thread_ctx_t *ctx, ngx_log_t *log)
+{
+    ssize_t                     n;
+    ngx_http_log_thread_buf_t  *tb;
+
+    ctx->len = 0;
+    ctx->written = 0;
+    ctx->err = 0;
+
+    for (tb = ctx->bufs; tb; tb = tb->next) {
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
+                       "http log thread write: %d, %uz", tb->fd, tb->len);
+
+#if (NGX_ZLIB)
+        if (ctx->gzip) {
+            n = ngx_http_log_gzip(tb->fd, tb->start, tb->len, ctx->gzip, log);
+        } else {
+            n = ngx_write_fd(tb->fd, tb->start, tb->len);
+        }
+#else
+        n = ngx_write_fd(tb->fd, tb->start, tb->len);
+#endif
+
+        if (n == -1) {
+            ctx->err = ngx_errno;
+
+        } else {
+            ctx->written += n;
+        }
+
+        ctx->len += tb->len;
+
+        (void) ngx_close_file(tb->fd);
+    }
+}
+
+
+static void
+ngx_http_log_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_open_file_t            *file;
+    ngx_http_log_buf_t         *buffer;
+    ngx_http_log_thread_ctx_t  *ctx;
+    ngx_http_log_thread_buf_t  *tb, *next;
+
+    file = ev->data;
+    buffer = file->data;
+    ctx = buffer->task->ctx;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "http log thread write done: %uz, %uims",
+                   ctx->written, ctx->usec / 1000);
+
+    ngx_http_log_thread_stats.writes++;
+    ngx_http_log_thread_stats.usec += ctx->usec;
+
+    if (ctx->usec > ngx_http_log_thread_stats.max_usec) {
+        ngx_http_log_thread_stats.max_usec = ctx->usec;
+    }
+
+    if (ctx->written != ctx->len) {
+        ngx_http_log_thread_stats.dropped += ctx->len - ctx->written;
+
+        if (ctx->err) {
+            ngx_log_error(NGX_LOG_ALERT, ev->log, ctx->err,
+                          ngx_write_fd_n " to \"%s\" failed", ctx->name);
+
+        } else {
+            ngx_log_error(NGX_LOG_ALERT, ev->log, 0,
+                          ngx_write_fd_n " to \"%s\" was incomplete: "
+                          "%uz of %uz", ctx->name, ctx->written, ctx->len);
+        }
+    }
+
+    for (tb = ctx->bufs; tb; tb = next) {
+        next = tb->next;
+        ngx_http_log_thread_free(buffer, tb);
+    }
+
+    ctx->bufs = NULL;
+
+    ngx_http_log_thread_post(file, ev->log);
+}
+
+
+/*
+ * on exit the thread pools are already destroyed, so the last task is
+ * complete and the buffers still queued are written in place
+ */
+
+static void
+ngx_http_log_thread_exit(ngx_open_file_t *file, ngx_log_t *log)
+{
+    ngx_fd_t                    fd;
+    ngx_http_log_buf_t         *buffer;
+    ngx_http_log_thread_ctx_t  *ctx;
+    ngx_http_log_thread_buf_t  *cur, *tb, *next;
+
+    buffer = file->data;
+    ctx = buffer->task->ctx;
+
+    for (tb = ctx->bufs; tb; tb = next) {
+        next = tb->next;
+        ngx_http_log_thread_free(buffer, tb);
+    }
+
+    ctx->bufs = NULL;
+
+    if (buffer->pos != buffer->start) {
+        fd = dup(file->fd);
+
+        if (fd == NGX_INVALID_FILE) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "dup() of \"%s\" failed", file->name.data);
+
+        } else {
+            cur = buffer->current;
+
+            cur->next = NULL;
+            cur->fd = fd;
+            cur->len = buffer->pos - buffer->start;
+
+            *buffer->last_queued = cur;
+            buffer->last_queued = &cur->next;
+
+            buffer->pos = buffer->start;
+        }
+    }
+
+    if (buffer->queue == NULL) {
+        return;
+    }
+
+    ctx->bufs = buffer->queue;
+    ctx->name = file->name.data;
+    ctx->gzip = buffer->gzip;
+
+    buffer->queue = NULL;
+    buffer->last_queued = &buffer->queue;
+
+    ngx_http_log_thread_write(ctx, log);
+
+    if (ctx->written != ctx->len) {
+        ngx_log_error(NGX_LOG_ALERT, log, ctx->err,
+                      ngx_write_fd_n " to \"%s\" failed", ctx->name);
+    }
+
+    for (tb = ctx->bufs; tb; tb = next) {
+        next = tb->next;
+        ngx_http_log_thread_free(buffer, tb);
+    }
+
+    ctx->bufs = NULL;
+}
+
+
+static ngx_http_variable_t  ngx_http_log_thread_vars[] = {
+
+    { ngx_string("access_log_writes"), NULL, ngx_http_log_thread_variable,
+      offsetof(ngx_http_log_thread_stats_t, writes),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("access_log_write_time"), NULL, ngx_http_log_thread_variable,
+      offsetof(ngx_http_log_thread_stats_t, usec),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("access_log_write_max_time"), NULL,
+      ngx_http_log_thread_variable,
+      offsetof(ngx_http_log_thread_stats_t, max_usec),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("access_log_blocked"), NULL, ngx_http_log_thread_variable,
+      offsetof(ngx_http_log_thread_stats_t, blocked),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("access_log_dropped"), NULL, ngx_http_log_thread_variable,
+      offsetof(ngx_http_log_thread_stats_t, dropped),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_null_string, NULL, NULL, 0, 0, 0 }
+};
+
+
+static ngx_int_t
+ngx_http_log_thread_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char      *p;
+    ngx_uint_t   n, usec;
+
+    p = ngx_pnalloc(r->pool, NGX_INT_T_LEN + 4);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    n = *(ngx_uint_t *) ((char *) &ngx_http_log_thread_stats + data);
+
+    switch (data) {
+
+    case offsetof(ngx_http_log_thread_stats_t, usec):
+
+        /* average time of a write */
+
+        usec = ngx_http_log_thread_stats.writes
+               ? n / ngx_http_log_thread_stats.writes : 0;
+
+        v->len = ngx_sprintf(p, "%ui.%03ui", usec / 1000000,
+                             usec / 1000 % 1000)
+                 - p;
+        break;
+
+    case offsetof(ngx_http_log_thread_stats_t, max_usec):
+        v->len = ngx_sprintf(p, "%ui.%03ui", n / 1000000, n / 1000 % 1000)
+                 - p;
+        break;
+
+    default:
+        v->len = ngx_sprintf(p, "%ui", n) - p;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_log_add_variables(ngx_conf_t *cf)
+{
+    ngx_http_variable_t  *var, *v;
+
+    for (v = ngx_http_log_thread_vars; v->name.len; v++) {
+        var = ngx_http_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static u_char *
+ngx_http_log_copy_short(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    size_t     len;
+    uintptr_t  data;
+
+    len = op->len;
+    data = op->data;
+
+    while (len--) {
+        *buf++ = (u_char) (data & 0xff);
+        data >>= 8;
+    }
+
+    return buf;
+}
+
+
+static u_char *
+ngx_http_log_copy_long(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    return ngx_cpymem(buf, (u_char *) op->data, op->len);
+}
+
+
+static u_char *
+ngx_http_log_pipe(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
+{
+    if (r->pipeline) {
+        *buf = 'p';
+    } else {
+        *buf = '.';
+    }
+
+    return buf + 1;
+}
+
+
+static u_char *
+ngx_http_log_time(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
+{
+    return ngx_cpymem(buf, ngx_cached_http_log_time.data,
+                      ngx_cached_http_log_time.len);
+}
+
+static u_char *
+ngx_http_log_iso8601(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
+{
+    return ngx_cpymem(buf, ngx_cached_http_log_iso8601.data,
+                      ngx_cached_http_log_iso8601.len);
+}
+
+static u_char *
+ngx_http_log_msec(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
+{
+    ngx_time_t  *tp;
+
+    tp = ngx_timeofday();
+
+    return ngx_http_log_msec3(buf, tp->sec, tp->msec);
+}
+
+
+static u_char *
+ngx_http_log_request_time(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    ngx_time_t      *tp;
+    ngx_msec_int_t   ms;
+
+    tp = ngx_timeofday();
+
+    ms = (ngx_msec_int_t)
+             ((tp->sec - r->start_sec) * 1000 + (tp->msec - r->start_msec));
+    ms = ngx_max(ms, 0);
+
+    return ngx_http_log_msec3(buf, (time_t) ms / 1000, ms % 1000);
+}
+
+
+static u_char *
+ngx_http_log_status(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
+{
+    ngx_uint_t  status;
+
+    if (r->err_status) {
+        status = r->err_status;
+
+    } else if (r->headers_out.status) {
+        status = r->headers_out.status;
+
+    } else if (r->http_version == NGX_HTTP_VERSION_9) {
+        status = 9;
+
+    } else {
+        status = 0;
+    }
+
+    if (status > 999) {
+        return ngx_http_log_uint(buf, status);
+    }
+
+    *buf++ = (u_char) (status / 100 + '0');
+    *buf++ = (u_char) (status / 10 % 10 + '0');
+    *buf++ = (u_char) (status % 10 + '0');
+
+    return buf;
+}
+
+
+static u_char *
+ngx_http_log_bytes_sent(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    return ngx_http_log_uint(buf, r->connection->sent);
+}
+
+
+/*
+ * although there is a real $body_bytes_sent variable,
+ * this log operation code function is more optimized for logging
+ */
+
+static u_char *
+ngx_http_log_body_bytes_sent(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    off_t  length;
+
+    length = r->connection->sent - r->header_size;
+
+    if (length > 0) {
+        return ngx_http_log_uint(buf, length);
+    }
+
+    *buf = '0';
+
+    return buf + 1;
+}
+
+
+static u_char *
+ngx_http_log_request_length(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    return ngx_http_log_uint(buf, r->request_length);
+}
+
+
+/*
+ * the fixed-size log operations are hot enough that the generic
+ * ngx_sprintf() format parsing shows up in profiles
+ */
+
+static u_char *
+ngx_http_log_uint(u_char *buf, uint64_t n)
+{
+    u_char  *p, tmp[NGX_INT64_LEN];
+
+    p = tmp + NGX_INT64_LEN;
+
+    do {
+        *--p = (u_char) (n % 10 + '0');
+    } while (n /= 10);
+
+    return ngx_cpymem(buf, p, tmp + NGX_INT64_LEN - p);
+}
+
+
+static u_char *
+ngx_http_log_msec3(u_char *buf, time_t sec, ngx_uint_t msec)
+{
+    buf = ngx_http_log_uint(buf, sec);
+
+    *buf++ = '.';
+    *buf++ = (u_char) (msec / 100 % 10 + '0');
+    *buf++ = (u_char) (msec / 10 % 10 + '0');
+    *buf++ = (u_char) (msec % 10 + '0');
+
+    return buf;
+}
+
+/* ־ */
+static ngx_int_t
+ngx_http_log_variable_compile(ngx_conf_t *cf, ngx_http_log_op_t *op,
+    ngx_str_t *value)
+{
+    ngx_int_t  index;
+
+    /*  */
+    index = ngx_http_get_variable_index(cf, value);
+    if (index == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    /*
+     * ΪԶ־ļʱ䳤ǲȷģｫ䳤Ϊ0
+     * Ȼgetlenصȡйеıֵ
+     */
+    op->len = 0;
+    op->getlen = ngx_http_log_variable_getlen;  // ûȡֵȵĻص
+    op->run = ngx_http_log_variable;  // ûȡֵĻص
+    op->data = index;  // 洢Ǳ
+
+    return NGX_OK;
+}
+
+/* ȡֵַĳ */
+static size_t
+ngx_http_log_variable_getlen(ngx_http_request_t *r, uintptr_t data)
+{
+    uintptr_t                   len;
+    ngx_http_variable_value_t  *value;
+
+    /* ȡֵ */
+    value = ngx_http_get_indexed_variable(r, data);
+
+    if (value == NULL || value->not_found) {
+        return 1;
+    }
+
+    /* 㲢رֵַĳ */
+    len = ngx_http_log_escape(NULL, value->data, value->len);
+
+    value->escape = len ? 1 : 0;
+
+    return value->len + len * 3;
+}
+
+/* ȡֵĻص */
+static u_char *
+ngx_http_log_variable(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
+{
+    ngx_http_variable_value_t  *value;
+
+    /* ȡֵ */
+    value = ngx_http_get_indexed_variable(r, op->data);
+
+    /* ֵΪգ򷵻ؿ */
+    if (value == NULL || value->not_found) {
+        *buf = '-';
+        return buf + 1;
+    }
+
+    /* ֵbuf */
+    if (value->escape == 0) {
+        return ngx_cpymem(buf, value->data, value->len);
+
+    } else {
+        return (u_char *) ngx_http_log_escape(buf, value->data, value->len);
+    }
+}
+
+
+static uintptr_t
+ngx_http_log_escape(u_char *dst, u_char *src, size_t size)
+{
+    ngx_uint_t      n;
+    static u_char   hex[] = "0123456789ABCDEF";
+
+    static uint32_t   escape[] = {
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+
+                    /* ?>=< ;:98 7654 3210  /.-, +*)( '&%$ #"!  */
+        0x00000004, /* 0000 0000 0000 0000  0000 0000 0000 0100 */
+
+                    /* _^]\ [ZYX WVUT SRQP  ONML KJIH GFED CBA@ */
+        0x10000000, /* 0001 0000 0000 0000  0000 0000 0000 0000 */
+
+                    /*  ~}| {zyx wvut srqp  onml kjih gfed cba` */
+        0x80000000, /* 1000 0000 0000 0000  0000 0000 0000 0000 */
+
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+    };
+
+
+    if (dst == NULL) {
+
+        /* find the number of the characters to be escaped */
+
+        n = 0;
+
+        while (size) {
+            if (escape[*src >> 5] & (1 << (*src & 0x1f))) {
+                n++;
+            }
+            src++;
+            size--;
+        }
+
+        return (uintptr_t) n;
+    }
+
+    while (size) {
+        if (escape[*src >> 5] & (1 << (*src & 0x1f))) {
+            *dst++ = '\\';
+            *dst++ = 'x';
+            *dst++ = hex[*src >> 4];
+            *dst++ = hex[*src & 0xf];
+            src++;
+
+        } else {
+            *dst++ = *src++;
+        }
+        size--;
+    }
+
+    return (uintptr_t) dst;
 }
 
-/* ȡֵַĳ */
+
 static size_t
-ngx_http_log_variable_getlen(ngx_http_request_t *r, uintptr_t data)
+ngx_http_log_json_variable_getlen(ngx_http_request_t *r, uintptr_t data)
 {
     uintptr_t                   len;
     ngx_http_variable_value_t  *value;
 
-    /* ȡֵ */
     value = ngx_http_get_indexed_variable(r, data);
 
     if (value == NULL || value->not_found) {
-        return 1;
+        return 0;
     }
 
-    /* 㲢رֵַĳ */
-    len = ngx_http_log_escape(NULL, value->data, value->len);
+    len = ngx_http_log_json_escape(NULL, value->data, value->len);
 
     value->escape = len ? 1 : 0;
 
-    return value->len + len * 3;
+    return value->len + len;
 }
 
-/* ȡֵĻص */
+
 static u_char *
-ngx_http_log_variable(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
+ngx_http_log_json_variable(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
 {
     ngx_http_variable_value_t  *value;
 
-    /* ȡֵ */
     value = ngx_http_get_indexed_variable(r, op->data);
 
-    /* ֵΪգ򷵻ؿ */
     if (value == NULL || value->not_found) {
-        *buf = '-';
-        return buf + 1;
+        return buf;
     }
 
-    /* ֵbuf */
     if (value->escape == 0) {
         return ngx_cpymem(buf, value->data, value->len);
 
     } else {
-        return (u_char *) ngx_http_log_escape(buf, value->data, value->len);
+        return (u_char *) ngx_http_log_json_escape(buf, value->data,
+                                                   value->len);
     }
 }
 
 
 static uintptr_t
-ngx_http_log_escape(u_char *dst, u_char *src, size_t size)
+ngx_http_log_json_escape(u_char *dst, u_char *src, size_t size)
 {
+    u_char          ch;
     ngx_uint_t      n;
-    static u_char   hex[] = "0123456789ABCDEF";
-
-    static uint32_t   escape[] = {
-        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
-
-                    /* ?>=< ;:98 7654 3210  /.-, +*)( '&%$ #"!  */
-        0x00000004, /* 0000 0000 0000 0000  0000 0000 0000 0100 */
-
-                    /* _^]\ [ZYX WVUT SRQP  ONML KJIH GFED CBA@ */
-        0x10000000, /* 0001 0000 0000 0000  0000 0000 0000 0000 */
+    static u_char   hex[] = "0123456789abcdef";
 
-                    /*  ~}| {zyx wvut srqp  onml kjih gfed cba` */
-        0x80000000, /* 1000 0000 0000 0000  0000 0000 0000 0000 */
-
-        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
-        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
-        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
-        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
-    };
+    /* short escapes for control characters, "u" means \u00XX */
 
+    static u_char   ctl[] = "uuuuuuuubtnufruuuuuuuuuuuuuuuuuu";
 
     if (dst == NULL) {
 
-        /* find the number of the characters to be escaped */
+        /* find the number of the extra bytes needed */
 
         n = 0;
 
         while (size) {
-            if (escape[*src >> 5] & (1 << (*src & 0x1f))) {
+            ch = *src++;
+
+            if (ch == '\\' || ch == '"') {
                 n++;
+
+            } else if (ch < 0x20) {
+                n += (ctl[ch] == 'u') ? 5 : 1;
             }
-            src++;
+
             size--;
         }
 
@@ -1080,16 +2548,27 @@ ngx_http_log_escape(u_char *dst, u_char *src, size_t size)
     }
 
     while (size) {
-        if (escape[*src >> 5] & (1 << (*src & 0x1f))) {
+        ch = *src++;
+
+        if (ch == '\\' || ch == '"') {
             *dst++ = '\\';
-            *dst++ = 'x';
-            *dst++ = hex[*src >> 4];
-            *dst++ = hex[*src & 0xf];
-            src++;
+            *dst++ = ch;
+
+        } else if (ch < 0x20) {
+            *dst++ = '\\';
+            *dst++ = ctl[ch];
+
+            if (ctl[ch] == 'u') {
+                *dst++ = '0';
+                *dst++ = '0';
+                *dst++ = hex[ch >> 4];
+                *dst++ = hex[ch & 0xf];
+            }
 
         } else {
-            *dst++ = *src++;
+            *dst++ = ch;
         }
+
         size--;
     }
 
@@ -1222,18 +2701,26 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     /* ȡngx_http_log_moduleģlocṹ */
     ngx_http_log_loc_conf_t *llcf = conf;
 
+    size_t                             ring_size;
     ssize_t                            size;
     ngx_int_t                          gzip;
-    ngx_uint_t                         i, n;
+    ngx_uint_t                         i, n, map;
     ngx_msec_t                         flush;
     ngx_str_t                         *value, name, s;
     ngx_http_log_t                    *log;
     ngx_syslog_peer_t                 *peer;
     ngx_http_log_buf_t                *buffer;
     ngx_http_log_fmt_t                *fmt;
+    ngx_shm_zone_t                    *shm_zone;
+    ngx_pool_cleanup_t                *cln;
+    ngx_http_log_ring_t               *ring, **rp;
+    ngx_http_log_sample_t             *sample;
     ngx_http_log_main_conf_t          *lmcf;
     ngx_http_script_compile_t          sc;
     ngx_http_compile_complex_value_t   ccv;
+#if (NGX_THREADS)
+    ngx_thread_pool_t                 *tp;
+#endif
 
     /*
      * access_log /spool/logs/nginx-access.log compression buffer=32k;
@@ -1378,6 +2865,13 @@ process_formats:
     size = 0;
     flush = 0;
     gzip = 0;
+    shm_zone = NULL;
+    ring_size = 0;
+    map = 0;
+    sample = NULL;
+#if (NGX_THREADS)
+    tp = NULL;
+#endif
 
     /* ĲbuffergzipflushϢ */
     for (i = 3; i < cf->args->nelts; i++) {
@@ -1479,11 +2973,289 @@ process_formats:
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "sample", 6) == 0
+            || ngx_strncmp(value[i].data, "keep_", 5) == 0)
+        {
+            if (sample == NULL) {
+                sample = ngx_pcalloc(cf->pool, sizeof(ngx_http_log_sample_t));
+                if (sample == NULL) {
+                    return NGX_CONF_ERROR;
+                }
+
+                sample->rate = NGX_CONF_UNSET_UINT;
+            }
+
+            if (ngx_strncmp(value[i].data, "sample=", 7) == 0) {
+
+                if (value[i].data[value[i].len - 1] != '%') {
+                    goto invalid_sample;
+                }
+
+                n = ngx_atofp(value[i].data + 7, value[i].len - 8, 2);
+
+                if (n == (ngx_uint_t) NGX_ERROR || n > 10000) {
+                    goto invalid_sample;
+                }
+
+                sample->rate = n;
+
+                continue;
+            }
+
+            if (ngx_strncmp(value[i].data, "sample_key=", 11) == 0) {
+                s.len = value[i].len - 11;
+                s.data = value[i].data + 11;
+
+                ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+                ccv.cf = cf;
+                ccv.value = &s;
+                ccv.complex_value = ngx_palloc(cf->pool,
+                                           sizeof(ngx_http_complex_value_t));
+                if (ccv.complex_value == NULL) {
+                    return NGX_CONF_ERROR;
+                }
+
+                if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+                    return NGX_CONF_ERROR;
+                }
+
+                sample->key = ccv.complex_value;
+
+                continue;
+            }
+
+            if (ngx_strncmp(value[i].data, "keep_status=", 12) == 0) {
+                n = ngx_atoi(value[i].data + 12, value[i].len - 12);
+
+                if (n == (ngx_uint_t) NGX_ERROR || n < 100 || n > 999) {
+                    goto invalid_sample;
+                }
+
+                sample->keep_status = n;
+
+                continue;
+            }
+
+            if (ngx_strncmp(value[i].data, "keep_slow=", 10) == 0) {
+                s.len = value[i].len - 10;
+                s.data = value[i].data + 10;
+
+                sample->keep_time = ngx_parse_time(&s, 0);
+
+                if (sample->keep_time == (ngx_msec_t) NGX_ERROR
+                    || sample->keep_time == 0)
+                {
+                    goto invalid_sample;
+                }
+
+                continue;
+            }
+
+        invalid_sample:
+
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[i]);
+            return NGX_CONF_ERROR;
+        }
+
+        if (ngx_strncmp(value[i].data, "ring=", 5) == 0) {
+
+            name.data = value[i].data + 5;
+
+            s.data = (u_char *) ngx_strchr(name.data, ':');
+
+            if (s.data == NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid ring \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            name.len = s.data - name.data;
+
+            s.data++;
+            s.len = value[i].data + value[i].len - s.data;
+
+            n = ngx_parse_size(&s);
+
+            if (n == (ngx_uint_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid ring size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (n < 8 * ngx_pagesize) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "ring \"%V\" is too small", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            ring_size = n;
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "map") == 0) {
+#if (NGX_WIN32)
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"map\" is not supported on this platform");
+            return NGX_CONF_ERROR;
+#else
+            map = 1;
+            continue;
+#endif
+        }
+
+        if (ngx_strncmp(value[i].data, "threads", 7) == 0
+            && (value[i].len == 7 || value[i].data[7] == '='))
+        {
+#if (NGX_THREADS)
+            if (size == 0) {
+                size = 64 * 1024;
+            }
+
+            if (value[i].len == 7) {
+                tp = ngx_thread_pool_add(cf, NULL);
+
+            } else {
+                s.len = value[i].len - 8;
+                s.data = value[i].data + 8;
+
+                tp = ngx_thread_pool_add(cf, &s);
+            }
+
+            if (tp == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "nginx was built without threads support");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
     }
 
+    if (sample) {
+
+        if (sample->rate == NGX_CONF_UNSET_UINT) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "no sample rate is defined for "
+                               "access_log \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+
+        log->sample = sample;
+    }
+
+    if (map && ring_size == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"map\" requires \"ring\"");
+        return NGX_CONF_ERROR;
+    }
+
+    if (ring_size) {
+
+        /* the zone of a mapped ring only identifies it across reloads */
+
+        shm_zone = ngx_shared_memory_add(cf, &name,
+                                         map ? 8 * ngx_pagesize : ring_size,
+                                         &ngx_http_log_module);
+        if (shm_zone == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    if (shm_zone) {
+
+        if (size || log->script || log->syslog_peer) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "ring logs cannot be buffered, compressed, "
+                               "or have variables in name");
+            return NGX_CONF_ERROR;
+        }
+
+        ring = shm_zone->data;
+
+        if (ring) {
+            if (ring->file != log->file
+                || ring->map_size != (map ? ring_size : 0)
+                || (flush && ring->flush != flush))
+            {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "ring \"%V\" is already used "
+                                   "with conflicting parameters",
+                                   &shm_zone->shm.name);
+                return NGX_CONF_ERROR;
+            }
+
+            log->ring = ring;
+
+            return NGX_CONF_OK;
+        }
+
+        ring = ngx_pcalloc(cf->pool, sizeof(ngx_http_log_ring_t));
+        if (ring == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ring->buf = ngx_pnalloc(cf->pool, NGX_HTTP_LOG_RING_BUF);
+        if (ring->buf == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        if (lmcf->rings == NULL) {
+            lmcf->rings = ngx_array_create(cf->pool, 1,
+                                           sizeof(ngx_http_log_ring_t *));
+            if (lmcf->rings == NULL) {
+                return NGX_CONF_ERROR;
+            }
+        }
+
+        rp = ngx_array_push(lmcf->rings);
+        if (rp == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *rp = ring;
+
+        ring->shm_zone = shm_zone;
+        ring->file = log->file;
+        ring->flush = flush ? flush : 100;
+
+        if (map) {
+            ring->map_size = ring_size;
+
+            cln = ngx_pool_cleanup_add(cf->pool, 0);
+            if (cln == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+#if !(NGX_WIN32)
+            cln->handler = ngx_http_log_ring_cleanup;
+            cln->data = ring;
+#endif
+        }
+
+        ring->event.data = ring;
+        ring->event.handler = ngx_http_log_ring_handler;
+        ring->event.log = &cf->cycle->new_log;
+        ring->event.cancelable = 1;
+
+        shm_zone->init = ngx_http_log_ring_init_zone;
+        shm_zone->data = ring;
+
+        log->ring = ring;
+
+        return NGX_CONF_OK;
+    }
+
     if (flush && size == 0) {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "no buffer is defined for access_log \"%V\"",
@@ -1512,7 +3284,11 @@ process_formats:
 
             if (buffer->last - buffer->start != size
                 || buffer->flush != flush
-                || buffer->gzip != gzip)
+                || buffer->gzip != gzip
+#if (NGX_THREADS)
+                || buffer->thread_pool != tp
+#endif
+               )
             {
                 ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                                    "access_log \"%V\" already defined "
@@ -1559,6 +3335,35 @@ process_formats:
         /* ѹ */
         buffer->gzip = gzip;
 
+#if (NGX_THREADS)
+        if (tp) {
+            buffer->current = ngx_pcalloc(cf->pool,
+                                          sizeof(ngx_http_log_thread_buf_t));
+            if (buffer->current == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            buffer->current->start = buffer->start;
+
+            buffer->size = size;
+            buffer->nbufs = 1;
+            buffer->last_queued = &buffer->queue;
+
+            buffer->task = ngx_thread_task_alloc(cf->pool,
+                                           sizeof(ngx_http_log_thread_ctx_t));
+            if (buffer->task == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            buffer->task->handler = ngx_http_log_thread_handler;
+            buffer->task->event.data = log->file;
+            buffer->task->event.handler = ngx_http_log_thread_event_handler;
+            buffer->task->event.log = &cf->cycle->new_log;
+
+            buffer->thread_pool = tp;
+        }
+#endif
+
         /* ־ļflushص */
         log->file->flush = ngx_http_log_flush;
         /* log->file->data־Ϣ */
@@ -1575,7 +3380,7 @@ ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_http_log_main_conf_t *lmcf = conf;
 
     ngx_str_t           *value;
-    ngx_uint_t           i;
+    ngx_uint_t           i, s, json;
     ngx_http_log_fmt_t  *fmt;
 
     value = cf->args->elts;
@@ -1620,13 +3425,39 @@ ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     /* ־ʽͨܶҪб룬ԱҪʱԻȡеıϢ */
-    return ngx_http_log_compile_format(cf, fmt->flushes, fmt->ops, cf->args, 2);
+    s = 2;
+    json = 0;
+
+    if (ngx_strncmp(value[2].data, "escape=", 7) == 0) {
+
+        if (ngx_strcmp(value[2].data + 7, "json") == 0) {
+            json = 1;
+
+        } else if (ngx_strcmp(value[2].data + 7, "default") != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "unknown log format escaping \"%s\"",
+                               value[2].data + 7);
+            return NGX_CONF_ERROR;
+        }
+
+        s++;
+
+        if (s == cf->args->nelts) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "no format strings in \"log_format %V\"",
+                               &value[1]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    return ngx_http_log_compile_format(cf, fmt->flushes, fmt->ops, cf->args, s,
+                                       json);
 }
 
 /* ־ʽ */
 static char *
 ngx_http_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
-    ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s)
+    ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s, ngx_uint_t json)
 {
     u_char              *data, *p, ch;
     size_t               i, len;
@@ -1762,6 +3593,11 @@ ngx_http_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
                     return NGX_CONF_ERROR;
                 }
 
+                if (json) {
+                    op->getlen = ngx_http_log_json_variable_getlen;
+                    op->run = ngx_http_log_json_variable;
+                }
+
                 if (flushes) {
 
                     flush = ngx_array_push(flushes);
@@ -1982,7 +3818,7 @@ ngx_http_log_init(ngx_conf_t *cf)
         *value = ngx_http_combined_fmt;
         fmt = lmcf->formats.elts;
 
-        if (ngx_http_log_compile_format(cf, NULL, fmt->ops, &a, 0)
+        if (ngx_http_log_compile_format(cf, NULL, fmt->ops, &a, 0, 0)
             != NGX_CONF_OK)
         {
             return NGX_ERROR;
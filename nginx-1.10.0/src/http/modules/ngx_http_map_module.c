@@ -13,6 +13,7 @@
 typedef struct {
     ngx_uint_t                  hash_max_size;
     ngx_uint_t                  hash_bucket_size;
+    ngx_array_t                *tables;     /* refreshed ngx_http_map_table_t */
 } ngx_http_map_conf_t;
 
 
@@ -31,10 +32,39 @@ typedef struct {
 } ngx_http_map_conf_ctx_t;
 
 
+/*
+ * a compiled table of exact keys: the header is followed by the offsets
+ * of "size" + 1 buckets and by the records of each bucket, a record is
+ * the key and value lengths as two uint16_t followed by the lowercased
+ * key and the value, aligned to 2 bytes; the file has no pointers and
+ * is used as read
+ */
+
+typedef struct {
+    u_char                      MAPTBL[6];
+    u_char                      version;
+    u_char                      reserved;
+    uint32_t                    endianness;
+    uint32_t                    crc32;
+    uint32_t                    size;
+    uint32_t                    nelts;
+} ngx_http_map_table_header_t;
+
+
+typedef struct {
+    ngx_str_t                   name;
+    u_char                     *base;
+    time_t                      mtime;
+    time_t                      refresh;
+    ngx_event_t                 event;
+} ngx_http_map_table_t;
+
+
 typedef struct {
     ngx_http_map_t              map;
     ngx_http_complex_value_t    value;
     ngx_http_variable_value_t  *default_value;
+    ngx_http_map_table_t       *table;
     ngx_uint_t                  hostnames;      /* unsigned  hostnames:1 */
 } ngx_http_map_ctx_t;
 
@@ -44,12 +74,24 @@ static int ngx_libc_cdecl ngx_http_map_cmp_dns_wildcards(const void *one,
 static void *ngx_http_map_create_conf(ngx_conf_t *cf);
 static char *ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_http_map(ngx_conf_t *cf, ngx_command_t *dummy, void *conf);
+static ngx_int_t ngx_http_map_table_find(ngx_http_request_t *r,
+    ngx_http_map_table_t *table, ngx_str_t *match,
+    ngx_http_variable_value_t *v);
+static void ngx_http_map_table_refresh(ngx_event_t *ev);
+static u_char *ngx_http_map_table_read(ngx_str_t *name, time_t *mtime,
+    ngx_log_t *log);
+static ngx_http_map_table_t *ngx_http_map_table_init(ngx_conf_t *cf,
+    ngx_str_t *name, time_t refresh);
+static ngx_int_t ngx_http_map_table_compile(ngx_conf_t *cf, ngx_str_t *name,
+    ngx_str_t *bin);
+static void ngx_http_map_table_cleanup(void *data);
+static ngx_int_t ngx_http_map_init_process(ngx_cycle_t *cycle);
 
 
 static ngx_command_t  ngx_http_map_commands[] = {
 
     { ngx_string("map"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_BLOCK|NGX_CONF_TAKE2,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_BLOCK|NGX_CONF_2MORE,
       ngx_http_map_block,
       NGX_HTTP_MAIN_CONF_OFFSET,
       0,
@@ -95,7 +137,7 @@ ngx_module_t  ngx_http_map_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_map_init_process,             /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -124,6 +166,22 @@ ngx_http_map_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
         val.len--;
     }
 
+    if (map->table) {
+        switch (ngx_http_map_table_find(r, map->table, &val, v)) {
+
+        case NGX_OK:
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http map table: \"%V\" \"%v\"", &val, v);
+            return NGX_OK;
+
+        case NGX_ERROR:
+            return NGX_ERROR;
+
+        default: /* NGX_DECLINED */
+            break;
+        }
+    }
+
     value = ngx_http_map_find(r, &map->map, &val);
 
     if (value == NULL) {
@@ -159,6 +217,7 @@ ngx_http_map_create_conf(ngx_conf_t *cf)
 
     mcf->hash_max_size = NGX_CONF_UNSET_UINT;
     mcf->hash_bucket_size = NGX_CONF_UNSET_UINT;
+    mcf->tables = NULL;
 
     return mcf;
 }
@@ -170,7 +229,9 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_http_map_conf_t  *mcf = conf;
 
     char                              *rv;
-    ngx_str_t                         *value, name;
+    time_t                             refresh;
+    ngx_str_t                         *value, name, table, s;
+    ngx_uint_t                         i;
     ngx_conf_t                         save;
     ngx_pool_t                        *pool;
     ngx_hash_init_t                    hash;
@@ -227,6 +288,49 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     var->get_handler = ngx_http_map_variable;
     var->data = (uintptr_t) map;
 
+    ngx_str_null(&table);
+    refresh = 0;
+
+    for (i = 3; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "table=", 6) == 0) {
+            table.len = value[i].len - 6;
+            table.data = value[i].data + 6;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "refresh=", 8) == 0) {
+            s.len = value[i].len - 8;
+            s.data = value[i].data + 8;
+
+            refresh = ngx_parse_time(&s, 1);
+
+            if (refresh == (time_t) NGX_ERROR || refresh == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid refresh time \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (table.len) {
+        map->table = ngx_http_map_table_init(cf, &table, refresh);
+        if (map->table == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+    } else if (refresh) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"refresh\" requires \"table\"");
+        return NGX_CONF_ERROR;
+    }
+
     pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, cf->log);
     if (pool == NULL) {
         return NGX_CONF_ERROR;
@@ -348,8 +452,32 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 #if (NGX_PCRE)
 
     if (ctx.regexes.nelts) {
+        ngx_uint_t             i;
+        ngx_http_regex_t     **regex;
+        ngx_http_map_regex_t  *reg;
+
         map->map.regex = ctx.regexes.elts;
         map->map.nregex = ctx.regexes.nelts;
+
+        regex = ngx_palloc(pool,
+                           ctx.regexes.nelts * sizeof(ngx_http_regex_t *));
+        if (regex == NULL) {
+            ngx_destroy_pool(pool);
+            return NGX_CONF_ERROR;
+        }
+
+        reg = ctx.regexes.elts;
+
+        for (i = 0; i < ctx.regexes.nelts; i++) {
+            regex[i] = reg[i].regex;
+        }
+
+        map->map.regex_set = ngx_http_regex_set_create(cf, regex,
+                                                       ctx.regexes.nelts);
+        if (map->map.regex_set == NULL) {
+            ngx_destroy_pool(pool);
+            return NGX_CONF_ERROR;
+        }
     }
 
 #endif
@@ -360,6 +488,617 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static ngx_http_map_table_header_t  ngx_http_map_table_header = {
+    { 'M', 'A', 'P', 'T', 'B', 'L' }, 0, 0, 0x12345678, 0, 0, 0
+};
+
+
+static ngx_int_t
+ngx_http_map_table_find(ngx_http_request_t *r, ngx_http_map_table_t *table,
+    ngx_str_t *match, ngx_http_variable_value_t *v)
+{
+    u_char                       *p, *last, *low;
+    size_t                        klen, vlen;
+    uint32_t                     *buckets;
+    ngx_uint_t                    key;
+    ngx_http_map_table_header_t  *header;
+
+    if (match->len == 0) {
+        return NGX_DECLINED;
+    }
+
+    low = ngx_pnalloc(r->pool, match->len);
+    if (low == NULL) {
+        return NGX_ERROR;
+    }
+
+    key = ngx_hash_strlow(low, match->data, match->len);
+
+    header = (ngx_http_map_table_header_t *) table->base;
+    buckets = (uint32_t *) (table->base + sizeof(ngx_http_map_table_header_t));
+
+    key %= header->size;
+
+    p = table->base + buckets[key];
+    last = table->base + buckets[key + 1];
+
+    while (p < last) {
+        klen = ((uint16_t *) p)[0];
+        vlen = ((uint16_t *) p)[1];
+
+        if (klen == match->len && ngx_memcmp(p + 4, low, klen) == 0) {
+            goto found;
+        }
+
+        p += ngx_align(4 + klen + vlen, 2);
+    }
+
+    return NGX_DECLINED;
+
+found:
+
+    v->len = vlen;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    if (table->refresh == 0) {
+        v->data = p + 4 + klen;
+        return NGX_OK;
+    }
+
+    /* the table may be replaced while the request still uses the value */
+
+    v->data = ngx_pnalloc(r->pool, vlen);
+    if (v->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(v->data, p + 4 + klen, vlen);
+
+    return NGX_OK;
+}
+
+
+/*
+ * each worker checks the binary table from a timer once in the refresh
+ * interval and reads it when its mtime changes, so that updates do not
+ * require reconfiguration; it should be replaced by rename()
+ */
+
+static void
+ngx_http_map_table_refresh(ngx_event_t *ev)
+{
+    u_char                *base;
+    time_t                 mtime;
+    ngx_file_info_t        fi;
+    ngx_http_map_table_t  *table;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    table = ev->data;
+
+    ngx_add_timer(ev, table->refresh * 1000);
+
+    if (ngx_file_info(table->name.data, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ev->log, ngx_errno,
+                      ngx_file_info_n " \"%s\" failed", table->name.data);
+        return;
+    }
+
+    if (ngx_file_mtime(&fi) == table->mtime) {
+        return;
+    }
+
+    base = ngx_http_map_table_read(&table->name, &mtime, ev->log);
+    if (base == NULL) {
+        return;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, ev->log, 0,
+                  "reloaded map table \"%s\"", table->name.data);
+
+    ngx_free(table->base);
+
+    table->base = base;
+    table->mtime = mtime;
+}
+
+
+static u_char *
+ngx_http_map_table_read(ngx_str_t *name, time_t *mtime, ngx_log_t *log)
+{
+    u_char                       *base;
+    size_t                        size;
+    ssize_t                       n;
+    uint32_t                      crc32, *buckets;
+    ngx_uint_t                    i;
+    ngx_file_t                    file;
+    ngx_file_info_t               fi;
+    ngx_http_map_table_header_t  *header;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+    file.name = *name;
+    file.log = log;
+
+    file.fd = ngx_open_file(name->data, NGX_FILE_RDONLY, 0, 0);
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", name->data);
+        return NULL;
+    }
+
+    base = NULL;
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", name->data);
+        goto failed;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+    *mtime = ngx_file_mtime(&fi);
+
+    if (size < sizeof(ngx_http_map_table_header_t) + 2 * sizeof(uint32_t)) {
+        goto invalid;
+    }
+
+    base = ngx_alloc(size, log);
+    if (base == NULL) {
+        goto failed;
+    }
+
+    n = ngx_read_file(&file, base, size, 0);
+
+    if (n == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_read_file_n " \"%s\" failed", name->data);
+        goto failed;
+    }
+
+    header = (ngx_http_map_table_header_t *) base;
+
+    if ((size_t) n != size
+        || ngx_memcmp(&ngx_http_map_table_header, header, 12) != 0
+        || header->size == 0
+        || (size - sizeof(ngx_http_map_table_header_t)) / sizeof(uint32_t)
+           <= header->size)
+    {
+        goto invalid;
+    }
+
+    crc32 = ngx_crc32_long(base + sizeof(ngx_http_map_table_header_t),
+                           size - sizeof(ngx_http_map_table_header_t));
+
+    if (crc32 != header->crc32) {
+        goto invalid;
+    }
+
+    buckets = (uint32_t *) (base + sizeof(ngx_http_map_table_header_t));
+
+    for (i = 0; i < header->size; i++) {
+        if (buckets[i] > buckets[i + 1]) {
+            goto invalid;
+        }
+    }
+
+    if (buckets[header->size] != size) {
+        goto invalid;
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name->data);
+    }
+
+    return base;
+
+invalid:
+
+    /* most likely the file is still being written */
+
+    ngx_log_error(NGX_LOG_WARN, log, 0,
+                  "invalid map table \"%s\"", name->data);
+
+failed:
+
+    if (base) {
+        ngx_free(base);
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name->data);
+    }
+
+    return NULL;
+}
+
+
+/*
+ * "table=name" loads "name.bin", which is compiled from the text file
+ * "name" with "key value" lines if it is missing or older than the file
+ */
+
+static ngx_http_map_table_t *
+ngx_http_map_table_init(ngx_conf_t *cf, ngx_str_t *name, time_t refresh)
+{
+    time_t                 mtime;
+    ngx_str_t              bin;
+    ngx_err_t              err;
+    ngx_file_info_t        fi;
+    ngx_pool_cleanup_t    *cln;
+    ngx_http_map_conf_t   *mcf;
+    ngx_http_map_table_t  *table, **tp;
+
+    if (ngx_conf_full_name(cf->cycle, name, 1) != NGX_OK) {
+        return NULL;
+    }
+
+    bin.len = name->len + 4;
+    bin.data = ngx_pnalloc(cf->pool, bin.len + 1);
+    if (bin.data == NULL) {
+        return NULL;
+    }
+
+    ngx_sprintf(bin.data, "%V.bin%Z", name);
+
+    mtime = 0;
+
+    if (ngx_file_info(bin.data, &fi) != NGX_FILE_ERROR) {
+        mtime = ngx_file_mtime(&fi);
+    }
+
+    if (ngx_file_info(name->data, &fi) == NGX_FILE_ERROR) {
+        err = ngx_errno;
+
+        if (err != NGX_ENOENT || mtime == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, err,
+                               ngx_file_info_n " \"%s\" failed", name->data);
+            return NULL;
+        }
+
+    } else if (mtime < ngx_file_mtime(&fi)) {
+        if (ngx_http_map_table_compile(cf, name, &bin) != NGX_OK) {
+            return NULL;
+        }
+    }
+
+    table = ngx_pcalloc(cf->pool, sizeof(ngx_http_map_table_t));
+    if (table == NULL) {
+        return NULL;
+    }
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    table->base = ngx_http_map_table_read(&bin, &table->mtime, cf->log);
+    if (table->base == NULL) {
+        return NULL;
+    }
+
+    cln->handler = ngx_http_map_table_cleanup;
+    cln->data = table;
+
+    table->name = bin;
+    table->refresh = refresh;
+
+    if (refresh == 0) {
+        return table;
+    }
+
+    table->event.handler = ngx_http_map_table_refresh;
+    table->event.data = table;
+    table->event.log = &cf->cycle->new_log;
+    table->event.cancelable = 1;
+
+    mcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_map_module);
+
+    if (mcf->tables == NULL) {
+        mcf->tables = ngx_array_create(cf->pool, 1,
+                                       sizeof(ngx_http_map_table_t *));
+        if (mcf->tables == NULL) {
+            return NULL;
+        }
+    }
+
+    tp = ngx_array_push(mcf->tables);
+    if (tp == NULL) {
+        return NULL;
+    }
+
+    *tp = table;
+
+    return table;
+}
+
+
+static ngx_int_t
+ngx_http_map_table_compile(ngx_conf_t *cf, ngx_str_t *name, ngx_str_t *bin)
+{
+    u_char                       *buf, *p, *last, *start, *end, *rec;
+    size_t                        size;
+    ssize_t                       n;
+    uint32_t                      nelts, hsize, *buckets, *pos;
+    ngx_int_t                     rc;
+    ngx_str_t                    *kv, tmp;
+    ngx_uint_t                    i, b, line;
+    ngx_file_t                    file;
+    ngx_array_t                   pairs;
+    ngx_file_info_t               fi;
+    ngx_file_mapping_t            fm;
+    ngx_http_map_table_header_t  *header;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+    file.name = *name;
+    file.log = cf->log;
+
+    file.fd = ngx_open_file(name->data, NGX_FILE_RDONLY, 0, 0);
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_open_file_n " \"%s\" failed", name->data);
+        return NGX_ERROR;
+    }
+
+    rc = NGX_ERROR;
+    buf = NULL;
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_fd_info_n " \"%s\" failed", name->data);
+        goto done;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+
+    buf = ngx_alloc(size + 1, cf->log);
+    if (buf == NULL) {
+        goto done;
+    }
+
+    n = ngx_read_file(&file, buf, size, 0);
+
+    if (n == NGX_ERROR || (size_t) n != size) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_read_file_n " \"%s\" failed", name->data);
+        goto done;
+    }
+
+    buf[size] = LF;
+    end = buf + size;
+
+    if (ngx_array_init(&pairs, cf->temp_pool, 1024, 2 * sizeof(ngx_str_t))
+        != NGX_OK)
+    {
+        goto done;
+    }
+
+    /* the text is parsed in place, keys are lowercased */
+
+    size = sizeof(ngx_http_map_table_header_t);
+
+    for (p = buf, line = 1; p < end; p++, line++) {
+        while (*p == ' ' || *p == '\t' || *p == CR) {
+            p++;
+        }
+
+        if (*p == LF) {
+            continue;
+        }
+
+        if (*p == '#') {
+            while (*p != LF) {
+                p++;
+            }
+
+            continue;
+        }
+
+        kv = ngx_array_push(&pairs);
+        if (kv == NULL) {
+            goto done;
+        }
+
+        for (start = p; *p != ' ' && *p != '\t' && *p != LF; p++) {
+            *p = ngx_tolower(*p);
+        }
+
+        kv[0].data = start;
+        kv[0].len = p - start;
+
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+
+        for (start = p; *p != LF; p++) { /* void */ }
+
+        for (last = p;
+             last > start
+             && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == CR
+                 || last[-1] == ';');
+             last--)
+        {
+            /* void */
+        }
+
+        kv[1].data = start;
+        kv[1].len = last - start;
+
+        if (kv[1].len == 0 || kv[0].len > 0xffff || kv[1].len > 0xffff) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid map table entry in %s:%ui",
+                               name->data, line);
+            goto done;
+        }
+
+        size += ngx_align(4 + kv[0].len + kv[1].len, 2);
+    }
+
+    nelts = pairs.nelts;
+    hsize = nelts ? nelts : 1;
+
+    size += (hsize + 1) * sizeof(uint32_t);
+
+    if (size > 0xffffffff) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "map table \"%s\" is too large", name->data);
+        goto done;
+    }
+
+    pos = ngx_pcalloc(cf->temp_pool, (hsize + 1) * sizeof(uint32_t));
+    if (pos == NULL) {
+        goto done;
+    }
+
+    kv = pairs.elts;
+
+    for (i = 0; i < nelts; i++) {
+        pos[ngx_hash_key(kv[2 * i].data, kv[2 * i].len) % hsize + 1] +=
+                    ngx_align(4 + kv[2 * i].len + kv[2 * i + 1].len, 2);
+    }
+
+    pos[0] = sizeof(ngx_http_map_table_header_t)
+             + (hsize + 1) * sizeof(uint32_t);
+
+    for (i = 1; i <= hsize; i++) {
+        pos[i] += pos[i - 1];
+    }
+
+    /* the file is written under a temporary name and then renamed */
+
+    tmp.len = bin->len + 4;
+    tmp.data = ngx_pnalloc(cf->temp_pool, tmp.len + 1);
+    if (tmp.data == NULL) {
+        goto done;
+    }
+
+    ngx_sprintf(tmp.data, "%V.tmp%Z", bin);
+
+    fm.name = tmp.data;
+    fm.size = size;
+    fm.log = cf->log;
+
+    ngx_log_error(NGX_LOG_NOTICE, cf->log, 0,
+                  "creating map table \"%s\"", bin->data);
+
+    if (ngx_create_file_mapping(&fm) != NGX_OK) {
+        goto done;
+    }
+
+    header = fm.addr;
+    *header = ngx_http_map_table_header;
+    header->size = hsize;
+    header->nelts = nelts;
+
+    buckets = (uint32_t *) ((u_char *) fm.addr
+                            + sizeof(ngx_http_map_table_header_t));
+
+    ngx_memcpy(buckets, pos, (hsize + 1) * sizeof(uint32_t));
+
+    for (i = 0; i < nelts; i++) {
+        b = ngx_hash_key(kv[2 * i].data, kv[2 * i].len) % hsize;
+
+        rec = (u_char *) fm.addr + pos[b];
+
+        /* only one of duplicate keys could ever be found */
+
+        for (p = (u_char *) fm.addr + buckets[b]; p < rec; p += n) {
+            n = ngx_align(4 + ((uint16_t *) p)[0] + ((uint16_t *) p)[1], 2);
+
+            if (((uint16_t *) p)[0] == kv[2 * i].len
+                && ngx_memcmp(p + 4, kv[2 * i].data, kv[2 * i].len) == 0)
+            {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "duplicate key \"%V\" in map table \"%s\"",
+                                   &kv[2 * i], name->data);
+
+                ngx_close_file_mapping(&fm);
+
+                if (ngx_delete_file(tmp.data) == NGX_FILE_ERROR) {
+                    ngx_conf_log_error(NGX_LOG_ALERT, cf, ngx_errno,
+                                       ngx_delete_file_n " \"%s\" failed",
+                                       tmp.data);
+                }
+
+                goto done;
+            }
+        }
+
+        ((uint16_t *) rec)[0] = (uint16_t) kv[2 * i].len;
+        ((uint16_t *) rec)[1] = (uint16_t) kv[2 * i + 1].len;
+
+        p = ngx_cpymem(rec + 4, kv[2 * i].data, kv[2 * i].len);
+        ngx_memcpy(p, kv[2 * i + 1].data, kv[2 * i + 1].len);
+
+        pos[b] += ngx_align(4 + kv[2 * i].len + kv[2 * i + 1].len, 2);
+    }
+
+    header->crc32 = ngx_crc32_long((u_char *) fm.addr
+                                       + sizeof(ngx_http_map_table_header_t),
+                                   size - sizeof(ngx_http_map_table_header_t));
+
+    ngx_close_file_mapping(&fm);
+
+    if (ngx_rename_file(tmp.data, bin->data) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                           tmp.data, bin->data);
+        goto done;
+    }
+
+    rc = NGX_OK;
+
+done:
+
+    if (buf) {
+        ngx_free(buf);
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name->data);
+    }
+
+    return rc;
+}
+
+
+static void
+ngx_http_map_table_cleanup(void *data)
+{
+    ngx_http_map_table_t  *table = data;
+
+    ngx_free(table->base);
+}
+
+
+static ngx_int_t
+ngx_http_map_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t              i;
+    ngx_http_map_conf_t    *mcf;
+    ngx_http_map_table_t  **table;
+
+    mcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_map_module);
+
+    if (mcf == NULL || mcf->tables == NULL) {
+        return NGX_OK;
+    }
+
+    table = mcf->tables->elts;
+
+    for (i = 0; i < mcf->tables->nelts; i++) {
+        ngx_add_timer(&table[i]->event, table[i]->refresh * 1000);
+    }
+
+    return NGX_OK;
+}
+
+
 static int ngx_libc_cdecl
 ngx_http_map_cmp_dns_wildcards(const void *one, const void *two)
 {
@@ -18,6 +18,7 @@
 
 typedef struct {
     ngx_array_t       *from;     /* array of ngx_cidr_t */
+    ngx_cidr_trie_t   *trusted;
     ngx_uint_t         type;
     ngx_uint_t         hash;
     ngx_str_t          header;
@@ -45,6 +46,7 @@ static char *ngx_http_realip_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
 static ngx_int_t ngx_http_realip_add_variables(ngx_conf_t *cf);
 static ngx_int_t ngx_http_realip_init(ngx_conf_t *cf);
+static ngx_uint_t ngx_http_realip_active(void **loc_conf);
 
 
 static ngx_int_t ngx_http_realip_remote_addr_variable(ngx_http_request_t *r,
@@ -226,8 +228,8 @@ found:
     addr.socklen = c->socklen;
     /* addr.name = c->addr_text; */
 
-    if (ngx_http_get_forwarded_addr(r, &addr, xfwd, value, rlcf->from,
-                                    rlcf->recursive)
+    if (ngx_http_get_forwarded_addr_trie(r, &addr, xfwd, value,
+                                         rlcf->trusted, rlcf->recursive)
         != NGX_DECLINED)
     {
         return ngx_http_realip_set_addr(r, &addr);
@@ -397,6 +399,7 @@ ngx_http_realip_create_loc_conf(ngx_conf_t *cf)
      * set by ngx_pcalloc():
      *
      *     conf->from = NULL;
+     *     conf->trusted = NULL;
      *     conf->hash = 0;
      *     conf->header = { 0, NULL };
      */
@@ -416,6 +419,18 @@ ngx_http_realip_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 
     if (conf->from == NULL) {
         conf->from = prev->from;
+        conf->trusted = prev->trusted;
+    }
+
+    if (conf->from && conf->trusted == NULL) {
+        conf->trusted = ngx_cidr_trie_create(cf->pool, conf->from);
+        if (conf->trusted == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        if (conf->from == prev->from) {
+            prev->trusted = conf->trusted;
+        }
     }
 
     ngx_conf_merge_uint_value(conf->type, prev->type, NGX_HTTP_REALIP_XREALIP);
@@ -471,7 +486,19 @@ ngx_http_realip_init(ngx_conf_t *cf)
 
     *h = ngx_http_realip_handler;
 
-    return NGX_OK;
+    return ngx_http_set_phase_active(cf, ngx_http_realip_handler,
+                                     ngx_http_realip_active);
+}
+
+
+static ngx_uint_t
+ngx_http_realip_active(void **loc_conf)
+{
+    ngx_http_realip_loc_conf_t  *rlcf;
+
+    rlcf = loc_conf[ngx_http_realip_module.ctx_index];
+
+    return rlcf->from != NULL;
 }
 
 
@@ -58,6 +58,9 @@ static char * ngx_http_rewrite_if_condition(ngx_conf_t *cf,
     ngx_http_rewrite_loc_conf_t *lcf);
 static char *ngx_http_rewrite_variable(ngx_conf_t *cf,
     ngx_http_rewrite_loc_conf_t *lcf, ngx_str_t *value);
+static char *ngx_http_rewrite_var_equal(ngx_conf_t *cf,
+    ngx_http_rewrite_loc_conf_t *lcf, ngx_str_t *var, ngx_str_t *text,
+    ngx_uint_t negative);
 static char *ngx_http_rewrite_set(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char * ngx_http_rewrite_value(ngx_conf_t *cf,
@@ -737,6 +740,18 @@ ngx_http_rewrite_if_condition(ngx_conf_t *cf, ngx_http_rewrite_loc_conf_t *lcf)
             return NGX_CONF_ERROR;
         }
 
+        if (cur + 2 == last
+            && ngx_http_script_variables_count(&value[last]) == 0
+            && ((value[cur + 1].len == 1 && value[cur + 1].data[0] == '=')
+                || (value[cur + 1].len == 2
+                    && value[cur + 1].data[0] == '!'
+                    && value[cur + 1].data[1] == '=')))
+        {
+            return ngx_http_rewrite_var_equal(cf, lcf, &value[cur],
+                                              &value[last],
+                                              value[cur + 1].len == 2);
+        }
+
         if (ngx_http_rewrite_variable(cf, lcf, &value[cur]) != NGX_CONF_OK) {
             return NGX_CONF_ERROR;
         }
@@ -929,6 +944,38 @@ ngx_http_rewrite_variable(ngx_conf_t *cf, ngx_http_rewrite_loc_conf_t *lcf,
     return NGX_CONF_OK;
 }
 
+
+static char *
+ngx_http_rewrite_var_equal(ngx_conf_t *cf, ngx_http_rewrite_loc_conf_t *lcf,
+    ngx_str_t *var, ngx_str_t *text, ngx_uint_t negative)
+{
+    ngx_int_t                          index;
+    ngx_http_script_var_equal_code_t  *code;
+
+    var->len--;
+    var->data++;
+
+    index = ngx_http_get_variable_index(cf, var);
+
+    if (index == NGX_ERROR) {
+        return NGX_CONF_ERROR;
+    }
+
+    code = ngx_http_script_start_code(cf->pool, &lcf->codes,
+                                      sizeof(ngx_http_script_var_equal_code_t));
+    if (code == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    code->code = ngx_http_script_var_equal_code;
+    code->index = index;
+    code->text_len = (uintptr_t) text->len;
+    code->text_data = (uintptr_t) text->data;
+    code->negative = negative;
+
+    return NGX_CONF_OK;
+}
+
 /*
  * set ngx_command_tص
  */
@@ -62,6 +62,22 @@ ngx_module_t  ngx_http_stub_status_module = {
 };
 
 
+static ngx_str_t  ngx_http_stub_status_timing[] = {
+    ngx_string("post_read"),
+    ngx_string("server_rewrite"),
+    ngx_string("find_config"),
+    ngx_string("rewrite"),
+    ngx_string("post_rewrite"),
+    ngx_string("preaccess"),
+    ngx_string("access"),
+    ngx_string("post_access"),
+    ngx_string("try_files"),
+    ngx_string("content"),
+    ngx_string("header_filter"),
+    ngx_string("body_filter")
+};
+
+
 static ngx_http_variable_t  ngx_http_stub_status_vars[] = {
 
     { ngx_string("connections_active"), NULL, ngx_http_stub_status_variable,
@@ -76,6 +92,17 @@ static ngx_http_variable_t  ngx_http_stub_status_vars[] = {
     { ngx_string("connections_waiting"), NULL, ngx_http_stub_status_variable,
       3, NGX_HTTP_VAR_NOCACHEABLE, 0 },
 
+    /* counted only for the upstreams with the "keepalive" directive */
+
+    { ngx_string("upstream_keepalive_connects"), NULL,
+      ngx_http_stub_status_variable, 4, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("upstream_keepalive_reused"), NULL,
+      ngx_http_stub_status_variable, 5, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("upstream_keepalive_closed"), NULL,
+      ngx_http_stub_status_variable, 6, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
     { ngx_null_string, NULL, NULL, 0, 0, 0 }
 };
 
@@ -83,11 +110,14 @@ static ngx_http_variable_t  ngx_http_stub_status_vars[] = {
 static ngx_int_t
 ngx_http_stub_status_handler(ngx_http_request_t *r)
 {
-    size_t             size;
-    ngx_int_t          rc;
-    ngx_buf_t         *b;
-    ngx_chain_t        out;
-    ngx_atomic_int_t   ap, hn, ac, rq, rd, wr, wa;
+    size_t                        size;
+    ngx_int_t                     rc;
+    ngx_buf_t                    *b;
+    ngx_uint_t                    i, n;
+    ngx_chain_t                   out;
+    ngx_atomic_int_t              ap, hn, ac, rq, rd, wr, wa;
+    ngx_http_core_main_conf_t    *cmcf;
+    ngx_http_timing_histogram_t  *hist;
 
     if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
         return NGX_HTTP_NOT_ALLOWED;
@@ -118,6 +148,20 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
            + 6 + 3 * NGX_ATOMIC_T_LEN
            + sizeof("Reading:  Writing:  Waiting:  \n") + 3 * NGX_ATOMIC_T_LEN;
 
+    cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+
+    /* "Timing <slot>: <requests> <usec> <buckets> \n" */
+
+    hist = NULL;
+
+    if (cmcf->request_timing_zone) {
+        hist = cmcf->request_timing_zone->data;
+
+        size += NGX_HTTP_TIMING_SLOTS
+                * (sizeof("Timing server_rewrite:  \n")
+                   + (NGX_HTTP_TIMING_BUCKETS + 2) * (NGX_ATOMIC_T_LEN + 1));
+    }
+
     b = ngx_create_temp_buf(r->pool, size);
     if (b == NULL) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
@@ -144,6 +188,21 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
     b->last = ngx_sprintf(b->last, "Reading: %uA Writing: %uA Waiting: %uA \n",
                           rd, wr, wa);
 
+    if (hist) {
+        for (i = 0; i < NGX_HTTP_TIMING_SLOTS; i++) {
+            b->last = ngx_sprintf(b->last, "Timing %V: %uA %uA",
+                                  &ngx_http_stub_status_timing[i],
+                                  hist[i].count, hist[i].usec);
+
+            for (n = 0; n < NGX_HTTP_TIMING_BUCKETS; n++) {
+                b->last = ngx_sprintf(b->last, " %uA", hist[i].buckets[n]);
+            }
+
+            *b->last++ = ' ';
+            *b->last++ = LF;
+        }
+    }
+
     r->headers_out.status = NGX_HTTP_OK;
     r->headers_out.content_length_n = b->last - b->pos;
 
@@ -189,6 +248,18 @@ ngx_http_stub_status_variable(ngx_http_request_t *r,
         value = *ngx_stat_waiting;
         break;
 
+    case 4:
+        value = *ngx_stat_upstream_keepalive_connects;
+        break;
+
+    case 5:
+        value = *ngx_stat_upstream_keepalive_reused;
+        break;
+
+    case 6:
+        value = *ngx_stat_upstream_keepalive_closed;
+        break;
+
     /* suppress warning */
     default:
         value = 0;
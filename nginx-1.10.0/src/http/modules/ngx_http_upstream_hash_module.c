@@ -13,18 +13,37 @@
 typedef struct {
     uint32_t                            hash;
     ngx_str_t                          *server;
+    ngx_uint_t                          peer;    /* first peer of server */
 } ngx_http_upstream_chash_point_t;
 
 
 typedef struct {
     ngx_uint_t                          number;
+    /* the first points of the buckets by the high bits of the hash */
+    uint32_t                           *index;
+    ngx_uint_t                          shift;
     ngx_http_upstream_chash_point_t     point[1];
 } ngx_http_upstream_chash_points_t;
 
 
+#define NGX_HTTP_UPSTREAM_HASH_MAGLEV   1
+#define NGX_HTTP_UPSTREAM_HASH_JUMP     2
+
+
 typedef struct {
     ngx_http_complex_value_t            key;
     ngx_http_upstream_chash_points_t   *points;
+    /* load factor of "consistent bounded=", in percents */
+    ngx_uint_t                          bounded;
+
+    ngx_uint_t                          method;
+    /* peer indices of the maglev lookup table or of the jump buckets */
+    uint32_t                           *table;
+    ngx_uint_t                          size;
+
+    /* per worker, as the peers may be moved to a shared zone */
+    ngx_http_upstream_rr_peers_t       *indexed;
+    ngx_http_upstream_rr_peer_t       **peer;
 } ngx_http_upstream_hash_srv_conf_t;
 
 
@@ -57,6 +76,23 @@ static ngx_int_t ngx_http_upstream_init_chash_peer(ngx_http_request_t *r,
     ngx_http_upstream_srv_conf_t *us);
 static ngx_int_t ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc,
     void *data);
+static ngx_uint_t ngx_http_upstream_chash_skip_peer(
+    ngx_http_upstream_hash_peer_data_t *hp, ngx_http_upstream_rr_peer_t *peer,
+    ngx_uint_t i, time_t now);
+
+static ngx_int_t ngx_http_upstream_init_maglev(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_uint_t ngx_http_upstream_hash_prime(ngx_uint_t n);
+static ngx_int_t ngx_http_upstream_init_jump(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_uint_t ngx_http_upstream_jump_hash(uint64_t key, ngx_uint_t n);
+static ngx_int_t ngx_http_upstream_init_table_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_table_peer(ngx_peer_connection_t *pc,
+    void *data);
+static ngx_int_t ngx_http_upstream_hash_index_peers(
+    ngx_http_upstream_hash_srv_conf_t *hcf,
+    ngx_http_upstream_rr_peers_t *peers);
 
 static void *ngx_http_upstream_hash_create_conf(ngx_conf_t *cf);
 static char *ngx_http_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -66,7 +102,7 @@ static char *ngx_http_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd,
 static ngx_command_t  ngx_http_upstream_hash_commands[] = {
 
     { ngx_string("hash"),
-      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE123,
       ngx_http_upstream_hash,
       NGX_HTTP_SRV_CONF_OFFSET,
       0,
@@ -259,6 +295,7 @@ ngx_http_upstream_get_hash_peer(ngx_peer_connection_t *pc, void *data)
     pc->name = &peer->name;
 
     peer->conns++;
+    (void) ngx_atomic_fetch_add(&hp->rrp.peers->conns, 1);
 
     if (now - peer->checked > peer->fail_timeout) {
         peer->checked = now;
@@ -279,7 +316,7 @@ ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
     size_t                              host_len, port_len, size;
     uint32_t                            hash, base_hash;
     ngx_str_t                          *server;
-    ngx_uint_t                          npoints, i, j;
+    ngx_uint_t                          npoints, i, j, p, first, bits;
     ngx_http_upstream_rr_peer_t        *peer;
     ngx_http_upstream_rr_peers_t       *peers;
     ngx_http_upstream_chash_points_t   *points;
@@ -307,8 +344,20 @@ ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
     }
 
     points->number = 0;
+    server = NULL;
+    first = 0;
+
+    for (peer = peers->peer, p = 0; peer; peer = peer->next, p++) {
+
+        /* the peers of a server with several addresses are adjacent */
+
+        if (server == NULL
+            || server->len != peer->server.len
+            || ngx_strncmp(server->data, peer->server.data, server->len) != 0)
+        {
+            first = p;
+        }
 
-    for (peer = peers->peer; peer; peer = peer->next) {
         server = &peer->server;
 
         /*
@@ -365,6 +414,7 @@ ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
 
             points->point[points->number].hash = hash;
             points->point[points->number].server = server;
+            points->point[points->number].peer = first;
             points->number++;
 
 #if (NGX_HAVE_LITTLE_ENDIAN)
@@ -391,6 +441,34 @@ ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
 
     points->number = i + 1;
 
+    /* about one point per bucket */
+
+    for (bits = 1; bits < 16 && ((ngx_uint_t) 1 << bits) < points->number;
+         bits++)
+    {
+        /* void */
+    }
+
+    points->shift = 32 - bits;
+
+    points->index = ngx_palloc(cf->pool,
+                               (((ngx_uint_t) 1 << bits) + 1)
+                               * sizeof(uint32_t));
+    if (points->index == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0, j = 0; j <= ((ngx_uint_t) 1 << bits); j++) {
+
+        while (i < points->number
+               && (points->point[i].hash >> points->shift) < j)
+        {
+            i++;
+        }
+
+        points->index[j] = i;
+    }
+
     hcf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_hash_module);
     hcf->points = points;
 
@@ -425,12 +503,12 @@ ngx_http_upstream_find_chash_point(ngx_http_upstream_chash_points_t *points,
     ngx_uint_t                        i, j, k;
     ngx_http_upstream_chash_point_t  *point;
 
-    /* find first point >= hash */
+    /* find first point >= hash, within the bucket of the hash */
 
     point = &points->point[0];
 
-    i = 0;
-    j = points->number;
+    i = points->index[hash >> points->shift];
+    j = points->index[(hash >> points->shift) + 1];
 
     while (i < j) {
         k = (i + j) / 2;
@@ -467,6 +545,10 @@ ngx_http_upstream_init_chash_peer(ngx_http_request_t *r,
     hp = r->upstream->peer.data;
     hcf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_hash_module);
 
+    if (ngx_http_upstream_hash_index_peers(hcf, hp->rrp.peers) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
     hash = ngx_crc32_long(hp->key.data, hp->key.len);
 
     ngx_http_upstream_rr_peers_rlock(hp->rrp.peers);
@@ -488,9 +570,10 @@ ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
     intptr_t                            m;
     ngx_str_t                          *server;
     ngx_int_t                           total;
-    ngx_uint_t                          i, n, best_i;
-    ngx_http_upstream_rr_peer_t        *peer, *best;
-    ngx_http_upstream_chash_point_t    *point;
+    ngx_uint_t                          i, n, best_i, conns, fallback_i;
+    ngx_http_upstream_rr_peer_t        *peer, *best, *fallback;
+    ngx_http_upstream_rr_peers_t       *peers;
+    ngx_http_upstream_chash_point_t    *point, *fallback_point;
     ngx_http_upstream_chash_points_t   *points;
     ngx_http_upstream_hash_srv_conf_t  *hcf;
 
@@ -504,12 +587,18 @@ ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
 
     now = ngx_time();
     hcf = hp->conf;
+    peers = hp->rrp.peers;
 
     points = hcf->points;
-    point = &points->point[0];
+
+    conns = peers->conns;
+    fallback = NULL;
+    fallback_i = 0;
+    fallback_point = NULL;
 
     for ( ;; ) {
-        server = point[hp->hash % points->number].server;
+        point = &points->point[hp->hash % points->number];
+        server = point->server;
 
         ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                        "consistent hash peer:%uD, server:\"%V\"",
@@ -517,60 +606,70 @@ ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
 
         best = NULL;
         best_i = 0;
-        total = 0;
-
-        for (peer = hp->rrp.peers->peer, i = 0;
-             peer;
-             peer = peer->next, i++)
-        {
 
-            n = i / (8 * sizeof(uintptr_t));
-            m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+        /*
+         * the weights are only compared here and updated for the point
+         * taken, so the points skipped for bounded loads leave them intact
+         */
 
-            if (hp->rrp.tried[n] & m) {
-                continue;
-            }
+        for (i = point->peer; i < peers->number; i++) {
 
-            if (peer->down) {
-                continue;
-            }
+            peer = hcf->peer[i];
 
             if (peer->server.len != server->len
                 || ngx_strncmp(peer->server.data, server->data, server->len)
                    != 0)
             {
-                continue;
+                break;
             }
 
-            if (peer->max_fails
-                && peer->fails >= peer->max_fails
-                && now - peer->checked <= peer->fail_timeout)
-            {
+            if (ngx_http_upstream_chash_skip_peer(hp, peer, i, now)) {
                 continue;
             }
 
-            peer->current_weight += peer->effective_weight;
-            total += peer->effective_weight;
-
-            if (peer->effective_weight < peer->weight) {
-                peer->effective_weight++;
-            }
-
-            if (best == NULL || peer->current_weight > best->current_weight) {
+            if (best == NULL
+                || peer->current_weight + peer->effective_weight
+                   > best->current_weight + best->effective_weight)
+            {
                 best = peer;
                 best_i = i;
             }
         }
 
         if (best) {
-            best->current_weight -= total;
-            goto found;
+
+            /*
+             * with bounded loads a peer takes no more than its weighted
+             * share of the connections times the load factor, the next
+             * points being tried otherwise
+             */
+
+            if (hcf->bounded == 0
+                || best->conns * peers->total_weight * 100
+                   < hcf->bounded * (conns + 1) * best->weight)
+            {
+                goto found;
+            }
+
+            if (fallback == NULL) {
+                fallback = best;
+                fallback_i = best_i;
+                fallback_point = point;
+            }
         }
 
         hp->hash++;
         hp->tries++;
 
         if (hp->tries >= points->number) {
+
+            if (fallback) {
+                best = fallback;
+                best_i = fallback_i;
+                point = fallback_point;
+                goto found;
+            }
+
             ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
             return NGX_BUSY;
         }
@@ -578,6 +677,33 @@ ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
 
 found:
 
+    server = point->server;
+    total = 0;
+
+    for (i = point->peer; i < peers->number; i++) {
+
+        peer = hcf->peer[i];
+
+        if (peer->server.len != server->len
+            || ngx_strncmp(peer->server.data, server->data, server->len) != 0)
+        {
+            break;
+        }
+
+        if (ngx_http_upstream_chash_skip_peer(hp, peer, i, now)) {
+            continue;
+        }
+
+        peer->current_weight += peer->effective_weight;
+        total += peer->effective_weight;
+
+        if (peer->effective_weight < peer->weight) {
+            peer->effective_weight++;
+        }
+    }
+
+    best->current_weight -= total;
+
     hp->rrp.current = best;
 
     pc->sockaddr = best->sockaddr;
@@ -585,6 +711,7 @@ found:
     pc->name = &best->name;
 
     best->conns++;
+    (void) ngx_atomic_fetch_add(&hp->rrp.peers->conns, 1);
 
     if (now - best->checked > best->fail_timeout) {
         best->checked = now;
@@ -601,17 +728,370 @@ found:
 }
 
 
+static ngx_uint_t
+ngx_http_upstream_chash_skip_peer(ngx_http_upstream_hash_peer_data_t *hp,
+    ngx_http_upstream_rr_peer_t *peer, ngx_uint_t i, time_t now)
+{
+    intptr_t    m;
+    ngx_uint_t  n;
+
+    n = i / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+    if (hp->rrp.tried[n] & m) {
+        return 1;
+    }
+
+    if (peer->down) {
+        return 1;
+    }
+
+    if (peer->max_fails
+        && peer->fails >= peer->max_fails
+        && now - peer->checked <= peer->fail_timeout)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_maglev(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
+{
+    uint32_t                           *table, *offset, *skip, *next, c;
+    ngx_uint_t                          size, filled, i, w;
+    ngx_http_upstream_rr_peer_t        *peer;
+    ngx_http_upstream_rr_peers_t       *peers;
+    ngx_http_upstream_hash_srv_conf_t  *hcf;
+
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_http_upstream_init_table_peer;
+
+    peers = us->peer.data;
+
+    /*
+     * Maglev hashing: each peer fills the lookup table in the order of
+     * its own permutation of the entries, given by the peer address, and
+     * takes as many entries in a turn as its weight.  The table size is
+     * a prime, so each permutation covers the whole table.
+     */
+
+    size = ngx_http_upstream_hash_prime(
+                          ngx_max(ngx_min(100 * peers->total_weight, 1048576),
+                                  1009));
+
+    table = ngx_palloc(cf->pool, size * sizeof(uint32_t));
+    if (table == NULL) {
+        return NGX_ERROR;
+    }
+
+    offset = ngx_palloc(cf->temp_pool, 3 * peers->number * sizeof(uint32_t));
+    if (offset == NULL) {
+        return NGX_ERROR;
+    }
+
+    skip = offset + peers->number;
+    next = skip + peers->number;
+
+    for (peer = peers->peer, i = 0; peer; peer = peer->next, i++) {
+        offset[i] = ngx_crc32_long(peer->name.data, peer->name.len) % size;
+        skip[i] = ngx_murmur_hash2(peer->name.data, peer->name.len)
+                  % (size - 1) + 1;
+        next[i] = 0;
+    }
+
+    ngx_memset(table, 0xff, size * sizeof(uint32_t));
+
+    filled = 0;
+
+    for ( ;; ) {
+        for (peer = peers->peer, i = 0; peer; peer = peer->next, i++) {
+            for (w = 0; w < (ngx_uint_t) peer->weight; w++) {
+
+                do {
+                    c = (uint32_t) ((offset[i] + (uint64_t) next[i] * skip[i])
+                                    % size);
+                    next[i]++;
+                } while (table[c] != (uint32_t) -1);
+
+                table[c] = i;
+
+                if (++filled == size) {
+                    goto done;
+                }
+            }
+        }
+    }
+
+done:
+
+    hcf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_hash_module);
+
+    hcf->method = NGX_HTTP_UPSTREAM_HASH_MAGLEV;
+    hcf->table = table;
+    hcf->size = size;
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_hash_prime(ngx_uint_t n)
+{
+    ngx_uint_t  i;
+
+    for ( ;; n++) {
+        for (i = 2; i * i <= n; i++) {
+            if (n % i == 0) {
+                break;
+            }
+        }
+
+        if (i * i > n) {
+            return n;
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_jump(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
+{
+    uint32_t                           *table;
+    ngx_uint_t                          i, n, w;
+    ngx_http_upstream_rr_peer_t        *peer;
+    ngx_http_upstream_rr_peers_t       *peers;
+    ngx_http_upstream_hash_srv_conf_t  *hcf;
+
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_http_upstream_init_table_peer;
+
+    peers = us->peer.data;
+
+    /* a peer has as many jump hash buckets as its weight */
+
+    table = ngx_palloc(cf->pool, peers->total_weight * sizeof(uint32_t));
+    if (table == NULL) {
+        return NGX_ERROR;
+    }
+
+    n = 0;
+
+    for (peer = peers->peer, i = 0; peer; peer = peer->next, i++) {
+        for (w = 0; w < (ngx_uint_t) peer->weight; w++) {
+            table[n++] = i;
+        }
+    }
+
+    hcf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_hash_module);
+
+    hcf->method = NGX_HTTP_UPSTREAM_HASH_JUMP;
+    hcf->table = table;
+    hcf->size = n;
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_jump_hash(uint64_t key, ngx_uint_t n)
+{
+    int64_t  b, j;
+
+    /* "A Fast, Minimal Memory, Consistent Hash Algorithm", Lamping, Veach */
+
+    b = -1;
+    j = 0;
+
+    while (j < (int64_t) n) {
+        b = j;
+        key = key * 2862933555777941757ULL + 1;
+        j = (int64_t) ((b + 1) * ((double) (1LL << 31)
+                                  / (double) ((key >> 33) + 1)));
+    }
+
+    return (ngx_uint_t) b;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_table_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_upstream_hash_srv_conf_t   *hcf;
+    ngx_http_upstream_hash_peer_data_t  *hp;
+
+    if (ngx_http_upstream_init_hash_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.get = ngx_http_upstream_get_table_peer;
+
+    hp = r->upstream->peer.data;
+    hcf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_hash_module);
+
+    if (ngx_http_upstream_hash_index_peers(hcf, hp->rrp.peers) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    hp->hash = ngx_crc32_long(hp->key.data, hp->key.len);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_table_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_hash_peer_data_t  *hp = data;
+
+    time_t                              now;
+    uint64_t                            key;
+    uintptr_t                           m;
+    ngx_uint_t                          n, p;
+    ngx_http_upstream_rr_peer_t        *peer;
+    ngx_http_upstream_hash_srv_conf_t  *hcf;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get hash table peer, try: %ui", pc->tries);
+
+    ngx_http_upstream_rr_peers_wlock(hp->rrp.peers);
+
+    if (hp->tries > 20 || hp->rrp.peers->single) {
+        ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+        return hp->get_rr_peer(pc, &hp->rrp);
+    }
+
+    now = ngx_time();
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    hcf = hp->conf;
+
+    for ( ;; ) {
+
+        /* the next tries take the next table entries or other jump keys */
+
+        if (hcf->method == NGX_HTTP_UPSTREAM_HASH_MAGLEV) {
+            p = hcf->table[(hp->hash + hp->tries) % hcf->size];
+
+        } else {
+            key = hp->hash | (uint64_t) hp->tries << 32;
+            p = hcf->table[ngx_http_upstream_jump_hash(key, hcf->size)];
+        }
+
+        peer = hcf->peer[p];
+
+        n = p / (8 * sizeof(uintptr_t));
+        m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
+
+        if (hp->rrp.tried[n] & m) {
+            goto next;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get hash table peer, value:%uD, peer:%ui",
+                       hp->hash, p);
+
+        if (peer->down) {
+            goto next;
+        }
+
+        if (peer->max_fails
+            && peer->fails >= peer->max_fails
+            && now - peer->checked <= peer->fail_timeout)
+        {
+            goto next;
+        }
+
+        break;
+
+    next:
+
+        if (++hp->tries > 20) {
+            ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+            return hp->get_rr_peer(pc, &hp->rrp);
+        }
+    }
+
+    hp->rrp.current = peer;
+
+    pc->sockaddr = peer->sockaddr;
+    pc->socklen = peer->socklen;
+    pc->name = &peer->name;
+
+    peer->conns++;
+    (void) ngx_atomic_fetch_add(&hp->rrp.peers->conns, 1);
+
+    if (now - peer->checked > peer->fail_timeout) {
+        peer->checked = now;
+    }
+
+    ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+
+    hp->rrp.tried[n] |= m;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hash_index_peers(ngx_http_upstream_hash_srv_conf_t *hcf,
+    ngx_http_upstream_rr_peers_t *peers)
+{
+    ngx_uint_t                    i;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    if (hcf->indexed == peers) {
+        return NGX_OK;
+    }
+
+    hcf->peer = ngx_palloc(ngx_cycle->pool,
+                           peers->number
+                           * sizeof(ngx_http_upstream_rr_peer_t *));
+    if (hcf->peer == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (peer = peers->peer, i = 0; peer; peer = peer->next, i++) {
+        hcf->peer[i] = peer;
+    }
+
+    hcf->indexed = peers;
+
+    return NGX_OK;
+}
+
+
 static void *
 ngx_http_upstream_hash_create_conf(ngx_conf_t *cf)
 {
     ngx_http_upstream_hash_srv_conf_t  *conf;
 
-    conf = ngx_palloc(cf->pool, sizeof(ngx_http_upstream_hash_srv_conf_t));
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_hash_srv_conf_t));
     if (conf == NULL) {
         return NULL;
     }
 
-    conf->points = NULL;
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->points = NULL;
+     *     conf->bounded = 0;
+     *     conf->method = 0;
+     *     conf->table = NULL;
+     *     conf->indexed = NULL;
+     *     conf->peer = NULL;
+     */
 
     return conf;
 }
@@ -622,6 +1102,7 @@ ngx_http_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_upstream_hash_srv_conf_t  *hcf = conf;
 
+    ngx_int_t                          bounded;
     ngx_str_t                         *value;
     ngx_http_upstream_srv_conf_t      *uscf;
     ngx_http_compile_complex_value_t   ccv;
@@ -657,11 +1138,38 @@ ngx_http_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     } else if (ngx_strcmp(value[2].data, "consistent") == 0) {
         uscf->peer.init_upstream = ngx_http_upstream_init_chash;
 
+    } else if (ngx_strcmp(value[2].data, "maglev") == 0) {
+        uscf->peer.init_upstream = ngx_http_upstream_init_maglev;
+
+    } else if (ngx_strcmp(value[2].data, "jump") == 0) {
+        uscf->peer.init_upstream = ngx_http_upstream_init_jump;
+
     } else {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[2]);
         return NGX_CONF_ERROR;
     }
 
+    if (cf->args->nelts == 4) {
+
+        if (uscf->peer.init_upstream != ngx_http_upstream_init_chash
+            || ngx_strncmp(value[3].data, "bounded=", 8) != 0)
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[3]);
+            return NGX_CONF_ERROR;
+        }
+
+        bounded = ngx_atofp(value[3].data + 8, value[3].len - 8, 2);
+
+        if (bounded < 100) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid load factor \"%V\"", &value[3]);
+            return NGX_CONF_ERROR;
+        }
+
+        hcf->bounded = bounded;
+    }
+
     return NGX_CONF_OK;
 }
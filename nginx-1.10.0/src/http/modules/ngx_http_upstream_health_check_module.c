@@ -0,0 +1,703 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+typedef struct {
+    ngx_msec_t                          interval;
+    ngx_msec_t                          timeout;
+    ngx_uint_t                          fails;
+    ngx_uint_t                          passes;
+
+    /* an empty request means that only the connection is checked */
+    ngx_str_t                           request;
+} ngx_http_upstream_hc_srv_conf_t;
+
+
+typedef struct {
+    ngx_http_upstream_hc_srv_conf_t    *conf;
+    ngx_http_upstream_rr_peers_t       *peers;
+    ngx_http_upstream_rr_peer_t        *peer;
+
+    ngx_event_t                         event;
+    ngx_peer_connection_t               pc;
+
+    size_t                              sent;
+    u_char                             *last;
+    u_char                              status[16];
+
+    ngx_uint_t                          fails;
+    ngx_uint_t                          passes;
+} ngx_http_upstream_hc_peer_t;
+
+
+static ngx_int_t ngx_http_upstream_hc_add_peers(ngx_cycle_t *cycle,
+    ngx_http_upstream_hc_srv_conf_t *hcf, ngx_http_upstream_rr_peers_t *peers);
+static void ngx_http_upstream_hc_handler(ngx_event_t *ev);
+static void ngx_http_upstream_hc_write_handler(ngx_event_t *wev);
+static void ngx_http_upstream_hc_read_handler(ngx_event_t *rev);
+static void ngx_http_upstream_hc_dummy_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_upstream_hc_test_connect(ngx_connection_t *c);
+static void ngx_http_upstream_hc_done(ngx_http_upstream_hc_peer_t *hp,
+    ngx_uint_t ok);
+
+static void *ngx_http_upstream_hc_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_hc_init_main_conf(ngx_conf_t *cf, void *conf);
+static char *ngx_http_upstream_health_check(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_upstream_hc_init_process(ngx_cycle_t *cycle);
+
+
+static ngx_command_t  ngx_http_upstream_hc_commands[] = {
+
+    { ngx_string("health_check"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_ANY,
+      ngx_http_upstream_health_check,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_hc_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    ngx_http_upstream_hc_init_main_conf,   /* init main configuration */
+
+    ngx_http_upstream_hc_create_conf,      /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_health_check_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_hc_module_ctx,      /* module context */
+    ngx_http_upstream_hc_commands,         /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_http_upstream_hc_init_process,     /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_hc_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                         i;
+    ngx_http_upstream_rr_peers_t      *peers;
+    ngx_http_upstream_srv_conf_t     **uscfp;
+    ngx_http_upstream_main_conf_t     *umcf;
+    ngx_http_upstream_hc_srv_conf_t   *hcf;
+
+    /*
+     * the peers are checked by the first worker only, the results are
+     * shared with other workers through the upstream zone
+     */
+
+    if ((ngx_process != NGX_PROCESS_WORKER
+         && ngx_process != NGX_PROCESS_SINGLE)
+        || ngx_worker != 0)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        hcf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                         ngx_http_upstream_health_check_module);
+
+        if (hcf->interval == NGX_CONF_UNSET_MSEC) {
+            continue;
+        }
+
+        for (peers = uscfp[i]->peer.data; peers; peers = peers->next) {
+            if (ngx_http_upstream_hc_add_peers(cycle, hcf, peers) != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hc_add_peers(ngx_cycle_t *cycle,
+    ngx_http_upstream_hc_srv_conf_t *hcf, ngx_http_upstream_rr_peers_t *peers)
+{
+    ngx_http_upstream_rr_peer_t  *peer;
+    ngx_http_upstream_hc_peer_t  *hp;
+
+    for (peer = peers->peer; peer; peer = peer->next) {
+
+        if (peer->down) {
+            continue;
+        }
+
+        hp = ngx_pcalloc(cycle->pool, sizeof(ngx_http_upstream_hc_peer_t));
+        if (hp == NULL) {
+            return NGX_ERROR;
+        }
+
+        hp->conf = hcf;
+        hp->peers = peers;
+        hp->peer = peer;
+
+        hp->event.handler = ngx_http_upstream_hc_handler;
+        hp->event.data = hp;
+        hp->event.log = cycle->log;
+        hp->event.cancelable = 1;
+
+        /* spread the first checks over the interval */
+
+        ngx_add_timer(&hp->event, ngx_random() % hcf->interval + 1);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_hc_handler(ngx_event_t *ev)
+{
+    ngx_int_t                     rc;
+    ngx_connection_t             *c;
+    ngx_http_upstream_hc_peer_t  *hp;
+
+    hp = ev->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "health check %V", &hp->peer->name);
+
+    ngx_memzero(&hp->pc, sizeof(ngx_peer_connection_t));
+
+    hp->pc.sockaddr = hp->peer->sockaddr;
+    hp->pc.socklen = hp->peer->socklen;
+    hp->pc.name = &hp->peer->name;
+    hp->pc.get = ngx_event_get_peer;
+    hp->pc.log = ev->log;
+    hp->pc.log_error = NGX_ERROR_ERR;
+
+    rc = ngx_event_connect_peer(&hp->pc);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        ngx_http_upstream_hc_done(hp, 0);
+        return;
+    }
+
+    c = hp->pc.connection;
+
+    c->data = hp;
+
+    c->write->handler = ngx_http_upstream_hc_write_handler;
+
+    if (hp->conf->request.len) {
+        c->read->handler = ngx_http_upstream_hc_read_handler;
+        ngx_add_timer(c->read, hp->conf->timeout);
+
+    } else {
+        c->read->handler = ngx_http_upstream_hc_dummy_handler;
+    }
+
+    hp->sent = 0;
+    hp->last = hp->status;
+
+    ngx_add_timer(c->write, hp->conf->timeout);
+
+    if (rc == NGX_OK) {
+        ngx_http_upstream_hc_write_handler(c->write);
+    }
+}
+
+
+static void
+ngx_http_upstream_hc_write_handler(ngx_event_t *wev)
+{
+    ssize_t                       n, size;
+    ngx_connection_t             *c;
+    ngx_http_upstream_hc_peer_t  *hp;
+
+    c = wev->data;
+    hp = c->data;
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, wev->log, NGX_ETIMEDOUT,
+                      "health check of %V timed out", &hp->peer->name);
+        ngx_http_upstream_hc_done(hp, 0);
+        return;
+    }
+
+    if (hp->sent == 0 && ngx_http_upstream_hc_test_connect(c) != NGX_OK) {
+        ngx_http_upstream_hc_done(hp, 0);
+        return;
+    }
+
+    size = hp->conf->request.len - hp->sent;
+
+    if (size == 0) {
+
+        /* the connection is established, nothing to send */
+
+        ngx_http_upstream_hc_done(hp, 1);
+        return;
+    }
+
+    n = ngx_send(c, hp->conf->request.data + hp->sent, size);
+
+    if (n == NGX_ERROR) {
+        ngx_http_upstream_hc_done(hp, 0);
+        return;
+    }
+
+    if (n > 0) {
+        hp->sent += n;
+
+        if (n == size) {
+            wev->handler = ngx_http_upstream_hc_dummy_handler;
+
+            if (wev->timer_set) {
+                ngx_del_timer(wev);
+            }
+
+            if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+                ngx_http_upstream_hc_done(hp, 0);
+            }
+
+            return;
+        }
+    }
+
+    if (!wev->timer_set) {
+        ngx_add_timer(wev, hp->conf->timeout);
+    }
+}
+
+
+static void
+ngx_http_upstream_hc_read_handler(ngx_event_t *rev)
+{
+    u_char                       *p;
+    ssize_t                       n;
+    ngx_uint_t                    status;
+    ngx_connection_t             *c;
+    ngx_http_upstream_hc_peer_t  *hp;
+
+    c = rev->data;
+    hp = c->data;
+
+    if (rev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, rev->log, NGX_ETIMEDOUT,
+                      "health check of %V timed out", &hp->peer->name);
+        ngx_http_upstream_hc_done(hp, 0);
+        return;
+    }
+
+    /* only the status line "HTTP/1.x NNN " is looked at */
+
+    for ( ;; ) {
+
+        if (hp->last - hp->status >= 13) {
+            p = hp->status;
+
+            if (ngx_strncmp(p, "HTTP/1.", 7) != 0 || p[8] != ' '
+                || p[9] < '1' || p[9] > '5'
+                || p[10] < '0' || p[10] > '9'
+                || p[11] < '0' || p[11] > '9')
+            {
+                ngx_log_error(NGX_LOG_ERR, rev->log, 0,
+                              "health check of %V: invalid response",
+                              &hp->peer->name);
+                ngx_http_upstream_hc_done(hp, 0);
+                return;
+            }
+
+            status = (p[9] - '0') * 100 + (p[10] - '0') * 10 + p[11] - '0';
+
+            if (status >= 200 && status < 400) {
+                ngx_http_upstream_hc_done(hp, 1);
+                return;
+            }
+
+            ngx_log_error(NGX_LOG_ERR, rev->log, 0,
+                          "health check of %V: status %ui",
+                          &hp->peer->name, status);
+            ngx_http_upstream_hc_done(hp, 0);
+            return;
+        }
+
+        n = ngx_recv(c, hp->last, hp->status + 13 - hp->last);
+
+        if (n > 0) {
+            hp->last += n;
+            continue;
+        }
+
+        if (n == NGX_AGAIN) {
+
+            if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+                ngx_http_upstream_hc_done(hp, 0);
+            }
+
+            return;
+        }
+
+        break;
+    }
+
+    ngx_log_error(NGX_LOG_ERR, rev->log, 0,
+                  "health check of %V: connection closed prematurely",
+                  &hp->peer->name);
+
+    ngx_http_upstream_hc_done(hp, 0);
+}
+
+
+static void
+ngx_http_upstream_hc_dummy_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "health check dummy handler");
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hc_test_connect(ngx_connection_t *c)
+{
+    int        err;
+    socklen_t  len;
+
+#if (NGX_HAVE_KQUEUE)
+
+    if (ngx_event_flags & NGX_USE_KQUEUE_EVENT)  {
+        if (c->write->pending_eof || c->read->pending_eof) {
+            if (c->write->pending_eof) {
+                err = c->write->kq_errno;
+
+            } else {
+                err = c->read->kq_errno;
+            }
+
+            (void) ngx_connection_error(c, err,
+                                    "kevent() reported that connect() failed");
+            return NGX_ERROR;
+        }
+
+    } else
+#endif
+    {
+        err = 0;
+        len = sizeof(int);
+
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
+            == -1)
+        {
+            err = ngx_socket_errno;
+        }
+
+        if (err) {
+            (void) ngx_connection_error(c, err, "connect() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_hc_done(ngx_http_upstream_hc_peer_t *hp, ngx_uint_t ok)
+{
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, hp->event.log, 0,
+                   "health check %V done: %ui", &hp->peer->name, ok);
+
+    if (hp->pc.connection) {
+        ngx_close_connection(hp->pc.connection);
+        hp->pc.connection = NULL;
+    }
+
+    peer = hp->peer;
+
+    if (ok) {
+        hp->fails = 0;
+        hp->passes++;
+
+        if ((peer->down & NGX_HTTP_UPSTREAM_RR_CHECK_DOWN)
+            && hp->passes >= hp->conf->passes)
+        {
+            ngx_log_error(NGX_LOG_WARN, hp->event.log, 0,
+                          "upstream server %V in \"%V\" passed health checks",
+                          &peer->name, hp->peers->name);
+
+            ngx_http_upstream_rr_peers_wlock(hp->peers);
+
+            peer->down &= ~NGX_HTTP_UPSTREAM_RR_CHECK_DOWN;
+            peer->fails = 0;
+
+            if (peer->slow_start) {
+                peer->slow_start_time = ngx_current_msec;
+                peer->current_weight = 0;
+                hp->peers->degraded = 1;
+            }
+
+            ngx_http_upstream_rr_peers_unlock(hp->peers);
+        }
+
+    } else {
+        hp->passes = 0;
+        hp->fails++;
+
+        if (!(peer->down & NGX_HTTP_UPSTREAM_RR_CHECK_DOWN)
+            && hp->fails >= hp->conf->fails)
+        {
+            ngx_log_error(NGX_LOG_WARN, hp->event.log, 0,
+                          "upstream server %V in \"%V\" failed health checks",
+                          &peer->name, hp->peers->name);
+
+            ngx_http_upstream_rr_peers_wlock(hp->peers);
+
+            peer->down |= NGX_HTTP_UPSTREAM_RR_CHECK_DOWN;
+
+            ngx_http_upstream_rr_peers_unlock(hp->peers);
+        }
+    }
+
+    if (!ngx_exiting) {
+        ngx_add_timer(&hp->event, hp->conf->interval);
+    }
+}
+
+
+static void *
+ngx_http_upstream_hc_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_hc_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_hc_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->request = { 0, NULL };
+     */
+
+    conf->interval = NGX_CONF_UNSET_MSEC;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_hc_init_main_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_uint_t                         i;
+    ngx_http_upstream_srv_conf_t     **uscfp;
+    ngx_http_upstream_main_conf_t     *umcf;
+    ngx_http_upstream_hc_srv_conf_t   *hcf;
+
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        hcf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                         ngx_http_upstream_health_check_module);
+
+        if (hcf->interval == NGX_CONF_UNSET_MSEC) {
+            continue;
+        }
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (uscfp[i]->shm_zone) {
+            continue;
+        }
+#endif
+
+        ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                      "health check requires \"zone\" in upstream \"%V\" "
+                      "in %s:%ui",
+                      &uscfp[i]->host, uscfp[i]->file_name, uscfp[i]->line);
+
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_upstream_health_check(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_hc_srv_conf_t  *hcf = conf;
+
+    u_char                        *p;
+    ngx_str_t                     *value, s, uri;
+    ngx_int_t                      n;
+    ngx_uint_t                     i, tcp;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    if (hcf->interval != NGX_CONF_UNSET_MSEC) {
+        return "is duplicate";
+    }
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    hcf->interval = 5000;
+    hcf->timeout = 1000;
+    hcf->fails = 1;
+    hcf->passes = 1;
+
+    ngx_str_set(&uri, "/");
+    tcp = 0;
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            hcf->interval = ngx_parse_time(&s, 0);
+
+            if (hcf->interval == (ngx_msec_t) NGX_ERROR
+                || hcf->interval == 0)
+            {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "timeout=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = value[i].data + 8;
+
+            hcf->timeout = ngx_parse_time(&s, 0);
+
+            if (hcf->timeout == (ngx_msec_t) NGX_ERROR || hcf->timeout == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "fails=", 6) == 0) {
+
+            n = ngx_atoi(value[i].data + 6, value[i].len - 6);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            hcf->fails = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "passes=", 7) == 0) {
+
+            n = ngx_atoi(value[i].data + 7, value[i].len - 7);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            hcf->passes = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "uri=", 4) == 0) {
+
+            uri.len = value[i].len - 4;
+            uri.data = value[i].data + 4;
+
+            if (uri.len == 0 || uri.data[0] != '/') {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "type=tcp") == 0) {
+            tcp = 1;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "type=http") == 0) {
+            tcp = 0;
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    if (tcp) {
+        return NGX_CONF_OK;
+    }
+
+    hcf->request.len = sizeof("GET  HTTP/1.0" CRLF) - 1 + uri.len
+                       + sizeof("Host: " CRLF) - 1 + uscf->host.len
+                       + sizeof("Connection: close" CRLF CRLF) - 1;
+
+    hcf->request.data = ngx_pnalloc(cf->pool, hcf->request.len);
+    if (hcf->request.data == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    p = ngx_sprintf(hcf->request.data, "GET %V HTTP/1.0" CRLF, &uri);
+    p = ngx_sprintf(p, "Host: %V" CRLF, &uscf->host);
+    ngx_memcpy(p, "Connection: close" CRLF CRLF,
+               sizeof("Connection: close" CRLF CRLF) - 1);
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
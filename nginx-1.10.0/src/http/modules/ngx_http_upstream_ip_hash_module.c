@@ -229,6 +229,7 @@ ngx_http_upstream_get_ip_hash_peer(ngx_peer_connection_t *pc, void *data)
     pc->name = &peer->name;
 
     peer->conns++;
+    (void) ngx_atomic_fetch_add(&iphp->rrp.peers->conns, 1);
 
     if (now - peer->checked > peer->fail_timeout) {
         peer->checked = now;
@@ -12,10 +12,17 @@
 
 typedef struct {
     ngx_uint_t                         max_cached;
+    ngx_uint_t                         max_per_peer;
+    ngx_uint_t                         requests;
+    ngx_msec_t                         timeout;
 
     ngx_queue_t                        cache;
     ngx_queue_t                        free;
 
+    /* cached connections hashed by peer address */
+    ngx_queue_t                       *buckets;
+    ngx_uint_t                         mask;
+
     ngx_http_upstream_init_pt          original_init_upstream;
     ngx_http_upstream_init_peer_pt     original_init_peer;
 
@@ -26,8 +33,10 @@ typedef struct {
     ngx_http_upstream_keepalive_srv_conf_t  *conf;
 
     ngx_queue_t                        queue;
+    ngx_queue_t                        bucket;
     ngx_connection_t                  *connection;
 
+    uint32_t                           hash;
     socklen_t                          socklen;
     u_char                             sockaddr[NGX_SOCKADDRLEN];
 
@@ -62,6 +71,8 @@ static void ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc,
 static void ngx_http_upstream_keepalive_dummy_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close(ngx_connection_t *c);
+static void ngx_http_upstream_keepalive_evict(
+    ngx_http_upstream_keepalive_cache_t *item);
 
 #if (NGX_HTTP_SSL)
 static ngx_int_t ngx_http_upstream_keepalive_set_session(
@@ -78,12 +89,26 @@ static char *ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd,
 static ngx_command_t  ngx_http_upstream_keepalive_commands[] = {
 
     { ngx_string("keepalive"),
-      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
       ngx_http_upstream_keepalive,
       NGX_HTTP_SRV_CONF_OFFSET,
       0,
       NULL },
 
+    { ngx_string("keepalive_timeout"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_upstream_keepalive_srv_conf_t, timeout),
+      NULL },
+
+    { ngx_string("keepalive_requests"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_upstream_keepalive_srv_conf_t, requests),
+      NULL },
+
       ngx_null_command
 };
 
@@ -123,7 +148,7 @@ static ngx_int_t
 ngx_http_upstream_init_keepalive(ngx_conf_t *cf,
     ngx_http_upstream_srv_conf_t *us)
 {
-    ngx_uint_t                               i;
+    ngx_uint_t                               i, n;
     ngx_http_upstream_keepalive_srv_conf_t  *kcf;
     ngx_http_upstream_keepalive_cache_t     *cached;
 
@@ -133,6 +158,9 @@ ngx_http_upstream_init_keepalive(ngx_conf_t *cf,
     kcf = ngx_http_conf_upstream_srv_conf(us,
                                           ngx_http_upstream_keepalive_module);
 
+    ngx_conf_init_msec_value(kcf->timeout, 60000);
+    ngx_conf_init_uint_value(kcf->requests, 1000);
+
     if (kcf->original_init_upstream(cf, us) != NGX_OK) {
         return NGX_ERROR;
     }
@@ -157,6 +185,21 @@ ngx_http_upstream_init_keepalive(ngx_conf_t *cf,
         cached[i].conf = kcf;
     }
 
+    /* about one peer address per bucket */
+
+    for (n = 1; n < kcf->max_cached; n <<= 1) { /* void */ }
+
+    kcf->buckets = ngx_palloc(cf->pool, n * sizeof(ngx_queue_t));
+    if (kcf->buckets == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < n; i++) {
+        ngx_queue_init(&kcf->buckets[i]);
+    }
+
+    kcf->mask = n - 1;
+
     return NGX_OK;
 }
 
@@ -211,7 +254,8 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
     ngx_http_upstream_keepalive_cache_t      *item;
 
     ngx_int_t          rc;
-    ngx_queue_t       *q, *cache;
+    uint32_t           hash;
+    ngx_queue_t       *q, *bucket;
     ngx_connection_t  *c;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
@@ -225,28 +269,36 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
         return rc;
     }
 
-    /* search cache for suitable connection */
+    /* search the peer's bucket for the most recently used connection */
 
-    cache = &kp->conf->cache;
+    hash = ngx_crc32_short((u_char *) pc->sockaddr, pc->socklen);
+    bucket = &kp->conf->buckets[hash & kp->conf->mask];
 
-    for (q = ngx_queue_head(cache);
-         q != ngx_queue_sentinel(cache);
+    for (q = ngx_queue_head(bucket);
+         q != ngx_queue_sentinel(bucket);
          q = ngx_queue_next(q))
     {
-        item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
+        item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, bucket);
         c = item->connection;
 
-        if (ngx_memn2cmp((u_char *) &item->sockaddr, (u_char *) pc->sockaddr,
-                         item->socklen, pc->socklen)
-            == 0)
+        if (item->hash == hash
+            && ngx_memn2cmp((u_char *) &item->sockaddr,
+                            (u_char *) pc->sockaddr,
+                            item->socklen, pc->socklen)
+               == 0)
         {
             ngx_queue_remove(q);
-            ngx_queue_insert_head(&kp->conf->free, q);
+            ngx_queue_remove(&item->queue);
+            ngx_queue_insert_head(&kp->conf->free, &item->queue);
 
             goto found;
         }
     }
 
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_upstream_keepalive_connects, 1);
+#endif
+
     return NGX_OK;
 
 found:
@@ -254,6 +306,14 @@ found:
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "get keepalive peer: using connection %p", c);
 
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_upstream_keepalive_reused, 1);
+#endif
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
     c->idle = 0;
     c->sent = 0;
     c->log = pc->log;
@@ -273,9 +333,11 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     ngx_uint_t state)
 {
     ngx_http_upstream_keepalive_peer_data_t  *kp = data;
-    ngx_http_upstream_keepalive_cache_t      *item;
+    ngx_http_upstream_keepalive_cache_t      *item, *cached;
 
-    ngx_queue_t          *q;
+    uint32_t              hash;
+    ngx_uint_t            n;
+    ngx_queue_t          *q, *bucket;
     ngx_connection_t     *c;
     ngx_http_upstream_t  *u;
 
@@ -306,6 +368,10 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
         goto invalid;
     }
 
+    if (++c->requests >= kp->conf->requests) {
+        goto invalid;
+    }
+
     if (ngx_terminate || ngx_exiting) {
         goto invalid;
     }
@@ -317,14 +383,47 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "free keepalive peer: saving connection %p", c);
 
-    if (ngx_queue_empty(&kp->conf->free)) {
+    hash = ngx_crc32_short((u_char *) pc->sockaddr, pc->socklen);
+    bucket = &kp->conf->buckets[hash & kp->conf->mask];
 
-        q = ngx_queue_last(&kp->conf->cache);
-        ngx_queue_remove(q);
+    item = NULL;
+
+    if (kp->conf->max_per_peer) {
 
+        /* find the least recently used connection of the peer */
+
+        n = 0;
+
+        for (q = ngx_queue_head(bucket);
+             q != ngx_queue_sentinel(bucket);
+             q = ngx_queue_next(q))
+        {
+            cached = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t,
+                                    bucket);
+
+            if (cached->hash == hash
+                && ngx_memn2cmp((u_char *) &cached->sockaddr,
+                                (u_char *) pc->sockaddr,
+                                cached->socklen, pc->socklen)
+                   == 0)
+            {
+                item = cached;
+                n++;
+            }
+        }
+
+        if (n < kp->conf->max_per_peer) {
+            item = NULL;
+        }
+    }
+
+    if (item == NULL && ngx_queue_empty(&kp->conf->free)) {
+        q = ngx_queue_last(&kp->conf->cache);
         item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
+    }
 
-        ngx_http_upstream_keepalive_close(item->connection);
+    if (item) {
+        ngx_http_upstream_keepalive_evict(item);
 
     } else {
         q = ngx_queue_head(&kp->conf->free);
@@ -333,9 +432,11 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
         item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
     }
 
-    ngx_queue_insert_head(&kp->conf->cache, q);
+    ngx_queue_insert_head(&kp->conf->cache, &item->queue);
+    ngx_queue_insert_head(bucket, &item->bucket);
 
     item->connection = c;
+    item->hash = hash;
 
     pc->connection = NULL;
 
@@ -346,6 +447,8 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
         ngx_del_timer(c->write);
     }
 
+    ngx_add_timer(c->read, kp->conf->timeout);
+
     c->write->handler = ngx_http_upstream_keepalive_dummy_handler;
     c->read->handler = ngx_http_upstream_keepalive_close_handler;
 
@@ -392,7 +495,7 @@ ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev)
 
     c = ev->data;
 
-    if (c->close) {
+    if (c->close || ev->timedout) {
         goto close;
     }
 
@@ -413,13 +516,29 @@ close:
     item = c->data;
     conf = item->conf;
 
-    ngx_http_upstream_keepalive_close(c);
+    ngx_http_upstream_keepalive_evict(item);
 
-    ngx_queue_remove(&item->queue);
     ngx_queue_insert_head(&conf->free, &item->queue);
 }
 
 
+static void
+ngx_http_upstream_keepalive_evict(ngx_http_upstream_keepalive_cache_t *item)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "keepalive evict connection %p", item->connection);
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_upstream_keepalive_closed, 1);
+#endif
+
+    ngx_queue_remove(&item->queue);
+    ngx_queue_remove(&item->bucket);
+
+    ngx_http_upstream_keepalive_close(item->connection);
+}
+
+
 static void
 ngx_http_upstream_keepalive_close(ngx_connection_t *c)
 {
@@ -483,8 +602,13 @@ ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf)
      *     conf->original_init_upstream = NULL;
      *     conf->original_init_peer = NULL;
      *     conf->max_cached = 0;
+     *     conf->max_per_peer = 0;
+     *     conf->buckets = NULL;
      */
 
+    conf->timeout = NGX_CONF_UNSET_MSEC;
+    conf->requests = NGX_CONF_UNSET_UINT;
+
     return conf;
 }
 
@@ -517,6 +641,21 @@ ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     kcf->max_cached = n;
 
+    if (cf->args->nelts == 3) {
+
+        if (ngx_strncmp(value[2].data, "max_per_peer=", 13) != 0) {
+            goto invalid;
+        }
+
+        n = ngx_atoi(&value[2].data[13], value[2].len - 13);
+
+        if (n == NGX_ERROR || n == 0) {
+            goto invalid;
+        }
+
+        kcf->max_per_peer = n;
+    }
+
     uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
 
     kcf->original_init_upstream = uscf->peer.init_upstream
@@ -526,4 +665,11 @@ ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     uscf->peer.init_upstream = ngx_http_upstream_init_keepalive;
 
     return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[2]);
+
+    return NGX_CONF_ERROR;
 }
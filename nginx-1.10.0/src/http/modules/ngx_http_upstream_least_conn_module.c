@@ -235,6 +235,7 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
     pc->name = &best->name;
 
     best->conns++;
+    (void) ngx_atomic_fetch_add(&peers->conns, 1);
 
     rrp->current = best;
 
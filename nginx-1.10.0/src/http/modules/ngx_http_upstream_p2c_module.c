@@ -0,0 +1,520 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_UPSTREAM_P2C_SAMPLES  20
+
+
+typedef struct {
+    ngx_http_upstream_rr_peers_t       *peers;
+    ngx_http_upstream_rr_peer_t       **peer;
+} ngx_http_upstream_p2c_index_t;
+
+
+typedef struct {
+    ngx_msec_t                          decay;
+
+    /* per worker, as the peers may be moved to a shared zone */
+    ngx_http_upstream_p2c_index_t       index[2];
+} ngx_http_upstream_p2c_srv_conf_t;
+
+
+typedef struct {
+    /* the round robin data must be first */
+    ngx_http_upstream_rr_peer_data_t    rrp;
+    ngx_http_upstream_p2c_srv_conf_t   *conf;
+    ngx_uint_t                          backup;
+    ngx_msec_t                          start;
+} ngx_http_upstream_p2c_peer_data_t;
+
+
+static ngx_int_t ngx_http_upstream_init_p2c_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_p2c_peer(ngx_peer_connection_t *pc,
+    void *data);
+static void ngx_http_upstream_free_p2c_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+static ngx_uint_t ngx_http_upstream_p2c_available(
+    ngx_http_upstream_rr_peer_data_t *rrp, ngx_http_upstream_rr_peer_t *peer,
+    ngx_uint_t i, time_t now);
+static ngx_uint_t ngx_http_upstream_p2c_ewma(
+    ngx_http_upstream_rr_peer_t *peer, ngx_msec_t decay);
+static ngx_http_upstream_rr_peer_t **ngx_http_upstream_p2c_index_peers(
+    ngx_http_upstream_p2c_srv_conf_t *pcf, ngx_http_upstream_rr_peers_t *peers,
+    ngx_uint_t backup);
+
+static void *ngx_http_upstream_p2c_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_p2c(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_p2c_commands[] = {
+
+    { ngx_string("p2c"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE1,
+      ngx_http_upstream_p2c,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_p2c_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_p2c_create_conf,     /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_p2c_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_p2c_module_ctx,     /* module context */
+    ngx_http_upstream_p2c_commands,        /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_init_p2c(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "init p2c");
+
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_http_upstream_init_p2c_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_p2c_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_upstream_p2c_peer_data_t  *pp;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "init p2c peer");
+
+    pp = ngx_palloc(r->pool, sizeof(ngx_http_upstream_p2c_peer_data_t));
+    if (pp == NULL) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.data = &pp->rrp;
+
+    if (ngx_http_upstream_init_round_robin_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.get = ngx_http_upstream_get_p2c_peer;
+    r->upstream->peer.free = ngx_http_upstream_free_p2c_peer;
+
+    pp->conf = ngx_http_conf_upstream_srv_conf(us,
+                                               ngx_http_upstream_p2c_module);
+    pp->backup = 0;
+    pp->start = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_p2c_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_p2c_peer_data_t  *pp = data;
+
+    time_t                         now;
+    uint64_t                       one, two;
+    uintptr_t                      m;
+    ngx_int_t                      rc;
+    ngx_uint_t                     i, n, p, k;
+    ngx_http_upstream_rr_peer_t   *peer, *best, **index;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get p2c peer, try: %ui", pc->tries);
+
+    pp->start = ngx_current_msec;
+
+    if (pp->rrp.peers->single) {
+        return ngx_http_upstream_get_round_robin_peer(pc, &pp->rrp);
+    }
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    now = ngx_time();
+
+    peers = pp->rrp.peers;
+
+    index = ngx_http_upstream_p2c_index_peers(pp->conf, peers, pp->backup);
+    if (index == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    /*
+     * sample two distinct available peers at random and select the one
+     * with the lower product of in-flight requests and the response time
+     * EWMA, per unit of weight
+     */
+
+    best = NULL;
+    p = 0;
+
+    for (k = 0; k < NGX_HTTP_UPSTREAM_P2C_SAMPLES; k++) {
+
+        i = ngx_random() % peers->number;
+        peer = index[i];
+
+        if (peer == best
+            || !ngx_http_upstream_p2c_available(&pp->rrp, peer, i, now))
+        {
+            continue;
+        }
+
+        if (best == NULL) {
+            best = peer;
+            p = i;
+            continue;
+        }
+
+        one = (uint64_t) (best->conns + 1)
+              * (ngx_http_upstream_p2c_ewma(best, pp->conf->decay) + 1)
+              * peer->weight;
+
+        two = (uint64_t) (peer->conns + 1)
+              * (ngx_http_upstream_p2c_ewma(peer, pp->conf->decay) + 1)
+              * best->weight;
+
+        ngx_log_debug4(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get p2c peer, choice: %V %uL or %V %uL",
+                       &best->name, one, &peer->name, two);
+
+        if (two < one) {
+            best = peer;
+            p = i;
+        }
+
+        break;
+    }
+
+    if (best == NULL) {
+
+        /* sampling missed, fall back to the first available peer */
+
+        k = ngx_random() % peers->number;
+
+        for (n = 0; n < peers->number; n++) {
+            i = (k + n) % peers->number;
+
+            if (ngx_http_upstream_p2c_available(&pp->rrp, index[i], i, now)) {
+                best = index[i];
+                p = i;
+                break;
+            }
+        }
+    }
+
+    if (best == NULL) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get p2c peer, no peer found");
+
+        goto failed;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get p2c peer: %V conns:%ui", &best->name, best->conns);
+
+    if (now - best->checked > best->fail_timeout) {
+        best->checked = now;
+    }
+
+    pc->sockaddr = best->sockaddr;
+    pc->socklen = best->socklen;
+    pc->name = &best->name;
+
+    best->conns++;
+    (void) ngx_atomic_fetch_add(&peers->conns, 1);
+
+    pp->rrp.current = best;
+
+    n = p / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
+
+    pp->rrp.tried[n] |= m;
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    return NGX_OK;
+
+failed:
+
+    if (peers->next) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get p2c peer, backup servers");
+
+        pp->rrp.peers = peers->next;
+        pp->backup = 1;
+
+        n = (pp->rrp.peers->number + (8 * sizeof(uintptr_t) - 1))
+                / (8 * sizeof(uintptr_t));
+
+        for (i = 0; i < n; i++) {
+            pp->rrp.tried[i] = 0;
+        }
+
+        ngx_http_upstream_rr_peers_unlock(peers);
+
+        rc = ngx_http_upstream_get_p2c_peer(pc, pp);
+
+        if (rc != NGX_BUSY) {
+            return rc;
+        }
+
+        ngx_http_upstream_rr_peers_wlock(peers);
+    }
+
+    /* all peers failed, mark them as live for quick recovery */
+
+    for (peer = peers->peer; peer; peer = peer->next) {
+        peer->fails = 0;
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    pc->name = peers->name;
+
+    return NGX_BUSY;
+}
+
+
+static void
+ngx_http_upstream_free_p2c_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_upstream_p2c_peer_data_t  *pp = data;
+
+    ngx_int_t                     sample;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    peer = pp->rrp.current;
+
+    /* the response time is measured in milliseconds, the EWMA is in us */
+
+    sample = (ngx_int_t) (ngx_current_msec - pp->start) * 1000;
+
+    ngx_http_upstream_rr_peers_rlock(pp->rrp.peers);
+    ngx_http_upstream_rr_peer_lock(pp->rrp.peers, peer);
+
+    if (state & NGX_PEER_FAILED) {
+
+        /* a failure, even a fast one, is never better than the average */
+
+        sample = ngx_max(sample, (ngx_int_t) peer->ewma * 2);
+        sample = ngx_max(sample, 1000);
+    }
+
+    if (peer->ewma_updated == 0) {
+        peer->ewma = sample;
+
+    } else {
+        peer->ewma = ngx_http_upstream_p2c_ewma(peer, pp->conf->decay);
+        peer->ewma += (sample - (ngx_int_t) peer->ewma) / 8;
+    }
+
+    peer->ewma_updated = ngx_current_msec ? ngx_current_msec : 1;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free p2c peer %V sample:%i ewma:%ui",
+                   &peer->name, sample, peer->ewma);
+
+    ngx_http_upstream_rr_peer_unlock(pp->rrp.peers, peer);
+    ngx_http_upstream_rr_peers_unlock(pp->rrp.peers);
+
+    ngx_http_upstream_free_round_robin_peer(pc, &pp->rrp, state);
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_p2c_available(ngx_http_upstream_rr_peer_data_t *rrp,
+    ngx_http_upstream_rr_peer_t *peer, ngx_uint_t i, time_t now)
+{
+    uintptr_t   m;
+    ngx_uint_t  n;
+
+    n = i / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+    if (rrp->tried[n] & m) {
+        return 0;
+    }
+
+    if (peer->down) {
+        return 0;
+    }
+
+    if (peer->max_fails
+        && peer->fails >= peer->max_fails
+        && now - peer->checked <= peer->fail_timeout)
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_p2c_ewma(ngx_http_upstream_rr_peer_t *peer,
+    ngx_msec_t decay)
+{
+    ngx_uint_t  shift;
+
+    /*
+     * the average halves for every decay interval without samples,
+     * so that a peer which was once slow is tried again eventually
+     */
+
+    shift = (ngx_msec_t) (ngx_current_msec - peer->ewma_updated) / decay;
+
+    if (shift >= 8 * sizeof(ngx_uint_t)) {
+        return 0;
+    }
+
+    return peer->ewma >> shift;
+}
+
+
+static ngx_http_upstream_rr_peer_t **
+ngx_http_upstream_p2c_index_peers(ngx_http_upstream_p2c_srv_conf_t *pcf,
+    ngx_http_upstream_rr_peers_t *peers, ngx_uint_t backup)
+{
+    ngx_uint_t                      i;
+    ngx_http_upstream_rr_peer_t    *peer;
+    ngx_http_upstream_p2c_index_t  *index;
+
+    index = &pcf->index[backup];
+
+    if (index->peers == peers) {
+        return index->peer;
+    }
+
+    index->peer = ngx_palloc(ngx_cycle->pool,
+                             peers->number
+                             * sizeof(ngx_http_upstream_rr_peer_t *));
+    if (index->peer == NULL) {
+        return NULL;
+    }
+
+    for (peer = peers->peer, i = 0; peer; peer = peer->next, i++) {
+        index->peer[i] = peer;
+    }
+
+    index->peers = peers;
+
+    return index->peer;
+}
+
+
+static void *
+ngx_http_upstream_p2c_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_p2c_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_p2c_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->index[0].peers = NULL;
+     *     conf->index[1].peers = NULL;
+     */
+
+    conf->decay = 10000;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_p2c(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_p2c_srv_conf_t  *pcf = conf;
+
+    ngx_str_t                     *value, s;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    value = cf->args->elts;
+
+    if (cf->args->nelts == 2) {
+
+        if (ngx_strncmp(value[1].data, "decay=", 6) != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+
+        s.len = value[1].len - 6;
+        s.data = value[1].data + 6;
+
+        pcf->decay = ngx_parse_time(&s, 0);
+
+        if (pcf->decay == (ngx_msec_t) NGX_ERROR || pcf->decay == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid decay \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    if (uscf->peer.init_upstream) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "load balancing method redefined");
+    }
+
+    uscf->peer.init_upstream = ngx_http_upstream_init_p2c;
+
+    uscf->flags = NGX_HTTP_UPSTREAM_CREATE
+                  |NGX_HTTP_UPSTREAM_WEIGHT
+                  |NGX_HTTP_UPSTREAM_MAX_FAILS
+                  |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
+                  |NGX_HTTP_UPSTREAM_DOWN
+                  |NGX_HTTP_UPSTREAM_BACKUP;
+
+    return NGX_CONF_OK;
+}
@@ -16,6 +16,8 @@ static ngx_int_t ngx_http_upstream_init_zone(ngx_shm_zone_t *shm_zone,
     void *data);
 static ngx_http_upstream_rr_peers_t *ngx_http_upstream_zone_copy_peers(
     ngx_slab_pool_t *shpool, ngx_http_upstream_srv_conf_t *uscf);
+static ngx_int_t ngx_http_upstream_zone_copy_index(ngx_slab_pool_t *shpool,
+    ngx_http_upstream_rr_peers_t *peers);
 
 
 static ngx_command_t  ngx_http_upstream_zone_commands[] = {
@@ -185,6 +187,7 @@ static ngx_http_upstream_rr_peers_t *
 ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
     ngx_http_upstream_srv_conf_t *uscf)
 {
+    ngx_uint_t                     i;
     ngx_http_upstream_rr_peer_t   *peer, **peerp;
     ngx_http_upstream_rr_peers_t  *peers, *backup;
 
@@ -197,7 +200,11 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
 
     peers->shpool = shpool;
 
-    for (peerp = &peers->peer; *peerp; peerp = &peer->next) {
+    if (ngx_http_upstream_zone_copy_index(shpool, peers) != NGX_OK) {
+        return NULL;
+    }
+
+    for (peerp = &peers->peer, i = 0; *peerp; peerp = &peer->next, i++) {
         /* pool is unlocked */
         peer = ngx_slab_calloc_locked(shpool,
                                       sizeof(ngx_http_upstream_rr_peer_t));
@@ -208,6 +215,10 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
         ngx_memcpy(peer, *peerp, sizeof(ngx_http_upstream_rr_peer_t));
 
         *peerp = peer;
+
+        if (peers->index) {
+            peers->index[i] = peer;
+        }
     }
 
     if (peers->next == NULL) {
@@ -223,7 +234,11 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
 
     backup->shpool = shpool;
 
-    for (peerp = &backup->peer; *peerp; peerp = &peer->next) {
+    if (ngx_http_upstream_zone_copy_index(shpool, backup) != NGX_OK) {
+        return NULL;
+    }
+
+    for (peerp = &backup->peer, i = 0; *peerp; peerp = &peer->next, i++) {
         /* pool is unlocked */
         peer = ngx_slab_calloc_locked(shpool,
                                       sizeof(ngx_http_upstream_rr_peer_t));
@@ -234,6 +249,10 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
         ngx_memcpy(peer, *peerp, sizeof(ngx_http_upstream_rr_peer_t));
 
         *peerp = peer;
+
+        if (backup->index) {
+            backup->index[i] = peer;
+        }
     }
 
     peers->next = backup;
@@ -244,3 +263,23 @@ done:
 
     return peers;
 }
+
+
+static ngx_int_t
+ngx_http_upstream_zone_copy_index(ngx_slab_pool_t *shpool,
+    ngx_http_upstream_rr_peers_t *peers)
+{
+    /* the schedule itself is read only and stays in the configuration pool */
+
+    if (peers->index == NULL) {
+        return NGX_OK;
+    }
+
+    peers->index = ngx_slab_alloc(shpool, peers->number
+                                  * sizeof(ngx_http_upstream_rr_peer_t *));
+    if (peers->index == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
@@ -17,6 +17,14 @@ static ngx_int_t ngx_http_init_headers_in_hash(ngx_conf_t *cf,
     ngx_http_core_main_conf_t *cmcf);
 static ngx_int_t ngx_http_init_phase_handlers(ngx_conf_t *cf,
     ngx_http_core_main_conf_t *cmcf);
+static ngx_int_t ngx_http_init_location_phase_handlers(ngx_conf_t *cf,
+    ngx_http_core_main_conf_t *cmcf, ngx_http_core_loc_conf_t *clcf,
+    void **loc_conf);
+static ngx_int_t ngx_http_init_trie_phase_handlers(ngx_conf_t *cf,
+    ngx_http_core_main_conf_t *cmcf, ngx_http_location_trie_t *trie);
+static ngx_uint_t ngx_http_phase_handler_active(
+    ngx_http_core_main_conf_t *cmcf, ngx_http_handler_pt handler,
+    void **loc_conf);
 
 static ngx_int_t ngx_http_add_addresses(ngx_conf_t *cf,
     ngx_http_core_srv_conf_t *cscf, ngx_http_conf_port_t *port,
@@ -41,11 +49,9 @@ static ngx_int_t ngx_http_cmp_locations(const ngx_queue_t *one,
     const ngx_queue_t *two);
 static ngx_int_t ngx_http_join_exact_locations(ngx_conf_t *cf,
     ngx_queue_t *locations);
-static void ngx_http_create_locations_list(ngx_queue_t *locations,
-    ngx_queue_t *q);
-static ngx_http_location_tree_node_t *
-    ngx_http_create_locations_tree(ngx_conf_t *cf, ngx_queue_t *locations,
-    size_t prefix);
+static void ngx_http_create_locations_trie(ngx_http_location_trie_t *trie,
+    ngx_uint_t n, ngx_http_location_queue_t **lqs, ngx_uint_t lo,
+    ngx_uint_t hi, size_t depth);
 
 static ngx_int_t ngx_http_optimize_servers(ngx_conf_t *cf,
     ngx_http_core_main_conf_t *cmcf, ngx_array_t *ports);
@@ -124,7 +130,7 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_conf_t                   pcf;
     ngx_http_module_t           *module;
     ngx_http_conf_ctx_t         *ctx;
-    ngx_http_core_loc_conf_t    *clcf;
+    ngx_http_core_loc_conf_t    *clcf, **clcfp;
     ngx_http_core_srv_conf_t   **cscfp;
     ngx_http_core_main_conf_t   *cmcf;
 
@@ -335,6 +341,35 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    for (s = 0; s < cmcf->servers.nelts; s++) {
+
+        clcf = cscfp[s]->ctx->loc_conf[ngx_http_core_module.ctx_index];
+
+        if (ngx_http_init_location_phase_handlers(cf, cmcf, clcf,
+                                                  cscfp[s]->ctx->loc_conf)
+            != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+
+        clcfp = cscfp[s]->named_locations;
+
+        if (clcfp == NULL) {
+            continue;
+        }
+
+        while (*clcfp) {
+            if (ngx_http_init_location_phase_handlers(cf, cmcf, *clcfp,
+                                                      (*clcfp)->loc_conf)
+                != NGX_OK)
+            {
+                return NGX_CONF_ERROR;
+            }
+
+            clcfp++;
+        }
+    }
+
 
     /* optimize the lists of ports, addresses and server names */
 
@@ -408,6 +443,13 @@ ngx_http_init_phases(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
         return NGX_ERROR;
     }
 
+    if (ngx_array_init(&cmcf->phase_active, cf->pool, 4,
+                       sizeof(ngx_http_phase_active_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
     return NGX_OK;
 }
 
@@ -532,6 +574,7 @@ ngx_http_init_phase_handlers(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
             find_config_index = n;
 
             ph->checker = ngx_http_core_find_config_phase;
+            ph->phase = i;
             n++;  // Ȼ׶βhttpģ봦cmcf->phase_engine.handlersҪռһλ
             ph++;  // cmcf->phase_engine.handlersһδʹõλ
 
@@ -556,6 +599,7 @@ ngx_http_init_phase_handlers(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
         case NGX_HTTP_POST_REWRITE_PHASE:
             if (use_rewrite) {
                 ph->checker = ngx_http_core_post_rewrite_phase;
+                ph->phase = i;
                 ph->next = find_config_index;  // һ׶NGX_HTTP_FIND_CONFIG_PHASEΪض
                 n++;  // Ȼ׶βhttpģ봦cmcf->phase_engine.handlersҪռһλ
                 ph++; // cmcf->phase_engine.handlersһδʹõλ
@@ -577,6 +621,7 @@ ngx_http_init_phase_handlers(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
             if (use_access) {
                 ph->checker = ngx_http_core_post_access_phase; // ֱָchecker
                 ph->next = n;  // Ϊʲôһ׶?
+                ph->phase = i;
                 ph++; // cmcf->phase_engine.handlersһδʹõλ
             }
 
@@ -590,6 +635,7 @@ ngx_http_init_phase_handlers(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
             /* cmcf->try_filestry_filesָҲ׶ */
             if (cmcf->try_files) {
                 ph->checker = ngx_http_core_try_files_phase;
+                ph->phase = i;
                 n++;
                 ph++;
             }
@@ -618,6 +664,7 @@ ngx_http_init_phase_handlers(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
         for (j = cmcf->phases[i].handlers.nelts - 1; j >=0; j--) {
             ph->checker = checker;
             ph->handler = h[j];
+            ph->phase = i;
 
             /* 
              * Ҫִеһ׶εţҲһ׶εһ
@@ -632,6 +679,242 @@ ngx_http_init_phase_handlers(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
 }
 
 
+/*
+ * every location gets a copy of the phase engine without the handlers
+ * which are known to do nothing in this location: preaccess and access
+ * handlers the modules have set ngx_http_set_phase_active() for, the
+ * try_files phase if there is no try_files, and the post access phase
+ * if no access handler is left.  The handlers up to and including the
+ * post rewrite phase are kept as is, so the indices there are the same
+ * in all engines and r->loc_conf may change before the preaccess phase
+ * (find config, "if" and named locations) without breaking anything.
+ */
+
+static ngx_int_t
+ngx_http_init_location_phase_handlers(ngx_conf_t *cf,
+    ngx_http_core_main_conf_t *cmcf, ngx_http_core_loc_conf_t *clcf,
+    void **loc_conf)
+{
+    u_char                     *keep;
+    ngx_uint_t                  i, n, k, start, use_access, *map;
+    ngx_http_phase_handler_t   *ph, *lph;
+    ngx_http_phase_handler_pt   checker;
+    ngx_http_core_loc_conf_t   *lclcf;
+#if (NGX_PCRE)
+    ngx_http_core_loc_conf_t  **clcfp;
+#endif
+
+    if (clcf->phase_handlers) {
+        return NGX_OK;
+    }
+
+    ph = cmcf->phase_engine.handlers;
+
+    for (n = 0; ph[n].checker; n++) { /* void */ }
+
+    for (start = 0; ph[start].checker != ngx_http_core_find_config_phase;
+         start++)
+    {
+        /* void */
+    }
+
+    do {
+        start++;
+        checker = ph[start].checker;
+    } while (checker == ngx_http_core_rewrite_phase
+             || checker == ngx_http_core_post_rewrite_phase);
+
+    use_access = 0;
+
+    for (i = start; i < n; i++) {
+        if (ph[i].checker == ngx_http_core_access_phase
+            && ngx_http_phase_handler_active(cmcf, ph[i].handler, loc_conf))
+        {
+            use_access = 1;
+            break;
+        }
+    }
+
+    keep = ngx_palloc(cf->temp_pool, n);
+    if (keep == NULL) {
+        return NGX_ERROR;
+    }
+
+    map = ngx_palloc(cf->temp_pool, (n + 1) * sizeof(ngx_uint_t));
+    if (map == NULL) {
+        return NGX_ERROR;
+    }
+
+    k = 0;
+
+    for (i = 0; i < n; i++) {
+
+        /* a dropped handler is mapped to the next one kept */
+
+        map[i] = k;
+        keep[i] = 1;
+
+        if (i >= start) {
+            checker = ph[i].checker;
+
+            if ((checker == ngx_http_core_try_files_phase
+                 && clcf->try_files == NULL)
+                || (checker == ngx_http_core_post_access_phase && !use_access)
+                || ((checker == ngx_http_core_generic_phase
+                     || checker == ngx_http_core_access_phase)
+                    && !ngx_http_phase_handler_active(cmcf, ph[i].handler,
+                                                      loc_conf)))
+            {
+                keep[i] = 0;
+                continue;
+            }
+        }
+
+        k++;
+    }
+
+    map[n] = k;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "http location \"%V\" phase handlers: %ui of %ui",
+                   &clcf->name, k, n);
+
+    clcf->nphase_handlers = k;
+
+    if (k == n) {
+        clcf->phase_handlers = ph;
+
+    } else {
+        lph = ngx_pcalloc(cf->pool, k * sizeof(ngx_http_phase_handler_t)
+                                    + sizeof(void *));
+        if (lph == NULL) {
+            return NGX_ERROR;
+        }
+
+        for (i = 0; i < n; i++) {
+            if (keep[i]) {
+                lph[map[i]].checker = ph[i].checker;
+                lph[map[i]].handler = ph[i].handler;
+                lph[map[i]].next = map[ph[i].next];
+                lph[map[i]].phase = ph[i].phase;
+            }
+        }
+
+        clcf->phase_handlers = lph;
+    }
+
+    if (clcf->limit_except_loc_conf) {
+        lclcf = clcf->limit_except_loc_conf[ngx_http_core_module.ctx_index];
+
+        if (ngx_http_init_location_phase_handlers(cf, cmcf, lclcf,
+                                                  clcf->limit_except_loc_conf)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    if (ngx_http_init_trie_phase_handlers(cf, cmcf, clcf->static_locations)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+#if (NGX_PCRE)
+
+    if (clcf->regex_locations) {
+        for (clcfp = clcf->regex_locations; *clcfp; clcfp++) {
+            if (ngx_http_init_location_phase_handlers(cf, cmcf, *clcfp,
+                                                      (*clcfp)->loc_conf)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+#endif
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_init_trie_phase_handlers(ngx_conf_t *cf,
+    ngx_http_core_main_conf_t *cmcf, ngx_http_location_trie_t *trie)
+{
+    ngx_uint_t                      i;
+    ngx_http_location_trie_node_t  *node;
+
+    if (trie == NULL) {
+        return NGX_OK;
+    }
+
+    for (i = 0; i < trie->nnodes; i++) {
+        node = &trie->nodes[i];
+
+        if (node->exact
+            && ngx_http_init_location_phase_handlers(cf, cmcf, node->exact,
+                                                     node->exact->loc_conf)
+               != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        if (node->inclusive
+            && ngx_http_init_location_phase_handlers(cf, cmcf,
+                                                     node->inclusive,
+                                                     node->inclusive->loc_conf)
+               != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_phase_handler_active(ngx_http_core_main_conf_t *cmcf,
+    ngx_http_handler_pt handler, void **loc_conf)
+{
+    ngx_uint_t                i;
+    ngx_http_phase_active_t  *pa;
+
+    pa = cmcf->phase_active.elts;
+
+    for (i = 0; i < cmcf->phase_active.nelts; i++) {
+        if (pa[i].handler == handler) {
+            return pa[i].active(loc_conf);
+        }
+    }
+
+    return 1;
+}
+
+
+ngx_int_t
+ngx_http_set_phase_active(ngx_conf_t *cf, ngx_http_handler_pt handler,
+    ngx_http_phase_active_pt active)
+{
+    ngx_http_phase_active_t    *pa;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    pa = ngx_array_push(&cmcf->phase_active);
+    if (pa == NULL) {
+        return NGX_ERROR;
+    }
+
+    pa->handler = handler;
+    pa->active = active;
+
+    return NGX_OK;
+}
+
+
 static char *
 ngx_http_merge_servers(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf,
     ngx_http_module_t *module, ngx_uint_t ctx_index)
@@ -788,8 +1071,9 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
     ngx_http_location_queue_t   *lq;
     ngx_http_core_loc_conf_t   **clcfp;
 #if (NGX_PCRE)
-    ngx_uint_t                   r;
+    ngx_uint_t                   r, i;
     ngx_queue_t                 *regex;
+    ngx_http_regex_t           **re;
 #endif
 
     locations = pclcf->locations;
@@ -898,6 +1182,20 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
 
         *clcfp = NULL;
 
+        re = ngx_palloc(cf->temp_pool, r * sizeof(ngx_http_regex_t *));
+        if (re == NULL) {
+            return NGX_ERROR;
+        }
+
+        for (i = 0; i < r; i++) {
+            re[i] = pclcf->regex_locations[i]->regex;
+        }
+
+        pclcf->regex_set = ngx_http_regex_set_create(cf, re, r);
+        if (pclcf->regex_set == NULL) {
+            return NGX_ERROR;
+        }
+
         ngx_queue_split(locations, regex, &tail);
     }
 
@@ -911,9 +1209,11 @@ static ngx_int_t
 ngx_http_init_static_location_trees(ngx_conf_t *cf,
     ngx_http_core_loc_conf_t *pclcf)
 {
+    ngx_uint_t                  n;
     ngx_queue_t                *q, *locations;
     ngx_http_core_loc_conf_t   *clcf;
-    ngx_http_location_queue_t  *lq;
+    ngx_http_location_trie_t   *trie;
+    ngx_http_location_queue_t  *lq, **lqs;
 
     locations = pclcf->locations;
 
@@ -942,13 +1242,59 @@ ngx_http_init_static_location_trees(ngx_conf_t *cf,
         return NGX_ERROR;
     }
 
-    ngx_http_create_locations_list(locations, ngx_queue_head(locations));
+    /*
+     * the joined queue is sorted by ngx_filename_cmp(), so the locations
+     * sharing a prefix are adjacent and the sibling nodes come out ordered
+     * by ngx_http_location_trie_key()
+     */
+
+    n = 0;
+
+    for (q = ngx_queue_head(locations);
+         q != ngx_queue_sentinel(locations);
+         q = ngx_queue_next(q))
+    {
+        n++;
+    }
+
+    lqs = ngx_palloc(cf->temp_pool, n * sizeof(ngx_http_location_queue_t *));
+    if (lqs == NULL) {
+        return NGX_ERROR;
+    }
+
+    n = 0;
+
+    for (q = ngx_queue_head(locations);
+         q != ngx_queue_sentinel(locations);
+         q = ngx_queue_next(q))
+    {
+        lqs[n++] = (ngx_http_location_queue_t *) q;
+    }
+
+    trie = ngx_palloc(cf->pool, sizeof(ngx_http_location_trie_t));
+    if (trie == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* a path compressed trie of n keys has at most 2 * n nodes */
+
+    trie->nodes = ngx_pcalloc(cf->pool,
+                       2 * n * sizeof(ngx_http_location_trie_node_t));
+    if (trie->nodes == NULL) {
+        return NGX_ERROR;
+    }
 
-    pclcf->static_locations = ngx_http_create_locations_tree(cf, locations, 0);
-    if (pclcf->static_locations == NULL) {
+    trie->keys = ngx_pcalloc(cf->pool, 2 * n);
+    if (trie->keys == NULL) {
         return NGX_ERROR;
     }
 
+    trie->nnodes = 1;
+
+    ngx_http_create_locations_trie(trie, 0, lqs, 0, n, 0);
+
+    pclcf->static_locations = trie;
+
     return NGX_OK;
 }
 
@@ -992,8 +1338,6 @@ ngx_http_add_location(ngx_conf_t *cf, ngx_queue_t **locations,
     lq->file_name = cf->conf_file->file.name.data;
     lq->line = cf->conf_file->line;
 
-    ngx_queue_init(&lq->list);
-
     ngx_queue_insert_tail(*locations, &lq->queue);
 
     return NGX_OK;
@@ -1114,140 +1458,95 @@ ngx_http_join_exact_locations(ngx_conf_t *cf, ngx_queue_t *locations)
 }
 
 
+/*
+ * the node n covers the locations lqs[lo .. hi - 1], they all share
+ * the first "depth" bytes; the children of a node are allocated
+ * in consecutive slots before descending into any of them, so a lookup
+ * scans or bisects a small contiguous range of the keys array
+ */
+
 static void
-ngx_http_create_locations_list(ngx_queue_t *locations, ngx_queue_t *q)
+ngx_http_create_locations_trie(ngx_http_location_trie_t *trie, ngx_uint_t n,
+    ngx_http_location_queue_t **lqs, ngx_uint_t lo, ngx_uint_t hi,
+    size_t depth)
 {
-    u_char                     *name;
-    size_t                      len;
-    ngx_queue_t                *x, tail;
-    ngx_http_location_queue_t  *lq, *lx;
-
-    if (q == ngx_queue_last(locations)) {
-        return;
-    }
-
-    lq = (ngx_http_location_queue_t *) q;
-
-    if (lq->inclusive == NULL) {
-        ngx_http_create_locations_list(locations, ngx_queue_next(q));
-        return;
-    }
-
-    len = lq->name->len;
-    name = lq->name->data;
+    size_t                          len;
+    u_char                         *first, *last;
+    ngx_uint_t                      i, j, c, child;
+    ngx_http_location_queue_t      *lq;
+    ngx_http_location_trie_node_t  *node, *cn;
 
-    for (x = ngx_queue_next(q);
-         x != ngx_queue_sentinel(locations);
-         x = ngx_queue_next(x))
-    {
-        lx = (ngx_http_location_queue_t *) x;
+    node = &trie->nodes[n];
 
-        if (len > lx->name->len
-            || ngx_filename_cmp(name, lx->name->data, len) != 0)
-        {
-            break;
-        }
-    }
+    if (lo < hi && lqs[lo]->name->len == depth) {
+        lq = lqs[lo++];
 
-    q = ngx_queue_next(q);
+        node->exact = lq->exact;
+        node->inclusive = lq->inclusive;
 
-    if (q == x) {
-        ngx_http_create_locations_list(locations, x);
-        return;
+        node->auto_redirect = (u_char) ((lq->exact && lq->exact->auto_redirect)
+                           || (lq->inclusive && lq->inclusive->auto_redirect));
     }
 
-    ngx_queue_split(locations, q, &tail);
-    ngx_queue_add(&lq->list, &tail);
-
-    if (x == ngx_queue_sentinel(locations)) {
-        ngx_http_create_locations_list(&lq->list, ngx_queue_head(&lq->list));
+    if (lo == hi) {
         return;
     }
 
-    ngx_queue_split(&lq->list, x, &tail);
-    ngx_queue_add(locations, &tail);
-
-    ngx_http_create_locations_list(&lq->list, ngx_queue_head(&lq->list));
-
-    ngx_http_create_locations_list(locations, x);
-}
-
-
-/*
- * to keep cache locality for left leaf nodes, allocate nodes in following
- * order: node, left subtree, right subtree, inclusive subtree
- */
+    node->children = (uint32_t) trie->nnodes;
 
-static ngx_http_location_tree_node_t *
-ngx_http_create_locations_tree(ngx_conf_t *cf, ngx_queue_t *locations,
-    size_t prefix)
-{
-    size_t                          len;
-    ngx_queue_t                    *q, tail;
-    ngx_http_location_queue_t      *lq;
-    ngx_http_location_tree_node_t  *node;
+    for (i = lo; i < hi; /* void */) {
+        c = ngx_http_location_trie_key(lqs[i]->name->data[depth]);
 
-    q = ngx_queue_middle(locations);
+        for (j = i + 1;
+             j < hi
+             && ngx_http_location_trie_key(lqs[j]->name->data[depth]) == c;
+             j++)
+        {
+            /* void */
+        }
 
-    lq = (ngx_http_location_queue_t *) q;
-    len = lq->name->len - prefix;
+        trie->keys[trie->nnodes++] = (u_char) c;
+        node->nchildren++;
 
-    node = ngx_palloc(cf->pool,
-                      offsetof(ngx_http_location_tree_node_t, name) + len);
-    if (node == NULL) {
-        return NULL;
+        i = j;
     }
 
-    node->left = NULL;
-    node->right = NULL;
-    node->tree = NULL;
-    node->exact = lq->exact;
-    node->inclusive = lq->inclusive;
-
-    node->auto_redirect = (u_char) ((lq->exact && lq->exact->auto_redirect)
-                           || (lq->inclusive && lq->inclusive->auto_redirect));
-
-    node->len = (u_char) len;
-    ngx_memcpy(node->name, &lq->name->data[prefix], len);
-
-    ngx_queue_split(locations, q, &tail);
+    child = node->children;
 
-    if (ngx_queue_empty(locations)) {
-        /*
-         * ngx_queue_split() insures that if left part is empty,
-         * then right one is empty too
-         */
-        goto inclusive;
-    }
+    for (i = lo; i < hi; /* void */) {
+        c = trie->keys[child];
 
-    node->left = ngx_http_create_locations_tree(cf, locations, prefix);
-    if (node->left == NULL) {
-        return NULL;
-    }
+        for (j = i + 1;
+             j < hi
+             && ngx_http_location_trie_key(lqs[j]->name->data[depth]) == c;
+             j++)
+        {
+            /* void */
+        }
 
-    ngx_queue_remove(q);
+        /* the common prefix of a sorted group is that of its ends */
 
-    if (ngx_queue_empty(&tail)) {
-        goto inclusive;
-    }
+        first = lqs[i]->name->data;
+        last = lqs[j - 1]->name->data;
+        for (len = depth + 1;
+             len < lqs[i]->name->len && len < lqs[j - 1]->name->len
+             && ngx_http_location_trie_key(first[len])
+                == ngx_http_location_trie_key(last[len]);
+             len++)
+        {
+            /* void */
+        }
 
-    node->right = ngx_http_create_locations_tree(cf, &tail, prefix);
-    if (node->right == NULL) {
-        return NULL;
-    }
+        cn = &trie->nodes[child];
 
-inclusive:
+        cn->name = &first[depth];
+        cn->len = (uint32_t) (len - depth);
 
-    if (ngx_queue_empty(&lq->list)) {
-        return node;
-    }
+        ngx_http_create_locations_trie(trie, child, lqs, i, j, len);
 
-    node->tree = ngx_http_create_locations_tree(cf, &lq->list, prefix + len);
-    if (node->tree == NULL) {
-        return NULL;
+        child++;
+        i = j;
     }
-
-    return node;
 }
 
 /*
@@ -1640,6 +1939,7 @@ ngx_http_server_names(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf,
     ngx_http_core_srv_conf_t  **cscfp;
 #if (NGX_PCRE)
     ngx_uint_t                  regex, i;
+    ngx_http_regex_t          **re;
 
     regex = 0;
 #endif
@@ -1769,6 +2069,11 @@ ngx_http_server_names(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf,
         return NGX_ERROR;
     }
 
+    re = ngx_palloc(cf->temp_pool, regex * sizeof(ngx_http_regex_t *));
+    if (re == NULL) {
+        return NGX_ERROR;
+    }
+
     i = 0;
 
     for (s = 0; s < addr->servers.nelts; s++) {
@@ -1777,11 +2082,17 @@ ngx_http_server_names(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf,
 
         for (n = 0; n < cscfp[s]->server_names.nelts; n++) {
             if (name[n].regex) {
+                re[i] = name[n].regex;
                 addr->regex[i++] = name[n];
             }
         }
     }
 
+    addr->regex_set = ngx_http_regex_set_create(cf, re, regex);
+    if (addr->regex_set == NULL) {
+        return NGX_ERROR;
+    }
+
 #endif
 
     return NGX_OK;
@@ -2090,6 +2401,7 @@ ngx_http_add_addrs(ngx_conf_t *cf, ngx_http_port_t *hport,
 #if (NGX_PCRE)
         vn->nregex = addr[i].nregex;
         vn->regex = addr[i].regex;
+        vn->regex_set = addr[i].regex_set;
 #endif
     }
 
@@ -2155,6 +2467,7 @@ ngx_http_add_addrs6(ngx_conf_t *cf, ngx_http_port_t *hport,
 #if (NGX_PCRE)
         vn->nregex = addr[i].nregex;
         vn->regex = addr[i].regex;
+        vn->regex_set = addr[i].regex_set;
 #endif
     }
 
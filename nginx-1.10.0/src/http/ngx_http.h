@@ -83,6 +83,8 @@ ngx_int_t ngx_http_add_location(ngx_conf_t *cf, ngx_queue_t **locations,
     ngx_http_core_loc_conf_t *clcf);
 ngx_int_t ngx_http_add_listen(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
     ngx_http_listen_opt_t *lsopt);
+ngx_int_t ngx_http_set_phase_active(ngx_conf_t *cf,
+    ngx_http_handler_pt handler, ngx_http_phase_active_pt active);
 
 
 void ngx_http_init_connection(ngx_connection_t *c);
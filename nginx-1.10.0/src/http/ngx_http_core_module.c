@@ -23,12 +23,22 @@ typedef struct {
 
 static ngx_int_t ngx_http_core_find_location(ngx_http_request_t *r);
 static ngx_int_t ngx_http_core_find_static_location(ngx_http_request_t *r,
-    ngx_http_location_tree_node_t *node);
+    ngx_http_location_trie_t *trie);
+static ngx_http_location_trie_node_t *
+    ngx_http_core_find_location_child(ngx_http_location_trie_t *trie,
+    ngx_http_location_trie_node_t *node, ngx_uint_t c);
 
 static ngx_int_t ngx_http_core_preconfiguration(ngx_conf_t *cf);
 static ngx_int_t ngx_http_core_postconfiguration(ngx_conf_t *cf);
 static void *ngx_http_core_create_main_conf(ngx_conf_t *cf);
 static char *ngx_http_core_init_main_conf(ngx_conf_t *cf, void *conf);
+static ngx_int_t ngx_http_core_init_process(ngx_cycle_t *cycle);
+static ngx_int_t ngx_http_core_init_timing_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_uint_t ngx_http_timing_enter(ngx_http_request_timing_t *t,
+    ngx_uint_t slot);
+static void ngx_http_timing_leave(ngx_http_request_timing_t *t,
+    ngx_uint_t prev);
 static void *ngx_http_core_create_srv_conf(ngx_conf_t *cf);
 static char *ngx_http_core_merge_srv_conf(ngx_conf_t *cf,
     void *parent, void *child);
@@ -79,9 +89,14 @@ static ngx_uint_t ngx_http_gzip_quantity(u_char *p, u_char *last);
 static char *ngx_http_gzip_disable(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 #endif
+static ngx_int_t ngx_http_get_forwarded_addr_headers(ngx_http_request_t *r,
+    ngx_addr_t *addr, ngx_array_t *headers, ngx_str_t *value,
+    ngx_array_t *cidrs, ngx_cidr_trie_t *trie, int recursive);
 static ngx_int_t ngx_http_get_forwarded_addr_internal(ngx_http_request_t *r,
-    ngx_addr_t *addr, u_char *xff, size_t xfflen, ngx_array_t *proxies,
-    int recursive);
+    ngx_addr_t *addr, u_char *xff, size_t xfflen, ngx_array_t *cidrs,
+    ngx_cidr_trie_t *trie, int recursive);
+static ngx_int_t ngx_http_get_forwarded_addr_match(struct sockaddr *sa,
+    ngx_array_t *proxies);
 #if (NGX_HAVE_OPENAT)
 static char *ngx_http_disable_symlinks(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -350,6 +365,27 @@ static ngx_command_t  ngx_http_core_commands[] = {
       offsetof(ngx_http_core_loc_conf_t, client_body_buffer_size),
       NULL },
 
+    { ngx_string("client_body_spool_size"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_core_main_conf_t, client_body_spool_size),
+      NULL },
+
+    { ngx_string("client_body_spool_max_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_core_loc_conf_t, client_body_spool_max_size),
+      NULL },
+
+    { ngx_string("request_timing"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_core_main_conf_t, request_timing),
+      NULL },
+
     { ngx_string("client_body_timeout"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_msec_slot,
@@ -774,7 +810,7 @@ ngx_module_t  ngx_http_core_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_core_init_process,            /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -855,7 +891,10 @@ void
 ngx_http_core_run_phases(ngx_http_request_t *r)
 {
     ngx_int_t                   rc;
+    ngx_uint_t                  prev, freed, *parent;
+    ngx_http_request_timing_t  *t;
     ngx_http_phase_handler_t   *ph;
+    ngx_http_core_loc_conf_t   *clcf;
     ngx_http_core_main_conf_t  *cmcf;
 
     /* ȡȫΨһĴhttp{}ÿϢĽṹ */
@@ -865,16 +904,62 @@ ngx_http_core_run_phases(ngx_http_request_t *r)
      * handlers洢һܾд(н׶εд
      * ռ)еÿһԪشһhttp׶ӵһ
      */
-    ph = cmcf->phase_engine.handlers;
 
     /* phase_handlerָҪִеĵĽ׶δhandlersеš */
-    while (ph[r->phase_handler].checker) {
+    for ( ;; ) {
+
+        /*
+         * the location's engine is looked up on each step as r->loc_conf
+         * changes in the find config phase; the locations of "if" blocks
+         * have no engine of their own and use the complete one
+         */
+
+        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+        ph = clcf->phase_handlers ? clcf->phase_handlers
+                                  : cmcf->phase_engine.handlers;
+
+        if (ph[r->phase_handler].checker == NULL) {
+            return;
+        }
 
         /*
          * ÿhandlerӦһcheckerΪhandlerֻܱcheckerá
          * ͬһ׶εдӵһchecker
          */
-        rc = ph[r->phase_handler].checker(r, &ph[r->phase_handler]);
+        t = r->timing;
+
+        if (t == NULL) {
+            rc = ph[r->phase_handler].checker(r, &ph[r->phase_handler]);
+
+        } else {
+
+            /*
+             * the checker may free the request along with the timing,
+             * ngx_http_free_request() then sets the flag of this call,
+             * which is passed to the enclosing calls
+             */
+
+            freed = 0;
+            parent = t->freed;
+            t->freed = &freed;
+
+            prev = ngx_http_timing_enter(t, ph[r->phase_handler].phase);
+
+            rc = ph[r->phase_handler].checker(r, &ph[r->phase_handler]);
+
+            if (freed) {
+                if (parent) {
+                    *parent = 1;
+                }
+
+                return;
+            }
+
+            t->freed = parent;
+
+            ngx_http_timing_leave(t, prev);
+        }
 
         /*
          * κһcheckerNGX_OKζŽִпȨNginx¼ģ飬
@@ -888,6 +973,110 @@ ngx_http_core_run_phases(ngx_http_request_t *r)
 }
 
 
+
+/*
+ * the timing of a request is kept as "self" time: entering a slot
+ * closes the running interval of the enclosing one, and leaving it
+ * resumes the enclosing slot, if any
+ */
+
+static ngx_inline ngx_uint_t
+ngx_http_timing_now(void)
+{
+    struct timeval  tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (ngx_uint_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+static ngx_uint_t
+ngx_http_timing_enter(ngx_http_request_timing_t *t, ngx_uint_t slot)
+{
+    ngx_uint_t  now, prev;
+
+    now = ngx_http_timing_now();
+
+    if (t->start) {
+        t->usec[t->slot] += now - t->start;
+        prev = t->slot;
+
+    } else {
+        prev = NGX_HTTP_TIMING_SLOTS;
+    }
+
+    t->slot = slot;
+    t->start = now;
+    t->used |= (ngx_uint_t) 1 << slot;
+
+    return prev;
+}
+
+
+static void
+ngx_http_timing_leave(ngx_http_request_timing_t *t, ngx_uint_t prev)
+{
+    ngx_uint_t  now;
+
+    now = ngx_http_timing_now();
+
+    t->usec[t->slot] += now - t->start;
+
+    if (prev == NGX_HTTP_TIMING_SLOTS) {
+        t->start = 0;
+        return;
+    }
+
+    t->slot = prev;
+    t->start = now;
+}
+
+
+void
+ngx_http_request_timing_done(ngx_http_request_t *r)
+{
+    ngx_uint_t                    i, n, usec;
+    ngx_http_request_timing_t    *t;
+    ngx_http_core_main_conf_t    *cmcf;
+    ngx_http_timing_histogram_t  *hist;
+
+    t = r->timing;
+
+    if (t->freed) {
+        *t->freed = 1;
+    }
+
+    /* the request is freed from inside of a phase checker or a filter */
+
+    if (t->start) {
+        t->usec[t->slot] += ngx_http_timing_now() - t->start;
+        t->start = 0;
+    }
+
+    cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+
+    hist = cmcf->request_timing_zone->data;
+
+    for (i = 0; i < NGX_HTTP_TIMING_SLOTS; i++) {
+
+        if (!(t->used & ((ngx_uint_t) 1 << i))) {
+            continue;
+        }
+
+        usec = t->usec[i];
+
+        for (n = 0; usec >> n && n < NGX_HTTP_TIMING_BUCKETS - 1; n++) {
+            /* void */
+        }
+
+        (void) ngx_atomic_fetch_add(&hist[i].count, 1);
+        (void) ngx_atomic_fetch_add(&hist[i].usec, usec);
+        (void) ngx_atomic_fetch_add(&hist[i].buckets[n], 1);
+    }
+}
+
+
 ngx_int_t
 ngx_http_core_generic_phase(ngx_http_request_t *r, ngx_http_phase_handler_t *ph)
 {
@@ -1703,27 +1892,24 @@ ngx_http_core_find_location(ngx_http_request_t *r)
 
     if (noregex == 0 && pclcf->regex_locations) {
 
-        for (clcfp = pclcf->regex_locations; *clcfp; clcfp++) {
+        n = ngx_http_regex_set_exec(r, pclcf->regex_set, &r->uri);
+
+        if (n >= 0) {
+            clcfp = &pclcf->regex_locations[n];
 
             ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                            "test location: ~ \"%V\"", &(*clcfp)->name);
 
-            n = ngx_http_regex_exec(r, (*clcfp)->regex, &r->uri);
-
-            if (n == NGX_OK) {
-                r->loc_conf = (*clcfp)->loc_conf;
-
-                /* look up nested locations */
+            r->loc_conf = (*clcfp)->loc_conf;
 
-                rc = ngx_http_core_find_location(r);
+            /* look up nested locations */
 
-                return (rc == NGX_ERROR) ? rc : NGX_OK;
-            }
+            rc = ngx_http_core_find_location(r);
 
-            if (n == NGX_DECLINED) {
-                continue;
-            }
+            return (rc == NGX_ERROR) ? rc : NGX_OK;
+        }
 
+        if (n == NGX_ERROR) {
             return NGX_ERROR;
         }
     }
@@ -1742,81 +1928,131 @@ ngx_http_core_find_location(ngx_http_request_t *r)
 
 static ngx_int_t
 ngx_http_core_find_static_location(ngx_http_request_t *r,
-    ngx_http_location_tree_node_t *node)
+    ngx_http_location_trie_t *trie)
 {
-    u_char     *uri;
-    size_t      len, n;
-    ngx_int_t   rc, rv;
+    u_char                         *uri;
+    size_t                          len;
+    ngx_int_t                       rv;
+    ngx_http_location_trie_node_t  *node, *child;
+
+    if (trie == NULL) {
+        return NGX_DECLINED;
+    }
 
     len = r->uri.len;
     uri = r->uri.data;
 
     rv = NGX_DECLINED;
 
+    node = &trie->nodes[0];
+
     for ( ;; ) {
 
-        if (node == NULL) {
-            return rv;
-        }
+        if (len == 0) {
 
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "test location: \"%*s\"",
-                       (size_t) node->len, node->name);
+            if (node->exact) {
+                r->loc_conf = node->exact->loc_conf;
+                return NGX_OK;
+            }
 
-        n = (len <= (size_t) node->len) ? len : node->len;
+            if (node->inclusive) {
+                r->loc_conf = node->inclusive->loc_conf;
+                return NGX_AGAIN;
+            }
 
-        rc = ngx_filename_cmp(uri, node->name, n);
+            /* "/dir" for the "/dir/" location */
 
-        if (rc != 0) {
-            node = (rc < 0) ? node->left : node->right;
+            child = ngx_http_core_find_location_child(trie, node, '/');
 
-            continue;
+            if (child && child->len == 1 && child->auto_redirect) {
+                r->loc_conf = (child->exact) ? child->exact->loc_conf:
+                                               child->inclusive->loc_conf;
+                return NGX_DONE;
+            }
+
+            return rv;
         }
 
-        if (len > (size_t) node->len) {
+        if (node->inclusive) {
+            r->loc_conf = node->inclusive->loc_conf;
+            rv = NGX_AGAIN;
+        }
 
-            if (node->inclusive) {
+        child = ngx_http_core_find_location_child(trie, node, *uri);
 
-                r->loc_conf = node->inclusive->loc_conf;
-                rv = NGX_AGAIN;
+        if (child == NULL) {
+            return rv;
+        }
 
-                node = node->tree;
-                uri += n;
-                len -= n;
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "test location: \"%*s\"",
+                       (size_t) child->len, child->name);
 
-                continue;
-            }
+        if (len < (size_t) child->len) {
 
-            /* exact only */
+            if (len + 1 == (size_t) child->len
+                && child->auto_redirect
+                && ngx_filename_cmp(uri, child->name, len) == 0)
+            {
+                r->loc_conf = (child->exact) ? child->exact->loc_conf:
+                                               child->inclusive->loc_conf;
+                return NGX_DONE;
+            }
 
-            node = node->right;
+            return rv;
+        }
 
-            continue;
+        if (ngx_filename_cmp(uri, child->name, child->len) != 0) {
+            return rv;
         }
 
-        if (len == (size_t) node->len) {
+        uri += child->len;
+        len -= child->len;
+        node = child;
+    }
+}
 
-            if (node->exact) {
-                r->loc_conf = node->exact->loc_conf;
-                return NGX_OK;
 
-            } else {
-                r->loc_conf = node->inclusive->loc_conf;
-                return NGX_AGAIN;
+static ngx_http_location_trie_node_t *
+ngx_http_core_find_location_child(ngx_http_location_trie_t *trie,
+    ngx_http_location_trie_node_t *node, ngx_uint_t c)
+{
+    u_char      *keys;
+    ngx_uint_t   lo, hi, mid;
+
+    c = ngx_http_location_trie_key(c);
+    keys = &trie->keys[node->children];
+
+    if (node->nchildren <= 8) {
+
+        for (lo = 0; lo < node->nchildren; lo++) {
+            if (keys[lo] == c) {
+                return &trie->nodes[node->children + lo];
             }
         }
 
-        /* len < node->len */
+        return NULL;
+    }
 
-        if (len + 1 == (size_t) node->len && node->auto_redirect) {
+    lo = 0;
+    hi = node->nchildren;
 
-            r->loc_conf = (node->exact) ? node->exact->loc_conf:
-                                          node->inclusive->loc_conf;
-            rv = NGX_DONE;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+
+        if (keys[mid] == c) {
+            return &trie->nodes[node->children + mid];
         }
 
-        node = node->left;
+        if (keys[mid] < c) {
+            lo = mid + 1;
+
+        } else {
+            hi = mid;
+        }
     }
+
+    return NULL;
 }
 
 
@@ -2115,6 +2351,9 @@ ngx_http_send_response(ngx_http_request_t *r, ngx_uint_t status,
 ngx_int_t
 ngx_http_send_header(ngx_http_request_t *r)
 {
+    ngx_int_t   rc;
+    ngx_uint_t  prev;
+
     if (r->post_action) {
         return NGX_OK;
     }
@@ -2134,6 +2373,14 @@ ngx_http_send_header(ngx_http_request_t *r)
         r->headers_out.status_line.len = 0;
     }
 
+    if (r->timing) {
+        prev = ngx_http_timing_enter(r->timing, NGX_HTTP_TIMING_HEADER_FILTER);
+        rc = ngx_http_top_header_filter(r);
+        ngx_http_timing_leave(r->timing, prev);
+
+        return rc;
+    }
+
     /* ͷģӦͷӦͷͻ */
     return ngx_http_top_header_filter(r);
 }
@@ -2148,6 +2395,7 @@ ngx_int_t
 ngx_http_output_filter(ngx_http_request_t *r, ngx_chain_t *in)
 {
     ngx_int_t          rc;
+    ngx_uint_t         prev;
     ngx_connection_t  *c;
 
     c = r->connection;
@@ -2155,7 +2403,14 @@ ngx_http_output_filter(ngx_http_request_t *r, ngx_chain_t *in)
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
                    "http output filter \"%V?%V\"", &r->uri, &r->args);
 
-    rc = ngx_http_top_body_filter(r, in);
+    if (r->timing) {
+        prev = ngx_http_timing_enter(r->timing, NGX_HTTP_TIMING_BODY_FILTER);
+        rc = ngx_http_top_body_filter(r, in);
+        ngx_http_timing_leave(r->timing, prev);
+
+    } else {
+        rc = ngx_http_top_body_filter(r, in);
+    }
 
     /* Ӧеһģ鴦NGX_ERRORӳc->error־λλ */
     if (rc == NGX_ERROR) {
@@ -3026,6 +3281,31 @@ ngx_int_t
 ngx_http_get_forwarded_addr(ngx_http_request_t *r, ngx_addr_t *addr,
     ngx_array_t *headers, ngx_str_t *value, ngx_array_t *proxies,
     int recursive)
+{
+    return ngx_http_get_forwarded_addr_headers(r, addr, headers, value,
+                                               proxies, NULL, recursive);
+}
+
+
+/*
+ * as ngx_http_get_forwarded_addr(), with the proxies compiled into a trie
+ * by ngx_cidr_trie_create() at configuration time
+ */
+
+ngx_int_t
+ngx_http_get_forwarded_addr_trie(ngx_http_request_t *r, ngx_addr_t *addr,
+    ngx_array_t *headers, ngx_str_t *value, ngx_cidr_trie_t *proxies,
+    int recursive)
+{
+    return ngx_http_get_forwarded_addr_headers(r, addr, headers, value,
+                                               NULL, proxies, recursive);
+}
+
+
+static ngx_int_t
+ngx_http_get_forwarded_addr_headers(ngx_http_request_t *r, ngx_addr_t *addr,
+    ngx_array_t *headers, ngx_str_t *value, ngx_array_t *cidrs,
+    ngx_cidr_trie_t *trie, int recursive)
 {
     ngx_int_t          rc;
     ngx_uint_t         i, found;
@@ -3033,7 +3313,7 @@ ngx_http_get_forwarded_addr(ngx_http_request_t *r, ngx_addr_t *addr,
 
     if (headers == NULL) {
         return ngx_http_get_forwarded_addr_internal(r, addr, value->data,
-                                                    value->len, proxies,
+                                                    value->len, cidrs, trie,
                                                     recursive);
     }
 
@@ -3046,8 +3326,8 @@ ngx_http_get_forwarded_addr(ngx_http_request_t *r, ngx_addr_t *addr,
 
     while (i-- > 0) {
         rc = ngx_http_get_forwarded_addr_internal(r, addr, h[i]->value.data,
-                                                  h[i]->value.len, proxies,
-                                                  recursive);
+                                                  h[i]->value.len, cidrs,
+                                                  trie, recursive);
 
         if (!recursive) {
             break;
@@ -3071,15 +3351,67 @@ ngx_http_get_forwarded_addr(ngx_http_request_t *r, ngx_addr_t *addr,
 
 static ngx_int_t
 ngx_http_get_forwarded_addr_internal(ngx_http_request_t *r, ngx_addr_t *addr,
-    u_char *xff, size_t xfflen, ngx_array_t *proxies, int recursive)
+    u_char *xff, size_t xfflen, ngx_array_t *cidrs, ngx_cidr_trie_t *trie,
+    int recursive)
+{
+    u_char      *p;
+    ngx_int_t    rc;
+    ngx_addr_t   paddr;
+
+    if (trie) {
+        rc = ngx_cidr_trie_match(trie, addr->sockaddr);
+
+    } else {
+        rc = ngx_http_get_forwarded_addr_match(addr->sockaddr, cidrs);
+    }
+
+    if (rc != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    for (p = xff + xfflen - 1; p > xff; p--, xfflen--) {
+        if (*p != ' ' && *p != ',') {
+            break;
+        }
+    }
+
+    for ( /* void */ ; p > xff; p--) {
+        if (*p == ' ' || *p == ',') {
+            p++;
+            break;
+        }
+    }
+
+    if (ngx_parse_addr(r->pool, &paddr, p, xfflen - (p - xff)) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    *addr = paddr;
+
+    if (recursive && p > xff) {
+        rc = ngx_http_get_forwarded_addr_internal(r, addr, xff, p - 1 - xff,
+                                                  cidrs, trie, 1);
+
+        if (rc == NGX_DECLINED) {
+            return NGX_DONE;
+        }
+
+        /* rc == NGX_OK || rc == NGX_DONE  */
+        return rc;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_get_forwarded_addr_match(struct sockaddr *sa, ngx_array_t *proxies)
 {
-    u_char           *p;
     in_addr_t         inaddr;
-    ngx_int_t         rc;
-    ngx_addr_t        paddr;
     ngx_cidr_t       *cidr;
     ngx_uint_t        family, i;
 #if (NGX_HAVE_INET6)
+    u_char           *p;
     ngx_uint_t        n;
     struct in6_addr  *inaddr6;
 #endif
@@ -3091,15 +3423,15 @@ ngx_http_get_forwarded_addr_internal(ngx_http_request_t *r, ngx_addr_t *addr,
 #endif
 #endif
 
-    family = addr->sockaddr->sa_family;
+    family = sa->sa_family;
 
     if (family == AF_INET) {
-        inaddr = ((struct sockaddr_in *) addr->sockaddr)->sin_addr.s_addr;
+        inaddr = ((struct sockaddr_in *) sa)->sin_addr.s_addr;
     }
 
 #if (NGX_HAVE_INET6)
     else if (family == AF_INET6) {
-        inaddr6 = &((struct sockaddr_in6 *) addr->sockaddr)->sin6_addr;
+        inaddr6 = &((struct sockaddr_in6 *) sa)->sin6_addr;
 
         if (IN6_IS_ADDR_V4MAPPED(inaddr6)) {
             family = AF_INET;
@@ -3147,37 +3479,6 @@ ngx_http_get_forwarded_addr_internal(ngx_http_request_t *r, ngx_addr_t *addr,
             break;
         }
 
-        for (p = xff + xfflen - 1; p > xff; p--, xfflen--) {
-            if (*p != ' ' && *p != ',') {
-                break;
-            }
-        }
-
-        for ( /* void */ ; p > xff; p--) {
-            if (*p == ' ' || *p == ',') {
-                p++;
-                break;
-            }
-        }
-
-        if (ngx_parse_addr(r->pool, &paddr, p, xfflen - (p - xff)) != NGX_OK) {
-            return NGX_DECLINED;
-        }
-
-        *addr = paddr;
-
-        if (recursive && p > xff) {
-            rc = ngx_http_get_forwarded_addr_internal(r, addr, xff, p - 1 - xff,
-                                                      proxies, 1);
-
-            if (rc == NGX_DECLINED) {
-                return NGX_DONE;
-            }
-
-            /* rc == NGX_OK || rc == NGX_DONE  */
-            return rc;
-        }
-
         return NGX_OK;
 
     next:
@@ -3712,6 +4013,10 @@ ngx_http_core_create_main_conf(ngx_conf_t *cf)
     cmcf->variables_hash_max_size = NGX_CONF_UNSET_UINT;
     cmcf->variables_hash_bucket_size = NGX_CONF_UNSET_UINT;
 
+    cmcf->client_body_spool_size = NGX_CONF_UNSET_SIZE;
+
+    cmcf->request_timing = NGX_CONF_UNSET;
+
     return cmcf;
 }
 
@@ -3721,6 +4026,8 @@ ngx_http_core_init_main_conf(ngx_conf_t *cf, void *conf)
 {
     ngx_http_core_main_conf_t *cmcf = conf;
 
+    static ngx_str_t  timing = ngx_string("request_timing");
+
     ngx_conf_init_uint_value(cmcf->server_names_hash_max_size, 512);
     ngx_conf_init_uint_value(cmcf->server_names_hash_bucket_size,
                              ngx_cacheline_size);
@@ -3739,10 +4046,77 @@ ngx_http_core_init_main_conf(ngx_conf_t *cf, void *conf)
         cmcf->ncaptures = (cmcf->ncaptures + 1) * 3;
     }
 
+    ngx_conf_init_size_value(cmcf->client_body_spool_size, 0);
+
+    ngx_conf_init_value(cmcf->request_timing, 0);
+
+    if (cmcf->request_timing) {
+        cmcf->request_timing_zone = ngx_shared_memory_add(cf, &timing,
+                                                    8 * ngx_pagesize,
+                                                    &ngx_http_core_module);
+        if (cmcf->request_timing_zone == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cmcf->request_timing_zone->init = ngx_http_core_init_timing_zone;
+    }
+
     return NGX_CONF_OK;
 }
 
 
+static ngx_int_t
+ngx_http_core_init_timing_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_slab_pool_t              *shpool;
+    ngx_http_timing_histogram_t  *hist;
+
+    if (data) {
+        shm_zone->data = data;
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        shm_zone->data = shpool->data;
+        return NGX_OK;
+    }
+
+    hist = ngx_slab_calloc(shpool, NGX_HTTP_TIMING_SLOTS
+                                   * sizeof(ngx_http_timing_histogram_t));
+    if (hist == NULL) {
+        return NGX_ERROR;
+    }
+
+    shpool->data = hist;
+    shm_zone->data = hist;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_core_init_process(ngx_cycle_t *cycle)
+{
+    ngx_http_core_main_conf_t  *cmcf;
+
+    cmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_core_module);
+
+    if (cmcf == NULL || cmcf->client_body_spool_size == 0) {
+        return NGX_OK;
+    }
+
+    cmcf->client_body_spool = ngx_http_request_body_spool_create(cycle,
+                                                 cmcf->client_body_spool_size);
+    if (cmcf->client_body_spool == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
 static void *
 ngx_http_core_create_srv_conf(ngx_conf_t *cf)
 {
@@ -3883,6 +4257,7 @@ ngx_http_core_create_loc_conf(ngx_conf_t *cf)
 
     clcf->client_max_body_size = NGX_CONF_UNSET;
     clcf->client_body_buffer_size = NGX_CONF_UNSET_SIZE;
+    clcf->client_body_spool_max_size = NGX_CONF_UNSET_SIZE;
     clcf->client_body_timeout = NGX_CONF_UNSET_MSEC;
     clcf->satisfy = NGX_CONF_UNSET_UINT;
     clcf->if_modified_since = NGX_CONF_UNSET_UINT;
@@ -4097,6 +4472,9 @@ ngx_http_core_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_size_value(conf->client_body_buffer_size,
                               prev->client_body_buffer_size,
                               (size_t) 2 * ngx_pagesize);
+    ngx_conf_merge_size_value(conf->client_body_spool_max_size,
+                              prev->client_body_spool_max_size,
+                              4 * 1024 * 1024);
     ngx_conf_merge_msec_value(conf->client_body_timeout,
                               prev->client_body_timeout, 60000);
 
@@ -53,7 +53,7 @@
 #define NGX_HTTP_KEEPALIVE_DISABLE_SAFARI  0x0008
 
 
-typedef struct ngx_http_location_tree_node_s  ngx_http_location_tree_node_t;
+typedef struct ngx_http_location_trie_s  ngx_http_location_trie_t;
 typedef struct ngx_http_core_loc_conf_s  ngx_http_core_loc_conf_t;
 
 
@@ -221,6 +221,8 @@ struct ngx_http_phase_handler_s {
      * Ҫִеһ׶εĵһcmcf->phase_engine.handlersе
      */
     ngx_uint_t                 next;
+
+    ngx_uint_t                 phase;
 };
 
 
@@ -248,6 +250,34 @@ typedef struct {
     ngx_uint_t                 location_rewrite_index;
 } ngx_http_phase_engine_t;
 
+
+/*
+ * tells if a phase handler does anything for the location with the
+ * modules' configuration loc_conf, the handlers which do not are left
+ * out of the location's phase engine
+ */
+typedef ngx_uint_t (*ngx_http_phase_active_pt)(void **loc_conf);
+
+typedef struct {
+    ngx_http_handler_pt        handler;
+    ngx_http_phase_active_pt   active;
+} ngx_http_phase_active_t;
+
+
+/*
+ * the "request_timing" zone keeps a histogram for each timing slot,
+ * a request with t microseconds in the slot is counted in the bucket
+ * of the bit length of t, the last bucket takes all longer requests
+ */
+
+#define NGX_HTTP_TIMING_BUCKETS  24
+
+typedef struct {
+    ngx_atomic_t               count;
+    ngx_atomic_t               usec;
+    ngx_atomic_t               buckets[NGX_HTTP_TIMING_BUCKETS];
+} ngx_http_timing_histogram_t;
+
 /*
  * httpܵĳʼУκһhttpģ鶼ngx_http_module_tӿڵpostconfiguration
  * нԶķӵhandlers
@@ -276,6 +306,7 @@ typedef struct {
      */
     ngx_array_t                variables;   
     ngx_uint_t                 ncaptures;
+    ngx_rbtree_t              *regexes;
 
     ngx_uint_t                 server_names_hash_max_size;
     ngx_uint_t                 server_names_hash_bucket_size;
@@ -291,12 +322,20 @@ typedef struct {
     /* Ƿtry_filesָı־λ */
     ngx_uint_t                 try_files;       /* unsigned  try_files:1 */
 
+    size_t                     client_body_spool_size;
+    ngx_http_request_body_spool_t  *client_body_spool;
+
+    ngx_flag_t                 request_timing;
+    ngx_shm_zone_t            *request_timing_zone;
+
     /*
      * httpܳʼʱhttpģ׶httpһ11
      * Աngx_http_phase_t(Ӧ11׶)ÿһngx_http_phase_tṹӦ
      * һhttp׶ед
      */
     ngx_http_phase_t           phases[NGX_HTTP_LOG_PHASE + 1];
+
+    ngx_array_t                phase_active;    /* ngx_http_phase_active_t */
 } ngx_http_core_main_conf_t;
 
 
@@ -357,6 +396,9 @@ typedef struct {
 
     ngx_uint_t                 nregex;
     ngx_http_server_name_t    *regex;
+#if (NGX_PCRE)
+    ngx_http_regex_set_t      *regex_set;
+#endif
 } ngx_http_virtual_names_t;
 
 
@@ -366,7 +408,8 @@ struct ngx_http_addr_conf_s {
      * Ϊʲôһip:portҪĬϵserver?
      * ĵշͨipַȷģһip:portжserverڼ
      * ôĳʼ׶Ƿֱ治ӦĸserverģҪ
-     * һĬϵserverip:portϵıȽһԵĴ()
+     * һĬϵserverip
+:portϵıȽһԵĴ()
      * лͷеhostNginxֶεֵȥȡ˴
      * serverøserverӹĺ
      */
@@ -433,6 +476,7 @@ typedef struct {
 #if (NGX_PCRE)
     ngx_uint_t                 nregex;
     ngx_http_server_name_t    *regex;
+    ngx_http_regex_set_t      *regex_set;
 #endif
 
     /* the default server configuration for this address:port */
@@ -488,9 +532,10 @@ struct ngx_http_core_loc_conf_s {
 #endif
 #endif
 
-    ngx_http_location_tree_node_t   *static_locations;
+    ngx_http_location_trie_t        *static_locations;
 #if (NGX_PCRE)
     ngx_http_core_loc_conf_t       **regex_locations;
+    ngx_http_regex_set_t            *regex_set;
 #endif
 
     /* pointer to the modules' loc_conf */
@@ -500,6 +545,10 @@ struct ngx_http_core_loc_conf_s {
      */
     void        **loc_conf;
 
+    /* the phase engine without handlers inactive in this location */
+    ngx_http_phase_handler_t  *phase_handlers;
+    ngx_uint_t                 nphase_handlers;
+
     uint32_t      limit_except;
     void        **limit_except_loc_conf;
 
@@ -522,6 +571,7 @@ struct ngx_http_core_loc_conf_s {
     off_t         directio_alignment;      /* directio_alignment */
 
     size_t        client_body_buffer_size; /* client_body_buffer_size */
+    size_t        client_body_spool_max_size;
     size_t        send_lowat;              /* send_lowat */
     size_t        postpone_output;         /* postpone_output */
     size_t        limit_rate;              /* limit_rate */
@@ -639,21 +689,40 @@ typedef struct {
     /* ָļ· */
     u_char                          *file_name;
     ngx_uint_t                       line;
-    ngx_queue_t                      list;
 } ngx_http_location_queue_t;
 
 
-struct ngx_http_location_tree_node_s {
-    ngx_http_location_tree_node_t   *left;
-    ngx_http_location_tree_node_t   *right;
-    ngx_http_location_tree_node_t   *tree;
+/*
+ * the static locations are kept in a path compressed trie stored in
+ * a flat array: the children of a node occupy the consecutive slots
+ * starting at the "children" index, and the same slots of the "keys"
+ * array hold the first bytes of their names as ngx_http_location_trie_key()
+ * maps them, in ascending order
+ */
+
+#if (NGX_HAVE_CASELESS_FILESYSTEM)
+#define ngx_http_location_trie_key(c)  ((c) == '/' ? 0 : ngx_tolower(c))
+#else
+#define ngx_http_location_trie_key(c)  ((c) == '/' ? 0 : (c))
+#endif
+
+
+typedef struct {
+    u_char                          *name;
+    uint32_t                         len;
+    uint32_t                         children;
+    uint16_t                         nchildren;
+    u_char                           auto_redirect;
 
     ngx_http_core_loc_conf_t        *exact;
     ngx_http_core_loc_conf_t        *inclusive;
+} ngx_http_location_trie_node_t;
 
-    u_char                           auto_redirect;
-    u_char                           len;
-    u_char                           name[1];
+
+struct ngx_http_location_trie_s {
+    ngx_http_location_trie_node_t   *nodes;
+    u_char                          *keys;
+    ngx_uint_t                       nnodes;
 };
 
 
@@ -713,6 +782,9 @@ ngx_int_t ngx_http_output_filter(ngx_http_request_t *r, ngx_chain_t *chain);
 ngx_int_t ngx_http_write_filter(ngx_http_request_t *r, ngx_chain_t *chain);
 ngx_int_t ngx_http_request_body_save_filter(ngx_http_request_t *r,
     ngx_chain_t *chain);
+ngx_http_request_body_spool_t *ngx_http_request_body_spool_create(
+    ngx_cycle_t *cycle, size_t size);
+void ngx_http_request_timing_done(ngx_http_request_t *r);
 
 
 ngx_int_t ngx_http_set_disable_symlinks(ngx_http_request_t *r,
@@ -721,6 +793,9 @@ ngx_int_t ngx_http_set_disable_symlinks(ngx_http_request_t *r,
 ngx_int_t ngx_http_get_forwarded_addr(ngx_http_request_t *r, ngx_addr_t *addr,
     ngx_array_t *headers, ngx_str_t *value, ngx_array_t *proxies,
     int recursive);
+ngx_int_t ngx_http_get_forwarded_addr_trie(ngx_http_request_t *r,
+    ngx_addr_t *addr, ngx_array_t *headers, ngx_str_t *value,
+    ngx_cidr_trie_t *proxies, int recursive);
 
 
 extern ngx_module_t  ngx_http_core_module;
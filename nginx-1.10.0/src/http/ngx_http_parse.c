@@ -2113,11 +2113,101 @@ ngx_http_split_args(ngx_http_request_t *r, ngx_str_t *uri, ngx_str_t *args)
 }
 
 
+static u_char  ngx_http_chunked_hex[] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+
+/*
+ * the fast path for the common "HEX CRLF" chunk-size line which is
+ * entirely within the buffer: the digits are converted with a table
+ * lookup instead of being fed one by one through the state machine;
+ * anything unusual (extensions, the last chunk, a line split across
+ * buffers, an overly long size) is left to the state machine
+ */
+
+static u_char *
+ngx_http_parse_chunk_size(u_char *p, u_char *last, off_t *size)
+{
+    u_char  *start, *end, d;
+    off_t    n;
+
+    /*
+     * at most 15 digits are converted, so the size cannot overflow;
+     * a longer one is not followed by CRLF here and is left to the state
+     * machine, which limits it to NGX_MAX_OFF_T_VALUE
+     */
+
+    end = (last - p > 15) ? p + 15 : last;
+
+    start = p;
+    n = 0;
+
+    while (p < end) {
+        d = ngx_http_chunked_hex[*p];
+
+        if (d > 0x0f) {
+            break;
+        }
+
+        n = (n << 4) | d;
+        p++;
+    }
+
+    if (p == start || n == 0) {
+        return NULL;
+    }
+
+    if (p < last && *p == LF) {
+        *size = n;
+        return p + 1;
+    }
+
+    if (last - p >= 2 && p[0] == CR && p[1] == LF) {
+        *size = n;
+        return p + 2;
+    }
+
+    return NULL;
+}
+
+
 ngx_int_t
 ngx_http_parse_chunked(ngx_http_request_t *r, ngx_buf_t *b,
     ngx_http_chunked_t *ctx)
 {
-    u_char     *pos, ch, c;
+    u_char     *pos, *p, ch, c;
     ngx_int_t   rc;
     enum {
         sw_chunk_start = 0,
@@ -2153,6 +2243,19 @@ ngx_http_parse_chunked(ngx_http_request_t *r, ngx_buf_t *b,
         switch (state) {
 
         case sw_chunk_start:
+            p = ngx_http_parse_chunk_size(pos, b->last, &ctx->size);
+
+            if (p) {
+                state = sw_chunk_data;
+                pos = p;
+
+                if (pos < b->last) {
+                    rc = NGX_OK;
+                }
+
+                goto data;
+            }
+
             if (ch >= '0' && ch <= '9') {
                 state = sw_chunk_size;
                 ctx->size = ch - '0';
@@ -2249,6 +2352,12 @@ ngx_http_parse_chunked(ngx_http_request_t *r, ngx_buf_t *b,
         case sw_after_data:
             switch (ch) {
             case CR:
+                if (pos + 1 < b->last && pos[1] == LF) {
+                    pos++;
+                    state = sw_chunk_start;
+                    break;
+                }
+
                 state = sw_after_data_almost_done;
                 break;
             case LF:
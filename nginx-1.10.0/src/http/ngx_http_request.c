@@ -677,6 +677,14 @@ ngx_http_create_request(ngx_connection_t *c)
         return NULL;
     }
 
+    if (cmcf->request_timing) {
+        r->timing = ngx_pcalloc(r->pool, sizeof(ngx_http_request_timing_t));
+        if (r->timing == NULL) {
+            ngx_destroy_pool(r->pool);
+            return NULL;
+        }
+    }
+
 #if (NGX_HTTP_SSL)
     if (c->ssl) {
         r->main_filter_need_in_memory = 1;
@@ -2331,7 +2339,6 @@ ngx_http_find_virtual_server(ngx_connection_t *c,
 
     if (host->len && virtual_names->nregex) {
         ngx_int_t                n;
-        ngx_uint_t               i;
         ngx_http_server_name_t  *sn;
 
         sn = virtual_names->regex;
@@ -2339,6 +2346,7 @@ ngx_http_find_virtual_server(ngx_connection_t *c,
 #if (NGX_HTTP_SSL && defined SSL_CTRL_SET_TLSEXT_HOSTNAME)
 
         if (r == NULL) {
+            ngx_uint_t              i;
             ngx_http_connection_t  *hc;
 
             for (i = 0; i < virtual_names->nregex; i++) {
@@ -2370,19 +2378,14 @@ ngx_http_find_virtual_server(ngx_connection_t *c,
 
 #endif /* NGX_HTTP_SSL && defined SSL_CTRL_SET_TLSEXT_HOSTNAME */
 
-        for (i = 0; i < virtual_names->nregex; i++) {
-
-            n = ngx_http_regex_exec(r, sn[i].regex, host);
-
-            if (n == NGX_DECLINED) {
-                continue;
-            }
+        n = ngx_http_regex_set_exec(r, virtual_names->regex_set, host);
 
-            if (n == NGX_OK) {
-                *cscfp = sn[i].server;
-                return NGX_OK;
-            }
+        if (n >= 0) {
+            *cscfp = sn[n].server;
+            return NGX_OK;
+        }
 
+        if (n == NGX_ERROR) {
             return NGX_ERROR;
         }
     }
@@ -3804,6 +3807,10 @@ ngx_http_free_request(ngx_http_request_t *r, ngx_int_t rc)
         r->headers_out.status = rc;
     }
 
+    if (r->timing) {
+        ngx_http_request_timing_done(r);
+    }
+
     log->action = "logging request";
 
     /* NGX_HTTP_LOG_PHASE׶εĴ¼־Ϊ¼־Ҫʱ */
@@ -309,6 +309,47 @@ typedef struct {
 } ngx_http_request_body_t;
 
 
+/*
+ * a per-worker ring of anonymous mapped memory, request bodies of known
+ * length which do not fit into client_body_buffer_size are read there
+ * instead of being buffered to a temporary file
+ */
+
+typedef struct {
+    u_char                           *start;
+    u_char                           *end;
+    u_char                           *head;
+    u_char                           *tail;
+    u_char                           *wrap;
+    ngx_uint_t                        blocks;
+    ngx_shm_t                         shm;
+} ngx_http_request_body_spool_t;
+
+
+/*
+ * the time in microseconds a request spends in each phase before
+ * the log one and in the header and body filter chains; the time of
+ * a nested call is not counted in the slot of its caller
+ */
+
+#define NGX_HTTP_TIMING_HEADER_FILTER     10
+#define NGX_HTTP_TIMING_BODY_FILTER       11
+#define NGX_HTTP_TIMING_SLOTS             12
+
+typedef struct {
+    ngx_uint_t                        usec[NGX_HTTP_TIMING_SLOTS];
+    ngx_uint_t                        used;
+    ngx_uint_t                        slot;
+    ngx_uint_t                        start;
+
+    /*
+     * the flag of the innermost ngx_http_core_run_phases() call, set when
+     * the request is freed so that the caller does not touch it anymore
+     */
+    ngx_uint_t                       *freed;
+} ngx_http_request_timing_t;
+
+
 typedef struct ngx_http_addr_conf_s  ngx_http_addr_conf_t;
 
 /* ýṹ洢ǷͻӶӦ[port,ip]Ϣ */
@@ -492,10 +533,17 @@ struct ngx_http_request_s {
      */
     ngx_http_variable_value_t        *variables;
 
+    ngx_http_request_timing_t        *timing;
+
+    ngx_http_variable_index_t        *args_index;
+    ngx_http_variable_index_t        *cookies_index;
+    ngx_http_variable_index_t        *headers_index;
+
 #if (NGX_PCRE)
     ngx_uint_t                        ncaptures;
     int                              *captures;
     u_char                           *captures_data;
+    ngx_http_regex_memo_t            *regex_memo;
 #endif
 
     size_t                            limit_rate;  // Ӧ
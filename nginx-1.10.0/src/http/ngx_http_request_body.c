@@ -10,6 +10,22 @@
 #include <ngx_http.h>
 
 
+/*
+ * chunks not larger than this are moved in place right after the data
+ * of the previous chunk from the same buffer, so a run of small chunks
+ * is passed on as a single buffer
+ */
+
+#define NGX_HTTP_CHUNKED_MERGE_SIZE  4096
+
+
+typedef struct {
+    ngx_http_request_body_spool_t  *spool;
+    size_t                          size;
+    ngx_uint_t                      free;
+} ngx_http_request_body_spool_block_t;
+
+
 static void ngx_http_read_client_request_body_handler(ngx_http_request_t *r);
 static ngx_int_t ngx_http_do_read_client_request_body(ngx_http_request_t *r);
 static ngx_int_t ngx_http_write_request_body(ngx_http_request_t *r);
@@ -17,6 +33,10 @@ static ngx_int_t ngx_http_read_discarded_request_body(ngx_http_request_t *r);
 static ngx_int_t ngx_http_discard_request_body_filter(ngx_http_request_t *r,
     ngx_buf_t *b);
 static ngx_int_t ngx_http_test_expect(ngx_http_request_t *r);
+static ngx_int_t ngx_http_request_body_spool_buf(ngx_http_request_t *r);
+static u_char *ngx_http_request_body_spool_alloc(
+    ngx_http_request_body_spool_t *spool, size_t size);
+static void ngx_http_request_body_spool_free(void *data);
 
 static ngx_int_t ngx_http_request_body_filter(ngx_http_request_t *r,
     ngx_chain_t *in);
@@ -226,11 +246,23 @@ ngx_http_read_client_request_body(ngx_http_request_t *r,
         size = clcf->client_body_buffer_size;
     }
 
+    if (!r->headers_in.chunked && rb->rest > size) {
+
+        rc = ngx_http_request_body_spool_buf(r);
+
+        if (rc == NGX_ERROR) {
+            rc = NGX_HTTP_INTERNAL_SERVER_ERROR;
+            goto done;
+        }
+    }
+
     /* ڽհĻ */
-    rb->buf = ngx_create_temp_buf(r->pool, size);
     if (rb->buf == NULL) {
-        rc = NGX_HTTP_INTERNAL_SERVER_ERROR;
-        goto done;
+        rb->buf = ngx_create_temp_buf(r->pool, size);
+        if (rb->buf == NULL) {
+            rc = NGX_HTTP_INTERNAL_SERVER_ERROR;
+            goto done;
+        }
     }
 
     /* д¼ */
@@ -613,6 +645,195 @@ ngx_http_write_request_body(ngx_http_request_t *r)
     return NGX_OK;
 }
 
+
+ngx_http_request_body_spool_t *
+ngx_http_request_body_spool_create(ngx_cycle_t *cycle, size_t size)
+{
+    ngx_http_request_body_spool_t  *spool;
+
+    spool = ngx_pcalloc(cycle->pool, sizeof(ngx_http_request_body_spool_t));
+    if (spool == NULL) {
+        return NULL;
+    }
+
+    spool->shm.size = size;
+    ngx_str_set(&spool->shm.name, "client_body_spool");
+    spool->shm.log = cycle->log;
+
+    if (ngx_shm_alloc(&spool->shm) != NGX_OK) {
+        return NULL;
+    }
+
+    spool->start = spool->shm.addr;
+    spool->end = spool->shm.addr + size;
+    spool->head = spool->start;
+    spool->tail = spool->start;
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     spool->wrap = NULL;
+     *     spool->blocks = 0;
+     */
+
+    return spool;
+}
+
+
+static ngx_int_t
+ngx_http_request_body_spool_buf(ngx_http_request_t *r)
+{
+    size_t                          size;
+    ngx_buf_t                      *b;
+    ngx_pool_cleanup_t             *cln;
+    ngx_http_request_body_t        *rb;
+    ngx_http_core_loc_conf_t       *clcf;
+    ngx_http_core_main_conf_t      *cmcf;
+    ngx_http_request_body_spool_t  *spool;
+
+    cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+
+    spool = cmcf->client_body_spool;
+
+    if (spool == NULL
+        || r->request_body_in_file_only
+        || r->request_body_in_single_buf
+        || r->request_body_no_buffering)
+    {
+        return NGX_DECLINED;
+    }
+
+    rb = r->request_body;
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (rb->rest > (off_t) clcf->client_body_spool_max_size) {
+        return NGX_DECLINED;
+    }
+
+    size = (size_t) rb->rest;
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->start = ngx_http_request_body_spool_alloc(spool, size);
+
+    if (b->start == NULL) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http client request body spool is full, %uz", size);
+        return NGX_DECLINED;
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        ngx_http_request_body_spool_free(b->start);
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_http_request_body_spool_free;
+    cln->data = b->start;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http client request body spooled to %p, %uz",
+                   b->start, size);
+
+    b->temporary = 1;
+    b->pos = b->start;
+    b->last = b->start;
+    b->end = b->start + size;
+
+    rb->buf = b;
+
+    return NGX_OK;
+}
+
+
+static u_char *
+ngx_http_request_body_spool_alloc(ngx_http_request_body_spool_t *spool,
+    size_t size)
+{
+    u_char                               *p;
+    ngx_http_request_body_spool_block_t  *block;
+
+    size = ngx_align(sizeof(ngx_http_request_body_spool_block_t) + size,
+                     NGX_ALIGNMENT);
+
+    /*
+     * the blocks are allocated at the head and released in any order,
+     * the tail is advanced past released blocks only; the data occupy
+     * either [tail, head), or [tail, wrap) and [start, head) after the
+     * head has wrapped around
+     */
+
+    if (spool->wrap == NULL) {
+
+        if ((size_t) (spool->end - spool->head) >= size) {
+            p = spool->head;
+
+        } else if ((size_t) (spool->tail - spool->start) >= size) {
+            spool->wrap = spool->head;
+            p = spool->start;
+
+        } else {
+            return NULL;
+        }
+
+    } else if ((size_t) (spool->tail - spool->head) >= size) {
+        p = spool->head;
+
+    } else {
+        return NULL;
+    }
+
+    spool->head = p + size;
+    spool->blocks++;
+
+    block = (ngx_http_request_body_spool_block_t *) p;
+
+    block->spool = spool;
+    block->size = size;
+    block->free = 0;
+
+    return (u_char *) (block + 1);
+}
+
+
+static void
+ngx_http_request_body_spool_free(void *data)
+{
+    ngx_http_request_body_spool_t        *spool;
+    ngx_http_request_body_spool_block_t  *block;
+
+    block = (ngx_http_request_body_spool_block_t *) data - 1;
+    spool = block->spool;
+
+    block->free = 1;
+
+    if (--spool->blocks == 0) {
+        spool->head = spool->start;
+        spool->tail = spool->start;
+        spool->wrap = NULL;
+        return;
+    }
+
+    for ( ;; ) {
+
+        if (spool->tail == spool->wrap) {
+            spool->tail = spool->start;
+            spool->wrap = NULL;
+        }
+
+        block = (ngx_http_request_body_spool_block_t *) spool->tail;
+
+        if (!block->free) {
+            return;
+        }
+
+        spool->tail += block->size;
+    }
+}
+
 /*
  * һ嶯 
  *     httpģԣհǼ򵥵زհ壬Ƕhttp˵
@@ -1170,7 +1391,7 @@ ngx_http_request_body_chunked_filter(ngx_http_request_t *r, ngx_chain_t *in)
 {
     size_t                     size;
     ngx_int_t                  rc;
-    ngx_buf_t                 *b;
+    ngx_buf_t                 *b, *prev;
     ngx_chain_t               *cl, *out, *tl, **ll;
     ngx_http_request_body_t   *rb;
     ngx_http_core_loc_conf_t  *clcf;
@@ -1196,6 +1417,8 @@ ngx_http_request_body_chunked_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
     for (cl = in; cl; cl = cl->next) {
 
+        prev = NULL;
+
         for ( ;; ) {
 
             ngx_log_debug7(NGX_LOG_DEBUG_EVENT, r->connection->log, 0,
@@ -1230,40 +1453,49 @@ ngx_http_request_body_chunked_filter(ngx_http_request_t *r, ngx_chain_t *in)
                     return NGX_HTTP_REQUEST_ENTITY_TOO_LARGE;
                 }
 
-                tl = ngx_chain_get_free_buf(r->pool, &rb->free);
-                if (tl == NULL) {
-                    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+                size = cl->buf->last - cl->buf->pos;
+
+                if ((off_t) size > rb->chunked->size) {
+                    size = (size_t) rb->chunked->size;
                 }
 
-                b = tl->buf;
+                if (prev && size <= NGX_HTTP_CHUNKED_MERGE_SIZE) {
 
-                ngx_memzero(b, sizeof(ngx_buf_t));
+                    /*
+                     * the chunk-size line between the previous chunk data
+                     * and this one is already parsed, so the data are
+                     * moved over it to extend the previous buffer
+                     */
 
-                b->temporary = 1;
-                b->tag = (ngx_buf_tag_t) &ngx_http_read_client_request_body;
-                b->start = cl->buf->pos;
-                b->pos = cl->buf->pos;
-                b->last = cl->buf->last;
-                b->end = cl->buf->end;
-                b->flush = r->request_body_no_buffering;
+                    prev->last = ngx_movemem(prev->last, cl->buf->pos, size);
 
-                *ll = tl;
-                ll = &tl->next;
+                } else {
+                    tl = ngx_chain_get_free_buf(r->pool, &rb->free);
+                    if (tl == NULL) {
+                        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+                    }
 
-                size = cl->buf->last - cl->buf->pos;
+                    b = tl->buf;
 
-                if ((off_t) size > rb->chunked->size) {
-                    cl->buf->pos += (size_t) rb->chunked->size;
-                    r->headers_in.content_length_n += rb->chunked->size;
-                    rb->chunked->size = 0;
+                    ngx_memzero(b, sizeof(ngx_buf_t));
 
-                } else {
-                    rb->chunked->size -= size;
-                    r->headers_in.content_length_n += size;
-                    cl->buf->pos = cl->buf->last;
+                    b->temporary = 1;
+                    b->tag = (ngx_buf_tag_t) &ngx_http_read_client_request_body;
+                    b->start = cl->buf->pos;
+                    b->pos = cl->buf->pos;
+                    b->last = cl->buf->pos + size;
+                    b->end = cl->buf->end;
+                    b->flush = r->request_body_no_buffering;
+
+                    *ll = tl;
+                    ll = &tl->next;
+
+                    prev = b;
                 }
 
-                b->last = cl->buf->pos;
+                cl->buf->pos += size;
+                rb->chunked->size -= size;
+                r->headers_in.content_length_n += size;
 
                 continue;
             }
@@ -10,6 +10,11 @@
 #include <ngx_http.h>
 
 
+static ngx_int_t ngx_http_complex_value_flat(ngx_http_request_t *r,
+    ngx_http_complex_value_t *val, ngx_str_t *value);
+static u_char *ngx_http_complex_value_flat_part(ngx_http_request_t *r,
+    u_char *ip, u_char **data, size_t *len);
+static ngx_uint_t ngx_http_script_flat_values(u_char *ip);
 static ngx_int_t ngx_http_script_init_arrays(ngx_http_script_compile_t *sc);
 static ngx_int_t ngx_http_script_done(ngx_http_script_compile_t *sc);
 static ngx_int_t ngx_http_script_add_copy_code(ngx_http_script_compile_t *sc,
@@ -70,6 +75,10 @@ ngx_http_complex_value(ngx_http_request_t *r, ngx_http_complex_value_t *val,
 
     ngx_http_script_flush_complex_value(r, val);
 
+    if (val->flat) {
+        return ngx_http_complex_value_flat(r, val, value);
+    }
+
     ngx_memzero(&e, sizeof(ngx_http_script_engine_t));
 
     e.ip = val->lengths;
@@ -104,6 +113,169 @@ ngx_http_complex_value(ngx_http_request_t *r, ngx_http_complex_value_t *val,
 }
 
 
+static ngx_int_t
+ngx_http_complex_value_flat(ngx_http_request_t *r,
+    ngx_http_complex_value_t *val, ngx_str_t *value)
+{
+    u_char       *ip, *start, *p, *end, *data;
+    size_t        len, size, total;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl, *out, **ll;
+
+    /*
+     * the parts are copied as they are evaluated into a buffer of the size
+     * of the previous value; a part that does not fit starts a new buffer,
+     * and the buffers are joined at the end
+     */
+
+    size = val->size;
+
+    start = ngx_pnalloc(r->pool, size);
+    if (start == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = start;
+    end = start + size;
+
+    total = 0;
+    out = NULL;
+    ll = &out;
+
+    for (ip = val->values; *(uintptr_t *) ip; /* void */ ) {
+        ip = ngx_http_complex_value_flat_part(r, ip, &data, &len);
+
+        if (len > (size_t) (end - p)) {
+
+            if (p != start) {
+                cl = ngx_alloc_chain_link(r->pool);
+                if (cl == NULL) {
+                    return NGX_ERROR;
+                }
+
+                b = ngx_calloc_buf(r->pool);
+                if (b == NULL) {
+                    return NGX_ERROR;
+                }
+
+                b->pos = start;
+                b->last = p;
+
+                cl->buf = b;
+                cl->next = NULL;
+
+                *ll = cl;
+                ll = &cl->next;
+            }
+
+            size = ngx_max(2 * size, len);
+
+            start = ngx_pnalloc(r->pool, size);
+            if (start == NULL) {
+                return NGX_ERROR;
+            }
+
+            p = start;
+            end = start + size;
+        }
+
+        p = ngx_cpymem(p, data, len);
+        total += len;
+    }
+
+    val->size = total;
+    value->len = total;
+
+    if (out == NULL) {
+        value->data = start;
+
+    } else {
+        value->data = ngx_pnalloc(r->pool, total);
+        if (value->data == NULL) {
+            return NGX_ERROR;
+        }
+
+        data = value->data;
+
+        for (cl = out; cl; cl = cl->next) {
+            data = ngx_cpymem(data, cl->buf->pos,
+                              cl->buf->last - cl->buf->pos);
+        }
+
+        ngx_memcpy(data, start, p - start);
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http script flat value: \"%*s\"", value->len, value->data);
+
+    return NGX_OK;
+}
+
+
+static u_char *
+ngx_http_complex_value_flat_part(ngx_http_request_t *r, u_char *ip,
+    u_char **data, size_t *len)
+{
+    ngx_http_variable_value_t    *vv;
+    ngx_http_script_var_code_t   *var;
+    ngx_http_script_copy_code_t  *copy;
+
+    if (*(ngx_http_script_code_pt *) ip == ngx_http_script_copy_code) {
+        copy = (ngx_http_script_copy_code_t *) ip;
+
+        *len = copy->len;
+        *data = ip + sizeof(ngx_http_script_copy_code_t);
+
+        return ip + sizeof(ngx_http_script_copy_code_t)
+               + ((copy->len + sizeof(uintptr_t) - 1)
+                  & ~(sizeof(uintptr_t) - 1));
+    }
+
+    var = (ngx_http_script_var_code_t *) ip;
+
+    vv = ngx_http_get_indexed_variable(r, var->index);
+
+    if (vv == NULL || vv->not_found) {
+        *len = 0;
+        *data = NULL;
+
+    } else {
+        *len = vv->len;
+        *data = vv->data;
+    }
+
+    return ip + sizeof(ngx_http_script_var_code_t);
+}
+
+
+static ngx_uint_t
+ngx_http_script_flat_values(u_char *ip)
+{
+    ngx_http_script_code_pt       code;
+    ngx_http_script_copy_code_t  *copy;
+
+    while (*(uintptr_t *) ip) {
+        code = *(ngx_http_script_code_pt *) ip;
+
+        if (code == ngx_http_script_copy_code) {
+            copy = (ngx_http_script_copy_code_t *) ip;
+
+            ip += sizeof(ngx_http_script_copy_code_t)
+                  + ((copy->len + sizeof(uintptr_t) - 1)
+                     & ~(sizeof(uintptr_t) - 1));
+
+        } else if (code == ngx_http_script_copy_var_code) {
+            ip += sizeof(ngx_http_script_var_code_t);
+
+        } else {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
 ngx_int_t
 ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv)
 {
@@ -144,6 +316,8 @@ ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv)
     ccv->complex_value->flushes = NULL;
     ccv->complex_value->lengths = NULL;
     ccv->complex_value->values = NULL;
+    ccv->complex_value->size = 0;
+    ccv->complex_value->flat = 0;
 
     if (nv == 0 && nc == 0) {
         return NGX_OK;
@@ -205,6 +379,8 @@ ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv)
     ccv->complex_value->lengths = lengths.elts;
     ccv->complex_value->values = values.elts;
 
+    ccv->complex_value->flat = ngx_http_script_flat_values(values.elts);
+
     return NGX_OK;
 }
 
@@ -1532,6 +1708,44 @@ ngx_http_script_not_equal_code(ngx_http_script_engine_t *e)
 }
 
 
+void
+ngx_http_script_var_equal_code(ngx_http_script_engine_t *e)
+{
+    ngx_uint_t                         equal;
+    ngx_http_variable_value_t         *value;
+    ngx_http_script_var_equal_code_t  *code;
+
+    code = (ngx_http_script_var_equal_code_t *) e->ip;
+
+    e->ip += sizeof(ngx_http_script_var_equal_code_t);
+
+    value = ngx_http_get_flushed_variable(e->request, code->index);
+
+    if (value == NULL || value->not_found) {
+        value = &ngx_http_variable_null_value;
+    }
+
+    equal = (value->len == code->text_len
+             && ngx_strncmp(value->data, (u_char *) code->text_data,
+                            code->text_len)
+                == 0);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, e->request->connection->log, 0,
+                   "http script var %s \"%v\": %ui",
+                   code->negative ? "not equal" : "equal", value,
+                   equal ^ code->negative);
+
+    if (equal ^ code->negative) {
+        *e->sp = ngx_http_variable_true_value;
+
+    } else {
+        *e->sp = ngx_http_variable_null_value;
+    }
+
+    e->sp++;
+}
+
+
 void
 ngx_http_script_file_code(ngx_http_script_engine_t *e)
 {
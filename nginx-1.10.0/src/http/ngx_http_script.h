@@ -77,6 +77,12 @@ typedef struct {
     ngx_uint_t                 *flushes;
     void                       *lengths;
     void                       *values;
+
+    /* the length of the last flat value, the buffer to start with */
+    size_t                      size;
+
+    /* the values are only constants and variables */
+    unsigned                    flat:1;
 } ngx_http_complex_value_t;
 
 
@@ -213,6 +219,16 @@ typedef struct {
 } ngx_http_script_value_code_t;
 
 
+/* "$var = text" and "$var != text" conditions folded into one code */
+typedef struct {
+    ngx_http_script_code_pt     code;
+    uintptr_t                   index;
+    uintptr_t                   text_len;
+    uintptr_t                   text_data;
+    uintptr_t                   negative;
+} ngx_http_script_var_equal_code_t;
+
+
 void ngx_http_script_flush_complex_value(ngx_http_request_t *r,
     ngx_http_complex_value_t *val);
 ngx_int_t ngx_http_complex_value(ngx_http_request_t *r,
@@ -255,6 +271,7 @@ void ngx_http_script_break_code(ngx_http_script_engine_t *e);
 void ngx_http_script_if_code(ngx_http_script_engine_t *e);
 void ngx_http_script_equal_code(ngx_http_script_engine_t *e);
 void ngx_http_script_not_equal_code(ngx_http_script_engine_t *e);
+void ngx_http_script_var_equal_code(ngx_http_script_engine_t *e);
 void ngx_http_script_file_code(ngx_http_script_engine_t *e);
 void ngx_http_script_complex_value_code(ngx_http_script_engine_t *e);
 void ngx_http_script_value_code(ngx_http_script_engine_t *e);
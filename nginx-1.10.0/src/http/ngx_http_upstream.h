@@ -111,6 +111,7 @@ typedef struct {
     ngx_uint_t                       weight;  // Ȩ
     ngx_uint_t                       max_fails;  // fail_timeoutʱڿʧܵ
     time_t                           fail_timeout;  // max_failsʹ
+    ngx_msec_t                       slow_start;
 
     unsigned                         down:1;  // ָʾǷ崻ı־
     unsigned                         backup:1;  // ָʾǷΪݷı־
@@ -123,6 +124,7 @@ typedef struct {
 #define NGX_HTTP_UPSTREAM_FAIL_TIMEOUT  0x0008
 #define NGX_HTTP_UPSTREAM_DOWN          0x0010
 #define NGX_HTTP_UPSTREAM_BACKUP        0x0020
+#define NGX_HTTP_UPSTREAM_SLOW_START    0x0040
 
 /* һupstreamϢṹ */
 struct ngx_http_upstream_srv_conf_s {
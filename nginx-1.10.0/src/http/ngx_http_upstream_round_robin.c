@@ -14,6 +14,24 @@
                                     + ((p)->next ? (p)->next->number : 0))
 
 
+#define NGX_HTTP_UPSTREAM_RR_SCHEDULE_PEERS  16
+#define NGX_HTTP_UPSTREAM_RR_SCHEDULE_SLOTS  262144
+#define NGX_HTTP_UPSTREAM_RR_SCHEDULE_SKIP   8
+
+/*
+ * the weighted selection adds scaled weights, so that a peer of weight 1
+ * in slow start still gets a gradually growing share
+ */
+#define NGX_HTTP_UPSTREAM_RR_WEIGHT_SCALE    256
+
+#define ngx_http_upstream_rr_position(n, count, i)                            \
+    ((uint64_t) 2 * (n) * (count)[i] + 2 * (i) + 1)
+
+
+static ngx_int_t ngx_http_upstream_init_round_robin_schedule(ngx_conf_t *cf,
+    ngx_http_upstream_rr_peers_t *peers);
+static void ngx_http_upstream_round_robin_schedule_sift(uint32_t *heap,
+    uint32_t *count, uint32_t *weight, ngx_uint_t n, ngx_uint_t r);
 static ngx_http_upstream_rr_peer_t *ngx_http_upstream_get_peer(
     ngx_http_upstream_rr_peer_data_t *rrp);
 
@@ -120,6 +138,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
                 peer[n].current_weight = 0;
                 peer[n].max_fails = server[i].max_fails;
                 peer[n].fail_timeout = server[i].fail_timeout;
+                peer[n].slow_start = server[i].slow_start;
                 peer[n].down = server[i].down;
                 peer[n].server = server[i].name;
 
@@ -130,6 +149,10 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
         }
 
         /* ŷǱݺ˷бngx_http_upstream_rr_peers_tصus->peer.data */
+        if (ngx_http_upstream_init_round_robin_schedule(cf, peers) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
         us->peer.data = peers;
 
         /* backup servers */
@@ -192,6 +215,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
                 peer[n].current_weight = 0;
                 peer[n].max_fails = server[i].max_fails;
                 peer[n].fail_timeout = server[i].fail_timeout;
+                peer[n].slow_start = server[i].slow_start;
                 peer[n].down = server[i].down;
                 peer[n].server = server[i].name;
 
@@ -202,6 +226,12 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
         }
 
         /* ݺ˷ɵбصǱݺ˷бnextֶ */
+        if (ngx_http_upstream_init_round_robin_schedule(cf, backup)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
         peers->next = backup;
 
         return NGX_OK;
@@ -276,6 +306,10 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
     }
 
     /* ˷бĶصus->peer.data */
+    if (ngx_http_upstream_init_round_robin_schedule(cf, peers) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
     us->peer.data = peers;
 
     /* implicitly defined upstream has no backup servers */
@@ -283,6 +317,139 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
     return NGX_OK;
 }
 
+static ngx_int_t
+ngx_http_upstream_init_round_robin_schedule(ngx_conf_t *cf,
+    ngx_http_upstream_rr_peers_t *peers)
+{
+    uint32_t                     *heap, *count, *weight;
+    ngx_uint_t                    i, n, a, b, t, slots;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    /*
+     * Selecting a peer scans all peers of a group, so for large groups
+     * a stride schedule is precomputed: the k-th of w selections of the
+     * i-th of n peers takes the position (k + (2i + 1) / 2n) / w of the
+     * cycle.  Selections of every peer are thus spread evenly over the
+     * cycle, and the phases keep peers with equal weights from clustering,
+     * as with smooth weighted round robin, while taking the next slot is O(1).
+     */
+
+    n = peers->number;
+
+    if (n < NGX_HTTP_UPSTREAM_RR_SCHEDULE_PEERS) {
+        return NGX_OK;
+    }
+
+    /* the cycle is shortened by the greatest common divisor of weights */
+
+    a = 0;
+
+    for (peer = peers->peer; peer; peer = peer->next) {
+        for (b = peer->weight; b; /* void */) {
+            t = a % b;
+            a = b;
+            b = t;
+        }
+    }
+
+    slots = peers->total_weight / a;
+
+    if (slots > NGX_HTTP_UPSTREAM_RR_SCHEDULE_SLOTS) {
+        return NGX_OK;
+    }
+
+    peers->index = ngx_palloc(cf->pool,
+                              n * sizeof(ngx_http_upstream_rr_peer_t *));
+    if (peers->index == NULL) {
+        return NGX_ERROR;
+    }
+
+    peers->schedule = ngx_palloc(cf->pool, slots * sizeof(uint32_t));
+    if (peers->schedule == NULL) {
+        return NGX_ERROR;
+    }
+
+    heap = ngx_palloc(cf->temp_pool, 3 * n * sizeof(uint32_t));
+    if (heap == NULL) {
+        return NGX_ERROR;
+    }
+
+    count = heap + n;
+    weight = count + n;
+
+    for (peer = peers->peer, i = 0; peer; peer = peer->next, i++) {
+        peers->index[i] = peer;
+        heap[i] = i;
+        count[i] = 0;
+        weight[i] = peer->weight / a;
+    }
+
+    for (i = n / 2; i--; /* void */) {
+        ngx_http_upstream_round_robin_schedule_sift(heap, count, weight, n, i);
+    }
+
+    for (i = 0; i < slots; i++) {
+        peers->schedule[i] = heap[0];
+        count[heap[0]]++;
+
+        ngx_http_upstream_round_robin_schedule_sift(heap, count, weight, n, 0);
+    }
+
+    peers->slots = slots;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_round_robin_schedule_sift(uint32_t *heap, uint32_t *count,
+    uint32_t *weight, ngx_uint_t n, ngx_uint_t r)
+{
+    uint32_t    t;
+    uint64_t    pc, pr;
+    ngx_uint_t  c;
+
+    /*
+     * the heap is ordered by the position of the next selection of a peer,
+     * (2n * count + 2i + 1) / (2n * weight), with ties broken by the number
+     */
+
+    for ( ;; ) {
+        c = 2 * r + 1;
+
+        if (c >= n) {
+            return;
+        }
+
+        if (c + 1 < n) {
+            pc = ngx_http_upstream_rr_position(n, count, heap[c])
+                 * weight[heap[c + 1]];
+            pr = ngx_http_upstream_rr_position(n, count, heap[c + 1])
+                 * weight[heap[c]];
+
+            if (pr < pc || (pr == pc && heap[c + 1] < heap[c])) {
+                c++;
+            }
+        }
+
+        pc = ngx_http_upstream_rr_position(n, count, heap[c])
+             * weight[heap[r]];
+        pr = ngx_http_upstream_rr_position(n, count, heap[r])
+             * weight[heap[c]];
+
+        if (pr < pc || (pr == pc && heap[r] < heap[c])) {
+            return;
+        }
+
+        t = heap[r];
+        heap[r] = heap[c];
+        heap[c] = t;
+
+        r = c;
+    }
+}
+
+
 /*
  * úgetfreeԼָʾк˷Ƿѡλͼ֮⣬
  * ҲὫdataֶιصĺ˷бõr->upstream->peer.dataϡúڹ
@@ -597,6 +764,7 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
 
     /* ¼˺˷ѡеĴ */
     peer->conns++;
+    (void) ngx_atomic_fetch_add(&peers->conns, 1);
 
     ngx_http_upstream_rr_peers_unlock(peers);
 
@@ -661,26 +829,79 @@ failed:
 static ngx_http_upstream_rr_peer_t *
 ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
 {
-    time_t                        now;
-    uintptr_t                     m;
-    ngx_int_t                     total;
-    ngx_uint_t                    i, n, p;
-    ngx_http_upstream_rr_peer_t  *peer, *best;
+    time_t                         now;
+    uintptr_t                      m;
+    ngx_int_t                      total, weight;
+    ngx_uint_t                     i, n, p, degraded;
+    ngx_http_upstream_rr_peer_t   *peer, *best;
+    ngx_http_upstream_rr_peers_t  *peers;
 
     /* ȡǰʱ */
     now = ngx_time();
 
+    peers = rrp->peers;
+
     best = NULL;
     total = 0;
+    degraded = 0;
 
 #if (NGX_SUPPRESS_WARN)
     p = 0;
 #endif
 
-    for (peer = rrp->peers->peer, i = 0;
+    if (peers->schedule && !peers->degraded) {
+
+        /*
+         * all peers have their full weights, take the next slot of the
+         * schedule; slots of unavailable peers are passed to the next ones
+         */
+
+        for (i = 0; i < NGX_HTTP_UPSTREAM_RR_SCHEDULE_SKIP; i++) {
+            p = peers->schedule[peers->cursor];
+
+            if (++peers->cursor == peers->slots) {
+                peers->cursor = 0;
+            }
+
+            peer = peers->index[p];
+
+            n = p / (8 * sizeof(uintptr_t));
+            m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
+
+            if (rrp->tried[n] & m) {
+                continue;
+            }
+
+            if (peer->down) {
+                continue;
+            }
+
+            if (peer->max_fails
+                && peer->fails >= peer->max_fails
+                && now - peer->checked <= peer->fail_timeout)
+            {
+                continue;
+            }
+
+            best = peer;
+
+            goto found;
+        }
+    }
+
+    for (peer = peers->peer, i = 0;
          peer;
          peer = peer->next, i++)
     {
+        if (peer->slow_start_time
+            && ngx_current_msec - peer->slow_start_time >= peer->slow_start)
+        {
+            peer->slow_start_time = 0;
+        }
+
+        if (peer->effective_weight < peer->weight || peer->slow_start_time) {
+            degraded++;
+        }
 
         /* 
          * iֵΪǰĺ˷
@@ -711,11 +932,19 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
             continue;
         }
 
+        weight = peer->effective_weight * NGX_HTTP_UPSTREAM_RR_WEIGHT_SCALE;
+
+        if (peer->slow_start_time) {
+            weight = (uint64_t) weight
+                     * (ngx_current_msec - peer->slow_start_time)
+                     / peer->slow_start;
+        }
+
         /* 㵱ǰȨ */
-        peer->current_weight += peer->effective_weight;
+        peer->current_weight += weight;
 
         /* totalΪοѡк˷ЧȨ֮ */
-        total += peer->effective_weight;
+        total += weight;
 
         /* ЧȨأЧȨСȨأЧȨ */
         if (peer->effective_weight < peer->weight) {
@@ -729,10 +958,14 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
         }
     }
 
+    peers->degraded = degraded;
+
     if (best == NULL) {
         return NULL;
     }
 
+found:
+
     /* rrp->currentΪѡеĺ˷ */
     rrp->current = best;
 
@@ -800,6 +1033,7 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
 
         /* ¼˺˷ѡеĴݼ */
         peer->conns--;
+        (void) ngx_atomic_fetch_add(&rrp->peers->conns, -1);
 
         ngx_http_upstream_rr_peer_unlock(rrp->peers, peer);
         ngx_http_upstream_rr_peers_unlock(rrp->peers);
@@ -851,6 +1085,10 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
             peer->effective_weight = 0;
         }
 
+        if (peer->effective_weight < peer->weight) {
+            rrp->peers->degraded = 1;
+        }
+
     } else {
 
         /* mark peer live if check passed */
@@ -870,12 +1108,23 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
          * Ǻʧܣֻܵfail_timeoutٲѡ٣Դơ
          */
         if (peer->accessed < peer->checked) {
+
+            if (peer->slow_start
+                && peer->max_fails
+                && peer->fails >= peer->max_fails)
+            {
+                peer->slow_start_time = ngx_current_msec;
+                peer->current_weight = 0;
+                rrp->peers->degraded = 1;
+            }
+
             peer->fails = 0;
         }
     }
 
     /* ¼˺˷ѡеĴݼ */
     peer->conns--;
+    (void) ngx_atomic_fetch_add(&rrp->peers->conns, -1);
 
     ngx_http_upstream_rr_peer_unlock(rrp->peers, peer);
     ngx_http_upstream_rr_peers_unlock(rrp->peers);
@@ -16,6 +16,15 @@
 
 typedef struct ngx_http_upstream_rr_peer_s   ngx_http_upstream_rr_peer_t;
 
+
+/*
+ * peer->down is 1 for servers configured as "down"; the health checks
+ * set the bit below while a peer fails them, so that every balancer
+ * skips the peer
+ */
+#define NGX_HTTP_UPSTREAM_RR_CHECK_DOWN  0x02
+
+
 /* 
  * һ˷ӦϢ(һ˷жipַ
  * ôṹӦľһipַϢ) 
@@ -32,6 +41,10 @@ struct ngx_http_upstream_rr_peer_s {
 
     ngx_uint_t                      conns;  // ¼˺˷ѡеĴ
 
+    /* response time EWMA, in microseconds, and when it was last sampled */
+    ngx_uint_t                      ewma;
+    ngx_msec_t                      ewma_updated;
+
     ngx_uint_t                      fails;  // fail_timeoutʱʧܵĴ
     
     /* ѡȡĺ˷쳣accessedʱΪǰѡȡ˷ʱ⵽쳣ʱ */
@@ -58,6 +71,14 @@ struct ngx_http_upstream_rr_peer_s {
 
     ngx_uint_t                      down;          /* unsigned  down:1; */
 
+    /*
+     * a peer that comes back after failures ramps its weight up from zero
+     * during slow_start; slow_start_time is when it came back, and is reset
+     * once the full weight is reached
+     */
+    ngx_msec_t                      slow_start;
+    ngx_msec_t                      slow_start_time;
+
 #if (NGX_HTTP_SSL)
     void                           *ssl_session;
     int                             ssl_session_len;
@@ -89,6 +110,19 @@ struct ngx_http_upstream_rr_peers_s {
     unsigned                        single:1;  // һupstreamǷֻһ˷ı־λ
     unsigned                        weighted:1;  // ǷԶÿ˷Ȩ
 
+    /* connections to all the peers, kept by the get and free methods */
+    ngx_atomic_t                    conns;
+
+    /*
+     * the stride schedule of peer numbers used by large groups while
+     * no peer has a reduced effective weight, see ngx_http_upstream_get_peer()
+     */
+    ngx_http_upstream_rr_peer_t   **index;
+    uint32_t                       *schedule;
+    ngx_uint_t                      slots;
+    ngx_uint_t                      cursor;
+    ngx_uint_t                      degraded;
+
     ngx_str_t                      *name;  // upstreamָ
 
     ngx_http_upstream_rr_peers_t   *next;  //һupstreamбݷɵб
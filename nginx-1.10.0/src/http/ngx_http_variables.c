@@ -122,6 +122,18 @@ static ngx_int_t ngx_http_variable_cookie(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_argument(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_http_variable_index_t *ngx_http_variable_index_create(
+    ngx_http_request_t *r, ngx_uint_t n);
+static void ngx_http_variable_index_add(ngx_http_variable_index_t *index,
+    u_char *name, size_t len, u_char *value, size_t size);
+static ngx_str_t *ngx_http_variable_index_find(
+    ngx_http_variable_index_t *index, u_char *name, size_t len);
+static ngx_http_variable_index_t *ngx_http_variable_args_index(
+    ngx_http_request_t *r);
+static ngx_http_variable_index_t *ngx_http_variable_cookies_index(
+    ngx_http_request_t *r);
+static ngx_http_variable_index_t *ngx_http_variable_headers_index(
+    ngx_http_request_t *r);
 #if (NGX_HAVE_TCP_INFO)
 static ngx_int_t ngx_http_variable_tcpinfo(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
@@ -179,6 +191,14 @@ static ngx_int_t ngx_http_variable_request_length(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_request_time(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_variable_timing(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_variable_phase_handlers(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+#if (NGX_PCRE)
+static ngx_int_t ngx_http_variable_regex_memo(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+#endif
 static ngx_int_t ngx_http_variable_status(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 
@@ -358,6 +378,56 @@ static ngx_http_variable_t  ngx_http_core_variables[] = {
     { ngx_string("request_time"), NULL, ngx_http_variable_request_time,
       0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
 
+    { ngx_string("timing_post_read"), NULL, ngx_http_variable_timing,
+      0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("timing_server_rewrite"), NULL, ngx_http_variable_timing,
+      1, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("timing_find_config"), NULL, ngx_http_variable_timing,
+      2, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("timing_rewrite"), NULL, ngx_http_variable_timing,
+      3, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("timing_post_rewrite"), NULL, ngx_http_variable_timing,
+      4, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("timing_preaccess"), NULL, ngx_http_variable_timing,
+      5, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("timing_access"), NULL, ngx_http_variable_timing,
+      6, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("timing_post_access"), NULL, ngx_http_variable_timing,
+      7, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("timing_try_files"), NULL, ngx_http_variable_timing,
+      8, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("timing_content"), NULL, ngx_http_variable_timing,
+      9, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("timing_header_filter"), NULL, ngx_http_variable_timing,
+      10, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("timing_body_filter"), NULL, ngx_http_variable_timing,
+      11, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("phase_handlers"), NULL, ngx_http_variable_phase_handlers,
+      0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("phase_handlers_total"), NULL,
+      ngx_http_variable_phase_handlers, 1, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+#if (NGX_PCRE)
+    { ngx_string("regex_memo_hits"), NULL, ngx_http_variable_regex_memo,
+      offsetof(ngx_http_regex_memo_t, hits), NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("regex_memo_misses"), NULL, ngx_http_variable_regex_memo,
+      offsetof(ngx_http_regex_memo_t, misses), NGX_HTTP_VAR_NOCACHEABLE, 0 },
+#endif
+
     { ngx_string("status"), NULL,
       ngx_http_variable_status, 0,
       NGX_HTTP_VAR_NOCACHEABLE, 0 },
@@ -1002,9 +1072,31 @@ static ngx_int_t
 ngx_http_variable_unknown_header_in(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
 {
-    return ngx_http_variable_unknown_header(v, (ngx_str_t *) data,
-                                            &r->headers_in.headers.part,
-                                            sizeof("http_") - 1);
+    ngx_str_t *name = (ngx_str_t *) data;
+
+    ngx_str_t                  *value;
+    ngx_http_variable_index_t  *index;
+
+    index = ngx_http_variable_headers_index(r);
+    if (index == NULL) {
+        return NGX_ERROR;
+    }
+
+    value = ngx_http_variable_index_find(index,
+                                         name->data + sizeof("http_") - 1,
+                                         name->len - (sizeof("http_") - 1));
+    if (value == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->len = value->len;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = value->data;
+
+    return NGX_OK;
 }
 
 
@@ -1131,24 +1223,27 @@ ngx_http_variable_cookie(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 {
     ngx_str_t *name = (ngx_str_t *) data;
 
-    ngx_str_t  cookie, s;
+    ngx_str_t                  *cookie;
+    ngx_http_variable_index_t  *index;
 
-    /*cookie_xxx벿ֵĳȺַ*/
-    s.len = name->len - (sizeof("cookie_") - 1);
-    s.data = name->data + sizeof("cookie_") - 1;
+    index = ngx_http_variable_cookies_index(r);
+    if (index == NULL) {
+        return NGX_ERROR;
+    }
 
-    if (ngx_http_parse_multi_header_lines(&r->headers_in.cookies, &s, &cookie)
-        == NGX_DECLINED)
-    {
+    cookie = ngx_http_variable_index_find(index,
+                                          name->data + sizeof("cookie_") - 1,
+                                          name->len - (sizeof("cookie_") - 1));
+    if (cookie == NULL) {
         v->not_found = 1;
         return NGX_OK;
     }
 
-    v->len = cookie.len;
+    v->len = cookie->len;
     v->valid = 1;
     v->no_cacheable = 0;
     v->not_found = 0;
-    v->data = cookie.data;
+    v->data = cookie->data;
 
     return NGX_OK;
 }
@@ -1161,23 +1256,24 @@ ngx_http_variable_argument(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 {
     ngx_str_t *name = (ngx_str_t *) data;
 
-    u_char     *arg;
-    size_t      len;
-    ngx_str_t   value;
+    ngx_str_t                  *value;
+    ngx_http_variable_index_t  *index;
 
-    /*arg_벿ֵĳȺַ*/
-    len = name->len - (sizeof("arg_") - 1);
-    arg = name->data + sizeof("arg_") - 1;
+    index = ngx_http_variable_args_index(r);
+    if (index == NULL) {
+        return NGX_ERROR;
+    }
 
-    /*ԭʼhttpַнarg_ĺ벿ֲֵ*/
-    if (ngx_http_arg(r, arg, len, &value) != NGX_OK) {
+    value = ngx_http_variable_index_find(index,
+                                         name->data + sizeof("arg_") - 1,
+                                         name->len - (sizeof("arg_") - 1));
+    if (value == NULL) {
         v->not_found = 1;
         return NGX_OK;
     }
 
-    /*ԭʼhttpַнõֵֵvݵϲ㺯*/
-    v->data = value.data;
-    v->len = value.len;
+    v->data = value->data;
+    v->len = value->len;
     v->valid = 1;
     v->no_cacheable = 0;
     v->not_found = 0;
@@ -1186,6 +1282,329 @@ ngx_http_variable_argument(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 }
 
 
+static ngx_http_variable_index_t *
+ngx_http_variable_index_create(ngx_http_request_t *r, ngx_uint_t n)
+{
+    ngx_uint_t                  size;
+    ngx_http_variable_index_t  *index;
+
+    for (size = 8; size < n; size <<= 1) { /* void */ }
+
+    index = ngx_palloc(r->pool, sizeof(ngx_http_variable_index_t));
+    if (index == NULL) {
+        return NULL;
+    }
+
+    index->elts = ngx_palloc(r->pool,
+                             n * sizeof(ngx_http_variable_index_elt_t));
+    if (index->elts == NULL) {
+        return NULL;
+    }
+
+    index->buckets = ngx_pcalloc(r->pool, size * sizeof(ngx_uint_t));
+    if (index->buckets == NULL) {
+        return NULL;
+    }
+
+    index->mask = size - 1;
+    index->nelts = 0;
+    index->source = NULL;
+    index->len = 0;
+
+    return index;
+}
+
+
+/* the first argument, cookie or header line with the name wins */
+
+static void
+ngx_http_variable_index_add(ngx_http_variable_index_t *index, u_char *name,
+    size_t len, u_char *value, size_t size)
+{
+    ngx_uint_t                      key;
+    ngx_http_variable_index_elt_t  *elt;
+
+    if (ngx_http_variable_index_find(index, name, len)) {
+        return;
+    }
+
+    key = ngx_hash_key_lc(name, len);
+
+    elt = &index->elts[index->nelts];
+
+    elt->name.len = len;
+    elt->name.data = name;
+    elt->value.len = size;
+    elt->value.data = value;
+    elt->key = key;
+    elt->next = index->buckets[key & index->mask];
+
+    index->buckets[key & index->mask] = ++index->nelts;
+}
+
+
+static ngx_str_t *
+ngx_http_variable_index_find(ngx_http_variable_index_t *index, u_char *name,
+    size_t len)
+{
+    ngx_uint_t                      key, n;
+    ngx_http_variable_index_elt_t  *elt;
+
+    key = ngx_hash_key_lc(name, len);
+
+    for (n = index->buckets[key & index->mask]; n; n = elt->next) {
+        elt = &index->elts[n - 1];
+
+        if (elt->key == key
+            && elt->name.len == len
+            && ngx_strncasecmp(elt->name.data, name, len) == 0)
+        {
+            return &elt->value;
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * the same pairs as ngx_http_arg() finds: a name starts the args or
+ * follows "&" and is followed by "=", the value lasts until "&"
+ */
+
+static ngx_http_variable_index_t *
+ngx_http_variable_args_index(ngx_http_request_t *r)
+{
+    u_char                     *p, *last, *name, *eq;
+    ngx_uint_t                  n;
+    ngx_http_variable_index_t  *index;
+
+    index = r->args_index;
+
+    if (index
+        && index->source == r->args.data
+        && index->len == r->args.len)
+    {
+        return index;
+    }
+
+    p = r->args.data;
+    last = p + r->args.len;
+
+    for (n = 1; p < last; p++) {
+        if (*p == '&') {
+            n++;
+        }
+    }
+
+    index = ngx_http_variable_index_create(r, n);
+    if (index == NULL) {
+        return NULL;
+    }
+
+    index->source = r->args.data;
+    index->len = r->args.len;
+
+    for (p = r->args.data; p < last; p++) {
+        name = p;
+        eq = NULL;
+
+        while (p < last && *p != '&') {
+            if (*p == '=' && eq == NULL) {
+                eq = p;
+            }
+
+            p++;
+        }
+
+        if (eq) {
+            ngx_http_variable_index_add(index, name, eq - name,
+                                        eq + 1, p - eq - 1);
+        }
+    }
+
+    r->args_index = index;
+
+    return index;
+}
+
+
+/*
+ * the same pairs as ngx_http_parse_multi_header_lines() finds:
+ * a pair starts a line or follows ";" or "," and optional spaces,
+ * spaces may surround "=", the value lasts until ";"
+ */
+
+static ngx_http_variable_index_t *
+ngx_http_variable_cookies_index(ngx_http_request_t *r)
+{
+    u_char                     *start, *end, *p, *name, *value, ch;
+    size_t                      len;
+    ngx_uint_t                  i, n;
+    ngx_table_elt_t           **h;
+    ngx_http_variable_index_t  *index;
+
+    index = r->cookies_index;
+    h = r->headers_in.cookies.elts;
+
+    if (index
+        && index->source == (u_char *) h
+        && index->len == r->headers_in.cookies.nelts)
+    {
+        return index;
+    }
+
+    n = 1;
+
+    for (i = 0; i < r->headers_in.cookies.nelts; i++) {
+        end = h[i]->value.data + h[i]->value.len;
+
+        for (p = h[i]->value.data; p < end; p++) {
+            if (*p == ';' || *p == ',') {
+                n++;
+            }
+        }
+
+        n++;
+    }
+
+    index = ngx_http_variable_index_create(r, n);
+    if (index == NULL) {
+        return NULL;
+    }
+
+    index->source = (u_char *) h;
+    index->len = r->headers_in.cookies.nelts;
+
+    for (i = 0; i < r->headers_in.cookies.nelts; i++) {
+
+        start = h[i]->value.data;
+        end = h[i]->value.data + h[i]->value.len;
+
+        while (start < end) {
+
+            name = start;
+
+            for (p = start; p < end; p++) {
+                if (*p == '=' || *p == ';' || *p == ',') {
+                    break;
+                }
+            }
+
+            if (p < end && *p == '=') {
+
+                for (len = p - name; len && name[len - 1] == ' '; len--) {
+                    /* void */
+                }
+
+                for (value = p + 1; value < end && *value == ' '; value++) {
+                    /* void */
+                }
+
+                for (p = value; p < end && *p != ';'; p++) { /* void */ }
+
+                ngx_http_variable_index_add(index, name, len,
+                                            value, p - value);
+            }
+
+            while (start < end) {
+                ch = *start++;
+                if (ch == ';' || ch == ',') {
+                    break;
+                }
+            }
+
+            while (start < end && *start == ' ') { start++; }
+        }
+    }
+
+    r->cookies_index = index;
+
+    return index;
+}
+
+
+/*
+ * the header line names are indexed as the $http_ variables name them:
+ * in lowercase and with dashes replaced by underscores
+ */
+
+static ngx_http_variable_index_t *
+ngx_http_variable_headers_index(ngx_http_request_t *r)
+{
+    u_char                     *name, ch;
+    ngx_uint_t                  i, k, n;
+    ngx_list_part_t            *part;
+    ngx_table_elt_t            *header;
+    ngx_http_variable_index_t  *index;
+
+    n = 0;
+
+    for (part = &r->headers_in.headers.part; part; part = part->next) {
+        n += part->nelts;
+    }
+
+    index = r->headers_index;
+
+    if (index && index->len == n) {
+        return index;
+    }
+
+    index = ngx_http_variable_index_create(r, n ? n : 1);
+    if (index == NULL) {
+        return NULL;
+    }
+
+    index->len = n;
+
+    part = &r->headers_in.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (header[i].hash == 0) {
+            continue;
+        }
+
+        name = ngx_pnalloc(r->pool, header[i].key.len);
+        if (name == NULL) {
+            return NULL;
+        }
+
+        for (k = 0; k < header[i].key.len; k++) {
+            ch = header[i].key.data[k];
+
+            if (ch >= 'A' && ch <= 'Z') {
+                ch |= 0x20;
+
+            } else if (ch == '-') {
+                ch = '_';
+            }
+
+            name[k] = ch;
+        }
+
+        ngx_http_variable_index_add(index, name, header[i].key.len,
+                                    header[i].value.data,
+                                    header[i].value.len);
+    }
+
+    r->headers_index = index;
+
+    return index;
+}
+
+
 #if (NGX_HAVE_TCP_INFO)
 
 static ngx_int_t
@@ -2244,19 +2663,29 @@ ngx_http_variable_request_time(ngx_http_request_t *r,
     return NGX_OK;
 }
 
-/*ȡʹô*/
+
 static ngx_int_t
-ngx_http_variable_connection(ngx_http_request_t *r,
+ngx_http_variable_timing(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
 {
-    u_char  *p;
+    u_char      *p;
+    ngx_uint_t   usec;
 
-    p = ngx_pnalloc(r->pool, NGX_ATOMIC_T_LEN);
+    if (r->main->timing == NULL
+        || !(r->main->timing->used & ((ngx_uint_t) 1 << data)))
+    {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(r->pool, NGX_INT_T_LEN + 7);
     if (p == NULL) {
         return NGX_ERROR;
     }
 
-    v->len = ngx_sprintf(p, "%uA", r->connection->number) - p;
+    usec = r->main->timing->usec[data];
+
+    v->len = ngx_sprintf(p, "%ui.%06ui", usec / 1000000, usec % 1000000) - p;
     v->valid = 1;
     v->no_cacheable = 0;
     v->not_found = 0;
@@ -2265,19 +2694,38 @@ ngx_http_variable_connection(ngx_http_request_t *r,
     return NGX_OK;
 }
 
-/*ȡ*/
+
 static ngx_int_t
-ngx_http_variable_connection_requests(ngx_http_request_t *r,
+ngx_http_variable_phase_handlers(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
 {
-    u_char  *p;
+    u_char                     *p;
+    ngx_uint_t                  n;
+    ngx_http_phase_handler_t   *ph;
+    ngx_http_core_loc_conf_t   *clcf;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (data == 0 && clcf->phase_handlers) {
+        n = clcf->nphase_handlers;
+
+    } else {
+
+        /* "if" locations run the complete engine */
+
+        cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+        ph = cmcf->phase_engine.handlers;
+
+        for (n = 0; ph[n].checker; n++) { /* void */ }
+    }
 
     p = ngx_pnalloc(r->pool, NGX_INT_T_LEN);
     if (p == NULL) {
         return NGX_ERROR;
     }
 
-    v->len = ngx_sprintf(p, "%ui", r->connection->requests) - p;
+    v->len = ngx_sprintf(p, "%ui", n) - p;
     v->valid = 1;
     v->no_cacheable = 0;
     v->not_found = 0;
@@ -2287,17 +2735,91 @@ ngx_http_variable_connection_requests(ngx_http_request_t *r,
 }
 
 
+#if (NGX_PCRE)
+
 static ngx_int_t
-ngx_http_variable_nginx_version(ngx_http_request_t *r,
+ngx_http_variable_regex_memo(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
 {
-    v->len = sizeof(NGINX_VERSION) - 1;
-    v->valid = 1;
-    v->no_cacheable = 0;
-    v->not_found = 0;
-    v->data = (u_char *) NGINX_VERSION;
+    u_char      *p;
+    ngx_uint_t   n;
 
-    return NGX_OK;
+    n = 0;
+
+    if (r->main->regex_memo) {
+        n = *(ngx_uint_t *) ((char *) r->main->regex_memo + data);
+    }
+
+    p = ngx_pnalloc(r->pool, NGX_INT_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(p, "%ui", n) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+#endif
+
+/*ȡʹô*/
+static ngx_int_t
+ngx_http_variable_connection(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char  *p;
+
+    p = ngx_pnalloc(r->pool, NGX_ATOMIC_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(p, "%uA", r->connection->number) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+/*ȡ*/
+static ngx_int_t
+ngx_http_variable_connection_requests(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char  *p;
+
+    p = ngx_pnalloc(r->pool, NGX_INT_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(p, "%ui", r->connection->requests) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_variable_nginx_version(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    v->len = sizeof(NGINX_VERSION) - 1;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = (u_char *) NGINX_VERSION;
+
+    return NGX_OK;
 }
 
 /*ȡgethostnameϵͳûȡ*/
@@ -2452,6 +2974,14 @@ ngx_http_map_find(ngx_http_request_t *r, ngx_http_map_t *map, ngx_str_t *match)
 
         reg = map->regex;
 
+        if (map->regex_set) {
+            n = ngx_http_regex_set_exec(r, map->regex_set, match);
+
+            /* NGX_DECLINED or NGX_ERROR */
+
+            return (n >= 0) ? reg[n].value : NULL;
+        }
+
         for (i = 0; i < map->nregex; i++) {
 
             n = ngx_http_regex_exec(r, reg[i].regex, match);
@@ -2478,6 +3008,12 @@ ngx_http_map_find(ngx_http_request_t *r, ngx_http_map_t *map, ngx_str_t *match)
 
 #if (NGX_PCRE)
 
+typedef struct {
+    ngx_str_node_t                sn;
+    ngx_http_regex_t             *regex;
+} ngx_http_regex_node_t;
+
+
 static ngx_int_t
 ngx_http_variable_not_found(ngx_http_request_t *r, ngx_http_variable_value_t *v,
     uintptr_t data)
@@ -2487,18 +3023,151 @@ ngx_http_variable_not_found(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 }
 
 
+static ngx_int_t
+ngx_http_regex_literal(ngx_conf_t *cf, ngx_http_regex_t *re,
+    ngx_regex_compile_t *rc)
+{
+    u_char  *p, *last, *t;
+
+    p = rc->pattern.data;
+    last = p + rc->pattern.len;
+
+    if (p == last || *p++ != '^') {
+        return NGX_DECLINED;
+    }
+
+    t = ngx_pnalloc(cf->pool, rc->pattern.len);
+    if (t == NULL) {
+        return NGX_ERROR;
+    }
+
+    re->text.data = t;
+
+    while (p < last) {
+
+        switch (*p) {
+
+        case '\\':
+            if (++p == last
+                || (*p >= '0' && *p <= '9')
+                || ((*p | 0x20) >= 'a' && (*p | 0x20) <= 'z'))
+            {
+                return NGX_DECLINED;
+            }
+
+            break;
+
+        case '$':
+            if (p + 1 != last) {
+                return NGX_DECLINED;
+            }
+
+            re->exact = 1;
+            p++;
+            continue;
+
+        case '.': case '^': case '|': case '?': case '*': case '+':
+        case '(': case ')': case '[': case ']': case '{': case '}':
+            return NGX_DECLINED;
+        }
+
+        *t++ = *p++;
+    }
+
+    re->text.len = t - re->text.data;
+    re->literal = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_regex_exec_literal(ngx_http_request_t *r, ngx_http_regex_t *re,
+    ngx_str_t *s)
+{
+    size_t  len;
+
+    len = re->text.len;
+
+    if (s->len < len) {
+        return NGX_DECLINED;
+    }
+
+    /* pcre "$" also matches before a trailing newline */
+
+    if (re->exact
+        && s->len != len
+        && (s->len != len + 1 || s->data[len] != LF))
+    {
+        return NGX_DECLINED;
+    }
+
+    if (re->caseless) {
+        if (ngx_strncasecmp(s->data, re->text.data, len) != 0) {
+            return NGX_DECLINED;
+        }
+
+    } else if (ngx_memcmp(s->data, re->text.data, len) != 0) {
+        return NGX_DECLINED;
+    }
+
+    r->ncaptures = 0;
+    r->captures_data = s->data;
+
+    return NGX_OK;
+}
+
+
 ngx_http_regex_t *
 ngx_http_regex_compile(ngx_conf_t *cf, ngx_regex_compile_t *rc)
 {
     u_char                     *p;
     size_t                      size;
+    uint32_t                    hash;
     ngx_str_t                   name;
-    ngx_uint_t                  i, n;
+    ngx_uint_t                  i, n, caseless;
+    ngx_rbtree_node_t          *sentinel;
     ngx_http_variable_t        *v;
     ngx_http_regex_t           *re;
+    ngx_http_regex_node_t      *rn;
     ngx_http_regex_variable_t  *rv;
     ngx_http_core_main_conf_t  *cmcf;
 
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    caseless = (rc->options & NGX_REGEX_CASELESS) ? 1 : 0;
+
+    /*
+     * identical patterns share a single regex, so the per-request memo
+     * of ngx_http_regex_exec() covers all directives that use them;
+     * the caseless flag is folded into the hash of the pattern
+     */
+
+    if (cmcf->regexes == NULL) {
+        cmcf->regexes = ngx_palloc(cf->pool, sizeof(ngx_rbtree_t));
+        if (cmcf->regexes == NULL) {
+            return NULL;
+        }
+
+        sentinel = ngx_palloc(cf->pool, sizeof(ngx_rbtree_node_t));
+        if (sentinel == NULL) {
+            return NULL;
+        }
+
+        ngx_rbtree_init(cmcf->regexes, sentinel,
+                        ngx_str_rbtree_insert_value);
+    }
+
+    hash = ngx_crc32_short(rc->pattern.data, rc->pattern.len) ^ caseless;
+
+    rn = (ngx_http_regex_node_t *)
+             ngx_str_rbtree_lookup(cmcf->regexes, &rc->pattern, hash);
+
+    if (rn) {
+        rc->captures = rn->regex->ncaptures;
+        return rn->regex;
+    }
+
     rc->pool = cf->pool;
 
     if (ngx_regex_compile(rc) != NGX_OK) {
@@ -2514,13 +3183,31 @@ ngx_http_regex_compile(ngx_conf_t *cf, ngx_regex_compile_t *rc)
     re->regex = rc->regex;
     re->ncaptures = rc->captures;
     re->name = rc->pattern;
+    re->caseless = caseless;
+
+    rn = ngx_palloc(cf->pool, sizeof(ngx_http_regex_node_t));
+    if (rn == NULL) {
+        return NULL;
+    }
+
+    rn->sn.node.key = hash;
+    rn->sn.str = re->name;
+    rn->regex = re;
+
+    ngx_rbtree_insert(cmcf->regexes, &rn->sn.node);
 
-    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
     cmcf->ncaptures = ngx_max(cmcf->ncaptures, re->ncaptures);
 
     n = (ngx_uint_t) rc->named_captures;
 
     if (n == 0) {
+
+        if (re->ncaptures == 0
+            && ngx_http_regex_literal(cf, re, rc) == NGX_ERROR)
+        {
+            return NULL;
+        }
+
         return re;
     }
 
@@ -2564,10 +3251,16 @@ ngx_int_t
 ngx_http_regex_exec(ngx_http_request_t *r, ngx_http_regex_t *re, ngx_str_t *s)
 {
     ngx_int_t                   rc, index;
-    ngx_uint_t                  i, n, len;
+    ngx_uint_t                  i, n, len, key;
+    ngx_http_regex_memo_t      *memo;
     ngx_http_variable_value_t  *vv;
+    ngx_http_regex_memo_elt_t  *me;
     ngx_http_core_main_conf_t  *cmcf;
 
+    if (re->literal) {
+        return ngx_http_regex_exec_literal(r, re, s);
+    }
+
     cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
 
     if (re->ncaptures) {
@@ -2584,7 +3277,75 @@ ngx_http_regex_exec(ngx_http_request_t *r, ngx_http_regex_t *re, ngx_str_t *s)
         len = 0;
     }
 
-    rc = ngx_regex_exec(re->regex, s, r->captures, len);
+    memo = NULL;
+    me = NULL;
+    key = 0;
+
+    if (s->len <= NGX_HTTP_REGEX_MEMO_LEN) {
+
+        memo = r->main->regex_memo;
+
+        if (memo == NULL) {
+            memo = ngx_pcalloc(r->pool, sizeof(ngx_http_regex_memo_t));
+            if (memo == NULL) {
+                return NGX_ERROR;
+            }
+
+            r->main->regex_memo = memo;
+        }
+
+        /*
+         * the subject is identified by its address and length, the hash
+         * of its content guards against a buffer reused in place
+         */
+
+        key = ngx_hash_key(s->data, s->len);
+
+        me = &memo->elts[(((uintptr_t) re >> 3) ^ key)
+                         & (NGX_HTTP_REGEX_MEMO_SIZE - 1)];
+    }
+
+    if (me
+        && me->regex == re
+        && me->data == s->data
+        && me->len == s->len
+        && me->key == key)
+    {
+        memo->hits++;
+
+        rc = me->rc;
+
+        if (rc > 0 && len) {
+            ngx_memcpy(r->captures, me->captures, rc * 2 * sizeof(int));
+        }
+
+    } else {
+        if (memo) {
+            memo->misses++;
+        }
+
+        rc = ngx_regex_exec(re->regex, s, r->captures, len);
+
+        if (me && (rc >= 0 || rc == NGX_REGEX_NO_MATCHED)) {
+
+            if (rc > 0 && len) {
+                if (me->captures == NULL) {
+                    me->captures = ngx_palloc(r->pool, len * sizeof(int));
+                    if (me->captures == NULL) {
+                        return NGX_ERROR;
+                    }
+                }
+
+                ngx_memcpy(me->captures, r->captures, rc * 2 * sizeof(int));
+            }
+
+            me->regex = re;
+            me->data = s->data;
+            me->len = s->len;
+            me->key = key;
+            me->rc = rc;
+        }
+    }
 
     if (rc == NGX_REGEX_NO_MATCHED) {
         return NGX_DECLINED;
@@ -2627,6 +3388,321 @@ ngx_http_regex_exec(ngx_http_request_t *r, ngx_http_regex_t *re, ngx_str_t *s)
     return NGX_OK;
 }
 
+
+#define NGX_HTTP_REGEX_SET_MAX   128
+#define NGX_HTTP_REGEX_SET_LEN   16384
+
+
+/*
+ * a regex may join a set if it matches only at the start of a subject
+ * and does not depend on its own group numbering: it starts with "^",
+ * has no top level alternation, captures, recursion, verbs, \Q...\E
+ * quoting or extended mode comments
+ */
+
+static ngx_uint_t
+ngx_http_regex_set_anchored(ngx_http_regex_t *re)
+{
+    u_char       c, *p, *q, *last;
+    ngx_uint_t   depth;
+
+    if (re->ncaptures || re->nvariables) {
+        return 0;
+    }
+
+    p = re->name.data;
+    last = p + re->name.len;
+
+    if (p == last || *p++ != '^') {
+        return 0;
+    }
+
+    depth = 0;
+
+    while (p < last) {
+
+        switch (*p++) {
+
+        case '\\':
+            if (p == last || *p == 'Q') {
+                return 0;
+            }
+
+            p++;
+            break;
+
+        case '[':
+            if (p < last && *p == '^') {
+                p++;
+            }
+
+            if (p < last && *p == ']') {
+                p++;
+            }
+
+            while (p < last && *p != ']') {
+
+                /* "[:alpha:]", "[.ch.]" and "[=ch=]" may contain "]" */
+
+                if (*p == '[' && last - p > 1
+                    && (p[1] == ':' || p[1] == '.' || p[1] == '='))
+                {
+                    c = p[1];
+
+                    for (q = p + 2; last - q > 1; q++) {
+                        if (q[0] == c && q[1] == ']') {
+                            break;
+                        }
+                    }
+
+                    if (last - q < 2) {
+                        return 0;
+                    }
+
+                    p = q + 2;
+                    continue;
+                }
+
+                if (*p++ == '\\') {
+                    p++;
+                }
+            }
+
+            p++;
+            break;
+
+        case '(':
+            if (p < last && *p == '*') {
+                return 0;
+            }
+
+            if (p < last && *p == '?') {
+                for (q = p + 1; q < last && *q != ':' && *q != ')'; q++) {
+                    if (*q == 'x' || *q == 'R' || (*q >= '0' && *q <= '9')) {
+                        return 0;
+                    }
+                }
+            }
+
+            depth++;
+            break;
+
+        case ')':
+            depth--;
+            break;
+
+        case '|':
+            if (depth == 0) {
+                return 0;
+            }
+
+            break;
+        }
+    }
+
+    return 1;
+}
+
+
+static ngx_int_t
+ngx_http_regex_set_compile(ngx_conf_t *cf, ngx_http_regex_run_t *run,
+    ngx_http_regex_t **regex, ngx_uint_t n)
+{
+    u_char               *p;
+    size_t                len;
+    ngx_uint_t            i;
+    ngx_regex_compile_t   rc;
+    u_char                errstr[NGX_MAX_CONF_ERRSTR];
+
+    len = sizeof("^(?:)");
+
+    for (i = 0; i < n; i++) {
+        len += sizeof("|()(?i)") - 1 + regex[i]->name.len;
+    }
+
+    p = ngx_pnalloc(cf->temp_pool, len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&rc, sizeof(ngx_regex_compile_t));
+
+    rc.pattern.data = p;
+
+    p = ngx_cpymem(p, "^(?:", 4);
+
+    for (i = 0; i < n; i++) {
+
+        if (i) {
+            *p++ = '|';
+        }
+
+        *p++ = '(';
+
+        if (regex[i]->caseless) {
+            p = ngx_cpymem(p, "(?i)", 4);
+        }
+
+        p = ngx_cpymem(p, regex[i]->name.data, regex[i]->name.len);
+        *p++ = ')';
+    }
+
+    *p++ = ')';
+    *p = '\0';
+
+    rc.pattern.len = p - rc.pattern.data;
+    rc.pool = cf->pool;
+    rc.err.len = NGX_MAX_CONF_ERRSTR;
+    rc.err.data = errstr;
+
+    if (ngx_regex_compile(&rc) != NGX_OK || rc.captures != (ngx_int_t) n) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                       "http regex set not compiled: %V", &rc.err);
+        return NGX_DECLINED;
+    }
+
+    run->regex = rc.regex;
+    run->n = n;
+
+    return NGX_OK;
+}
+
+
+ngx_http_regex_set_t *
+ngx_http_regex_set_create(ngx_conf_t *cf, ngx_http_regex_t **regex,
+    ngx_uint_t n)
+{
+    size_t                 len;
+    ngx_int_t              rc;
+    ngx_uint_t             i, k;
+    ngx_http_regex_run_t  *run;
+    ngx_http_regex_set_t  *set;
+
+    set = ngx_palloc(cf->pool, sizeof(ngx_http_regex_set_t));
+    if (set == NULL) {
+        return NULL;
+    }
+
+    set->runs = ngx_palloc(cf->pool, n * sizeof(ngx_http_regex_run_t));
+    if (set->runs == NULL) {
+        return NULL;
+    }
+
+    set->nruns = 0;
+
+    for (i = 0; i < n; /* void */) {
+
+        k = i + 1;
+
+        if (ngx_http_regex_set_anchored(regex[i])) {
+            len = regex[i]->name.len;
+
+            while (k < n
+                   && k - i < NGX_HTTP_REGEX_SET_MAX
+                   && ngx_http_regex_set_anchored(regex[k]))
+            {
+                len += regex[k]->name.len;
+
+                if (len > NGX_HTTP_REGEX_SET_LEN) {
+                    break;
+                }
+
+                k++;
+            }
+        }
+
+        if (k - i > 1) {
+            run = &set->runs[set->nruns];
+            run->single = NULL;
+            run->first = i;
+
+            rc = ngx_http_regex_set_compile(cf, run, &regex[i], k - i);
+
+            if (rc == NGX_ERROR) {
+                return NULL;
+            }
+
+            if (rc == NGX_OK) {
+                set->nruns++;
+                i = k;
+                continue;
+            }
+        }
+
+        /* test the regexes one by one */
+
+        while (i < k) {
+            run = &set->runs[set->nruns++];
+            run->regex = NULL;
+            run->single = regex[i];
+            run->first = i++;
+            run->n = 1;
+        }
+    }
+
+    return set;
+}
+
+
+/*
+ * returns the index of the first regex in declaration order
+ * that matches, NGX_DECLINED or NGX_ERROR
+ */
+
+ngx_int_t
+ngx_http_regex_set_exec(ngx_http_request_t *r, ngx_http_regex_set_t *set,
+    ngx_str_t *s)
+{
+    int                    captures[3 * (NGX_HTTP_REGEX_SET_MAX + 1)];
+    ngx_int_t              rc;
+    ngx_uint_t             i;
+    ngx_http_regex_run_t  *run;
+
+    run = set->runs;
+
+    for (i = 0; i < set->nruns; i++, run++) {
+
+        if (run->single) {
+            rc = ngx_http_regex_exec(r, run->single, s);
+
+            if (rc == NGX_OK) {
+                return run->first;
+            }
+
+            if (rc == NGX_DECLINED) {
+                continue;
+            }
+
+            return NGX_ERROR;
+        }
+
+        rc = ngx_regex_exec(run->regex, s, captures, 3 * (run->n + 1));
+
+        if (rc == NGX_REGEX_NO_MATCHED) {
+            continue;
+        }
+
+        if (rc < 2) {
+            ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                          ngx_regex_exec_n " failed: %i on \"%V\" "
+                          "using regex set", rc, s);
+            return NGX_ERROR;
+        }
+
+        /*
+         * only the group of the matched alternative is set,
+         * so pcre returns its number plus one
+         */
+
+        r->ncaptures = 0;
+        r->captures_data = s->data;
+
+        return run->first + rc - 2;
+    }
+
+    return NGX_DECLINED;
+}
+
 #endif
 
 /*
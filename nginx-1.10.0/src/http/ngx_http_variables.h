@@ -67,6 +67,30 @@ struct ngx_http_variable_s {
 };
 
 
+/*
+ * a per-request index of the arguments, cookies or request header lines,
+ * built by the first lookup of an $arg_, $cookie_ or $http_ variable;
+ * "source" and "len" tell which args or how many lines were indexed
+ */
+
+typedef struct {
+    ngx_str_t                     name;
+    ngx_str_t                     value;
+    ngx_uint_t                    key;
+    ngx_uint_t                    next;
+} ngx_http_variable_index_elt_t;
+
+
+typedef struct {
+    ngx_http_variable_index_elt_t  *elts;
+    ngx_uint_t                     *buckets;
+    ngx_uint_t                      mask;
+    ngx_uint_t                      nelts;
+    u_char                         *source;
+    size_t                          len;
+} ngx_http_variable_index_t;
+
+
 ngx_http_variable_t *ngx_http_add_variable(ngx_conf_t *cf, ngx_str_t *name,
     ngx_uint_t flags);
 ngx_int_t ngx_http_get_variable_index(ngx_conf_t *cf, ngx_str_t *name);
@@ -96,19 +120,72 @@ typedef struct {
     ngx_http_regex_variable_t    *variables;
     ngx_uint_t                    nvariables;
     ngx_str_t                     name;
+    unsigned                      caseless:1;
+
+    /* "^literal" and "^literal$" patterns are matched without pcre */
+    unsigned                      literal:1;
+    unsigned                      exact:1;
+    ngx_str_t                     text;
 } ngx_http_regex_t;
 
 
+/*
+ * a run of consecutive anchored regexes without captures is compiled
+ * into a single alternation, other regexes are tested one by one
+ */
+
+typedef struct {
+    ngx_regex_t                  *regex;
+    ngx_http_regex_t             *single;
+    ngx_uint_t                    first;
+    ngx_uint_t                    n;
+} ngx_http_regex_run_t;
+
+
+typedef struct {
+    ngx_http_regex_run_t         *runs;
+    ngx_uint_t                    nruns;
+} ngx_http_regex_set_t;
+
+
 typedef struct {
     ngx_http_regex_t             *regex;
     void                         *value;
 } ngx_http_map_regex_t;
 
 
+#define NGX_HTTP_REGEX_MEMO_SIZE  16
+
+/* longer subjects bypass the memo, hashing them costs as much as a match */
+#define NGX_HTTP_REGEX_MEMO_LEN   256
+
+typedef struct {
+    ngx_http_regex_t             *regex;
+    u_char                       *data;
+    size_t                        len;
+    ngx_uint_t                    key;
+    ngx_int_t                     rc;
+    int                          *captures;
+} ngx_http_regex_memo_elt_t;
+
+
+/* results of ngx_http_regex_exec() within a request, direct mapped */
+
+typedef struct {
+    ngx_http_regex_memo_elt_t     elts[NGX_HTTP_REGEX_MEMO_SIZE];
+    ngx_uint_t                    hits;
+    ngx_uint_t                    misses;
+} ngx_http_regex_memo_t;
+
+
 ngx_http_regex_t *ngx_http_regex_compile(ngx_conf_t *cf,
     ngx_regex_compile_t *rc);
 ngx_int_t ngx_http_regex_exec(ngx_http_request_t *r, ngx_http_regex_t *re,
     ngx_str_t *s);
+ngx_http_regex_set_t *ngx_http_regex_set_create(ngx_conf_t *cf,
+    ngx_http_regex_t **regex, ngx_uint_t n);
+ngx_int_t ngx_http_regex_set_exec(ngx_http_request_t *r,
+    ngx_http_regex_set_t *set, ngx_str_t *s);
 
 #endif
 
@@ -118,6 +195,7 @@ typedef struct {
 #if (NGX_PCRE)
     ngx_http_map_regex_t         *regex;
     ngx_uint_t                    nregex;
+    ngx_http_regex_set_t         *regex_set;
 #endif
 } ngx_http_map_t;
 
@@ -0,0 +1,508 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_stream.h>
+
+
+typedef struct {
+    ngx_msec_t                            interval;
+    ngx_msec_t                            timeout;
+    ngx_uint_t                            fails;
+    ngx_uint_t                            passes;
+} ngx_stream_upstream_hc_srv_conf_t;
+
+
+typedef struct {
+    ngx_stream_upstream_hc_srv_conf_t    *conf;
+    ngx_stream_upstream_rr_peers_t       *peers;
+    ngx_stream_upstream_rr_peer_t        *peer;
+
+    ngx_event_t                           event;
+    ngx_peer_connection_t                 pc;
+
+    ngx_uint_t                            fails;
+    ngx_uint_t                            passes;
+} ngx_stream_upstream_hc_peer_t;
+
+
+static ngx_int_t ngx_stream_upstream_hc_add_peers(ngx_cycle_t *cycle,
+    ngx_stream_upstream_hc_srv_conf_t *hcf,
+    ngx_stream_upstream_rr_peers_t *peers);
+static void ngx_stream_upstream_hc_handler(ngx_event_t *ev);
+static void ngx_stream_upstream_hc_connect_handler(ngx_event_t *ev);
+static void ngx_stream_upstream_hc_dummy_handler(ngx_event_t *ev);
+static ngx_int_t ngx_stream_upstream_hc_test_connect(ngx_connection_t *c);
+static void ngx_stream_upstream_hc_done(ngx_stream_upstream_hc_peer_t *hp,
+    ngx_uint_t ok);
+
+static void *ngx_stream_upstream_hc_create_conf(ngx_conf_t *cf);
+static char *ngx_stream_upstream_hc_init_main_conf(ngx_conf_t *cf,
+    void *conf);
+static char *ngx_stream_upstream_health_check(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static ngx_int_t ngx_stream_upstream_hc_init_process(ngx_cycle_t *cycle);
+
+
+static ngx_command_t  ngx_stream_upstream_hc_commands[] = {
+
+    { ngx_string("health_check"),
+      NGX_STREAM_UPS_CONF|NGX_CONF_ANY,
+      ngx_stream_upstream_health_check,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_stream_module_t  ngx_stream_upstream_hc_module_ctx = {
+    NULL,                                    /* postconfiguration */
+
+    NULL,                                    /* create main configuration */
+    ngx_stream_upstream_hc_init_main_conf,   /* init main configuration */
+
+    ngx_stream_upstream_hc_create_conf,      /* create server configuration */
+    NULL,                                    /* merge server configuration */
+};
+
+
+ngx_module_t  ngx_stream_upstream_health_check_module = {
+    NGX_MODULE_V1,
+    &ngx_stream_upstream_hc_module_ctx,      /* module context */
+    ngx_stream_upstream_hc_commands,         /* module directives */
+    NGX_STREAM_MODULE,                       /* module type */
+    NULL,                                    /* init master */
+    NULL,                                    /* init module */
+    ngx_stream_upstream_hc_init_process,     /* init process */
+    NULL,                                    /* init thread */
+    NULL,                                    /* exit thread */
+    NULL,                                    /* exit process */
+    NULL,                                    /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_stream_upstream_hc_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                           i;
+    ngx_stream_upstream_rr_peers_t      *peers;
+    ngx_stream_upstream_srv_conf_t     **uscfp;
+    ngx_stream_upstream_main_conf_t     *umcf;
+    ngx_stream_upstream_hc_srv_conf_t   *hcf;
+
+    /*
+     * the peers are checked by the first worker only, the results are
+     * shared with other workers through the upstream zone
+     */
+
+    if ((ngx_process != NGX_PROCESS_WORKER
+         && ngx_process != NGX_PROCESS_SINGLE)
+        || ngx_worker != 0)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_stream_cycle_get_module_main_conf(cycle,
+                                                 ngx_stream_upstream_module);
+
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        hcf = ngx_stream_conf_upstream_srv_conf(uscfp[i],
+                                       ngx_stream_upstream_health_check_module);
+
+        if (hcf->interval == NGX_CONF_UNSET_MSEC) {
+            continue;
+        }
+
+        for (peers = uscfp[i]->peer.data; peers; peers = peers->next) {
+            if (ngx_stream_upstream_hc_add_peers(cycle, hcf, peers) != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_upstream_hc_add_peers(ngx_cycle_t *cycle,
+    ngx_stream_upstream_hc_srv_conf_t *hcf,
+    ngx_stream_upstream_rr_peers_t *peers)
+{
+    ngx_stream_upstream_rr_peer_t  *peer;
+    ngx_stream_upstream_hc_peer_t  *hp;
+
+    for (peer = peers->peer; peer; peer = peer->next) {
+
+        if (peer->down) {
+            continue;
+        }
+
+        hp = ngx_pcalloc(cycle->pool, sizeof(ngx_stream_upstream_hc_peer_t));
+        if (hp == NULL) {
+            return NGX_ERROR;
+        }
+
+        hp->conf = hcf;
+        hp->peers = peers;
+        hp->peer = peer;
+
+        hp->event.handler = ngx_stream_upstream_hc_handler;
+        hp->event.data = hp;
+        hp->event.log = cycle->log;
+        hp->event.cancelable = 1;
+
+        /* spread the first checks over the interval */
+
+        ngx_add_timer(&hp->event, ngx_random() % hcf->interval + 1);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_stream_upstream_hc_handler(ngx_event_t *ev)
+{
+    ngx_int_t                       rc;
+    ngx_connection_t               *c;
+    ngx_stream_upstream_hc_peer_t  *hp;
+
+    hp = ev->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_STREAM, ev->log, 0,
+                   "health check %V", &hp->peer->name);
+
+    ngx_memzero(&hp->pc, sizeof(ngx_peer_connection_t));
+
+    hp->pc.sockaddr = hp->peer->sockaddr;
+    hp->pc.socklen = hp->peer->socklen;
+    hp->pc.name = &hp->peer->name;
+    hp->pc.get = ngx_event_get_peer;
+    hp->pc.log = ev->log;
+    hp->pc.log_error = NGX_ERROR_ERR;
+
+    rc = ngx_event_connect_peer(&hp->pc);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        ngx_stream_upstream_hc_done(hp, 0);
+        return;
+    }
+
+    c = hp->pc.connection;
+
+    c->data = hp;
+
+    c->read->handler = ngx_stream_upstream_hc_dummy_handler;
+    c->write->handler = ngx_stream_upstream_hc_connect_handler;
+
+    if (rc == NGX_OK) {
+        ngx_stream_upstream_hc_done(hp, 1);
+        return;
+    }
+
+    ngx_add_timer(c->write, hp->conf->timeout);
+}
+
+
+static void
+ngx_stream_upstream_hc_connect_handler(ngx_event_t *wev)
+{
+    ngx_connection_t               *c;
+    ngx_stream_upstream_hc_peer_t  *hp;
+
+    c = wev->data;
+    hp = c->data;
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, wev->log, NGX_ETIMEDOUT,
+                      "health check of %V timed out", &hp->peer->name);
+        ngx_stream_upstream_hc_done(hp, 0);
+        return;
+    }
+
+    ngx_stream_upstream_hc_done(hp,
+                          ngx_stream_upstream_hc_test_connect(c) == NGX_OK);
+}
+
+
+static void
+ngx_stream_upstream_hc_dummy_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_STREAM, ev->log, 0,
+                   "health check dummy handler");
+}
+
+
+static ngx_int_t
+ngx_stream_upstream_hc_test_connect(ngx_connection_t *c)
+{
+    int        err;
+    socklen_t  len;
+
+#if (NGX_HAVE_KQUEUE)
+
+    if (ngx_event_flags & NGX_USE_KQUEUE_EVENT)  {
+        if (c->write->pending_eof || c->read->pending_eof) {
+            if (c->write->pending_eof) {
+                err = c->write->kq_errno;
+
+            } else {
+                err = c->read->kq_errno;
+            }
+
+            (void) ngx_connection_error(c, err,
+                                    "kevent() reported that connect() failed");
+            return NGX_ERROR;
+        }
+
+    } else
+#endif
+    {
+        err = 0;
+        len = sizeof(int);
+
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
+            == -1)
+        {
+            err = ngx_socket_errno;
+        }
+
+        if (err) {
+            (void) ngx_connection_error(c, err, "connect() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_stream_upstream_hc_done(ngx_stream_upstream_hc_peer_t *hp, ngx_uint_t ok)
+{
+    ngx_stream_upstream_rr_peer_t  *peer;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_STREAM, hp->event.log, 0,
+                   "health check %V done: %ui", &hp->peer->name, ok);
+
+    if (hp->pc.connection) {
+        ngx_close_connection(hp->pc.connection);
+        hp->pc.connection = NULL;
+    }
+
+    peer = hp->peer;
+
+    if (ok) {
+        hp->fails = 0;
+        hp->passes++;
+
+        if ((peer->down & NGX_STREAM_UPSTREAM_RR_CHECK_DOWN)
+            && hp->passes >= hp->conf->passes)
+        {
+            ngx_log_error(NGX_LOG_WARN, hp->event.log, 0,
+                          "upstream server %V in \"%V\" passed health checks",
+                          &peer->name, hp->peers->name);
+
+            ngx_stream_upstream_rr_peers_wlock(hp->peers);
+
+            peer->down &= ~NGX_STREAM_UPSTREAM_RR_CHECK_DOWN;
+            peer->fails = 0;
+
+            ngx_stream_upstream_rr_peers_unlock(hp->peers);
+        }
+
+    } else {
+        hp->passes = 0;
+        hp->fails++;
+
+        if (!(peer->down & NGX_STREAM_UPSTREAM_RR_CHECK_DOWN)
+            && hp->fails >= hp->conf->fails)
+        {
+            ngx_log_error(NGX_LOG_WARN, hp->event.log, 0,
+                          "upstream server %V in \"%V\" failed health checks",
+                          &peer->name, hp->peers->name);
+
+            ngx_stream_upstream_rr_peers_wlock(hp->peers);
+
+            peer->down |= NGX_STREAM_UPSTREAM_RR_CHECK_DOWN;
+
+            ngx_stream_upstream_rr_peers_unlock(hp->peers);
+        }
+    }
+
+    if (!ngx_exiting) {
+        ngx_add_timer(&hp->event, hp->conf->interval);
+    }
+}
+
+
+static void *
+ngx_stream_upstream_hc_create_conf(ngx_conf_t *cf)
+{
+    ngx_stream_upstream_hc_srv_conf_t  *conf;
+
+    conf = ngx_palloc(cf->pool, sizeof(ngx_stream_upstream_hc_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    conf->interval = NGX_CONF_UNSET_MSEC;
+
+    return conf;
+}
+
+
+static char *
+ngx_stream_upstream_hc_init_main_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_uint_t                           i;
+    ngx_stream_upstream_srv_conf_t     **uscfp;
+    ngx_stream_upstream_main_conf_t     *umcf;
+    ngx_stream_upstream_hc_srv_conf_t   *hcf;
+
+    umcf = ngx_stream_conf_get_module_main_conf(cf, ngx_stream_upstream_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        hcf = ngx_stream_conf_upstream_srv_conf(uscfp[i],
+                                       ngx_stream_upstream_health_check_module);
+
+        if (hcf->interval == NGX_CONF_UNSET_MSEC) {
+            continue;
+        }
+
+#if (NGX_STREAM_UPSTREAM_ZONE)
+        if (uscfp[i]->shm_zone) {
+            continue;
+        }
+#endif
+
+        ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                      "health check requires \"zone\" in upstream \"%V\" "
+                      "in %s:%ui",
+                      &uscfp[i]->host, uscfp[i]->file_name, uscfp[i]->line);
+
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_stream_upstream_health_check(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_stream_upstream_hc_srv_conf_t  *hcf = conf;
+
+    ngx_str_t   *value, s;
+    ngx_int_t    n;
+    ngx_uint_t   i;
+
+    if (hcf->interval != NGX_CONF_UNSET_MSEC) {
+        return "is duplicate";
+    }
+
+    hcf->interval = 5000;
+    hcf->timeout = 1000;
+    hcf->fails = 1;
+    hcf->passes = 1;
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            hcf->interval = ngx_parse_time(&s, 0);
+
+            if (hcf->interval == (ngx_msec_t) NGX_ERROR
+                || hcf->interval == 0)
+            {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "timeout=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = value[i].data + 8;
+
+            hcf->timeout = ngx_parse_time(&s, 0);
+
+            if (hcf->timeout == (ngx_msec_t) NGX_ERROR || hcf->timeout == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "fails=", 6) == 0) {
+
+            n = ngx_atoi(value[i].data + 6, value[i].len - 6);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            hcf->fails = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "passes=", 7) == 0) {
+
+            n = ngx_atoi(value[i].data + 7, value[i].len - 7);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            hcf->passes = n;
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
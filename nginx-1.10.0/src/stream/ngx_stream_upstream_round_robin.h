@@ -16,6 +16,15 @@
 
 typedef struct ngx_stream_upstream_rr_peer_s   ngx_stream_upstream_rr_peer_t;
 
+
+/*
+ * peer->down is 1 for servers configured as "down"; the health checks
+ * set the bit below while a peer fails them, so that every balancer
+ * skips the peer
+ */
+#define NGX_STREAM_UPSTREAM_RR_CHECK_DOWN  0x02
+
+
 /* 
  * һ˷ӦϢ(һ˷жipַ
  * ôṹӦľһipַϢ) Ϣڷйлᱻ